@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "err.h"
+#include "arena.h"
+
+// every buffer is aligned for any type, blocks grow by doubling from ARENA_BLOCK_SIZE
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK_SIZE (64 * 1024)
+// memory kept across resets, a job with a bigger working set gives the rest back to malloc
+#define ARENA_KEEP_MAX (16 * 1024 * 1024)
+#define ALIGN_UP(x) (((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct arenaBlock {
+	struct arenaBlock *next;
+	size_t size, used;
+};
+
+struct arenaAdopted {
+	struct arenaAdopted *next;
+	void *ptr;
+};
+
+static pthread_key_t threadKey;
+static pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+
+static unsigned char *blockData(struct arenaBlock *block)
+{
+	return (unsigned char *)block + ALIGN_UP(sizeof(*block));
+}
+
+static struct arenaBlock *newBlock(size_t size)
+{
+	struct arenaBlock *block = malloc(ALIGN_UP(sizeof(*block)) + size);
+
+	if (!block)
+		return NULL;
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+
+	return block;
+}
+
+void arenaInit(struct arena *arena)
+{
+	arena->blocks = NULL;
+	arena->adopted = NULL;
+}
+
+/**
+ *@return size bytes that stay valid until the next arenaReset, NULL if out of memory
+ */
+void *arenaAlloc(struct arena *arena, size_t size)
+{
+	struct arenaBlock *block = arena->blocks;
+	size_t blockSize;
+	void *ret;
+
+	if (size > SIZE_MAX / 2)
+		return NULL;
+	size = size ? ALIGN_UP(size) : ARENA_ALIGN;
+	if (!block || block->size - block->used < size) {
+		blockSize = block ? block->size * 2 : ARENA_BLOCK_SIZE;
+		if (blockSize < size)
+			blockSize = size;
+		block = newBlock(blockSize);
+		if (!block)
+			return NULL;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+	ret = blockData(block) + block->used;
+	block->used += size;
+
+	return ret;
+}
+
+void *arenaCalloc(struct arena *arena, size_t count, size_t size)
+{
+	void *ret;
+
+	if (size && count > SIZE_MAX / size)
+		return NULL;
+	ret = arenaAlloc(arena, count * size);
+	if (ret)
+		memset(ret, 0, count * size);
+
+	return ret;
+}
+
+/**
+ *hands a malloc'd buffer to the arena, it is freed with everything else on reset
+ *@return SUCCESS, or ALLOC_FAIL in which case ptr has already been freed
+ */
+int arenaAdopt(struct arena *arena, void *ptr)
+{
+	struct arenaAdopted *node;
+
+	if (!ptr)
+		return SUCCESS;
+	node = arenaAlloc(arena, sizeof(*node));
+	if (!node) {
+		free(ptr);
+		return ALLOC_FAIL;
+	}
+	node->ptr = ptr;
+	node->next = arena->adopted;
+	arena->adopted = node;
+
+	return SUCCESS;
+}
+
+/**
+ *releases every buffer of the arena, the memory is kept as a single block so that
+ *the next job of the same size does not go to malloc at all
+ */
+void arenaReset(struct arena *arena)
+{
+	struct arenaBlock *block, *next;
+	size_t total = 0;
+
+	for (struct arenaAdopted *node = arena->adopted; node; node = node->next)
+		free(node->ptr);
+	arena->adopted = NULL;
+	if (!arena->blocks)
+		return;
+	if (!arena->blocks->next && arena->blocks->size <= ARENA_KEEP_MAX) {
+		arena->blocks->used = 0;
+		return;
+	}
+	for (block = arena->blocks; block; block = next) {
+		next = block->next;
+		total += block->size;
+		free(block);
+	}
+	// if this fails the next job just starts from scratch
+	arena->blocks = total <= ARENA_KEEP_MAX ? newBlock(total) : NULL;
+}
+
+void arenaDestroy(struct arena *arena)
+{
+	arenaReset(arena);
+	free(arena->blocks);
+	arena->blocks = NULL;
+}
+
+static void destroyThreadArena(void *arena)
+{
+	arenaDestroy(arena);
+	free(arena);
+}
+
+static void createThreadKey(void)
+{
+	pthread_key_create(&threadKey, destroyThreadArena);
+}
+
+/**
+ *every thread has its own arena, so jobs run one after another on a thread pool reuse the same memory,
+ *it is destroyed when the thread exits
+ *@return the arena of the calling thread, NULL if out of memory
+ */
+struct arena *arenaForThread(void)
+{
+	struct arena *arena;
+
+	pthread_once(&threadKeyOnce, createThreadKey);
+	arena = pthread_getspecific(threadKey);
+	if (arena)
+		return arena;
+	arena = malloc(sizeof(*arena));
+	if (!arena)
+		return NULL;
+	arenaInit(arena);
+	if (pthread_setspecific(threadKey, arena)) {
+		free(arena);
+		return NULL;
+	}
+
+	return arena;
+}
@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "crypto/crypto.h"
+#include "backends/edk2-compat/include/edk2-svc.h"// include last, pragma pack(1) issue
+
+/*
+ *content digests of the variables, so that the state of many hosts can be compared without their data:
+ *every entry of an ESL is a leaf of a Merkle tree, the root of that tree and the ESL header give the ESL digest,
+ *the ESL digests are the leaves of the tree of the variable and the variable digests the leaves of the root.
+ *Equal roots mean equal variables, otherwise the trees are walked down only where the digests differ.
+ *Every kind of hash has its own first byte so that a leaf can not be taken for a node or an ESL (as in RFC 6962),
+ *bytes that are not an ESL have their own too, so that they can not be forged into the digest of a real ESL
+ */
+#define DIGEST_LEAF 0x00
+#define DIGEST_NODE 0x01
+#define DIGEST_ESL 0x02
+#define DIGEST_VARIABLE 0x03
+#define DIGEST_INVALID 0x04
+
+/*
+ *SHA256 of a type byte followed by up to three buffers
+ *@param type, one of DIGEST_xxx
+ *@param a, b, c, data to hash, NULL to skip
+ *@param aLen, bLen, cLen, length of each
+ *@param out, DIGEST_SIZE bytes
+ *@return SUCCESS or HASH_FAIL
+ */
+static int digestParts(unsigned char type, const void *a, size_t aLen, const void *b, size_t bLen,
+		       const void *c, size_t cLen, unsigned char *out)
+{
+	crypto_md_ctx *ctx = NULL;
+	int rc;
+
+	rc = crypto_md_ctx_init(&ctx, CRYPTO_MD_SHA256);
+	if (rc)
+		goto out;
+	rc = crypto_md_update(ctx, &type, 1);
+	if (!rc && a)
+		rc = crypto_md_update(ctx, a, aLen);
+	if (!rc && b)
+		rc = crypto_md_update(ctx, b, bLen);
+	if (!rc && c)
+		rc = crypto_md_update(ctx, c, cLen);
+	if (!rc)
+		rc = crypto_md_finish(ctx, out);
+out:
+	if (ctx)
+		crypto_md_free(ctx);
+	if (rc) {
+		prlog(PR_ERR, "ERROR: Failed to hash digest data\n");
+		return HASH_FAIL;
+	}
+
+	return SUCCESS;
+}
+
+/**
+ *builds a Merkle tree bottom up, the nodes of a level are hashed in pairs and an odd last node is moved up as is
+ *@param tree, returned tree, free with merkleFree
+ *@param leaves, count digests of DIGEST_SIZE back to back, copied into the tree
+ *@param count, number of leaves, 0 gives an empty tree
+ *@return SUCCESS or error number
+ */
+int merkleBuild(struct merkleTree *tree, const unsigned char *leaves, size_t count)
+{
+	size_t total = 0, n;
+	unsigned char *level, *block;
+	int rc, levels = 0;
+
+	memset(tree, 0, sizeof(*tree));
+	if (!count)
+		return SUCCESS;
+	for (n = count; ; n = (n + 1) / 2) {
+		total += n;
+		levels++;
+		if (n == 1)
+			break;
+	}
+	// one allocation: the size and start of every level, then the digests
+	block = malloc(levels * (sizeof(*tree->sizes) + sizeof(*tree->levels)) + total * DIGEST_SIZE);
+	if (!block) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	tree->sizes = (size_t *)block;
+	tree->levels = (unsigned char **)(block + levels * sizeof(*tree->sizes));
+	tree->nodes = block + levels * (sizeof(*tree->sizes) + sizeof(*tree->levels));
+	memcpy(tree->nodes, leaves, count * DIGEST_SIZE);
+	level = tree->nodes;
+	for (n = count; ; n = (n + 1) / 2) {
+		tree->levels[tree->levelCount] = level;
+		tree->sizes[tree->levelCount++] = n;
+		if (n == 1)
+			break;
+		for (size_t i = 0; i < n / 2; i++) {
+			rc = digestParts(DIGEST_NODE, level + 2 * i * DIGEST_SIZE, DIGEST_SIZE,
+					 level + (2 * i + 1) * DIGEST_SIZE, DIGEST_SIZE, NULL, 0, level + (n + i) * DIGEST_SIZE);
+			if (rc) {
+				merkleFree(tree);
+				return rc;
+			}
+		}
+		if (n % 2)
+			memcpy(level + (n + n / 2) * DIGEST_SIZE, level + (n - 1) * DIGEST_SIZE, DIGEST_SIZE);
+		level += n * DIGEST_SIZE;
+	}
+
+	return SUCCESS;
+}
+
+/**
+ *@return the root of tree, all zeros for an empty tree
+ */
+const unsigned char *merkleRoot(const struct merkleTree *tree)
+{
+	static const unsigned char empty[DIGEST_SIZE];
+
+	return tree->levelCount ? tree->levels[tree->levelCount - 1] : empty;
+}
+
+void merkleFree(struct merkleTree *tree)
+{
+	// sizes is the start of the allocation made by merkleBuild
+	if (tree->sizes)
+		free(tree->sizes);
+	memset(tree, 0, sizeof(*tree));
+}
+
+/*
+ *digest of one ESL: its header and signature header followed by the root of its entries
+ *@param esl, returned digest and entry tree
+ *@param list, the ESL, its sizes must already be checked against the data
+ *@return SUCCESS or error number
+ */
+static int digestESL(struct eslDigest *esl, const EFI_SIGNATURE_LIST *list)
+{
+	const unsigned char *entry = (const unsigned char *)list + sizeof(*list) + list->SignatureHeaderSize;
+	size_t count = (list->SignatureListSize - sizeof(*list) - list->SignatureHeaderSize) / list->SignatureSize;
+	unsigned char *leaves;
+	int rc = SUCCESS;
+
+	esl->list = list;
+	leaves = malloc(count * DIGEST_SIZE);
+	if (!leaves) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	for (size_t i = 0; i < count && !rc; i++, entry += list->SignatureSize)
+		rc = digestParts(DIGEST_LEAF, entry, list->SignatureSize, NULL, 0, NULL, 0, leaves + i * DIGEST_SIZE);
+	if (!rc)
+		rc = merkleBuild(&esl->entries, leaves, count);
+	free(leaves);
+	if (!rc)
+		rc = digestParts(DIGEST_ESL, list, sizeof(*list) + list->SignatureHeaderSize,
+				 merkleRoot(&esl->entries), DIGEST_SIZE, NULL, 0, esl->digest);
+
+	return rc;
+}
+
+/**
+ *computes the digest and trees of one variable, the data is only pointed to and must outlive digest
+ *bytes that are not a well formed ESL, including one that is not a whole number of entries, are hashed as one last ESL
+ *without entries and make the variable invalid,
+ *so that a broken variable still gets a digest that differs from a good one. Whether the variable is valid is hashed too.
+ *TS is not made of ESL's, its data is a single leaf
+ *@param digest, returned digest, free with freeVarDigest
+ *@param name, variable name, hashed into the digest
+ *@param data, contents of the variable, NULL if it could not be read (the digest is then all zeros)
+ *@param size, length of data
+ *@return SUCCESS or error number if hashing failed
+ */
+int digestVariable(struct varDigest *digest, const char *name, const unsigned char *data, size_t size)
+{
+	const EFI_SIGNATURE_LIST *list;
+	unsigned char *leaves = NULL, leaf[DIGEST_SIZE], valid;
+	size_t offset = 0, max;
+	int rc = SUCCESS;
+
+	memset(digest, 0, sizeof(*digest));
+	digest->name = name;
+	digest->size = size;
+	if (!data)
+		return SUCCESS;
+	digest->present = 1;
+	digest->valid = 1;
+	if (!strcmp(name, "TS")) {
+		rc = digestParts(DIGEST_LEAF, data, size, NULL, 0, NULL, 0, leaf);
+		if (!rc)
+			rc = merkleBuild(&digest->eslTree, leaf, 1);
+		goto out;
+	}
+	// every ESL is at least a header and one entry
+	max = size / (sizeof(EFI_SIGNATURE_LIST) + sizeof(uuid_t) + 1) + 1;
+	digest->esls = calloc(max, sizeof(*digest->esls));
+	leaves = malloc(max * DIGEST_SIZE);
+	if (!digest->esls || !leaves) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	while (offset < size && !rc) {
+		list = (const EFI_SIGNATURE_LIST *)(data + offset);
+		if (size - offset < sizeof(EFI_SIGNATURE_LIST) || list->SignatureListSize > size - offset
+			|| list->SignatureSize <= sizeof(uuid_t)
+			|| list->SignatureListSize < sizeof(EFI_SIGNATURE_LIST) + list->SignatureHeaderSize + list->SignatureSize
+			// bytes after the last whole entry would not be in any leaf
+			|| (list->SignatureListSize - sizeof(EFI_SIGNATURE_LIST) - list->SignatureHeaderSize) % list->SignatureSize) {
+			prlog(PR_WARNING, "WARNING: %s has %zu bytes that are not an ESL at offset %zu\n", name, size - offset, offset);
+			digest->valid = 0;
+			rc = digestParts(DIGEST_INVALID, data + offset, size - offset, NULL, 0, NULL, 0, digest->esls[digest->eslCount].digest);
+			offset = size;
+		}
+		else {
+			rc = digestESL(&digest->esls[digest->eslCount], list);
+			offset += list->SignatureListSize;
+		}
+		memcpy(leaves + digest->eslCount * DIGEST_SIZE, digest->esls[digest->eslCount].digest, DIGEST_SIZE);
+		digest->eslCount++;
+	}
+	if (!rc)
+		rc = merkleBuild(&digest->eslTree, leaves, digest->eslCount);
+out:
+	valid = digest->valid;
+	if (!rc)
+		rc = digestParts(DIGEST_VARIABLE, name, strlen(name) + 1, merkleRoot(&digest->eslTree), DIGEST_SIZE,
+				 &valid, 1, digest->digest);
+	if (leaves)
+		free(leaves);
+	if (rc)
+		freeVarDigest(digest);
+
+	return rc;
+}
+
+void freeVarDigest(struct varDigest *digest)
+{
+	for (size_t i = 0; i < digest->eslCount; i++)
+		merkleFree(&digest->esls[i].entries);
+	if (digest->esls)
+		free(digest->esls);
+	merkleFree(&digest->eslTree);
+	digest->esls = NULL;
+	digest->eslCount = 0;
+}
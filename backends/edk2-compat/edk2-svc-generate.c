@@ -8,7 +8,11 @@
 #include <time.h> // for timestamp
 #include <ctype.h> // for isspace
 #include <argp.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "crypto/crypto.h"
+#include "arena.h"
+#include "threadpool.h"
 #include "external/skiboot/include/endian.h"
 #include "backends/edk2-compat/include/edk2-svc.h"
 #include "external/skiboot/include/edk2-compat-process.h" // work on factoring this out
@@ -23,20 +27,57 @@ enum pkcs7_generation_method {
 	NO_PKCS7_GEN_METHOD
 };
 
+#define PEM_BEGIN "-----BEGIN "
+#define PEM_END "-----END "
+#define PEM_DASHES "-----"
+#define PEM_CERT_LABEL "CERTIFICATE"
+// certificates are told apart by the SHA256 of their DER
+#define CERT_DIGEST_SIZE 32
+// '-i @FILE' of a 'c' input reads the input files from FILE, one per line
+#define FILE_LIST_PREFIX '@'
+
+// a DER certificate, a block of a PEM file or a whole DER file
+struct certificate {
+	const unsigned char *der;
+	size_t size;
+	// where it comes from, block is the number of the PEM block or 0 for a DER file
+	const char *file;
+	size_t block;
+	unsigned char digest[CERT_DIGEST_SIZE];
+};
+
+// the certificates of a 'c' input, every job validates and hashes one and leaves its result at the same index of rcs
+struct certValidation {
+	struct certificate *certs;
+	const char *varName;
+	int inpValid;
+	int *rcs;
+};
+
+// one file of a set of 'c' inputs, it is read and decoded on a threadpool, everything is allocated from its own arena
+struct certFile {
+	const char *path;
+	struct arena arena;
+	struct certificate *certs;
+	size_t count;
+};
+
 struct Arguments {
     // the pkcs7_gen_meth is to determine if signKeys stores a private key file(0) or signed data (1)
-	int helpFlag, inpValid, signKeyCount, signCertCount;
+	int helpFlag, inpValid, signKeyCount, signCertCount, inFileCount, jobs;
 	const char *inFile, *outFile, 
-	**signCerts, **signKeys,
+	**signCerts, **signKeys, **inFiles,
 	*inForm, *outForm, *varName, *hashAlg;
 	struct efi_time *time;
 	enum pkcs7_generation_method pkcs7_gen_meth;
+	// every buffer of one generate job, from the input file to the output, is released at once when it is done
+	struct arena *arena;
 }; 
 
 static int parse_opt(int key, char *arg, struct argp_state *state);
 static int generateHash(const unsigned char* data, size_t size, struct Arguments *args, const struct hash_funct *alg, unsigned char** outHash, size_t* outHashSize);
 static int validateHashAndAlg(size_t size, const struct hash_funct *alg);
-static int toESL(const unsigned char* data, size_t size, const uuid_t guid, unsigned char** outESL, size_t* outESLSize);
+static int toESL(struct arena *arena, const unsigned char* data, size_t size, size_t count, const uuid_t guid, unsigned char** outESL, size_t* outESLSize);
 static int getHashFunction(const char* name, struct hash_funct **returnFunct);
 static int toPKCS7ForSecVar(const unsigned char* newData, size_t dataSize, struct Arguments *args, int hashFunct, unsigned char** outBuff, size_t* outBuffSize);
 static int toAuth(const unsigned char* newESL, size_t eslSize, struct Arguments *args, int hashFunct, unsigned char** outBuff, size_t* outBuffSize);
@@ -44,11 +85,28 @@ static int generateESL(const unsigned char* buff, size_t size, struct Arguments
 static int generateAuthOrPKCS7(const unsigned char* buff, size_t size, struct Arguments *args, const struct hash_funct *hashFunct, unsigned char** outBuff, size_t* outBuffSize);
 static int getTimestamp(struct efi_time *ts);
 static int getOutputData (const unsigned char *buff, size_t size, struct Arguments *args, const struct hash_funct *hashFunction, unsigned char **outBuff, size_t *outBuffSize);
-static int authToESL(const unsigned char *in, size_t inSize, unsigned char **out, size_t *outSize);
+static int authToESL(struct arena *arena, const unsigned char *in, size_t inSize, unsigned char **out, size_t *outSize);
 static int toHashForSecVarSigning(const unsigned char* ESL, size_t ESL_size, struct Arguments *args, unsigned char** outBuff, size_t* outBuffSize);
 static int getPreHashForSecVar(unsigned char **outData, size_t *outSize, const unsigned char *ESL, size_t ESL_size, struct Arguments *args);
 static int parseCustomTimestamp(struct efi_time *strct, const char *str);
 static void convert_tm_to_efi_time(struct efi_time *efi_t, struct tm *tm_t);
+static int isPE(const char *inForm);
+static int isAuto(const char *inForm);
+static int resolveAutoFormat(struct Arguments *args, unsigned char **buff, size_t *size);
+static int imagesAreFiles(struct Arguments *args);
+static int hashImages(struct Arguments *args, const struct hash_funct *alg, unsigned char **outHashes, size_t *outSize);
+static int hashImageJob(void *ctx, size_t index);
+static int pemCertificates(struct arena *arena, const char *file, const unsigned char *buff, size_t size, struct certificate **certs, size_t *count);
+static int decodeCertificates(struct arena *arena, const char *file, const unsigned char *buff, size_t size, struct certificate **certs, size_t *count);
+static int isCertSet(struct Arguments *args);
+static int listCertFiles(struct Arguments *args, const char ***paths, size_t *count);
+static int loadCertSet(struct Arguments *args, struct certFile **files, size_t *fileCount, struct certificate **certs, size_t *count);
+static int readCertFileJob(void *ctx, size_t index);
+static void freeCertSet(struct certFile *files, size_t count);
+static int validateCerts(struct Arguments *args, struct certificate *certs, size_t count);
+static int validateCertJob(void *ctx, size_t index);
+static size_t dropDuplicateCerts(struct Arguments *args, struct certificate *certs, size_t count);
+static int certsToESLs(struct arena *arena, const struct certificate *certs, size_t count, unsigned char **outESL, size_t *outESLSize);
 /*
  *called from main()
  *handles argument parsing for generate command
@@ -63,10 +121,10 @@ int performGenerateCommand(int argc,char* argv[])
 	struct hash_funct *hashFunction;
 	unsigned char *buff = NULL, *outBuff = NULL;
 	struct Arguments args = {	
-		.helpFlag = 0, .inpValid = 0, .signKeyCount = 0, .signCertCount = 0,
+		.helpFlag = 0, .inpValid = 0, .signKeyCount = 0, .signCertCount = 0, .inFileCount = 0, .jobs = 0,
 		.inFile = NULL, .outFile = NULL,  
-		.signCerts = NULL, .signKeys = NULL, .inForm = NULL, .outForm = NULL, .varName = NULL, 
-		.hashAlg = NULL, .time = NULL, .pkcs7_gen_meth = NO_PKCS7_GEN_METHOD
+		.signCerts = NULL, .signKeys = NULL, .inFiles = NULL, .inForm = NULL, .outForm = NULL, .varName = NULL, 
+		.hashAlg = NULL, .time = NULL, .pkcs7_gen_meth = NO_PKCS7_GEN_METHOD, .arena = NULL
 	};
     // combine command and subcommand for usage/help messages
     argv[0] = "secvarctl generate";
@@ -92,9 +150,11 @@ int performGenerateCommand(int argc,char* argv[])
 		{"time", 't', "<YYYY-MM-DDThh:mm:ss>", 0, "set custom timestamp in UTC when generating PKCS7/Auth/presigned "
                                         "digest, default is currrent time in UTC, format defined by ISO 8601, note 'T' is literally in the string, see manpage for value info/ranges"},
 		{"force", 'f', 0 ,0, "does not do prevalidation on the input file, assumes format is correct"},
+		{"jobs", 'j', "N", 0, "number of threads hashing the images of 'pe' input or reading and validating the"
+					" certificates of 'c' input, default is the number of online cpus"},
 		// these are hidden because they are mandatory and are described in the help message instead of in the options
-		{0, 'i', "FILE", OPTION_HIDDEN, "input file"},
-		{0, 'o', "FILE", OPTION_HIDDEN, "output file"},
+		{0, 'i', "FILE", OPTION_HIDDEN, "input file, '-' for stdin"},
+		{0, 'o', "FILE", OPTION_HIDDEN, "output file, '-' for stdout"},
 		{"help", '?', 0, 0, "Give this help list", 1},
 		{"usage", ARGP_OPT_USAGE_KEY, 0, 0, "Give a short usage message", -1 },
 		{0}
@@ -107,11 +167,18 @@ int performGenerateCommand(int argc,char* argv[])
 		" and produces an output file that is formatted according to <outputFormat> (see below).\v"
 		"Accepted <inputFormat>:"
 		"\n\t[h]ash\tA file containing only hashed data\n"
-		"\t[c]ert\tAn x509 certificate (PEM format)\n"
+		"\t[c]ert\tAn x509 certificate (PEM or DER format), or a bundle of several PEM certificates. '-i' may be given"
+		" several times, as a directory of certificate files or as '@<file>' listing one certificate file per line."
+		" Every certificate goes in an ESL of its own, the ESLs are put back to back in input order and repeated"
+		" certificates are left out\n"
 		"\t[e]sl\tAn EFI Signature List, if dbx must specify '-n dbx'\n"
 		"\t[p]kcs7\tA PKCS7 file\n"
 		"\t[a]uth\ta properly generated authenticated variable fileI\n"
-		"\t[f]ile\tAny file type, Warning: no format validation will be done\n\n"
+		"\t[f]ile\tAny file type, Warning: no format validation will be done\n"
+		"\tpe\tPE/COFF images (EFI applications, bootloaders, kernels), hashed as Authenticode with SHA256, SHA384"
+		" or SHA512. '-i' may be given once per image, the hashes are put in one ESL in the same order\n"
+		"\tauto\tAny of the above but [f]ile, told apart by the magic bytes and headers of the first input file."
+		" A raw hash is recognized by its length, which also picks '-h' if it is not given\n\n"
 		"Accepted <outputFormat>:\n"
 		"\t[h]ash\tA file containing only hashed data\n"
 		"\t[e]sl\tAn EFI Signature List\n"
@@ -126,12 +193,18 @@ int performGenerateCommand(int argc,char* argv[])
 		"\t'... f:e -i <file> -o <file> -h SHA512'\n" 
 		"  -create an ESL from an x509 certificate:\n"
 		"\t'... c:e -i <file> -o <file>'\n"
+		"  -create an auth file from a certificate, ESL or PE image without saying which:\n"
+		"\t'... auto:a -k <file> -c <file> -n <varName> -i <file> -o <file>'\n"
 		"  -create an auth file from an ESL:\n"
 		"\t'... e:a -k <file> -c <file> -n <varName> -i <file> -o <file>'\n"
+		"  -create a db ESL from every certificate of a directory and of a list of files:\n"
+		"\t'... c:e -n db -i <dir> -i @<listFile> -o <file>'\n"
 		"  -create an auth file from an x509:\n"
 		"\t'... c:a -k <file> -c <file> -n <varName> -i <file> -o <file>'\n"
 		"  -create a valid dbx update (auth) file from a binary file:\n"
 		"\t'... f:a -h <hashAlg> -k <file> -c <file> -n dbx -i <file> -o <file>'\n"
+		"  -create a valid dbx update (auth) file revoking EFI binaries:\n"
+		"\t'... pe:a -k <file> -c <file> -n dbx -i <file> -i <file> ... -o <file>'\n"
 		"  -retrieve the ESL from an auth file:\n"
 		"\t'... a:e -i <file> -o <file>'\n"
 		"  -create an auth file for a key reset:\n"
@@ -140,12 +213,27 @@ int performGenerateCommand(int argc,char* argv[])
         "\t'... c:x -n <varName> -t <y-m-dTh:m:s> -i <file> -o <file>'\n"
         "\tthen user gets output signed through server (<sigFile>):\n"
         "\t'... c:a -n <> -t <sameTime!> -s <sigFile> -c <crtfile> -i <file> -o <file>\n"
+        "  -use '-' as <file> to read from stdin or write to stdout, ex: pipe an ESL into an auth file:\n"
+        "\t'... c:e -i <file> -o - | secvarctl generate e:a -k <file> -c <file> -n <varName> -i - -o <file>'\n"
 
 	};
 
+	// batch callers run generate many times per thread, the arena keeps its memory between jobs
+	args.arena = arenaForThread();
+	if (!args.arena) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		rc = ALLOC_FAIL;
+		goto out;
+	}
 	rc = argp_parse( &argp, argc, argv, ARGP_NO_EXIT | ARGP_IN_ORDER | ARGP_NO_HELP, 0, &args);
 	if (rc || args.helpFlag)
 		goto out;
+	// output data is going to stdout, keep everything else off of it
+	if (isStdio(args.outFile)) {
+		rc = reserveStdoutForData();
+		if (rc)
+			goto out;
+	}
 
 	// if signing each signer needs a certificate
 	if (args.signCertCount != args.signKeyCount) {
@@ -156,12 +244,18 @@ int performGenerateCommand(int argc,char* argv[])
 		rc = ARG_PARSE_FAIL;
 		goto out;
 	}
+	// the first input is read to find its format, it is not read again below
+	if (isAuto(args.inForm)) {
+		rc = resolveAutoFormat(&args, &buff, &size);
+		if (rc)
+			goto out;
+	}
 	prlog(PR_INFO, "Input file is %s of type %s , output file is %s of type %s\n", args.inFile, args.inForm, args.outFile, args.outForm);
 	
-	// if reset key than don't look for an input file
-	if (args.inForm[0] == 'r') 
+	// if reset key than don't look for an input file, images are streamed when they are hashed, sets of certificates read file by file
+	if (args.inForm[0] == 'r' || isPE(args.inForm) || isCertSet(&args))
 		size = 0;
-	else {
+	else if (!buff) {
 		// get data from input file
 		buff = (unsigned char *)getDataFromFile(args.inFile, &size);
 		if (buff == NULL){
@@ -169,6 +263,9 @@ int performGenerateCommand(int argc,char* argv[])
 			rc = INVALID_FILE;
 			goto out;
 		}
+		rc = arenaAdopt(args.arena, buff);
+		if (rc)
+			goto out;
 	}
 	// default alg is sha256
 	if (args.hashAlg == NULL) 
@@ -192,16 +289,14 @@ int performGenerateCommand(int argc,char* argv[])
 	}
 
 out:
-	if (buff) 
-		free(buff);
-	if (outBuff) 
-		free(outBuff);
+	if (args.arena)
+		arenaReset(args.arena);
 	if (args.signKeys) 
 		free(args.signKeys);
 	if (args.signCerts) 
 		free(args.signCerts);
-	if (args.time) 
-		free(args.time);
+	if (args.inFiles)
+		free(args.inFiles);
 	if (!args.helpFlag) 
 		printf("RESULT: %s\n", rc ? "FAILURE" : "SUCCESS");
 	
@@ -218,6 +313,7 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 {
 	struct Arguments *args = state->input;
 	int rc = SUCCESS;
+	char *saveptr, *end;
 
 	switch (key) {
 		case '?':
@@ -276,7 +372,21 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
             args->signKeys[args->signKeyCount - 1] = arg;
 			break;
 		case 'i':
-			args->inFile = arg;
+			args->inFileCount++;
+			rc = reallocArray((void **)&args->inFiles, args->inFileCount, sizeof(*args->inFiles));
+			if (rc) {
+				prlog(PR_ERR, "Failed to realloc input file (-i <>) array\n");
+				break;
+			}
+			args->inFiles[args->inFileCount - 1] = arg;
+			args->inFile = args->inFiles[0];
+			break;
+		case 'j':
+			args->jobs = strtol(arg, &end, 10);
+			if (*end || args->jobs <= 0) {
+				prlog(PR_ERR, "ERROR: Number of jobs must be a positive integer, found %s\n", arg);
+				rc = ARG_PARSE_FAIL;
+			}
 			break;
 		case 'o':
 			args->outFile = arg;
@@ -288,7 +398,7 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 			args->varName = arg;
 			break;
 		case 't':
-			args->time = calloc(1, sizeof(*args->time));
+			args->time = arenaCalloc(args->arena, 1, sizeof(*args->time));
 			if (!args->time) {
 				prlog(PR_ERR, "ERROR: failed to allocate memory\n");
 				rc = ALLOC_FAIL;
@@ -308,8 +418,9 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 				break;
 			}
 			// else set input and output formats
-			args->inForm = strtok(arg, ":");
-			args->outForm = strtok(NULL, ":");
+			// strtok_r since generate may be run on several threads at once
+			args->inForm = strtok_r(arg, ":", &saveptr);
+			args->outForm = strtok_r(NULL, ":", &saveptr);
 			break;
 		case ARGP_KEY_SUCCESS:
 			// check that all essential args are given and valid
@@ -319,8 +430,16 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 				prlog(PR_ERR, "ERROR: Incorrect '<inputFormat>:<outputFormat>', see usage...\n");
 			else if (args->time && validateTime(args->time))
 				prlog(PR_ERR, "Invalid timestamp flag '-t YYYY-MM-DDThh:mm:ss' , see usage...\n");
-			else if (args->inForm[0] != 'r' && (args->inFile == NULL || isFile(args->inFile) ))
+			else if (args->inForm[0] != 'r' && (args->inFile == NULL ||
+				 isFile(args->inFile + ((args->inForm[0] == 'c' || isAuto(args->inForm)) && args->inFile[0] == FILE_LIST_PREFIX))))
 				prlog(PR_ERR, "ERROR: Input File is invalid, see usage below...\n");
+			// the checks on the number of inputs for 'auto' are done once the format is known, see resolveAutoFormat
+			else if (args->inFileCount > 1 && !isPE(args->inForm) && args->inForm[0] != 'c' && !isAuto(args->inForm))
+				prlog(PR_ERR, "ERROR: Only 'pe' and 'c' input take more than one input file\n");
+			else if (isCertSet(args) && args->outForm[0] == 'h')
+				prlog(PR_ERR, "ERROR: Several certificates can not be hashed, only put in ESLs\n");
+			else if (isPE(args->inForm) && !imagesAreFiles(args))
+				prlog(PR_ERR, "ERROR: Every PE image must be a file that can be read, not stdin\n");
 			else if (args->varName && isVariable(args->varName))
 				prlog(PR_ERR, "ERROR: %s is not a valid variable name\n", args->varName);	
 			else if (args->outFile == NULL)
@@ -388,7 +507,7 @@ static int getOutputData(const unsigned char *buff, size_t size, struct Argument
 		case 'p':
 			// if no time is given then get curent time
 			if (!args->time) {
-				args->time = calloc(1, sizeof(*args->time));
+				args->time = arenaCalloc(args->arena, 1, sizeof(*args->time));
 				if (!args->time){
 					prlog(PR_ERR, "ERROR: failed to allocate memory\n");
 					rc = ALLOC_FAIL;
@@ -418,7 +537,7 @@ out:
  *@param size , length of buff
  *@param args, struct containing command line info and lots of other important information
  *@param hashFunct, array of hash function information to use for signing (see above for format)
- *@param outBuff, the resulting auth or PKCS7 File, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+ *@param outBuff, the resulting auth or PKCS7 File, owned by args->arena
  *@param outBuffSize, the length of outBuff
  *@return SUCCESS or err number 
  */
@@ -430,6 +549,14 @@ static int generateAuthOrPKCS7(const unsigned char* buff, size_t size, struct Ar
 	inpPtr = (unsigned char **)&buff;
 	
 	switch (args->inForm[0]) {
+		case 'p':
+			// a pkcs7 can not be put in an auth, only pe images go on
+			if (!isPE(args->inForm)) {
+				prlog(PR_ERR, "ERROR: Unknown input format %s for generating %s file.\n", args->inForm, (args->outForm[0] == 'a' ? "an Auth" : "a PKCS7"));
+				rc = ARG_PARSE_FAIL;
+				break;
+			}
+			// intentional flow
 		case 'f':
 			// intentional flow
 		case 'h':
@@ -484,8 +611,6 @@ static int generateAuthOrPKCS7(const unsigned char* buff, size_t size, struct Ar
 		goto out;
 	}
 out: 
-	if (intermediateBuff) 
-		free(intermediateBuff);
 	return rc;
 }
 
@@ -495,7 +620,7 @@ out:
  *@param size , length of buff
  *@param args, struct of input info
  *@param hashFunct, array of hash function information to use for ESL GUID, also helps in prevalation, if inform is '[c]ert' then this doesn't matter
- *@param outBuff, the resulting ESL File, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+ *@param outBuff, the resulting ESL File, owned by args->arena
  *@param outBuffSize, the length of outBuff
  *@return SUCCESS or err number 
  */
@@ -505,11 +630,17 @@ static int generateESL(const unsigned char* buff, size_t size, struct Arguments
 	size_t intermediateBuffSize, inpSize = size; 
 	unsigned char *intermediateBuff = NULL , **inpPtr;
 	uuid_t const* eslGUID = &EFI_CERT_X509_GUID;
+	struct certificate *certs = NULL;
+	struct certFile *files = NULL;
+	// number of signatures in the ESL, one per image for pe input, number of ESLs for cert input
+	size_t count = 1, fileCount = 0;
 	inpPtr = (unsigned char **) &buff;
 
 	switch (args->inForm[0]) {
 		case 'f':
 			rc = crypto_md_generate_hash(buff, size, hashFunct->crypto_md_funct, &intermediateBuff, &intermediateBuffSize);
+			if (arenaAdopt(args->arena, intermediateBuff) && !rc)
+				rc = ALLOC_FAIL;
 			if (rc) {
 				prlog(PR_ERR,"Failed to generate hash from file\n");
 				break;
@@ -530,25 +661,17 @@ static int generateESL(const unsigned char* buff, size_t size, struct Arguments
 			eslGUID = hashFunct->guid;
 			break;
 		case 'c': 
-			// two intermediate buffers needed, one for input -> DER and one for DER -> ESL,
-			prlog(PR_INFO, "Converting x509 from PEM to DER...\n");
-			rc = crypto_convert_pem_to_der(*inpPtr, inpSize, (unsigned char **)&intermediateBuff, &intermediateBuffSize);
-			if (rc) {
-				prlog(PR_ERR, "ERROR: Could not convert PEM to DER\n");
+			if (isCertSet(args))
+				rc = loadCertSet(args, &files, &fileCount, &certs, &count);
+			else
+				rc = decodeCertificates(args->arena, args->inFile, *inpPtr, inpSize, &certs, &count);
+			if (rc)
 				break;
-			}
-			if (!args->inpValid) {
-				rc = validateCert(intermediateBuff, intermediateBuffSize, args->varName);
-				if (rc) {
-					prlog(PR_ERR, "ERROR: Could not validate certificate\n");
-					break;
-				}
-			}
+			rc = validateCerts(args, certs, count);
+			if (rc)
+				break;
+			count = dropDuplicateCerts(args, certs, count);
 			eslGUID = &EFI_CERT_X509_GUID;
-			rc = SUCCESS;
-			// new input is the der
-			inpPtr = &intermediateBuff;
-			inpSize = intermediateBuffSize;	
 			break;	
 		case 'a':
 			if (!args->inpValid) {
@@ -560,6 +683,18 @@ static int generateESL(const unsigned char* buff, size_t size, struct Arguments
 			}
 			rc = SUCCESS;
 			break;
+		case 'p':
+			if (isPE(args->inForm)) {
+				rc = hashImages(args, hashFunct, &intermediateBuff, &intermediateBuffSize);
+				if (rc)
+					break;
+				inpPtr = &intermediateBuff;
+				inpSize = hashFunct->size;
+				count = args->inFileCount;
+				eslGUID = hashFunct->guid;
+				break;
+			}
+			// a pkcs7 can not be put in an ESL, intentional flow
 		default:
 			prlog(PR_ERR, "ERROR: unknown input format %s for generating an ESL, use `--help` for more info\n", args->inForm);
 			rc = ARG_PARSE_FAIL;
@@ -571,16 +706,19 @@ static int generateESL(const unsigned char* buff, size_t size, struct Arguments
 	}
 	// if input file is auth than extract it
 	if (args->inForm[0] == 'a') 
-		rc = authToESL(*inpPtr, inpSize, outBuff, outBuffSize);
+		rc = authToESL(args->arena, *inpPtr, inpSize, outBuff, outBuffSize);
+	else if (args->inForm[0] == 'c')
+		rc = certsToESLs(args->arena, certs, count, outBuff, outBuffSize);
 	else
 	// now we have either a hash or x509 in der and is ready to be put into an ESL
-		rc = toESL(*inpPtr, inpSize, *eslGUID, outBuff, outBuffSize);
+		rc = toESL(args->arena, *inpPtr, inpSize, count, *eslGUID, outBuff, outBuffSize);
 	if (rc) {
 		prlog(PR_ERR, "Failed to generate ESL file\n");
 		goto out;
 	}
 out: 
-	if (intermediateBuff) free(intermediateBuff);
+	freeCertSet(files, fileCount);
+
 	return rc;
 	
 }
@@ -591,13 +729,16 @@ out:
  *@param size , length of buff
  *@param args, struct containing important command line info
  *@param hashFunct, array of hash function information to use as hash algorithm
-  *@param outHash, the resulting hash, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+  *@param outHash, the resulting hash, owned by args->arena
  *@param outHashSize, the length of outHash
  *@return SUCCESS or err number 
  */
 static int generateHash(const unsigned char* data, size_t size, struct Arguments *args, const struct hash_funct *alg, unsigned char** outHash, size_t* outHashSize)
 {
 	int rc;
+	// images are not loaded, their Authenticode digests are the hashes
+	if (isPE(args->inForm))
+		return hashImages(args, alg, outHash, outHashSize);
 	//  if the input is not declared valid then we validate it is the same as inForm format
 	if (!args->inpValid) {
 		switch (args->inForm[0]) {
@@ -626,6 +767,8 @@ static int generateHash(const unsigned char* data, size_t size, struct Arguments
 		}	
 	}
 	rc = crypto_md_generate_hash(data, size, alg->crypto_md_funct, outHash, outHashSize);
+	if (arenaAdopt(args->arena, *outHash) && !rc)
+		rc = ALLOC_FAIL;
 	if (rc) {
 		prlog(PR_ERR, "Failed to generate hash\n");
 		return rc;
@@ -634,6 +777,671 @@ static int generateHash(const unsigned char* data, size_t size, struct Arguments
 }
 
 
+// the images of one pe input, every job writes the digest of its image at index * alg->size
+struct imageHashing {
+	const char **files;
+	const struct hash_funct *alg;
+	unsigned char *hashes;
+};
+
+static int isPE(const char *inForm)
+{
+	return !strcmp(inForm, "pe");
+}
+
+static int isAuto(const char *inForm)
+{
+	return !strcmp(inForm, "auto");
+}
+
+/*
+ *replaces an 'auto' input format with the format sniffed from the first input file
+ *directories and '@' lists can only hold certificates so they are not read
+ *@param args, args->inForm and, for a raw hash without '-h', args->hashAlg are set
+ *@param buff, returned data of the first input, owned by args->arena, NULL if it was not read
+ *@param size, length of buff
+ *@return SUCCESS or err number, the same errors as ARGP_KEY_SUCCESS gives for an explicit format
+ */
+static int resolveAutoFormat(struct Arguments *args, unsigned char **buff, size_t *size)
+{
+	enum fileFormat format;
+	struct stat st;
+	int rc;
+
+	if (args->inFile[0] == FILE_LIST_PREFIX || (!stat(args->inFile, &st) && S_ISDIR(st.st_mode)))
+		format = FORMAT_X509;
+	else {
+		*buff = (unsigned char *)getDataFromFile(args->inFile, size);
+		if (*buff == NULL) {
+			prlog(PR_ERR, "ERROR: Could not find data in file %s\n", args->inFile);
+			return INVALID_FILE;
+		}
+		rc = arenaAdopt(args->arena, *buff);
+		if (rc)
+			return rc;
+		format = sniffFormat(*buff, *size);
+	}
+	switch (format) {
+		case FORMAT_PEM:
+		case FORMAT_X509:
+			args->inForm = "c";
+			break;
+		case FORMAT_PKCS7:
+			args->inForm = "p";
+			break;
+		case FORMAT_AUTH:
+			args->inForm = "a";
+			break;
+		case FORMAT_ESL:
+			args->inForm = "e";
+			break;
+		case FORMAT_PE:
+			args->inForm = "pe";
+			break;
+		case FORMAT_HASH:
+			args->inForm = "h";
+			for (int i = 0; !args->hashAlg && i < ARRAY_SIZE(hash_functions); i++) {
+				if (hash_functions[i].size == *size)
+					args->hashAlg = hash_functions[i].name;
+			}
+			break;
+		default:
+			prlog(PR_ERR, "ERROR: Could not tell the format of %s, give it as <inputFormat>:%s\n", args->inFile, args->outForm);
+			return INVALID_FILE;
+	}
+	prlog(PR_INFO, "Input file %s looks like %s, using input format '%s'\n", args->inFile, formatName(format), args->inForm);
+
+	if (args->inFileCount > 1 && !isPE(args->inForm) && args->inForm[0] != 'c') {
+		prlog(PR_ERR, "ERROR: Only 'pe' and 'c' input take more than one input file, %s is %s\n", args->inFile, formatName(format));
+		return ARG_PARSE_FAIL;
+	}
+	if (isCertSet(args) && args->outForm[0] == 'h') {
+		prlog(PR_ERR, "ERROR: Several certificates can not be hashed, only put in ESLs\n");
+		return ARG_PARSE_FAIL;
+	}
+	if (isPE(args->inForm) && !imagesAreFiles(args)) {
+		prlog(PR_ERR, "ERROR: Every PE image must be a file that can be read, not stdin\n");
+		return ARG_PARSE_FAIL;
+	}
+
+	return SUCCESS;
+}
+
+// images are read at offsets so stdin can not be one
+static int imagesAreFiles(struct Arguments *args)
+{
+	for (int i = 0; i < args->inFileCount; i++) {
+		if (isStdio(args->inFiles[i]) || isFile(args->inFiles[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ *computes the Authenticode digest of every input image, on a threadpool when there are several
+ *@param args, the images are args->inFiles
+ *@param alg, hash function, only SHA256, SHA384 and SHA512 are used by Authenticode
+ *@param outHashes, the digests back to back in the order of the '-i' arguments, owned by args->arena
+ *@param outSize, the length of outHashes
+ *@return SUCCESS or err number
+ */
+static int hashImages(struct Arguments *args, const struct hash_funct *alg, unsigned char **outHashes, size_t *outSize)
+{
+	struct imageHashing hashing = { args->inFiles, alg, NULL };
+	struct threadpool *pool = NULL;
+	int rc = SUCCESS, threads;
+
+	if (alg->crypto_md_funct != CRYPTO_MD_SHA256 && alg->crypto_md_funct != CRYPTO_MD_SHA384 &&
+	    alg->crypto_md_funct != CRYPTO_MD_SHA512) {
+		prlog(PR_ERR, "ERROR: Authenticode digests are SHA256, SHA384 or SHA512, not %s\n", alg->name);
+		return ARG_PARSE_FAIL;
+	}
+	hashing.hashes = arenaAlloc(args->arena, alg->size * args->inFileCount);
+	if (!hashing.hashes) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	threads = args->jobs ? args->jobs : threadpoolDefaultSize();
+	if (threads > args->inFileCount)
+		threads = args->inFileCount;
+	// batch callers that already run generate on a pool hash inline
+	if (threads > 1 && !threadpoolInJob())
+		pool = threadpoolCreate(threads);
+	if (pool) {
+		rc = threadpoolRun(pool, hashImageJob, &hashing, args->inFileCount);
+		threadpoolDestroy(pool);
+	}
+	else {
+		for (int i = 0; i < args->inFileCount && !rc; i++)
+			rc = hashImageJob(&hashing, i);
+	}
+	if (rc) {
+		prlog(PR_ERR, "Failed to hash PE images\n");
+		return rc;
+	}
+	*outHashes = hashing.hashes;
+	*outSize = alg->size * args->inFileCount;
+
+	return SUCCESS;
+}
+
+// threadpool job of hashImages
+static int hashImageJob(void *ctx, size_t index)
+{
+	struct imageHashing *hashing = ctx;
+
+	return authenticodeHash(hashing->files[index], hashing->alg, hashing->hashes + index * hashing->alg->size);
+}
+
+// finds text in [p, end), NULL if it is not there
+static const unsigned char *findText(const unsigned char *p, const unsigned char *end, const char *text)
+{
+	size_t len = strlen(text);
+
+	while (p < end && (p = memchr(p, text[0], end - p)) && (size_t)(end - p) >= len) {
+		if (!memcmp(p, text, len))
+			return p;
+		p++;
+	}
+
+	return NULL;
+}
+
+/*
+ *decodes every "-----BEGIN CERTIFICATE-----" block of a PEM file, text between blocks is skipped as in the
+ *bundles of distributions, the base64 is decoded here rather than by the crypto library one block at a time
+ *@param arena, where certs and the DER of every certificate are allocated
+ *@param file, name of the file, for messages
+ *@param buff, the PEM file
+ *@param size, length of buff
+ *@param certs, the certificates in the order of the file
+ *@param count, number of certificates, 0 if buff has no PEM block at all
+ *@return SUCCESS or err number if a block is not a certificate or can not be decoded
+ */
+static int pemCertificates(struct arena *arena, const char *file, const unsigned char *buff, size_t size, struct certificate **certs, size_t *count)
+{
+	const unsigned char *end = buff + size, *p, *label, *body, *bodyEnd;
+	size_t blocks = 0, labelLen;
+	unsigned char *der;
+
+	*count = 0;
+	for (p = buff; (p = findText(p, end, PEM_BEGIN)); p += strlen(PEM_BEGIN))
+		blocks++;
+	if (!blocks)
+		return SUCCESS;
+	*certs = arenaCalloc(arena, blocks, sizeof(**certs));
+	if (!*certs) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	for (p = buff; *count < blocks; p = bodyEnd + strlen(PEM_END) + labelLen + strlen(PEM_DASHES)) {
+		label = findText(p, end, PEM_BEGIN) + strlen(PEM_BEGIN);
+		body = findText(label, end, PEM_DASHES);
+		if (!body || memchr(label, '\n', body - label)) {
+			prlog(PR_ERR, "ERROR: PEM block %zu of %s has no end to its BEGIN line\n", *count + 1, file);
+			return INVALID_FILE;
+		}
+		labelLen = body - label;
+		if (labelLen != strlen(PEM_CERT_LABEL) || memcmp(label, PEM_CERT_LABEL, labelLen)) {
+			prlog(PR_ERR, "ERROR: PEM block %zu of %s is a %.*s, only certificates can be put in an ESL\n", *count + 1, file,
+			      (int)labelLen, label);
+			return INVALID_FILE;
+		}
+		body += strlen(PEM_DASHES);
+		bodyEnd = findText(body, end, PEM_END);
+		if (!bodyEnd || (size_t)(end - bodyEnd) < strlen(PEM_END) + labelLen + strlen(PEM_DASHES) ||
+		    memcmp(bodyEnd + strlen(PEM_END), label, labelLen) ||
+		    memcmp(bodyEnd + strlen(PEM_END) + labelLen, PEM_DASHES, strlen(PEM_DASHES))) {
+			prlog(PR_ERR, "ERROR: PEM block %zu of %s has no \"" PEM_END PEM_CERT_LABEL PEM_DASHES "\" line\n", *count + 1, file);
+			return INVALID_FILE;
+		}
+		der = arenaAlloc(arena, (bodyEnd - body) / 4 * 3);
+		if (!der) {
+			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+			return ALLOC_FAIL;
+		}
+		if (base64Decode(der, &(*certs)[*count].size, (const char *)body, bodyEnd - body) || !(*certs)[*count].size) {
+			prlog(PR_ERR, "ERROR: PEM block %zu of %s is not valid base64\n", *count + 1, file);
+			return INVALID_FILE;
+		}
+		(*certs)[*count].der = der;
+		(*certs)[*count].file = file;
+		(*count)++;
+		(*certs)[*count - 1].block = *count;
+	}
+	prlog(PR_INFO, "Decoded %zu PEM certificates of %s\n", *count, file);
+
+	return SUCCESS;
+}
+
+/*
+ *gets the certificates of one 'c' input file, the PEM blocks if it has any, else the whole file as DER
+ *@param arena, where certs is allocated, the certificates point into buff or into the arena
+ *@param file, name of the file, for messages
+ *@param buff, the content of the file
+ *@param size, length of buff
+ *@param certs, the certificates in the order of the file
+ *@param count, number of certificates
+ *@return SUCCESS or err number
+ */
+static int decodeCertificates(struct arena *arena, const char *file, const unsigned char *buff, size_t size, struct certificate **certs, size_t *count)
+{
+	int rc;
+
+	rc = pemCertificates(arena, file, buff, size, certs, count);
+	if (rc || *count)
+		return rc;
+	if (!size) {
+		prlog(PR_ERR, "ERROR: %s has no certificate\n", file);
+		return INVALID_FILE;
+	}
+	*certs = arenaCalloc(arena, 1, sizeof(**certs));
+	if (!*certs) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	(*certs)->der = buff;
+	(*certs)->size = size;
+	(*certs)->file = file;
+	*count = 1;
+
+	return SUCCESS;
+}
+
+// a 'c' input that is more than one file, or a directory or list of them
+static int isCertSet(struct Arguments *args)
+{
+	struct stat st;
+
+	if (args->inForm[0] != 'c' || !args->inFile)
+		return 0;
+
+	return args->inFileCount > 1 || args->inFile[0] == FILE_LIST_PREFIX || (!stat(args->inFile, &st) && S_ISDIR(st.st_mode));
+}
+
+// adds path to a list that grows with reallocArray
+static int addPath(const char ***paths, size_t *count, const char *path)
+{
+	if (reallocArray((void **)paths, *count + 1, sizeof(**paths))) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	(*paths)[(*count)++] = path;
+
+	return SUCCESS;
+}
+
+/*
+ *adds every regular file of a directory, in name order and without going into subdirectories
+ *@param arena, where the paths are allocated
+ *@param dir, the directory
+ *@param paths, list to add to
+ *@param count, length of paths
+ *@return SUCCESS or err number
+ */
+static int addDirectory(struct arena *arena, const char *dir, const char ***paths, size_t *count)
+{
+	struct dirent **entries = NULL;
+	struct stat st;
+	char *path;
+	int n, rc = SUCCESS;
+
+	n = scandir(dir, &entries, NULL, alphasort);
+	if (n < 0) {
+		prlog(PR_ERR, "ERROR: Could not open directory %s\n", dir);
+		return INVALID_FILE;
+	}
+	for (int i = 0; i < n && !rc; i++) {
+		if (entries[i]->d_name[0] == '.')
+			continue;
+		path = arenaAlloc(arena, strlen(dir) + strlen(entries[i]->d_name) + 2);
+		if (!path) {
+			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+			rc = ALLOC_FAIL;
+			break;
+		}
+		sprintf(path, "%s/%s", dir, entries[i]->d_name);
+		if (!stat(path, &st) && S_ISREG(st.st_mode))
+			rc = addPath(paths, count, path);
+	}
+	for (int i = 0; i < n; i++)
+		free(entries[i]);
+	free(entries);
+
+	return rc;
+}
+
+/*
+ *expands the '-i' arguments of a 'c' input into certificate files, in the order of the arguments:
+ *a directory gives its files in name order, '@<file>' gives the files listed in <file>, one per line,
+ *empty lines and lines starting with '#' are skipped, every other argument is a file
+ *@param args, struct containing command line info, the arguments are args->inFiles
+ *@param paths, the files, owned by args->arena
+ *@param count, number of files
+ *@return SUCCESS or err number
+ */
+static int listCertFiles(struct Arguments *args, const char ***paths, size_t *count)
+{
+	const char **list = NULL;
+	char *data, *line, *next, *end;
+	struct stat st;
+	size_t size, n = 0;
+	int rc = SUCCESS;
+
+	for (int i = 0; i < args->inFileCount && !rc; i++) {
+		if (args->inFiles[i][0] != FILE_LIST_PREFIX) {
+			if (!stat(args->inFiles[i], &st) && S_ISDIR(st.st_mode))
+				rc = addDirectory(args->arena, args->inFiles[i], &list, &n);
+			else
+				rc = addPath(&list, &n, args->inFiles[i]);
+			continue;
+		}
+		data = getDataFromFile(args->inFiles[i] + 1, &size);
+		if (!data) {
+			prlog(PR_ERR, "ERROR: Could not read file list %s\n", args->inFiles[i] + 1);
+			rc = INVALID_FILE;
+			break;
+		}
+		rc = arenaAdopt(args->arena, data);
+		// the list is cut into strings in place, the last line may not end with a new line
+		for (line = data; !rc && line < data + size; line = next) {
+			end = memchr(line, '\n', data + size - line);
+			next = end ? end + 1 : data + size;
+			if (!end)
+				end = data + size;
+			while (end > line && isspace((unsigned char)end[-1]))
+				end--;
+			while (line < end && isspace((unsigned char)*line))
+				line++;
+			if (line == end || *line == '#')
+				continue;
+			// a line that fills the whole buffer has no room for its terminator
+			if (end == data + size) {
+				line = strndup(line, end - line);
+				if (!line || arenaAdopt(args->arena, line)) {
+					prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+					rc = ALLOC_FAIL;
+					break;
+				}
+			}
+			else
+				*end = '\0';
+			rc = addPath(&list, &n, line);
+		}
+	}
+	if (!rc && !n) {
+		prlog(PR_ERR, "ERROR: No certificate files given\n");
+		rc = INVALID_FILE;
+	}
+	if (!rc)
+		rc = arenaAdopt(args->arena, list);
+	else
+		free(list);
+	if (rc)
+		return rc;
+	*paths = list;
+	*count = n;
+
+	return SUCCESS;
+}
+
+/*
+ *reads and decodes every file of a set of 'c' inputs, on a threadpool when there are several
+ *@param args, struct containing command line info
+ *@param files, one per file, free with freeCertSet even on failure
+ *@param fileCount, number of files
+ *@param certs, the certificates of every file, in the order of the files, owned by args->arena and files
+ *@param count, number of certificates
+ *@return SUCCESS or the error of the first file that could not be read
+ */
+static int loadCertSet(struct Arguments *args, struct certFile **files, size_t *fileCount, struct certificate **certs, size_t *count)
+{
+	struct threadpool *pool = NULL;
+	const char **paths;
+	size_t n, total = 0;
+	int rc, threads;
+
+	rc = listCertFiles(args, &paths, &n);
+	if (rc)
+		return rc;
+	*files = arenaCalloc(args->arena, n, sizeof(**files));
+	if (!*files) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	for (size_t i = 0; i < n; i++) {
+		(*files)[i].path = paths[i];
+		arenaInit(&(*files)[i].arena);
+	}
+	*fileCount = n;
+	threads = args->jobs ? args->jobs : threadpoolDefaultSize();
+	if ((size_t)threads > n)
+		threads = n;
+	if (threads > 1 && !threadpoolInJob())
+		pool = threadpoolCreate(threads);
+	if (pool) {
+		rc = threadpoolRun(pool, readCertFileJob, *files, n);
+		threadpoolDestroy(pool);
+	}
+	else {
+		for (size_t i = 0; i < n && !rc; i++)
+			rc = readCertFileJob(*files, i);
+	}
+	if (rc) {
+		prlog(PR_ERR, "ERROR: Could not read certificates\n");
+		return rc;
+	}
+	for (size_t i = 0; i < n; i++)
+		total += (*files)[i].count;
+	*certs = arenaAlloc(args->arena, total * sizeof(**certs));
+	if (!*certs) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	*count = 0;
+	for (size_t i = 0; i < n; i++) {
+		memcpy(*certs + *count, (*files)[i].certs, (*files)[i].count * sizeof(**certs));
+		*count += (*files)[i].count;
+	}
+	prlog(PR_INFO, "Read %zu certificates from %zu files\n", *count, n);
+
+	return SUCCESS;
+}
+
+// threadpool job of loadCertSet, the buffers of the file go in its own arena since args->arena belongs to the calling thread
+static int readCertFileJob(void *ctx, size_t index)
+{
+	struct certFile *file = (struct certFile *)ctx + index;
+	unsigned char *data;
+	size_t size;
+	int rc;
+
+	data = (unsigned char *)getDataFromFile(file->path, &size);
+	if (!data) {
+		prlog(PR_ERR, "ERROR: Could not find data in file %s\n", file->path);
+		return INVALID_FILE;
+	}
+	rc = arenaAdopt(&file->arena, data);
+	if (rc)
+		return rc;
+
+	return decodeCertificates(&file->arena, file->path, data, size, &file->certs, &file->count);
+}
+
+static void freeCertSet(struct certFile *files, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		arenaDestroy(&files[i].arena);
+}
+
+/*
+ *validates, unless '-f' is given, and hashes every certificate of a 'c' input, on a threadpool when there are several
+ *@param args, struct containing command line info, args->varName is what the certificates are for
+ *@param certs, the DER certificates, their digest is filled in
+ *@param count, number of certificates
+ *@return SUCCESS or the error of the first certificate that is not valid
+ */
+static int validateCerts(struct Arguments *args, struct certificate *certs, size_t count)
+{
+	struct certValidation validation = { certs, args->varName, args->inpValid, NULL };
+	struct threadpool *pool = NULL;
+	int rc = SUCCESS, threads;
+
+	validation.rcs = arenaCalloc(args->arena, count, sizeof(*validation.rcs));
+	if (!validation.rcs) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	threads = args->jobs ? args->jobs : threadpoolDefaultSize();
+	if ((size_t)threads > count)
+		threads = count;
+	if (threads > 1 && !threadpoolInJob())
+		pool = threadpoolCreate(threads);
+	if (pool) {
+		threadpoolRun(pool, validateCertJob, &validation, count);
+		threadpoolDestroy(pool);
+	}
+	else {
+		for (size_t i = 0; i < count; i++)
+			validateCertJob(&validation, i);
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (!validation.rcs[i])
+			continue;
+		if (certs[i].block)
+			prlog(PR_ERR, "ERROR: Could not validate certificate %zu of %s\n", certs[i].block, certs[i].file);
+		else
+			prlog(PR_ERR, "ERROR: Could not validate certificate %s\n", certs[i].file);
+		if (!rc)
+			rc = validation.rcs[i];
+	}
+
+	return rc;
+}
+
+// threadpool job of validateCerts
+static int validateCertJob(void *ctx, size_t index)
+{
+	struct certValidation *validation = ctx;
+	struct certificate *cert = validation->certs + index;
+	unsigned char *digest = NULL;
+	size_t digestSize;
+	int rc = SUCCESS;
+
+	if (!validation->inpValid)
+		rc = validateCert(cert->der, cert->size, validation->varName);
+	if (!rc)
+		rc = crypto_md_generate_hash(cert->der, cert->size, CRYPTO_MD_SHA256, &digest, &digestSize);
+	if (!rc)
+		memcpy(cert->digest, digest, CERT_DIGEST_SIZE);
+	if (digest)
+		free(digest);
+	validation->rcs[index] = rc;
+
+	return rc;
+}
+
+// qsort comparison of two struct certificate pointers by digest, ties keep input order
+static int compareCertDigests(const void *a, const void *b)
+{
+	const struct certificate *x = *(const struct certificate **)a, *y = *(const struct certificate **)b;
+	int rc = memcmp(x->digest, y->digest, sizeof(x->digest));
+
+	if (rc)
+		return rc;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ *leaves out every certificate that is the same as one before it, so the same certificate from two
+ *vendor drops is only in the variable once, the order of the others does not change
+ *@param args, struct containing command line info
+ *@param certs, the hashed certificates, compacted in place
+ *@param count, number of certificates
+ *@return number of certificates left, count if there is not enough memory to look for repeats
+ */
+static size_t dropDuplicateCerts(struct Arguments *args, struct certificate *certs, size_t count)
+{
+	struct certificate **sorted;
+	unsigned char *repeated;
+	size_t kept = 0;
+
+	if (count < 2)
+		return count;
+	sorted = arenaAlloc(args->arena, count * sizeof(*sorted));
+	repeated = arenaCalloc(args->arena, count, 1);
+	if (!sorted || !repeated)
+		return count;
+	for (size_t i = 0; i < count; i++)
+		sorted[i] = certs + i;
+	qsort(sorted, count, sizeof(*sorted), compareCertDigests);
+	for (size_t i = 1; i < count; i++) {
+		if (memcmp(sorted[i]->digest, sorted[i - 1]->digest, CERT_DIGEST_SIZE))
+			continue;
+		repeated[sorted[i] - certs] = 1;
+		if (sorted[i]->block)
+			prlog(PR_INFO, "Leaving out certificate %zu of %s, it is already in the ESLs\n", sorted[i]->block, sorted[i]->file);
+		else
+			prlog(PR_INFO, "Leaving out certificate %s, it is already in the ESLs\n", sorted[i]->file);
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (!repeated[i])
+			certs[kept++] = certs[i];
+	}
+	if (kept < count)
+		prlog(PR_NOTICE, "Left out %zu repeated certificates\n", count - kept);
+
+	return kept;
+}
+
+/*
+ *puts every certificate in an ESL of its own, x509 signatures differ in size so one ESL can not hold two,
+ *the ESLs are written back to back into one buffer
+ *@param arena, where outESL is allocated
+ *@param certs, the DER certificates
+ *@param count, number of certificates
+ *@param outESL, the resulting ESLs
+ *@param outESLSize, the length of outESL
+ *@return SUCCESS or err number
+ */
+static int certsToESLs(struct arena *arena, const struct certificate *certs, size_t count, unsigned char **outESL, size_t *outESLSize)
+{
+	EFI_SIGNATURE_LIST esl;
+	size_t total = 0, offset = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		if (certs[i].size > UINT32_MAX - sizeof(esl) - sizeof(uuid_t)) {
+			prlog(PR_ERR, "ERROR: certificate %zu is too big for an ESL\n", i + 1);
+			return ESL_FAIL;
+		}
+		total += sizeof(esl) + sizeof(uuid_t) + certs[i].size;
+	}
+	*outESL = arenaCalloc(arena, 1, total);
+	if (!*outESL) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	esl.SignatureType = EFI_CERT_X509_GUID;
+	// for some reason we are using header size is zero in all our files
+	esl.SignatureHeaderSize = 0;
+	for (size_t i = 0; i < count; i++) {
+		esl.SignatureSize = sizeof(uuid_t) + certs[i].size;
+		esl.SignatureListSize = sizeof(esl) + esl.SignatureSize;
+		prlog(PR_INFO, "Adding certificate %zu, Sig List Size - %d\n", i + 1, esl.SignatureListSize);
+		memcpy(*outESL + offset, &esl, sizeof(esl));
+		// owner guid left blank
+		offset += sizeof(esl) + sizeof(uuid_t);
+		memcpy(*outESL + offset, certs[i].der, certs[i].size);
+		offset += certs[i].size;
+	}
+	*outESLSize = total;
+	prlog(PR_INFO, "Generated %zu x509 ESLs, %zu bytes\n", count, total);
+
+	return SUCCESS;
+}
+
 /*
  *validates that the size of the hash buffer is equal to the expected, only real check we can do on a hash
  *@param size , length of hash to be validated
@@ -652,14 +1460,16 @@ static int validateHashAndAlg(size_t size, const struct hash_funct *alg)
 
 /* 
  *generates ESL from input data, esl will have GUID specified by guid
- *@param data, data to be added to ESL
- *@param size , length of data
+ *@param arena, where outESL is allocated
+ *@param data, data to be added to ESL, count signatures back to back
+ *@param size , length of the data of one signature
+ *@param count , number of signatures
  *@param guid, guid of data type of data
- *@param outESL, the resulting ESL File, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+ *@param outESL, the resulting ESL File
  *@param outESLSize, the length of outBuff
  *@return SUCCESS or err number 
  */
-static int toESL(const unsigned char* data, size_t size, const uuid_t guid, unsigned char** outESL, size_t* outESLSize)
+static int toESL(struct arena *arena, const unsigned char* data, size_t size, size_t count, const uuid_t guid, unsigned char** outESL, size_t* outESLSize)
 {
 	EFI_SIGNATURE_LIST esl;
 	size_t offset = 0;
@@ -671,7 +1481,7 @@ static int toESL(const unsigned char* data, size_t size, const uuid_t guid, unsi
 		printGuidSig(&guid);
 	}
 
-	esl.SignatureListSize = sizeof(esl) + sizeof(uuid_t) + size;
+	esl.SignatureListSize = sizeof(esl) + (sizeof(uuid_t) + size) * count;
 	prlog(PR_INFO, "\tSig List Size - %d\n", esl.SignatureListSize);
 	// for some reason we are using header size is zero in all our files
 	esl.SignatureHeaderSize = 0;
@@ -680,11 +1490,12 @@ static int toESL(const unsigned char* data, size_t size, const uuid_t guid, unsi
 
 	/*ESL Structure:
 		-ESL header - 28 bytes
-		-ESL Owner uuid - 16 bytes
-		-data
+		-for each signature:
+			-ESL Owner uuid - 16 bytes
+			-data
 	*/
 	// add ESL header stuff
-	*outESL = calloc(1,esl.SignatureListSize);
+	*outESL = arenaCalloc(arena, 1, esl.SignatureListSize);
 	if (!*outESL) {
 		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
 		return ALLOC_FAIL;
@@ -693,10 +1504,13 @@ static int toESL(const unsigned char* data, size_t size, const uuid_t guid, unsi
 	memcpy(*outESL, &esl, sizeof(esl));
 	offset += sizeof(esl);
 
-	// add owner guid here, leave blank for now
-	offset += sizeof(uuid_t);
-	// add data
-	memcpy(*outESL + offset, data, size);
+	for (size_t i = 0; i < count; i++) {
+		// add owner guid here, leave blank for now
+		offset += sizeof(uuid_t);
+		// add data
+		memcpy(*outESL + offset, data + i * size, size);
+		offset += size;
+	}
 	*outESLSize = esl.SignatureListSize;
 	prlog(PR_INFO, "ESL generation successful...\n");
 	return SUCCESS;
@@ -704,14 +1518,14 @@ static int toESL(const unsigned char* data, size_t size, const uuid_t guid, unsi
 
 /**
  *actually performs the extraction of the esl from the authfile
+ *@param arena, where out is allocated
  *@param in , in buffer, auth buffer 
  *@param inSize, length of auth buffer
  *@param out , out ESL, ESL buffer
  *@param outSize, length of ESL
- *NOTE: This allocates memory for output buffer, FREE LATER
  *@return SUCCESS or error number
  */
-static int authToESL(const unsigned char *in, size_t inSize, unsigned char **out, size_t *outSize) { 
+static int authToESL(struct arena *arena, const unsigned char *in, size_t inSize, unsigned char **out, size_t *outSize) { 
 	size_t length, auth_buffer_size, offset = 0, pkcs7_size;
 	const struct efi_variable_authentication_2 *auth;
 
@@ -745,7 +1559,11 @@ static int authToESL(const unsigned char *in, size_t inSize, unsigned char **out
 		prlog(PR_WARNING, "WARNING: ESL is empty\n");
 	}
 	*outSize = inSize - offset;
-	*out = malloc(*outSize);
+	*out = arenaAlloc(arena, *outSize);
+	if (!*out) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
 	memcpy(*out, in + offset, *outSize);
    	
 	return SUCCESS;	
@@ -799,11 +1617,11 @@ static void convert_tm_to_efi_time(struct efi_time *efi_t, struct tm *tm_t)
  */
 static int getTimestamp(struct efi_time *ts) {
 	time_t epochTime;
-	struct tm *t;
+	struct tm t;
 
 	time(&epochTime);	
-	t = gmtime(&epochTime);
-    convert_tm_to_efi_time(ts, t);
+	gmtime_r(&epochTime, &t);
+    convert_tm_to_efi_time(ts, &t);
 
   	return validateTime(ts);	
 }
@@ -813,7 +1631,7 @@ static int getTimestamp(struct efi_time *ts) {
  *@param ESL, ESL data buffer
  *@param ESL_size , length of ESL
  *@param args, struct containing command line info and lots of other important information
- *@param outBuff, the resulting hashed data, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+ *@param outBuff, the resulting hashed data, owned by args->arena
  *@param outBuffSize, the length of hashed data (should be 32 bytes)
  *@return SUCCESS or err number 
  */
@@ -829,6 +1647,8 @@ static int toHashForSecVarSigning(const unsigned char* ESL, size_t ESL_size, str
         goto out;
     }
     rc = crypto_md_generate_hash(preHash, preHash_size, CRYPTO_MD_SHA256, outBuff, outBuffSize);
+    if (arenaAdopt(args->arena, *outBuff) && !rc)
+        rc = ALLOC_FAIL;
     if (rc) {
         prlog(PR_ERR, "Failed to generate hash\n");
         goto out;
@@ -839,23 +1659,20 @@ static int toHashForSecVarSigning(const unsigned char* ESL, size_t ESL_size, str
     }
 
 out:
-    if (preHash)
-        free(preHash);
-
     return rc;
 }
 /* 
  *Expand char to wide character size , for edk2 since ESL's use double wides
  *@param key ,key name
  *@param keylen, length of key
- *@return the new keylen with double length, REMEMBER TO UNALLOC
+ *@return the new keylen with double length, allocated in arena
  */
-static char *char_to_wchar(const char *key, const size_t keylen)
+static char *char_to_wchar(struct arena *arena, const char *key, const size_t keylen)
 {
 	int i;
 	char *str;
 
-	str = zalloc(keylen * 2);
+	str = arenaCalloc(arena, 1, keylen * 2);
 	if (!str)
 		return NULL;
 
@@ -870,7 +1687,7 @@ static char *char_to_wchar(const char *key, const size_t keylen)
 /*
  *generates data that is ready to be hashed and eventually signed for secure variables
  *more specifically this accepts an ESL and preprends metadata 
- *@param outData, the outputted data with prepended data / REMEMBER TO UNALLOC 
+ *@param outData, the outputted data with prepended data, owned by args->arena
  *@param outSize, length of output data
  *@param ESL, the new ESL data 
  *@param ESL_size, length of ESL buffer
@@ -912,11 +1729,11 @@ static int getPreHashForSecVar(unsigned char **outData, size_t *outSize, const u
 
     /* Expand char name to wide character width */
     varlen = strlen(args->varName) * 2;
-    wkey = char_to_wchar(args->varName, strlen(args->varName));
+    wkey = char_to_wchar(args->arena, args->varName, strlen(args->varName));
     // with timestamp and all this funky bussiniss, we can  make the correct data to be hashed
     *outSize = varlen + sizeof(guid) + sizeof(attr) + sizeof(struct efi_time) + ESL_size;
-    *outData = malloc(*outSize);
-    if (!*outData){
+    *outData = arenaAlloc(args->arena, *outSize);
+    if (!wkey || !*outData){
         prlog(PR_ERR, "ERROR: failed to allocate memory\n");
         rc = ALLOC_FAIL;
         goto out;
@@ -933,8 +1750,6 @@ static int getPreHashForSecVar(unsigned char **outData, size_t *outSize, const u
     memcpy(ptr, ESL, ESL_size);
 
 out:
-    if (wkey) 
-        free(wkey);
     return rc;
 }
 
@@ -944,7 +1759,7 @@ out:
  *@param dataSize , length of newData
  *@param args,  struct containing important information for generation
  *@param hashFunct, digest to use, NOTE: hashFucnt doesn't matter currently, it will always use SHA256 until edk2-compat-process.c supports different digest algorithms
- *@param outBuff, the resulting PKCS7, newData not appended, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+ *@param outBuff, the resulting PKCS7, newData not appended, owned by args->arena
  *@param outBuffSize, the length of outBuff
  *@return SUCCESS or err number 
  */
@@ -971,11 +1786,9 @@ static int toPKCS7ForSecVar(const unsigned char* newData, size_t dataSize, struc
 		rc = PKCS7_FAIL;
 		goto out;
 	}
+	rc = arenaAdopt(args->arena, *outBuff);
 
 out:
-	if (actualData) 
-		free(actualData);
-
 	return rc;
 }
 
@@ -985,7 +1798,7 @@ out:
  *@param eslSize , length of newESL
  *@param args, struct containing important command line info
  *@param hashFunct, array of hash function information to use for signing NOTE: NOT CURRENTLY DOING ANYTING SEE toPKCS7ForSecVar
- *@param outBuff, the resulting auth File, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+ *@param outBuff, the resulting auth File, owned by args->arena
  *@param outBuffSize, the length of outBuff
  *@return SUCCESS or err number 
  */
@@ -1012,8 +1825,8 @@ static int toAuth(const unsigned char* newESL, size_t eslSize, struct Arguments
 
 	// now build auth file, = auth header + pkcs7 + new ESL
 	*outBuffSize = pkcs7Size + sizeof(authHeader) + eslSize;
-	*outBuff = malloc(*outBuffSize);
-	if (!outBuff) {
+	*outBuff = arenaAlloc(args->arena, *outBuffSize);
+	if (!*outBuff) {
 		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
 		rc = ALLOC_FAIL;
 		goto out;
@@ -1030,9 +1843,6 @@ static int toAuth(const unsigned char* newESL, size_t eslSize, struct Arguments
 	prlog(PR_INFO, "\t+ new ESL %zd bytes\n\t= %zd total bytes\n", eslSize, offset);
 	
 out:
-	if (pkcs7) 
-		free(pkcs7);
-
 	return rc;
 }
 #endif
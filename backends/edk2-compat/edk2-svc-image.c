@@ -0,0 +1,598 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifndef NO_CRYPTO
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <argp.h>
+#include "external/skiboot/include/secvar.h"
+#include "output.h"
+#include "threadpool.h"
+#include "backends/edk2-compat/include/edk2-svc.h"// include last, pragma pack(1) issue
+
+/*
+ *evaluates boot binaries the way firmware does before it runs them:
+ *an image is rejected if its Authenticode digest is in dbx or if one of its signatures chains to a dbx certificate,
+ *otherwise it is accepted if its digest is in db or if one of its signatures chains to a db certificate.
+ *db and dbx are prepared once, hashes into one hash set per algorithm and certificates into a store,
+ *so that every image only costs one pass over its file and one signature check per signature
+ */
+
+// signatures of one image that are looked at, the rest are ignored (see the help text)
+#define MAX_IMAGE_SIGNATURES 8
+// db and dbx hold image digests of SHA256, SHA384 and SHA512
+#define IMAGE_HASH_TYPES 3
+
+struct Arguments {
+	int helpFlag, imageCount, jobs;
+	const char *pathToSecVars, **images;
+	enum outputFormat outForm;
+};
+
+// entries of one hash type of db or dbx, open addressing on the first bytes of the digest
+struct hashSet {
+	const struct hash_funct *alg;
+	// pointers into the variable data, NULL for an empty slot
+	const unsigned char **slots;
+	size_t mask, count;
+};
+
+struct sigDatabase {
+	const char *name;
+	struct hashSet hashes[IMAGE_HASH_TYPES];
+	crypto_x509_store *certs;
+	int certCount, ignored;
+};
+
+enum imageVerdict { IMAGE_ACCEPTED = 0, IMAGE_REJECTED, IMAGE_ERROR };
+
+struct imageResult {
+	enum imageVerdict verdict;
+	const char *reason;
+	int signatures;
+};
+
+struct imageCheck {
+	const char **files;
+	struct sigDatabase db, dbx;
+	// every algorithm with a hash in db or dbx, images are hashed with all of them
+	const struct hash_funct *algs[IMAGE_HASH_TYPES];
+	int algCount;
+	struct imageResult *results;
+};
+
+static int parse_opt(int key, char *arg, struct argp_state *state);
+static int checkImages(struct Arguments *args, struct emitter *e);
+static int loadDatabase(struct sigDatabase *sdb, struct list_head *bank, const char *name);
+static void freeDatabase(struct sigDatabase *sdb);
+static int checkImageJob(void *ctx, size_t index);
+static void printResults(struct imageCheck *check, int count, struct emitter *e);
+
+/*
+ *called from main()
+ *handles argument parsing for check-image command
+ *@param argc, number of argument
+ *@param arv, array of params
+ *@return SUCCESS if every image would be accepted, AUTH_FAIL if one would not or err number
+ */
+int performCheckImageCommand(int argc, char *argv[])
+{
+	int rc;
+	struct emitter emitter, *e = NULL;
+	struct Arguments args = {
+		.helpFlag = 0, .imageCount = 0, .jobs = 0,
+		.pathToSecVars = NULL, .images = NULL, .outForm = OUTPUT_TEXT
+	};
+	// combine command and subcommand for usage/help messages
+	argv[0] = "secvarctl check-image";
+
+	struct argp_option options[] =
+	{
+		{"verbose", 'v', 0, 0, "print more verbose process information"},
+		{"path", 'p', "PATH" ,0, "looks for .../<var>/data of db and dbx in PATH, default is " SECVARPATH "."
+							" PATH may also be a packed snapshot file (see `secvarctl read --snapshot-out`)"},
+		{"jobs", 'j', "N", 0, "number of threads checking images, default is the number of online cpus"},
+		{"output", ARGP_OPT_OUTPUT_KEY, "FORMAT", 0, "output format, one of {'text', 'json', 'cbor'}, default is text."
+										" json and cbor carry the verdict of every image and are written to stdout"},
+		{"help", '?', 0, 0, "Give this help list", 1},
+		{"usage", ARGP_OPT_USAGE_KEY, 0, 0, "Give a short usage message", -1 },
+		{0}
+	};
+
+	struct argp argp = {
+		options, parse_opt, "<IMAGE> ...",
+		"This command tells whether firmware would run the given PE/COFF images (EFI applications, bootloaders,"
+		" kernels with an EFI stub) with the current db and dbx. An image is rejected if its Authenticode digest"
+		" is in dbx or if it is signed by a certificate in dbx, else it is accepted if its digest is in db or if"
+		" it is signed by a certificate in db or by a certificate issued under one."
+		" Only the first 8 signatures of an image are looked at.\v"
+		"The result is SUCCESS only if every image is accepted"
+	};
+
+	rc = argp_parse(&argp, argc, argv, ARGP_NO_EXIT | ARGP_IN_ORDER | ARGP_NO_HELP, 0, &args);
+	if (rc || args.helpFlag)
+		goto out;
+
+	if (args.outForm != OUTPUT_TEXT) {
+		// structured data owns stdout, everything else goes to stderr
+		rc = reserveStdoutForData();
+		if (rc)
+			goto out;
+		e = &emitter;
+		emitterInit(e, args.outForm);
+		emitMapStart(e, NULL);
+	}
+
+	rc = checkImages(&args, e);
+
+	if (e) {
+		emitString(e, "result", rc ? "FAILURE" : "SUCCESS");
+		emitInt(e, "rc", rc);
+		emitMapEnd(e);
+		if (emitterFlush(e, STDIO_FILE)) {
+			prlog(PR_ERR, "ERROR: Failed to write structured output\n");
+			if (!rc)
+				rc = FILE_WRITE_FAIL;
+		}
+		emitterFree(e);
+	}
+
+out:
+	if (args.images)
+		free(args.images);
+	if (!args.helpFlag)
+		printf("RESULT: %s\n", rc ? "FAILURE" : "SUCCESS");
+
+	return rc;
+}
+
+/**
+ *@param key , every option that is parsed has a value to identify it
+ *@param arg, if key is an option than arg will hold its value ex: -<key> <arg>
+ *@param state,  argp_state struct that contains useful information about the current parsing state
+ *@return success or errno
+ */
+static int parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct Arguments *args = state->input;
+	const char **images;
+	int rc = SUCCESS;
+	char *end;
+
+	switch (key) {
+		case '?':
+			args->helpFlag = 1;
+			argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
+			break;
+		case ARGP_OPT_USAGE_KEY:
+			args->helpFlag = 1;
+			argp_state_help(state, stdout, ARGP_HELP_USAGE);
+			break;
+		case 'p':
+			args->pathToSecVars = arg;
+			break;
+		case 'j':
+			args->jobs = strtol(arg, &end, 10);
+			if (*end || args->jobs <= 0) {
+				prlog(PR_ERR, "ERROR: Number of jobs must be a positive integer, found %s\n", arg);
+				rc = ARG_PARSE_FAIL;
+			}
+			break;
+		case ARGP_OPT_OUTPUT_KEY:
+			rc = parseOutputFormat(arg, &args->outForm);
+			break;
+		case 'v':
+			verbose = PR_DEBUG;
+			break;
+		case ARGP_KEY_ARG:
+			if (isStdio(arg)) {
+				prlog(PR_ERR, "ERROR: Every image must be a file that can be read, not stdin\n");
+				rc = ARG_PARSE_FAIL;
+				break;
+			}
+			images = realloc(args->images, (args->imageCount + 1) * sizeof(*images));
+			if (!images) {
+				prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+				rc = ALLOC_FAIL;
+				break;
+			}
+			args->images = images;
+			args->images[args->imageCount++] = arg;
+			break;
+		case ARGP_KEY_SUCCESS:
+			if (args->helpFlag || args->imageCount)
+				break;
+			prlog(PR_ERR, "ERROR: No images given, see usage...\n");
+			argp_usage(state);
+			rc = ARG_PARSE_FAIL;
+			break;
+	}
+
+	if (rc)
+		prlog(PR_ERR, "Failed during argument parsing\n");
+
+	return rc;
+}
+
+/**
+ *loads db and dbx, checks every image on a pool and prints the verdicts
+ *@return SUCCESS if every image is accepted, AUTH_FAIL if one is rejected or error number
+ */
+static int checkImages(struct Arguments *args, struct emitter *e)
+{
+	struct imageCheck check = { .files = args->images, .algCount = 0, .results = NULL };
+	struct list_head bank;
+	struct threadpool *pool = NULL;
+	int rc, threads;
+
+	list_head_init(&bank);
+	rc = loadSecVars(&bank, args->pathToSecVars ? args->pathToSecVars : SECVARPATH, NULL);
+	if (rc) {
+		prlog(PR_ERR, "ERROR: Could not load the current variables\n");
+		goto out;
+	}
+	rc = loadDatabase(&check.db, &bank, "db");
+	if (!rc)
+		rc = loadDatabase(&check.dbx, &bank, "dbx");
+	if (rc)
+		goto out;
+	for (int i = 0; i < IMAGE_HASH_TYPES; i++) {
+		if (check.db.hashes[i].count || check.dbx.hashes[i].count)
+			check.algs[check.algCount++] = check.db.hashes[i].alg;
+	}
+	check.results = calloc(args->imageCount, sizeof(*check.results));
+	if (!check.results) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	threads = args->jobs ? args->jobs : threadpoolDefaultSize();
+	if (threads > args->imageCount)
+		threads = args->imageCount;
+	if (threads > 1 && !threadpoolInJob())
+		pool = threadpoolCreate(threads);
+	if (pool) {
+		rc = threadpoolRun(pool, checkImageJob, &check, args->imageCount);
+		threadpoolDestroy(pool);
+	}
+	else {
+		for (int i = 0; i < args->imageCount && !rc; i++)
+			rc = checkImageJob(&check, i);
+	}
+	if (rc)
+		goto out;
+	printResults(&check, args->imageCount, e);
+	for (int i = 0; i < args->imageCount && !rc; i++) {
+		if (check.results[i].verdict == IMAGE_ERROR)
+			rc = INVALID_FILE;
+		else if (check.results[i].verdict == IMAGE_REJECTED)
+			rc = AUTH_FAIL;
+	}
+
+out:
+	free(check.results);
+	freeDatabase(&check.db);
+	freeDatabase(&check.dbx);
+	clear_bank_list(&bank);
+
+	return rc;
+}
+
+static uint64_t slotOf(const unsigned char *digest)
+{
+	uint64_t h;
+
+	// digests are already uniformly distributed, their first bytes are a good enough hash
+	memcpy(&h, digest, sizeof(h));
+
+	return h;
+}
+
+static int hashSetContains(const struct hashSet *set, const unsigned char *digest)
+{
+	if (!set->count)
+		return 0;
+	for (size_t i = slotOf(digest) & set->mask; set->slots[i]; i = (i + 1) & set->mask) {
+		if (!memcmp(set->slots[i], digest, set->alg->size))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void hashSetInsert(struct hashSet *set, const unsigned char *digest)
+{
+	size_t i;
+
+	for (i = slotOf(digest) & set->mask; set->slots[i]; i = (i + 1) & set->mask) {
+		if (!memcmp(set->slots[i], digest, set->alg->size))
+			return;
+	}
+	set->slots[i] = digest;
+}
+
+// @return the hash set of db or dbx that holds entries of type, NULL if it is not an Authenticode digest
+static struct hashSet *hashSetFor(struct sigDatabase *sdb, const uuid_t *type)
+{
+	for (int i = 0; i < IMAGE_HASH_TYPES; i++) {
+		if (uuid_equals(type, sdb->hashes[i].alg->guid))
+			return &sdb->hashes[i];
+	}
+
+	return NULL;
+}
+
+/*
+ *calls visit for every entry of every ESL of data, without the owner GUID
+ *@return SUCCESS, ESL_FAIL if the ESLs are malformed, or the first error of visit
+ */
+static int walkESLs(const char *data, size_t size, struct sigDatabase *sdb,
+		    int (*visit)(struct sigDatabase *sdb, const uuid_t *type, const unsigned char *entry, size_t entrySize))
+{
+	size_t offset = 0, entryOffset;
+	EFI_SIGNATURE_LIST *sigList;
+	int rc;
+
+	while (offset < size) {
+		sigList = get_esl_signature_list(data + offset, size - offset);
+		if (!sigList || sigList->SignatureListSize > size - offset || sigList->SignatureSize <= sizeof(uuid_t)
+			|| sigList->SignatureListSize < sizeof(EFI_SIGNATURE_LIST) + sigList->SignatureHeaderSize + sigList->SignatureSize) {
+			prlog(PR_ERR, "ERROR: %s is not structured correctly, defined size and actual sizes are mismatched\n", sdb->name);
+			return ESL_FAIL;
+		}
+		for (entryOffset = sizeof(EFI_SIGNATURE_LIST) + sigList->SignatureHeaderSize;
+			entryOffset + sigList->SignatureSize <= sigList->SignatureListSize;
+			entryOffset += sigList->SignatureSize) {
+			rc = visit(sdb, &sigList->SignatureType, (const unsigned char *)data + offset + entryOffset + sizeof(uuid_t),
+				   sigList->SignatureSize - sizeof(uuid_t));
+			if (rc)
+				return rc;
+		}
+		offset += sigList->SignatureListSize;
+	}
+
+	return SUCCESS;
+}
+
+// first pass over the ESLs, sizes the hash sets and fills the certificate store
+static int countEntry(struct sigDatabase *sdb, const uuid_t *type, const unsigned char *entry, size_t entrySize)
+{
+	struct hashSet *set = hashSetFor(sdb, type);
+	crypto_x509 *x509;
+	int rc;
+
+	if (set && entrySize == set->alg->size) {
+		set->count++;
+		return SUCCESS;
+	}
+	if (!uuid_equals(type, &EFI_CERT_X509_GUID)) {
+		// ex: x509 TBS hashes, RSA2048 keys, SHA1 digests
+		sdb->ignored++;
+		return SUCCESS;
+	}
+	x509 = crypto_x509_parse_der(entry, entrySize);
+	if (!x509) {
+		prlog(PR_ERR, "ERROR: Could not parse certificate %d of %s\n", sdb->certCount, sdb->name);
+		return CERT_FAIL;
+	}
+	rc = crypto_x509_store_add(sdb->certs, x509);
+	crypto_x509_free(x509);
+	if (!rc)
+		sdb->certCount++;
+
+	return rc;
+}
+
+static int insertEntry(struct sigDatabase *sdb, const uuid_t *type, const unsigned char *entry, size_t entrySize)
+{
+	struct hashSet *set = hashSetFor(sdb, type);
+
+	if (set && entrySize == set->alg->size)
+		hashSetInsert(set, entry);
+
+	return SUCCESS;
+}
+
+/**
+ *prepares db or dbx for checking images, the hash sets point into the data of the variable in bank
+ *@param sdb, receives the hashes and certificates of the variable
+ *@param bank, current variables
+ *@param name, "db" or "dbx", a missing variable is empty
+ *@return SUCCESS or error number
+ */
+static int loadDatabase(struct sigDatabase *sdb, struct list_head *bank, const char *name)
+{
+	struct secvar *var = find_secvar(name, strlen(name) + 1, bank);
+	size_t slots;
+	int rc, n = 0;
+
+	sdb->name = name;
+	sdb->certCount = 0;
+	sdb->ignored = 0;
+	// the Authenticode digests of hash_functions, SHA256 and up
+	for (int i = 0; i < ARRAY_SIZE(hash_functions) && n < IMAGE_HASH_TYPES; i++) {
+		if (hash_functions[i].crypto_md_funct >= CRYPTO_MD_SHA256) {
+			sdb->hashes[n].alg = &hash_functions[i];
+			sdb->hashes[n].slots = NULL;
+			sdb->hashes[n].count = 0;
+			n++;
+		}
+	}
+	sdb->certs = crypto_x509_store_new();
+	if (!sdb->certs)
+		return CERT_FAIL;
+	if (!var || !var->data_size) {
+		prlog(PR_INFO, "%s is empty\n", name);
+		return SUCCESS;
+	}
+	rc = walkESLs(var->data, var->data_size, sdb, countEntry);
+	if (rc)
+		return rc;
+	for (int i = 0; i < IMAGE_HASH_TYPES; i++) {
+		if (!sdb->hashes[i].count)
+			continue;
+		// at most half full, so a lookup for a digest that is not there stops after a slot or two
+		for (slots = 16; slots < sdb->hashes[i].count * 2; slots *= 2)
+			;
+		sdb->hashes[i].slots = calloc(slots, sizeof(*sdb->hashes[i].slots));
+		if (!sdb->hashes[i].slots) {
+			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+			return ALLOC_FAIL;
+		}
+		sdb->hashes[i].mask = slots - 1;
+	}
+	rc = walkESLs(var->data, var->data_size, sdb, insertEntry);
+	if (rc)
+		return rc;
+	prlog(PR_INFO, "%s has %zu SHA256, %zu SHA384, %zu SHA512 hashes and %d certificates\n", name,
+	      sdb->hashes[0].count, sdb->hashes[1].count, sdb->hashes[2].count, sdb->certCount);
+	if (sdb->ignored)
+		prlog(PR_NOTICE, "NOTE: %d entries of %s are not image hashes or certificates and are not checked\n", sdb->ignored, name);
+
+	return SUCCESS;
+}
+
+static void freeDatabase(struct sigDatabase *sdb)
+{
+	crypto_x509_store_free(sdb->certs);
+	sdb->certs = NULL;
+	for (int i = 0; i < IMAGE_HASH_TYPES; i++) {
+		free(sdb->hashes[i].slots);
+		sdb->hashes[i].slots = NULL;
+	}
+}
+
+// @return 1 if one of the digests of the image is in sdb
+static int digestListed(struct imageCheck *check, struct sigDatabase *sdb, unsigned char *digests[])
+{
+	for (int i = 0; i < check->algCount; i++) {
+		for (int j = 0; j < IMAGE_HASH_TYPES; j++) {
+			if (sdb->hashes[j].alg == check->algs[i] && hashSetContains(&sdb->hashes[j], digests[i]))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *checks one image, the verdict goes to check->results[index]
+ *@return SUCCESS, a rejected or unreadable image is a verdict, not an error
+ */
+static int checkImageJob(void *ctx, size_t index)
+{
+	struct imageCheck *check = ctx;
+	struct imageResult *result = &check->results[index];
+	const struct hash_funct *algs[PE_MAX_DIGESTS];
+	unsigned char digestBuf[PE_MAX_DIGESTS][64], *digests[PE_MAX_DIGESTS];
+	unsigned char signedDigest[MAX_IMAGE_SIGNATURES][64];
+	const unsigned char *sigs[MAX_IMAGE_SIGNATURES];
+	size_t sigSizes[MAX_IMAGE_SIGNATURES], signedSize[MAX_IMAGE_SIGNATURES];
+	crypto_pkcs7 *pkcs7[MAX_IMAGE_SIGNATURES] = { NULL };
+	int signedAlg[MAX_IMAGE_SIGNATURES], algCount = check->algCount, matched = 0, allowed = 0, md, a;
+	struct peImage *img = NULL;
+
+	result->verdict = IMAGE_ERROR;
+	result->reason = "not a valid PE/COFF image";
+	if (peOpen(&img, check->files[index]))
+		return SUCCESS;
+	result->signatures = peSignatures(img, sigs, sigSizes, MAX_IMAGE_SIGNATURES);
+	if (result->signatures < 0)
+		goto out;
+	memcpy(algs, check->algs, algCount * sizeof(*algs));
+	for (int i = 0; i < result->signatures; i++) {
+		pkcs7[i] = crypto_pkcs7_parse_der(sigs[i], sigSizes[i]);
+		if (!pkcs7[i] || crypto_pkcs7_authenticode_digest(pkcs7[i], &md, signedDigest[i], &signedSize[i])) {
+			result->verdict = IMAGE_REJECTED;
+			result->reason = "a signature can not be parsed";
+			goto out;
+		}
+		// every digest the image is checked against is computed in the same pass over the file
+		for (a = 0; a < algCount && algs[a]->crypto_md_funct != md; a++)
+			;
+		if (a == algCount) {
+			for (int h = 0; h < ARRAY_SIZE(hash_functions); h++) {
+				if (hash_functions[h].crypto_md_funct == md)
+					algs[algCount++] = &hash_functions[h];
+			}
+		}
+		signedAlg[i] = a;
+	}
+	for (int i = 0; i < algCount; i++)
+		digests[i] = digestBuf[i];
+	if (peDigests(img, algs, algCount, digests)) {
+		result->reason = "the image can not be hashed";
+		goto out;
+	}
+	result->verdict = IMAGE_REJECTED;
+	if (digestListed(check, &check->dbx, digests)) {
+		result->reason = "its digest is in dbx";
+		goto out;
+	}
+	for (int i = 0; i < result->signatures; i++) {
+		// a signature of something else does not count, neither for nor against the image
+		if (signedSize[i] != algs[signedAlg[i]]->size || memcmp(signedDigest[i], digests[signedAlg[i]], signedSize[i]))
+			continue;
+		matched++;
+		if (check->dbx.certCount && !crypto_pkcs7_authenticode_verify(pkcs7[i], check->dbx.certs)) {
+			result->reason = "it is signed by a certificate in dbx";
+			goto out;
+		}
+		if (!allowed && check->db.certCount && !crypto_pkcs7_authenticode_verify(pkcs7[i], check->db.certs))
+			allowed = 1;
+	}
+	result->verdict = IMAGE_ACCEPTED;
+	if (allowed)
+		result->reason = "it is signed by a certificate in db";
+	else if (digestListed(check, &check->db, digests))
+		result->reason = "its digest is in db";
+	else {
+		result->verdict = IMAGE_REJECTED;
+		if (!result->signatures)
+			result->reason = "it is not signed and its digest is not in db";
+		else if (!matched)
+			result->reason = "its signatures are not of this image";
+		else
+			result->reason = "it is not signed by a certificate in db";
+	}
+
+out:
+	for (int i = 0; i < MAX_IMAGE_SIGNATURES; i++)
+		crypto_pkcs7_free(pkcs7[i]);
+	peClose(img);
+
+	return SUCCESS;
+}
+
+static const char *verdictName(enum imageVerdict verdict)
+{
+	switch (verdict) {
+		case IMAGE_ACCEPTED:
+			return "ACCEPTED";
+		case IMAGE_REJECTED:
+			return "REJECTED";
+		default:
+			return "ERROR";
+	}
+}
+
+static void printResults(struct imageCheck *check, int count, struct emitter *e)
+{
+	if (e)
+		emitArrayStart(e, "images");
+	for (int i = 0; i < count; i++) {
+		if (!e) {
+			printf("%s: %s, %s\n", check->files[i], verdictName(check->results[i].verdict), check->results[i].reason);
+			continue;
+		}
+		emitMapStart(e, NULL);
+		emitString(e, "file", check->files[i]);
+		emitString(e, "verdict", verdictName(check->results[i].verdict));
+		emitString(e, "reason", check->results[i].reason);
+		emitInt(e, "signatures", check->results[i].signatures > 0 ? check->results[i].signatures : 0);
+		emitMapEnd(e);
+	}
+	if (e)
+		emitArrayEnd(e);
+}
+#endif
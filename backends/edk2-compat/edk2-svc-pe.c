@@ -0,0 +1,423 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifndef NO_CRYPTO
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "crypto/crypto.h"
+#include "timing.h"
+#include "external/skiboot/include/endian.h"
+#include "backends/edk2-compat/include/edk2-svc.h"// include last, pragma pack(1) issue
+
+/*
+ *Authenticode digest of a PE/COFF image (EFI application, bootloader, kernel with an EFI stub),
+ *which is what a db/dbx entry for an image holds and what the firmware compares against.
+ *as in the PE/COFF specification the digest covers the headers except the checksum and the certificate
+ *table entry, the sections in file order and whatever follows them except the certificate table itself.
+ *only the headers are kept in memory, the rest of the image is streamed through the hash context
+ */
+
+// bytes read and hashed at once
+#define PE_CHUNK_SIZE (64 * 1024)
+// the headers are usually one page, the first read is enough for all of them
+#define PE_FIRST_READ 4096
+#define DOS_MAGIC 0x5a4d
+#define DOS_LFANEW 0x3c
+#define PE_SIGNATURE 0x00004550
+// from the PE signature, the optional header follows the 4 byte signature and the 20 byte COFF header
+#define COFF_NUM_SECTIONS 6
+#define COFF_OPT_HEADER_SIZE 20
+#define OPT_HEADER 24
+#define OPT_MAGIC_PE32 0x10b
+#define OPT_MAGIC_PE32_PLUS 0x20b
+#define OPT_SIZE_OF_HEADERS 60
+#define OPT_CHECKSUM 64
+// NumberOfRvaAndSizes and the data directories are 16 bytes further in PE32+, ImageBase is 64 bits
+#define OPT_NUM_DIRS_PE32 92
+#define OPT_NUM_DIRS_PE32_PLUS 108
+#define DATA_DIR_SIZE 8
+#define CERT_TABLE_DIR 4
+#define SECTION_HEADER_SIZE 40
+#define SECTION_RAW_SIZE 16
+#define SECTION_RAW_OFFSET 20
+// the PE/COFF specification limits images to 96 sections
+#define PE_MAX_SECTIONS 96
+// WIN_CERTIFICATE header of every entry of the certificate table, entries are 8 byte aligned
+#define WIN_CERT_HEADER_SIZE 8
+#define WIN_CERT_REVISION_2_0 0x0200
+#define WIN_CERT_TYPE_PKCS_SIGNED_DATA 0x0002
+
+struct peSection {
+	uint32_t offset, size;
+};
+
+struct peImage {
+	const char *file;
+	int fd;
+	uint64_t fileSize;
+	unsigned char *headers;
+	uint32_t headersSize;
+	// offsets in headers of the fields left out of the digest, certEntry is 0 if the image has no such entry
+	uint32_t checksum, certEntry;
+	// the certificate table itself, from its data directory entry
+	uint32_t certOffset, certSize;
+	// read by peSignatures, NULL until then
+	unsigned char *certTable;
+	struct peSection sections[PE_MAX_SECTIONS];
+	int numSections;
+};
+
+static uint16_t get16(const unsigned char *p)
+{
+	leint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le16_to_cpu(v);
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	leint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32_to_cpu(v);
+}
+
+// @return SUCCESS once size bytes at offset are in buf, INVALID_FILE if the file is shorter or can not be read
+static int readAt(struct peImage *img, unsigned char *buf, size_t size, uint64_t offset)
+{
+	ssize_t n;
+
+	while (size) {
+		n = pread(img->fd, buf, size, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			prlog(PR_ERR, "ERROR: Could not read %s: %s\n", img->file, n ? strerror(errno) : "file is truncated");
+			return INVALID_FILE;
+		}
+		buf += n;
+		size -= n;
+		offset += n;
+	}
+
+	return SUCCESS;
+}
+
+static int notPE(struct peImage *img, const char *reason)
+{
+	prlog(PR_ERR, "ERROR: %s is not a valid PE/COFF image, %s\n", img->file, reason);
+
+	return INVALID_FILE;
+}
+
+static int compareSections(const void *a, const void *b)
+{
+	const struct peSection *x = a, *y = b;
+
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/*
+ *reads and checks the headers, every offset taken from them is checked against the file before it is used
+ *@return SUCCESS or INVALID_FILE
+ */
+static int parseHeaders(struct peImage *img)
+{
+	unsigned char *headers;
+	uint32_t pe, opt, optSize, numDirs, dirs, sectionTable;
+	size_t firstRead = img->fileSize < PE_FIRST_READ ? img->fileSize : PE_FIRST_READ;
+	uint16_t magic;
+	int rc;
+
+	if (firstRead < DOS_LFANEW + 4)
+		return notPE(img, "it is too small");
+	img->headers = malloc(firstRead);
+	if (!img->headers) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	rc = readAt(img, img->headers, firstRead, 0);
+	if (rc)
+		return rc;
+	if (get16(img->headers) != DOS_MAGIC)
+		return notPE(img, "no MZ header");
+	pe = get32(img->headers + DOS_LFANEW);
+	// the signature, the COFF header and the optional header magic must be in the first read
+	if ((uint64_t)pe + OPT_HEADER + 2 > firstRead || get32(img->headers + pe) != PE_SIGNATURE)
+		return notPE(img, "no PE header");
+	opt = pe + OPT_HEADER;
+	optSize = get16(img->headers + pe + COFF_OPT_HEADER_SIZE);
+	img->numSections = get16(img->headers + pe + COFF_NUM_SECTIONS);
+	magic = get16(img->headers + opt);
+	if (magic == OPT_MAGIC_PE32)
+		numDirs = OPT_NUM_DIRS_PE32;
+	else if (magic == OPT_MAGIC_PE32_PLUS)
+		numDirs = OPT_NUM_DIRS_PE32_PLUS;
+	else
+		return notPE(img, "unknown optional header magic");
+	// SizeOfHeaders, CheckSum and NumberOfRvaAndSizes come before the data directories
+	if ((uint64_t)opt + numDirs + 4 > firstRead)
+		return notPE(img, "the optional header is past the end of the file");
+	if (optSize < numDirs + 4 || img->numSections > PE_MAX_SECTIONS)
+		return notPE(img, "bad COFF header");
+	img->headersSize = get32(img->headers + opt + OPT_SIZE_OF_HEADERS);
+	sectionTable = opt + optSize;
+	if (img->headersSize > img->fileSize || sectionTable + (uint64_t)img->numSections * SECTION_HEADER_SIZE > img->headersSize)
+		return notPE(img, "the headers do not fit in the file");
+	if (img->headersSize > firstRead) {
+		headers = realloc(img->headers, img->headersSize);
+		if (!headers) {
+			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+			return ALLOC_FAIL;
+		}
+		img->headers = headers;
+		rc = readAt(img, img->headers + firstRead, img->headersSize - firstRead, firstRead);
+		if (rc)
+			return rc;
+	}
+	img->checksum = opt + OPT_CHECKSUM;
+	// images without a certificate table entry are hashed in one piece after the checksum
+	dirs = opt + numDirs + 4;
+	img->certEntry = 0;
+	img->certOffset = 0;
+	img->certSize = 0;
+	if (get32(img->headers + opt + numDirs) > CERT_TABLE_DIR && dirs + (CERT_TABLE_DIR + 1) * DATA_DIR_SIZE <= sectionTable) {
+		img->certEntry = dirs + CERT_TABLE_DIR * DATA_DIR_SIZE;
+		// unlike the other directories this one holds a file offset, not an address
+		img->certOffset = get32(img->headers + img->certEntry);
+		img->certSize = get32(img->headers + img->certEntry + 4);
+		if ((uint64_t)img->certOffset + img->certSize > img->fileSize)
+			return notPE(img, "the certificate table is past the end of the file");
+	}
+	for (int i = 0; i < img->numSections; i++) {
+		img->sections[i].size = get32(img->headers + sectionTable + i * SECTION_HEADER_SIZE + SECTION_RAW_SIZE);
+		img->sections[i].offset = get32(img->headers + sectionTable + i * SECTION_HEADER_SIZE + SECTION_RAW_OFFSET);
+		if ((uint64_t)img->sections[i].offset + img->sections[i].size > img->fileSize)
+			return notPE(img, "a section is past the end of the file");
+	}
+	qsort(img->sections, img->numSections, sizeof(*img->sections), compareSections);
+
+	return SUCCESS;
+}
+
+// feeds the same data to every context
+static int updateAll(crypto_md_ctx *ctx[], int count, const unsigned char *data, size_t size)
+{
+	for (int i = 0; i < count; i++) {
+		if (crypto_md_update(ctx[i], data, size))
+			return HASH_FAIL;
+	}
+
+	return SUCCESS;
+}
+
+// streams size bytes of the file at offset through every context
+static int hashRange(struct peImage *img, crypto_md_ctx *ctx[], int count, unsigned char *chunk, uint64_t offset, uint64_t size)
+{
+	size_t n;
+	int rc;
+
+	while (size) {
+		n = size < PE_CHUNK_SIZE ? size : PE_CHUNK_SIZE;
+		rc = readAt(img, chunk, n, offset);
+		if (rc)
+			return rc;
+		rc = updateAll(ctx, count, chunk, n);
+		if (rc)
+			return rc;
+		offset += n;
+		size -= n;
+	}
+
+	return SUCCESS;
+}
+
+// the digest itself, once the headers are parsed, the order is the one of the specification
+static int hashImage(struct peImage *img, crypto_md_ctx *ctx[], int count)
+{
+	unsigned char *chunk;
+	uint64_t hashed = img->headersSize;
+	uint32_t afterChecksum = img->checksum + 4;
+	int rc;
+
+	if (img->certEntry)
+		rc = updateAll(ctx, count, img->headers, img->checksum) ||
+			updateAll(ctx, count, img->headers + afterChecksum, img->certEntry - afterChecksum) ||
+			updateAll(ctx, count, img->headers + img->certEntry + DATA_DIR_SIZE, img->headersSize - img->certEntry - DATA_DIR_SIZE);
+	else
+		rc = updateAll(ctx, count, img->headers, img->checksum) ||
+			updateAll(ctx, count, img->headers + afterChecksum, img->headersSize - afterChecksum);
+	if (rc)
+		return HASH_FAIL;
+	chunk = malloc(PE_CHUNK_SIZE);
+	if (!chunk) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	for (int i = 0; i < img->numSections && !rc; i++) {
+		rc = hashRange(img, ctx, count, chunk, img->sections[i].offset, img->sections[i].size);
+		hashed += img->sections[i].size;
+	}
+	// data after the last section (ex: debug info) is hashed, the certificate table that ends the file is not
+	if (!rc && img->fileSize > hashed + img->certSize)
+		rc = hashRange(img, ctx, count, chunk, hashed, img->fileSize - hashed - img->certSize);
+	free(chunk);
+
+	return rc;
+}
+
+/**
+ *opens a PE/COFF image and checks its headers, the image is then hashed with peDigests
+ *@param img, receives the image, to be closed with peClose
+ *@param file, path to the image, it has to be a regular file
+ *@return SUCCESS, INVALID_FILE if file is not a PE/COFF image, or error number
+ */
+int peOpen(struct peImage **img, const char *file)
+{
+	struct stat st;
+	int rc;
+
+	*img = calloc(1, sizeof(**img));
+	if (!*img) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	(*img)->file = file;
+	(*img)->fd = open(file, O_RDONLY);
+	if ((*img)->fd < 0 || fstat((*img)->fd, &st)) {
+		prlog(PR_ERR, "ERROR: Could not open %s: %s\n", file, strerror(errno));
+		rc = INVALID_FILE;
+		goto out;
+	}
+	(*img)->fileSize = st.st_size;
+	rc = parseHeaders(*img);
+out:
+	if (rc) {
+		peClose(*img);
+		*img = NULL;
+	}
+
+	return rc;
+}
+
+void peClose(struct peImage *img)
+{
+	if (!img)
+		return;
+	if (img->fd >= 0)
+		close(img->fd);
+	free(img->headers);
+	free(img->certTable);
+	free(img);
+}
+
+/**
+ *computes the Authenticode digests of an image with several hash functions in one pass over the file
+ *@param img, from peOpen
+ *@param algs, hash functions, Authenticode uses SHA256, SHA384 or SHA512
+ *@param count, number of algs, at most PE_MAX_DIGESTS
+ *@param hashes, hashes[i] receives algs[i]->size bytes
+ *@return SUCCESS or error number
+ */
+int peDigests(struct peImage *img, const struct hash_funct *algs[], int count, unsigned char *hashes[])
+{
+	crypto_md_ctx *ctx[PE_MAX_DIGESTS] = { NULL };
+	uint64_t start = timingStart();
+	int rc = SUCCESS;
+
+	if (count > PE_MAX_DIGESTS)
+		count = PE_MAX_DIGESTS;
+	for (int i = 0; i < count && !rc; i++) {
+		if (crypto_md_ctx_init(&ctx[i], algs[i]->crypto_md_funct))
+			rc = HASH_FAIL;
+	}
+	if (!rc)
+		rc = hashImage(img, ctx, count);
+	for (int i = 0; i < count && !rc; i++) {
+		if (crypto_md_finish(ctx[i], hashes[i]))
+			rc = HASH_FAIL;
+	}
+	if (rc)
+		prlog(PR_ERR, "ERROR: Failed to compute the Authenticode digest of %s\n", img->file);
+	else
+		prlog(PR_INFO, "Computed %d Authenticode digests of %s, %d sections\n", count, img->file, img->numSections);
+	for (int i = 0; i < count; i++)
+		crypto_md_free(ctx[i]);
+	timingStop(TIMING_HASH, start);
+
+	return rc;
+}
+
+/**
+ *finds the PKCS7 signatures in the certificate table of an image, other kinds of certificates are skipped
+ *@param img, from peOpen, the table is kept with it until peClose
+ *@param pkcs7, receives a pointer to the DER of each signature
+ *@param sizes, receives the size of each signature
+ *@param max, number of items in pkcs7 and sizes, further signatures are ignored
+ *@return number of signatures, 0 if the image is not signed, or INVALID_FILE if the table is malformed
+ */
+int peSignatures(struct peImage *img, const unsigned char *pkcs7[], size_t sizes[], int max)
+{
+	uint32_t offset = 0, length;
+	int count = 0, rc;
+
+	if (!img->certSize)
+		return 0;
+	if (!img->certTable) {
+		img->certTable = malloc(img->certSize);
+		if (!img->certTable) {
+			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+			return ALLOC_FAIL;
+		}
+		rc = readAt(img, img->certTable, img->certSize, img->certOffset);
+		if (rc) {
+			free(img->certTable);
+			img->certTable = NULL;
+			return rc;
+		}
+	}
+	while (img->certSize - offset >= WIN_CERT_HEADER_SIZE && count < max) {
+		length = get32(img->certTable + offset);
+		if (length < WIN_CERT_HEADER_SIZE || length > img->certSize - offset)
+			return notPE(img, "bad certificate table entry");
+		if (get16(img->certTable + offset + 4) == WIN_CERT_REVISION_2_0 &&
+		    get16(img->certTable + offset + 6) == WIN_CERT_TYPE_PKCS_SIGNED_DATA) {
+			pkcs7[count] = img->certTable + offset + WIN_CERT_HEADER_SIZE;
+			sizes[count] = length - WIN_CERT_HEADER_SIZE;
+			count++;
+		}
+		offset += (length + 7) & ~7U;
+		if (offset > img->certSize)
+			break;
+	}
+	prlog(PR_INFO, "Found %d signatures in %s\n", count, img->file);
+
+	return count;
+}
+
+/**
+ *computes the Authenticode digest of a PE/COFF image
+ *@param file, path to the image, it has to be a regular file
+ *@param alg, hash function, Authenticode uses SHA256, SHA384 or SHA512
+ *@param hash, receives alg->size bytes
+ *@return SUCCESS, INVALID_FILE if file is not a PE/COFF image, or error number
+ */
+int authenticodeHash(const char *file, const struct hash_funct *alg, unsigned char *hash)
+{
+	struct peImage *img;
+	int rc;
+
+	rc = peOpen(&img, file);
+	if (rc)
+		return rc;
+	rc = peDigests(img, &alg, 1, &hash);
+	peClose(img);
+
+	return rc;
+}
+#endif
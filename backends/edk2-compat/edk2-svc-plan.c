@@ -0,0 +1,427 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "external/skiboot/include/opal-api.h"
+#include "external/skiboot/include/secvar.h"
+#include "output.h"
+#include "backends/edk2-compat/include/edk2-svc.h"// include last, pragma pack(1) issue
+#include "external/skiboot/include/edk2-compat-process.h" // for struct secvar_ctx, also packs
+
+/*
+ *the updates of one variable must be applied oldest first, so every variable is a chain sorted by timestamp.
+ *who may sign the next update of a chain only depends on how far the PK and KEK chains are applied,
+ *so the planner walks the states (pk, kek, db, dbx) = number of applied updates of each chain,
+ *every state is visited at most once and no update is processed more than once per PK/KEK state
+ */
+enum planChain { PLAN_PK = 0, PLAN_KEK, PLAN_DB, PLAN_DBX, PLAN_CHAINS };
+static const char *chainNames[PLAN_CHAINS] = { "PK", "KEK", "db", "dbx" };
+
+struct planUpdate {
+	const char *file;
+	struct secvar *var;
+	void *auth_buffer;
+	struct efi_time timestamp;
+	// new content of the variable once the update is applied
+	const char *esl;
+	int eslSize, eslCount;
+	// OPAL error if the update is malformed and can never be applied
+	int rc;
+	// 1 if the timestamp is newer than the one of the update before it in the chain, or the current TS
+	int inOrder;
+	size_t index;
+};
+
+struct plan {
+	struct secvar_ctx *ctx;
+	struct planUpdate *updates;
+	size_t count;
+	struct planUpdate **chains[PLAN_CHAINS];
+	size_t lengths[PLAN_CHAINS];
+	struct secvar *currentPK, *currentKEK;
+	// memo of signature checks, -1 unknown, 0 invalid, 1 valid. PK and KEK by pk state, db and dbx by (pk, kek) state
+	signed char *pkSigned, *kekSigned, *dbSigned, *dbxSigned;
+	// one per state, step taken to reach it or -1 if unreached
+	signed char *steps;
+	size_t states;
+};
+
+static int parseUpdate(struct planUpdate *u);
+static int compareTimestamps(struct secvar_ctx *ctx, const struct planUpdate *x, const struct planUpdate *y);
+static void sortChain(struct plan *p, enum planChain chain);
+static int canApply(struct plan *p, enum planChain chain, const size_t pos[PLAN_CHAINS]);
+static int isSigned(struct plan *p, struct planUpdate *u, size_t pk, size_t kek);
+static size_t stateIndex(struct plan *p, const size_t pos[PLAN_CHAINS]);
+static void stateFromIndex(struct plan *p, size_t index, size_t pos[PLAN_CHAINS]);
+static int printOrder(struct plan *p, struct list_head *update_bank, struct emitter *e);
+static void printConflicts(struct plan *p, struct emitter *e);
+
+/**
+ *finds an order in which every update can be applied on top of the current variables and reorders the update bank to it,
+ *if there is none the updates that no reachable PK/KEK can get past are reported
+ *@param ctx context that pre_process was run with
+ *@param variable_bank list of secvar's of current variables, after pre_process
+ *@param update_bank list of secvar's of update variables, in the order of updateVars
+ *@param updateVars holds content of -u argument, for the file names
+ *@param updateCount length of updateVars
+ *@param e emitter for structured output, NULL for text output
+ *@return SUCCESS, OPAL_PERMISSION if no order exists, or error
+ */
+int planUpdates(struct secvar_ctx *ctx, struct list_head *variable_bank, struct list_head *update_bank, const char *updateVars[], int updateCount, struct emitter *e)
+{
+	struct plan p = { .ctx = ctx, .updates = NULL, .count = 0 };
+	struct secvar *var, *tsvar;
+	size_t i, c, head = 0, tail = 0, *queue = NULL, pos[PLAN_CHAINS], next[PLAN_CHAINS];
+	int rc;
+
+	list_for_each(update_bank, var, link)
+		p.count++;
+	if (p.count != updateCount / 2) {
+		prlog(PR_ERR, "ERROR: Every update file must be readable to plan an order\n");
+		return INVALID_FILE;
+	}
+	tsvar = find_secvar("TS", 3, variable_bank);
+	p.currentPK = find_secvar("PK", 3, variable_bank);
+	p.currentKEK = find_secvar("KEK", 4, variable_bank);
+	if (!tsvar || !p.currentPK || !p.currentKEK)
+		return OPAL_PERMISSION;
+	p.updates = calloc(p.count, sizeof(*p.updates));
+	if (!p.updates) {
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	i = 0;
+	list_for_each(update_bank, var, link) {
+		p.updates[i].file = updateVars[2 * i + 1];
+		p.updates[i].var = var;
+		p.updates[i].index = i;
+		rc = parseUpdate(&p.updates[i]);
+		if (rc)
+			goto out;
+		i++;
+	}
+	for (c = 0; c < PLAN_CHAINS; c++) {
+		p.chains[c] = malloc(p.count * sizeof(*p.chains[c]));
+		if (!p.chains[c]) {
+			rc = ALLOC_FAIL;
+			goto out;
+		}
+		for (i = 0; i < p.count; i++) {
+			if (!strcmp(p.updates[i].var->key, chainNames[c]))
+				p.chains[c][p.lengths[c]++] = &p.updates[i];
+		}
+		sortChain(&p, c);
+		// an update whose timestamp is not newer than its predecessor's can never be applied after it
+		for (i = 0; i < p.lengths[c]; i++) {
+			char last[4 * sizeof(struct efi_time)];
+
+			memcpy(last, tsvar->data, sizeof(last));
+			if (i)
+				update_timestamp(ctx, chainNames[c], &p.chains[c][i - 1]->timestamp, last);
+			p.chains[c][i]->inOrder = check_timestamp(ctx, chainNames[c], &p.chains[c][i]->timestamp, last) == OPAL_SUCCESS;
+		}
+	}
+	// the signer tables below are smaller than the states, so only these and the queue can overflow
+	p.states = 1;
+	for (c = 0; c < PLAN_CHAINS; c++) {
+		if (__builtin_mul_overflow(p.states, p.lengths[c] + 1, &p.states) || p.states > SIZE_MAX / sizeof(*queue)) {
+			prlog(PR_ERR, "ERROR: %zu updates make too many states to plan, verify them in the given order instead\n", p.count);
+			rc = ALLOC_FAIL;
+			goto cleanup;
+		}
+	}
+	p.pkSigned = malloc(p.lengths[PLAN_PK] + 1);
+	p.kekSigned = malloc(p.lengths[PLAN_KEK] * (p.lengths[PLAN_PK] + 1) + 1);
+	p.dbSigned = malloc(p.lengths[PLAN_DB] * (p.lengths[PLAN_PK] + 1) * (p.lengths[PLAN_KEK] + 1) + 1);
+	p.dbxSigned = malloc(p.lengths[PLAN_DBX] * (p.lengths[PLAN_PK] + 1) * (p.lengths[PLAN_KEK] + 1) + 1);
+	p.steps = malloc(p.states);
+	queue = malloc(p.states * sizeof(*queue));
+	if (!p.pkSigned || !p.kekSigned || !p.dbSigned || !p.dbxSigned || !p.steps || !queue) {
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	memset(p.pkSigned, -1, p.lengths[PLAN_PK] + 1);
+	memset(p.kekSigned, -1, p.lengths[PLAN_KEK] * (p.lengths[PLAN_PK] + 1) + 1);
+	memset(p.dbSigned, -1, p.lengths[PLAN_DB] * (p.lengths[PLAN_PK] + 1) * (p.lengths[PLAN_KEK] + 1) + 1);
+	memset(p.dbxSigned, -1, p.lengths[PLAN_DBX] * (p.lengths[PLAN_PK] + 1) * (p.lengths[PLAN_KEK] + 1) + 1);
+	memset(p.steps, -1, p.states);
+
+	// breadth first from nothing applied, the last state is everything applied
+	p.steps[0] = PLAN_CHAINS;
+	queue[tail++] = 0;
+	while (head < tail && p.steps[p.states - 1] < 0) {
+		stateFromIndex(&p, queue[head++], pos);
+		for (c = 0; c < PLAN_CHAINS; c++) {
+			if (pos[c] == p.lengths[c] || !canApply(&p, c, pos))
+				continue;
+			memcpy(next, pos, sizeof(next));
+			next[c]++;
+			i = stateIndex(&p, next);
+			if (p.steps[i] >= 0)
+				continue;
+			p.steps[i] = c;
+			queue[tail++] = i;
+		}
+	}
+	if (p.steps[p.states - 1] >= 0)
+		rc = printOrder(&p, update_bank, e);
+	else {
+		printConflicts(&p, e);
+		rc = OPAL_PERMISSION;
+	}
+
+out:
+	if (rc == ALLOC_FAIL)
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+cleanup:
+	for (i = 0; p.updates && i < p.count; i++)
+		free(p.updates[i].auth_buffer);
+	for (c = 0; c < PLAN_CHAINS; c++)
+		free(p.chains[c]);
+	free(p.updates);
+	free(p.pkSigned);
+	free(p.kekSigned);
+	free(p.dbSigned);
+	free(p.dbxSigned);
+	free(p.steps);
+	free(queue);
+
+	return rc;
+}
+
+/**
+ *splits an update into its auth descriptor and new ESL, malformed updates are recorded in u->rc rather than failing
+ *@return SUCCESS or error if memory could not be allocated
+ */
+static int parseUpdate(struct planUpdate *u)
+{
+	int size;
+
+	size = get_auth_descriptor2(u->var->data, u->var->data_size, &u->auth_buffer);
+	if (size == OPAL_NO_MEM)
+		return ALLOC_FAIL;
+	if (size < 0 || u->var->data_size < size) {
+		u->rc = size < 0 ? size : OPAL_PARAMETER;
+		return SUCCESS;
+	}
+	memcpy(&u->timestamp, u->auth_buffer, sizeof(u->timestamp));
+	u->esl = u->var->data + size;
+	u->eslSize = u->var->data_size - size;
+	u->eslCount = validate_esl_list(u->var->key, u->esl, u->eslSize);
+	if (u->eslCount < 0)
+		u->rc = u->eslCount;
+
+	return SUCCESS;
+}
+
+// orders two updates of the same variable, oldest first, ties keep -u order
+static int compareTimestamps(struct secvar_ctx *ctx, const struct planUpdate *x, const struct planUpdate *y)
+{
+	char last[4 * sizeof(struct efi_time)] = { 0 };
+
+	update_timestamp(ctx, x->var->key, &x->timestamp, last);
+	if (check_timestamp(ctx, y->var->key, &y->timestamp, last) == OPAL_SUCCESS)
+		return -1;
+	update_timestamp(ctx, y->var->key, &y->timestamp, last);
+	if (check_timestamp(ctx, x->var->key, &x->timestamp, last) == OPAL_SUCCESS)
+		return 1;
+
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+// insertion sort, chains are short and the comparison needs the context
+static void sortChain(struct plan *p, enum planChain chain)
+{
+	struct planUpdate **updates = p->chains[chain], *u;
+	size_t i, j;
+
+	for (i = 1; i < p->lengths[chain]; i++) {
+		u = updates[i];
+		for (j = i; j > 0 && compareTimestamps(p->ctx, updates[j - 1], u) > 0; j--)
+			updates[j] = updates[j - 1];
+		updates[j] = u;
+	}
+}
+
+/**
+ *@param pos number of applied updates of every chain
+ *@return 1 if the next update of chain can be applied in state pos
+ */
+static int canApply(struct plan *p, enum planChain chain, const size_t pos[PLAN_CHAINS])
+{
+	struct planUpdate *u = p->chains[chain][pos[chain]];
+	size_t pk = pos[PLAN_PK], kek = pos[PLAN_KEK], nPK = p->lengths[PLAN_PK] + 1, nKEK = p->lengths[PLAN_KEK] + 1;
+	signed char *memo;
+
+	if (u->rc || !u->inOrder)
+		return 0;
+	// setup mode is decided once before processing, in it nothing is checked against the PK or KEK
+	if (p->ctx->setup_mode)
+		return 1;
+	switch (chain) {
+		case PLAN_PK:
+			// the next PK update is always checked against the PK right before it
+			memo = &p->pkSigned[pk];
+			kek = 0;
+			break;
+		case PLAN_KEK:
+			memo = &p->kekSigned[pos[PLAN_KEK] * nPK + pk];
+			// a KEK update is signed by the PK, so the KEK state does not matter
+			kek = 0;
+			break;
+		case PLAN_DB:
+			memo = &p->dbSigned[(pos[PLAN_DB] * nPK + pk) * nKEK + kek];
+			break;
+		default:
+			memo = &p->dbxSigned[(pos[PLAN_DBX] * nPK + pk) * nKEK + kek];
+			break;
+	}
+	if (*memo < 0)
+		*memo = isSigned(p, u, pk, kek);
+
+	return *memo;
+}
+
+/**
+ *checks the signature of u against the PK after pk updates of the PK chain and the KEK after kek updates of the KEK chain
+ *@return 1 if u is signed by one of its authorities
+ */
+static int isSigned(struct plan *p, struct planUpdate *u, size_t pk, size_t kek)
+{
+	struct secvar pkvar = *p->currentPK, kekvar = *p->currentKEK;
+	struct list_head bank;
+	int rc;
+
+	if (pk) {
+		pkvar.data = (char *)p->chains[PLAN_PK][pk - 1]->esl;
+		pkvar.data_size = p->chains[PLAN_PK][pk - 1]->eslSize;
+	}
+	if (kek) {
+		kekvar.data = (char *)p->chains[PLAN_KEK][kek - 1]->esl;
+		kekvar.data_size = p->chains[PLAN_KEK][kek - 1]->eslSize;
+	}
+	list_head_init(&bank);
+	list_add_tail(&bank, &pkvar.link);
+	list_add_tail(&bank, &kekvar.link);
+	rc = verify_update(p->ctx, u->var, u->auth_buffer, u->esl, u->eslSize, &u->timestamp, &bank, NULL);
+	ctx_prlog(p->ctx, PR_INFO, "%s %s with PK state %zu and KEK state %zu: %s\n", u->var->key, u->file, pk, kek, rc ? "not signed" : "signed");
+	// like process(), an update with nothing to check it against only passes if it holds no ESL
+	if (rc == OPAL_EMPTY)
+		rc = u->eslCount;
+
+	return rc == OPAL_SUCCESS;
+}
+
+static size_t stateIndex(struct plan *p, const size_t pos[PLAN_CHAINS])
+{
+	size_t index = 0;
+
+	for (int c = 0; c < PLAN_CHAINS; c++)
+		index = index * (p->lengths[c] + 1) + pos[c];
+
+	return index;
+}
+
+static void stateFromIndex(struct plan *p, size_t index, size_t pos[PLAN_CHAINS])
+{
+	for (int c = PLAN_CHAINS - 1; c >= 0; c--) {
+		pos[c] = index % (p->lengths[c] + 1);
+		index /= p->lengths[c] + 1;
+	}
+}
+
+/**
+ *walks back from the final state, prints the order and moves the secvar's of update_bank into it
+ *@return SUCCESS or ALLOC_FAIL, update_bank is then left as it was
+ */
+static int printOrder(struct plan *p, struct list_head *update_bank, struct emitter *e)
+{
+	struct planUpdate **order;
+	size_t i, pos[PLAN_CHAINS], state = p->states - 1, n = p->count;
+	int c;
+
+	order = malloc(p->count * sizeof(*order));
+	if (!order)
+		return ALLOC_FAIL;
+	while (state) {
+		stateFromIndex(p, state, pos);
+		c = p->steps[state];
+		order[--n] = p->chains[c][pos[c] - 1];
+		pos[c]--;
+		state = stateIndex(p, pos);
+	}
+	for (i = 0; i < p->count; i++) {
+		list_del(&order[i]->var->link);
+		list_add_tail(update_bank, &order[i]->var->link);
+	}
+	if (e) {
+		emitArrayStart(e, "plan");
+		for (i = 0; i < p->count; i++) {
+			emitMapStart(e, NULL);
+			emitString(e, "name", order[i]->var->key);
+			emitString(e, "file", order[i]->file);
+			emitMapEnd(e);
+		}
+		emitArrayEnd(e);
+	}
+	else {
+		printf("PLAN: -u");
+		for (i = 0; i < p->count; i++)
+			printf(" %s %s", order[i]->var->key, order[i]->file);
+		printf("\n");
+	}
+	free(order);
+
+	return SUCCESS;
+}
+
+/**
+ *prints, for every chain that could not be finished, the first update that no reachable state could apply and why,
+ *fixing or removing these updates is needed before any order can exist
+ */
+static void printConflicts(struct plan *p, struct emitter *e)
+{
+	size_t i, c, reached[PLAN_CHAINS] = { 0 }, pos[PLAN_CHAINS];
+	struct planUpdate *u;
+	char reason[256];
+
+	for (i = 0; i < p->states; i++) {
+		if (p->steps[i] < 0)
+			continue;
+		stateFromIndex(p, i, pos);
+		for (c = 0; c < PLAN_CHAINS; c++) {
+			if (pos[c] > reached[c])
+				reached[c] = pos[c];
+		}
+	}
+	if (e)
+		emitArrayStart(e, "conflicts");
+	else
+		printf("PLAN: no valid order, conflicting updates:\n");
+	for (c = 0; c < PLAN_CHAINS; c++) {
+		if (reached[c] == p->lengths[c])
+			continue;
+		u = p->chains[c][reached[c]];
+		if (u->rc)
+			snprintf(reason, sizeof(reason), "malformed update, OPAL ERR = %d", u->rc);
+		else if (!u->inOrder && reached[c])
+			snprintf(reason, sizeof(reason), "timestamp is not newer than the one of %s", p->chains[c][reached[c] - 1]->file);
+		else if (!u->inOrder)
+			snprintf(reason, sizeof(reason), "timestamp is not newer than the current TS");
+		else
+			snprintf(reason, sizeof(reason), "not signed by any reachable %s", c == PLAN_PK || c == PLAN_KEK ? "PK" : "PK or KEK");
+		if (e) {
+			emitMapStart(e, NULL);
+			emitString(e, "name", u->var->key);
+			emitString(e, "file", u->file);
+			emitString(e, "reason", reason);
+			emitMapEnd(e);
+		}
+		else
+			printf("\t%s %s: %s\n", u->var->key, u->file, reason);
+	}
+	if (e)
+		emitArrayEnd(e);
+}
@@ -10,20 +10,57 @@
 #include <stdlib.h>
 #include <argp.h>
 #include "crypto/crypto.h"
+#include "output.h"
+#include "timing.h"
+#include "memstats.h"
+#include "threadpool.h"
 #include "external/skiboot/include/secvar.h" // for secvar struct
 #include "backends/edk2-compat/include/edk2-svc.h"// include last, pragma pack(1) issue
 
-static int readFiles(const char* var, const char* file, int hrFlag, const  char* path);
+static int readFiles(const char* var, const char* file, int hrFlag, int summary, const  char* path, struct emitter *e);
+static int captureSnapshot(const char *var, const char *path, const char *snapshotOut);
 static int printReadable(const char *c , size_t size, const char * key);
-static int readFileFromSecVar(const char * path, const char *variable, int hrFlag);
-static int readFileFromPath(const char *path, int hrFlag);
+static int printESLChain(const char *c, size_t size, const char *key);
+static int readFileFromSecVar(struct secvar *var, const char *variable, int hrFlag, struct emitter *e);
+static int readFileFromPath(const char *path, int hrFlag, struct emitter *e);
 static int getSizeFromSizeFile(size_t *returnSize, const char* path);
+static int parseSize(size_t *returnSize, const char *c, ssize_t len);
+static int loadVar(void *ctx, size_t index);
+static int loadVarAt(int dirFd, const char *name, struct secvar **var);
 static int readTS(const char *data, size_t size);
+static int emitVariable(struct emitter *e, const char *name, const char *data, size_t size, int hrFlag);
+static int summarizeVariable(struct emitter *e, const char *name, const char *data, size_t size, const struct efi_time *ts);
+static void formatTimestamp(char *str, size_t size, const struct efi_time *t);
+static int printDigests(const char *var, const char *file, const char *path, struct emitter *e);
 
 
+// these are only used here and hold pointers, so they get their natural layout back from the pack(1) of edk2.h
+#pragma pack(push)
+#pragma pack()
+// entries of one variable counted by signature type, see summarizeVariable,
+// one slot per name getSigType can return: the hash functions, X509, RSA2048, PKCS7 and UNKNOWN
+#define SUMMARY_MAX_TYPES (ARRAY_SIZE(hash_functions) + 4)
+struct varSummary {
+	int eslCount, entryCount, typeCount;
+	struct {
+		const char *type;
+		int count;
+	} types[SUMMARY_MAX_TYPES];
+};
+
+// state shared by the jobs of loadSecVars, one slot per variable
+struct varLoad {
+	int dirFd;
+	const char *names[ARRAY_SIZE(variables)];
+	struct secvar *vars[ARRAY_SIZE(variables)];
+};
+#pragma pack(pop)
+_Static_assert(__alignof__(struct varLoad) == __alignof__(void *), "struct varLoad must not be packed");
+
 struct Arguments {
-	int helpFlag, printRaw;
-	const char *pathToSecVars, *varName, *inFile;
+	int helpFlag, printRaw, summary, digest;
+	const char *pathToSecVars, *varName, *inFile, *snapshotOut;
+	enum outputFormat outForm;
 }; 
 static int parse_opt(int key, char *arg, struct argp_state *state);
 
@@ -37,9 +74,10 @@ static int parse_opt(int key, char *arg, struct argp_state *state);
 int performReadCommand(int argc, char* argv[]) 
 {
 	int rc;
+	struct emitter emitter;
 	struct Arguments args = {	
-		.helpFlag = 0, .printRaw = 0, 
-		.pathToSecVars = NULL, .inFile = NULL, .varName = NULL
+		.helpFlag = 0, .printRaw = 0, .summary = 0, .digest = 0,
+		.pathToSecVars = NULL, .inFile = NULL, .varName = NULL, .snapshotOut = NULL, .outForm = OUTPUT_TEXT
 	};
 	// combine command and subcommand for usage/help messages
     argv[0] = "secvarctl read";
@@ -48,8 +86,17 @@ int performReadCommand(int argc, char* argv[])
 	{
 		{"raw", 'r', 0, 0, "prints raw data, default is human readable information"},
 		{"verbose", 'v', 0, 0, "print more verbose process information"},
-		{"file", 'f', "FILE", 0, "navigates to ESL file from working directiory"},
-		{"path", 'p', "PATH" ,0, "looks for key directories {'PK','KEK','db','dbx', 'TS'} in PATH, default is " SECVARPATH},
+		{"file", 'f', "FILE", 0, "navigates to ESL file from working directiory, use '-' to read from stdin"},
+		{"path", 'p', "PATH" ,0, "looks for key directories {'PK','KEK','db','dbx', 'TS'} in PATH, default is " SECVARPATH
+								". PATH may also be a packed snapshot file made with --snapshot-out"},
+		{"snapshot-out", ARGP_OPT_SNAPSHOT_KEY, "FILE", 0, "capture the variables into the packed snapshot FILE instead of printing them,"
+										" use '-' to write to stdout"},
+		{"output", ARGP_OPT_OUTPUT_KEY, "FORMAT", 0, "output format, one of {'text', 'json', 'cbor'}, default is text."
+										" json and cbor carry every variable, ESL, entry, certificate and timestamp and are written to stdout"},
+		{"summary", ARGP_OPT_SUMMARY_KEY, 0, 0, "only print the size, timestamp, number of ESL's and number of entries of each"
+										" signature type of every variable. Only the ESL headers are looked at, no certificate is parsed"},
+		{"digest", ARGP_OPT_DIGEST_KEY, 0, 0, "print a SHA256 root over the variables, the digest of every variable and of every ESL."
+										" With --output the Merkle trees down to every entry are included, to find what differs between two hosts"},
         {"help", '?', 0, 0, "Give this help list", 1},
 		{"usage", ARGP_OPT_USAGE_KEY, 0, 0, "Give a short usage message", -1 },
 		{0}
@@ -62,13 +109,44 @@ int performReadCommand(int argc, char* argv[])
 		" given, then the information for the keys in the default path will be printed."
 		" If the user would like to print the information for another ESL file,"
 		" then the '-f' command would be appropriate."
-		"\vvalues for [VARIABLES] = {'PK','KEK','db','dbx', 'TS'} type one of the following to get info on that key, default is all. NOTE does not work when -f option is present"
+		"\vvalues for [VARIABLES] = {'PK','KEK','db','dbx', 'TS'} type one of the following to get info on that key, default is all. NOTE does not work when -f option is present, except with --digest where it names the variable the file holds"
 	};
 	rc = argp_parse( &argp, argc, argv, ARGP_NO_EXIT | ARGP_IN_ORDER | ARGP_NO_HELP, 0, &args);
 	if (rc || args.helpFlag)
 		goto out;
 
-	rc = readFiles(args.varName, args.inFile, !args.printRaw, args.pathToSecVars);
+	if (args.snapshotOut) {
+		rc = captureSnapshot(args.varName, args.pathToSecVars, args.snapshotOut);
+		goto out;
+	}
+	if (args.outForm == OUTPUT_TEXT && args.digest) {
+		rc = printDigests(args.varName, args.inFile, args.pathToSecVars, NULL);
+		goto out;
+	}
+	if (args.outForm == OUTPUT_TEXT) {
+		rc = readFiles(args.varName, args.inFile, !args.printRaw, args.summary, args.pathToSecVars, NULL);
+		goto out;
+	}
+	// structured data owns stdout, everything else goes to stderr
+	rc = reserveStdoutForData();
+	if (rc)
+		goto out;
+	emitterInit(&emitter, args.outForm);
+	emitMapStart(&emitter, NULL);
+	if (args.digest)
+		rc = printDigests(args.varName, args.inFile, args.pathToSecVars, &emitter);
+	else {
+		emitArrayStart(&emitter, "variables");
+		rc = readFiles(args.varName, args.inFile, !args.printRaw, args.summary, args.pathToSecVars, &emitter);
+		emitArrayEnd(&emitter);
+	}
+	emitBool(&emitter, "success", rc == SUCCESS);
+	emitMapEnd(&emitter);
+	if (emitterFlush(&emitter, STDIO_FILE)) {
+		prlog(PR_ERR, "ERROR: Failed to write structured output\n");
+		rc = FILE_WRITE_FAIL;
+	}
+	emitterFree(&emitter);
 
 out:
 	return rc;	
@@ -106,12 +184,43 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 		case 'v':
 			verbose = PR_DEBUG;
 			break;
+		case ARGP_OPT_OUTPUT_KEY:
+			rc = parseOutputFormat(arg, &args->outForm);
+			break;
+		case ARGP_OPT_SNAPSHOT_KEY:
+			args->snapshotOut = arg;
+			break;
+		case ARGP_OPT_SUMMARY_KEY:
+			args->summary = 1;
+			break;
+		case ARGP_OPT_DIGEST_KEY:
+			args->digest = 1;
+			break;
 		case ARGP_KEY_ARG:
 			args->varName = arg;
 			rc = isVariable(args->varName);
 			if (rc) 
 				prlog(PR_ERR, "ERROR: Invalid variable name %s\n", args->varName);
 			break;
+		case ARGP_KEY_SUCCESS:
+			if (args->snapshotOut && (args->inFile || args->printRaw || args->outForm != OUTPUT_TEXT)) {
+				prlog(PR_ERR, "ERROR: --snapshot-out cannot be used with -f, -r or --output\n");
+				rc = ARG_PARSE_FAIL;
+			}
+			else if ((args->summary || args->digest) && (args->snapshotOut || args->printRaw)) {
+				prlog(PR_ERR, "ERROR: --summary and --digest cannot be used with -r or --snapshot-out\n");
+				rc = ARG_PARSE_FAIL;
+			}
+			else if (args->summary && args->digest) {
+				prlog(PR_ERR, "ERROR: --summary cannot be used with --digest\n");
+				rc = ARG_PARSE_FAIL;
+			}
+			// the name is part of the digest, so the file must say which variable it would be
+			else if (args->digest && args->inFile && !args->varName) {
+				prlog(PR_ERR, "ERROR: --digest with -f needs the name of the variable the file holds, ex: db\n");
+				rc = ARG_PARSE_FAIL;
+			}
+			break;
 	}
 
 	if (rc) 
@@ -126,13 +235,17 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
  *@param var  string to variable wanted if <variable> option is given, NULL if not
  *@param file string to filename with path if -f option, NULL if not
  *@param hrFLag 1 if -hr for human readable output, 0 for raw data
+ *@param summary 1 to only print what summarizeVariable finds, hrFlag is then ignored
  *@param path string to path where {PK,KEK,db,dbx,TS} subdirectories are, default SECVARPATH if none given
+ *@param e emitter for structured output, NULL for text output
  *@return succcess if at least one file was successfully read
  */
-static int readFiles(const char* var, const char* file, int hrFlag, const char *path) 
+static int readFiles(const char* var, const char* file, int hrFlag, int summary, const char *path, struct emitter *e) 
 {  
 	// program is successful if at least one var was able to be read
 	int rc, successCount = 0;
+	struct list_head bank;
+	struct secvar *secVar, *ts;
 
 	if (file) prlog(PR_NOTICE, "Looking in file %s for ESL's\n", file); 
 	else prlog(PR_NOTICE, "Looking in %s for %s variable with %s format\n", path ? path : SECVARPATH, var ? var : "ALL", hrFlag ? "ASCII" : "raw_data");
@@ -143,18 +256,46 @@ static int readFiles(const char* var, const char* file, int hrFlag, const char *
 	}
 
 	if (!file) {
-		for (int i = 0; i < ARRAY_SIZE(variables); i++) {
+		// one load for all variables so that a snapshot is only mapped once
+		list_head_init(&bank);
+		rc = loadSecVars(&bank, path, var);
+		// the timestamps of a summary come from TS
+		if (!rc && summary && var && strcmp(var, "TS"))
+			rc = loadSecVars(&bank, path, "TS");
+		ts = find_secvar("TS", strlen("TS") + 1, &bank);
+		if (ts && ts->data_size != sizeof(struct efi_time) * (ARRAY_SIZE(variables) - 1))
+			ts = NULL;
+		for (int i = 0; i < ARRAY_SIZE(variables) && !rc; i++) {
 			// if var is defined and it is not the current one then skip
 			if (var && strcmp(var, variables[i]) != 0) {	
 				continue;
 			}
-			printf("READING %s :\n", variables[i]);
-			rc = readFileFromSecVar(path, variables[i], hrFlag);
-			if (rc == SUCCESS) successCount++;
+			secVar = find_secvar(variables[i], strlen(variables[i]) + 1, &bank);
+			if (summary) {
+				if (summarizeVariable(e, variables[i], secVar ? secVar->data : NULL, secVar ? secVar->data_size : 0,
+						      ts && strcmp(variables[i], "TS") ? (struct efi_time *)ts->data + i : NULL) == SUCCESS)
+					successCount++;
+				continue;
+			}
+			if (!e)
+				printf("READING %s :\n", variables[i]);
+			if (readFileFromSecVar(secVar, variables[i], hrFlag, e) == SUCCESS)
+				successCount++;
 		}
+		clear_bank_list(&bank);
+	}
+	else if (summary) {
+		char *c;
+		size_t size = 0;
+
+		c = getDataFromFile(file, &size);
+		rc = summarizeVariable(e, file, c, size, NULL);
+		if (rc == SUCCESS) successCount++;
+		if (c)
+			free(c);
 	}
 	else {
-		rc = readFileFromPath(file, hrFlag);
+		rc = readFileFromPath(file, hrFlag, e);
 		if (rc == SUCCESS) successCount++;
 	} 
 	// if no good files read then count it as a failure
@@ -167,34 +308,26 @@ static int readFiles(const char* var, const char* file, int hrFlag, const char *
 }
 
 /**
- *Does the appropriate read command depending on hrFlag on the file <path>/<var>/data
- *@param path , the path to the file with ending '/'
+ *Does the appropriate read command depending on hrFlag on a variable loaded with loadSecVars
+ *@param var , the loaded variable, NULL if it could not be read
  *@param variable , variable name one of {db,dbx,KEK,PK,TS}
  *@param hrFlag, 1 for human readable 0 for raw data
+ *@param e, emitter for structured output, NULL for text output
  *@return SUCCESS or error number
  */
-static int readFileFromSecVar(const char *path, const char *variable, int hrFlag)
+static int readFileFromSecVar(struct secvar *var, const char *variable, int hrFlag, struct emitter *e)
 {
-	int extra = 10, rc;
-	struct secvar *var = NULL;
-	char *fullPath = NULL;
+	int rc = var ? SUCCESS : INVALID_FILE;
 
-	fullPath = malloc(strlen(path) + strlen(variable) + extra);
-	if (!fullPath) { 
-		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
-		return ALLOC_FAIL;
+	if (e) {
+		if (rc)
+			emitVariable(e, variable, NULL, 0, hrFlag);
+		else
+			rc = emitVariable(e, var->key, var->data, var->data_size, hrFlag);
+		return rc;
 	}
-
-	strcpy(fullPath, path);
-	strcat(fullPath, variable);
-	strcat(fullPath, "/data");
-
-	rc = getSecVar(&var, variable, fullPath);
-	
-	free(fullPath);
-
 	if (rc) {
-		goto out;
+		return rc;
 	}
 	if (hrFlag) {
 		if (var->data_size == 0) {
@@ -213,10 +346,7 @@ static int readFileFromSecVar(const char *path, const char *variable, int hrFlag
 		printRaw(var->data, var->data_size);
 		rc = SUCCESS;
 	}
-	
-out:
-	dealloc_secvar(var);
-	
+
 	return rc;
 }
 
@@ -224,18 +354,23 @@ out:
  *Does the appropriate read command depending on hrFlag on the file 
  *@param file , the path to the file 
  *@param hrFlag, 1 for human readable 0 for raw data
+ *@param e, emitter for structured output, NULL for text output
  *@return SUCCESS or error number
  */
-static int readFileFromPath(const char *file, int hrFlag)
+static int readFileFromPath(const char *file, int hrFlag, struct emitter *e)
 {
 	int rc;
 	size_t size = 0;
 	char *c = NULL;
 	c = getDataFromFile(file, &size);
 	if (!c) {
+		if (e)
+			emitVariable(e, file, NULL, 0, hrFlag);
 		return INVALID_FILE;
 	}
-	if (hrFlag) {
+	if (e)
+		rc = emitVariable(e, file, c, size, hrFlag);
+	else if (hrFlag) {
 		rc = printReadable(c, size, NULL);
 		if(rc)
 			prlog(PR_WARNING,"ERROR: Could not parse file\n");
@@ -258,7 +393,7 @@ static int readFileFromPath(const char *file, int hrFlag)
  *@param fullPath, file and path <path>/<varname>/data
  *NOTE: THIS IS ALLOCATING DATA AND var STILL NEEDS TO BE DEALLOCATED
  */
-int getSecVar(struct secvar **var, const char* name, const char *fullPath){
+static int readSecVar(struct secvar **var, const char* name, const char *fullPath){
 	int rc, fptr;
 	size_t size;
 	ssize_t read_size;
@@ -308,7 +443,7 @@ int getSecVar(struct secvar **var, const char* name, const char *fullPath){
 		return INVALID_FILE;
 	}
 	prlog(PR_NOTICE,"---opening %s is success: reading %zd bytes---- \n", fullPath, size);
-	c = malloc(size);
+	c = memMalloc(MEM_FILE_IO, size);
 	if (!c) {
 		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
 		return ALLOC_FAIL;	
@@ -338,6 +473,180 @@ int getSecVar(struct secvar **var, const char* name, const char *fullPath){
 	return SUCCESS;
 }
 
+// reading a variable (its size and data file) counts as file io for --timings
+int getSecVar(struct secvar **var, const char* name, const char *fullPath)
+{
+	uint64_t start = timingStart();
+	int rc = readSecVar(var, name, fullPath);
+
+	timingStop(TIMING_FILE_IO, start);
+
+	return rc;
+}
+
+/**
+ *loads the current variables into bank, variables that do not exist are left out
+ *the directory is opened once and every variable is read relative to it, on their own thread since
+ *reads of the real secvar directory go to firmware and block
+ *@param bank , list to add the secvar's to
+ *@param path , directory with {PK,KEK,db,dbx,TS} subdirectories (with ending '/') or a packed snapshot file
+ *@param name , only load this variable, NULL for all of them
+ *@return SUCCESS or error number, a missing variable is not an error but a malformed snapshot is
+ */
+int loadSecVars(struct list_head *bank, const char *path, const char *name)
+{
+	struct varLoad load = { .dirFd = -1 };
+	struct threadpool *pool = NULL;
+	size_t count = 0;
+	int rc = SUCCESS;
+
+	if (isSnapshot(path))
+		return readSnapshot(bank, path, name);
+	load.dirFd = open(path, O_RDONLY | O_DIRECTORY);
+	if (load.dirFd < 0) {
+		prlog(PR_NOTICE, "Could not open %s: %s, no variables loaded\n", path, strerror(errno));
+		return SUCCESS;
+	}
+	for (int i = 0; i < ARRAY_SIZE(variables); i++) {
+		if (!name || !strcmp(name, variables[i]))
+			load.names[count++] = variables[i];
+	}
+	// callers that are already spread over a pool (ex: verify --fleet) load inline
+	if (count > 1 && !threadpoolInJob())
+		pool = threadpoolCreate(count);
+	if (pool) {
+		rc = threadpoolRun(pool, loadVar, &load, count);
+		threadpoolDestroy(pool);
+	}
+	else {
+		for (size_t i = 0; i < count && !rc; i++)
+			rc = loadVar(&load, i);
+	}
+	close(load.dirFd);
+	// keep variable order no matter which read finished first
+	for (size_t i = 0; i < count; i++) {
+		if (load.vars[i] && !rc)
+			list_add_tail(bank, &load.vars[i]->link);
+		else if (load.vars[i])
+			dealloc_secvar(load.vars[i]);
+	}
+
+	return rc;
+}
+
+// threadpool job of loadSecVars, a variable that can not be read is left NULL
+static int loadVar(void *ctx, size_t index)
+{
+	struct varLoad *load = ctx;
+	uint64_t start = timingStart();
+	int rc = loadVarAt(load->dirFd, load->names[index], &load->vars[index]);
+
+	timingStop(TIMING_FILE_IO, start);
+
+	return rc == ALLOC_FAIL ? rc : SUCCESS;
+}
+
+/**
+ *reads <dirFd>/<name>/size and <name>/data with one open of each and no separate existence check
+ *@param dirFd , open directory holding the variable subdirectories
+ *@param name , variable name
+ *@param var , returned secvar, untouched if the variable does not exist or can not be read
+ *@return SUCCESS or error number
+ */
+static int loadVarAt(int dirFd, const char *name, struct secvar **var)
+{
+	char sizePath[16], dataPath[16], digits[9];
+	ssize_t len;
+	size_t size, done = 0;
+	struct stat fileInfo;
+	char *c = NULL;
+	int fd, sizeFd, rc = INVALID_FILE;
+
+	snprintf(sizePath, sizeof(sizePath), "%s/size", name);
+	snprintf(dataPath, sizeof(dataPath), "%s/data", name);
+	// a variable without a data file does not exist, same as the isFile check of getSecVar
+	fd = openat(dirFd, dataPath, O_RDONLY);
+	if (fd < 0)
+		return INVALID_FILE;
+	sizeFd = openat(dirFd, sizePath, O_RDONLY);
+	if (sizeFd < 0) {
+		prlog(PR_WARNING, "ERROR: Could not get size of variable, TIP: does %s/size exist?\n", name);
+		goto out;
+	}
+	len = pread(sizeFd, digits, sizeof(digits) - 1, 0);
+	close(sizeFd);
+	if (len <= 0 || parseSize(&size, digits, len)) {
+		prlog(PR_WARNING, "ERROR: Could not get size of variable %s\n", name);
+		goto out;
+	}
+	if (size == 0)
+		prlog(PR_WARNING, "Secure Variable has size of zero, (specified by size file)\n");
+	if (fstat(fd, &fileInfo) < 0)
+		goto out;
+	// if file size is less than expeced size, error
+	if (fileInfo.st_size < size) {
+		prlog(PR_ERR, "ERROR: expected size (%zd) is less than actual size (%ld)\n", size, fileInfo.st_size);
+		goto out;
+	}
+	prlog(PR_NOTICE,"---opening %s is success: reading %zd bytes---- \n", dataPath, size);
+	c = memMalloc(MEM_FILE_IO, size ? size : 1);
+	if (!c) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	while (done < size) {
+		len = pread(fd, c + done, size - done, done);
+		if (len <= 0) {
+			prlog(PR_ERR, "ERROR: did not read all data of %s\n", dataPath);
+			goto out;
+		}
+		done += len;
+	}
+	*var = new_secvar(name, strlen(name) + 1, c, size, 0);
+	if (!*var) {
+		prlog(PR_ERR, "ERROR: Could not convert data to secvar\n");
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	rc = SUCCESS;
+
+out:
+	free(c);
+	close(fd);
+
+	return rc;
+}
+
+/**
+ *writes the current variables into a packed snapshot
+ *@param var , only capture this variable, NULL for all of them
+ *@param path , where the current variables are, default SECVARPATH if NULL
+ *@param snapshotOut , snapshot file to create or '-' for stdout
+ *@return SUCCESS or error number, capturing no variables at all is an error
+ */
+static int captureSnapshot(const char *var, const char *path, const char *snapshotOut)
+{
+	int rc;
+	struct list_head bank;
+
+	if (!path)
+		path = SECVARPATH;
+	list_head_init(&bank);
+	rc = loadSecVars(&bank, path, var);
+	if (!rc && list_empty(&bank)) {
+		prlog(PR_ERR, "ERROR: No variables found in %s\n", path);
+		rc = INVALID_FILE;
+	}
+	if (!rc)
+		rc = writeSnapshot(snapshotOut, &bank);
+	if (!rc)
+		prlog(PR_NOTICE, "Captured variables from %s into %s\n", path, snapshotOut);
+	clear_bank_list(&bank);
+
+	return rc;
+}
+
 /*
  *prints human readable data in of ESL buffer
  *@param c , buffer containing ESL data
@@ -346,6 +655,16 @@ int getSecVar(struct secvar **var, const char* name, const char *fullPath){
  *@return SUCCESS or error number if failure
  */
 static int printReadable(const char *c, size_t size, const char *key) 
+{
+	enum memTag tag = memTagEnter(MEM_ESL);
+	int rc = printESLChain(c, size, key);
+
+	memTagExit(tag);
+
+	return rc;
+}
+
+static int printESLChain(const char *c, size_t size, const char *key) 
 {
 	ssize_t eslvarsize = size, cert_size;
 	size_t  eslsize = 0;
@@ -473,6 +792,419 @@ static int readTS(const char *data, size_t size)
 	return SUCCESS;
 }
 
+/**
+ *emits the certificate info of one x509 ESL entry
+ *@param e, emitter for structured output
+ *@param cert, DER certificate data
+ *@param certSize, length of cert
+ *@return SUCCESS or error number if the certificate could not be parsed
+ */
+static int emitCert(struct emitter *e, const unsigned char *cert, size_t certSize)
+{
+	int rc;
+	char *str = NULL;
+	unsigned char *fingerprint = NULL;
+	size_t fingerprintSize;
+	crypto_x509 *x509 = NULL;
+
+	emitMapStart(e, "certificate");
+	rc = crypto_md_generate_hash(cert, certSize, CRYPTO_MD_SHA256, &fingerprint, &fingerprintSize);
+	if (rc) {
+		prlog(PR_ERR, "ERROR: Failed to generate certificate fingerprint\n");
+		rc = HASH_FAIL;
+		goto out;
+	}
+	emitBytes(e, "sha256", fingerprint, fingerprintSize);
+	rc = parseX509(&x509, cert, certSize);
+	if (rc)
+		goto out;
+	str = malloc(CERT_BUFFER_SIZE);
+	if (!str) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	if (!crypto_x509_get_subject(x509, str, CERT_BUFFER_SIZE))
+		emitString(e, "subject", str);
+	if (!crypto_x509_get_issuer(x509, str, CERT_BUFFER_SIZE))
+		emitString(e, "issuer", str);
+	if (!crypto_x509_get_expiry(x509, str, CERT_BUFFER_SIZE))
+		emitString(e, "notAfter", str);
+	emitInt(e, "keyBits", crypto_x509_get_pk_bit_len(x509));
+out:
+	emitBool(e, "valid", rc == SUCCESS);
+	emitMapEnd(e);
+	if (str)
+		free(str);
+	if (fingerprint)
+		free(fingerprint);
+	if (x509)
+		crypto_x509_free(x509);
+
+	return rc;
+}
+
+/**
+ *emits every ESL in buffer and every entry in those ESL's, hashes are emitted as is and x509's are parsed
+ *@param e, emitter for structured output
+ *@param c , buffer containing ESL data
+ *@param size , length of buffer
+ *@return SUCCESS or ESL_FAIL if no ESL could be parsed
+ */
+static int emitESLs(struct emitter *e, const char *c, size_t size)
+{
+	size_t offset = 0, entryOffset;
+	int count = 0, isX509;
+	EFI_SIGNATURE_LIST *sigList;
+
+	emitArrayStart(e, "esls");
+	while (offset < size) {
+		sigList = get_esl_signature_list(c + offset, size - offset);
+		if (!sigList)
+			break;
+		if (sigList->SignatureListSize > size - offset || sigList->SignatureSize <= sizeof(uuid_t)
+			|| sigList->SignatureListSize < sizeof(EFI_SIGNATURE_LIST) + sigList->SignatureHeaderSize + sigList->SignatureSize) {
+			prlog(PR_ERR,"ERROR: Sig List is not structured correctly, defined size and actual sizes are mismatched\n");
+			break;
+		}
+		isX509 = uuid_equals(&sigList->SignatureType, &EFI_CERT_X509_GUID);
+		emitMapStart(e, NULL);
+		emitString(e, "type", getSigType(sigList->SignatureType));
+		emitBytes(e, "guid", sigList->SignatureType.b, UUID_SIZE);
+		emitInt(e, "size", sigList->SignatureListSize);
+		emitArrayStart(e, "entries");
+		for (entryOffset = sizeof(EFI_SIGNATURE_LIST) + sigList->SignatureHeaderSize;
+			entryOffset + sigList->SignatureSize <= sigList->SignatureListSize;
+			entryOffset += sigList->SignatureSize) {
+			emitMapStart(e, NULL);
+			emitBytes(e, "owner", (const unsigned char *)c + offset + entryOffset, sizeof(uuid_t));
+			if (isX509)
+				emitCert(e, (const unsigned char *)c + offset + entryOffset + sizeof(uuid_t), sigList->SignatureSize - sizeof(uuid_t));
+			else
+				emitBytes(e, "hash", (const unsigned char *)c + offset + entryOffset + sizeof(uuid_t), sigList->SignatureSize - sizeof(uuid_t));
+			emitMapEnd(e);
+		}
+		emitArrayEnd(e);
+		emitMapEnd(e);
+		count++;
+		offset += sigList->SignatureListSize;
+	}
+	emitArrayEnd(e);
+
+	return count ? SUCCESS : ESL_FAIL;
+}
+
+/**
+ *emits all 16 byte timestamps of TS variable
+ *@param e, emitter for structured output
+ *@param data, timestamps of normal variables {pk, db, kek, dbx}
+ *@param size, size of timestamp data, should be 16*4
+ *@return SUCCESS or INVALID_TIMESTAMP if data is the wrong size
+ */
+static int emitTS(struct emitter *e, const char *data, size_t size)
+{
+	struct efi_time *t;
+	char str[32];
+
+	if (size != sizeof(struct efi_time) * (ARRAY_SIZE(variables) - 1)) {
+		prlog(PR_ERR,"ERROR: TS variable does not contain data on all the variables, expected %ld bytes of data, found %zd\n", sizeof(struct efi_time) * (ARRAY_SIZE(variables) - 1), size);
+		return INVALID_TIMESTAMP;
+	}
+	emitArrayStart(e, "timestamps");
+	for (int i = 0; i < ARRAY_SIZE(variables) - 1; i++) {
+		t = (struct efi_time *)data + i;
+		formatTimestamp(str, sizeof(str), t);
+		emitMapStart(e, NULL);
+		emitString(e, "variable", variables[i]);
+		emitString(e, "time", str);
+		emitMapEnd(e);
+	}
+	emitArrayEnd(e);
+
+	return SUCCESS;
+}
+
+/**
+ *emits all information of one variable, or of a file given with -f
+ *@param e, emitter for structured output
+ *@param name, variable name or file name
+ *@param data, contents of variable, NULL if it could not be read
+ *@param size, length of data
+ *@param hrFlag, 1 to parse the data, 0 to emit the raw data
+ *@return SUCCESS or error number if the data could not be parsed
+ */
+static int emitVariable(struct emitter *e, const char *name, const char *data, size_t size, int hrFlag)
+{
+	int rc = SUCCESS;
+
+	emitMapStart(e, NULL);
+	emitString(e, "name", name);
+	if (!data) {
+		rc = INVALID_FILE;
+		goto out;
+	}
+	emitInt(e, "size", size);
+	if (!hrFlag)
+		emitBytes(e, "data", (const unsigned char *)data, size);
+	else if (size == 0)
+		rc = SUCCESS;
+	else if (!strcmp(name, "TS"))
+		rc = emitTS(e, data, size);
+	else
+		rc = emitESLs(e, data, size);
+out:
+	emitBool(e, "valid", rc == SUCCESS);
+	emitMapEnd(e);
+
+	return rc;
+}
+
+// ISO 8601 in UTC, as in json output
+static void formatTimestamp(char *str, size_t size, const struct efi_time *t)
+{
+	snprintf(str, size, "%04d-%02d-%02dT%02d:%02d:%02dZ", t->year, t->month, t->day, t->hour, t->minute, t->second);
+}
+
+/**
+ *counts the ESL's of buffer and their entries by signature type, only the ESL headers are read
+ *@param c , buffer containing ESL data
+ *@param size , length of buffer
+ *@param sum , returned counts
+ *@return SUCCESS or ESL_FAIL if a header does not add up, the counts are then of the ESL's before it
+ */
+static int countESLs(const char *c, size_t size, struct varSummary *sum)
+{
+	size_t offset = 0, entries;
+	const EFI_SIGNATURE_LIST *sigList;
+	const char *type;
+	int i;
+
+	while (offset < size) {
+		if (size - offset < sizeof(EFI_SIGNATURE_LIST))
+			return ESL_FAIL;
+		sigList = (const EFI_SIGNATURE_LIST *)(c + offset);
+		if (sigList->SignatureListSize > size - offset || sigList->SignatureSize <= sizeof(uuid_t)
+			|| sigList->SignatureListSize < sizeof(EFI_SIGNATURE_LIST) + sigList->SignatureHeaderSize + sigList->SignatureSize)
+			return ESL_FAIL;
+		entries = (sigList->SignatureListSize - sizeof(EFI_SIGNATURE_LIST) - sigList->SignatureHeaderSize) / sigList->SignatureSize;
+		type = getSigType(sigList->SignatureType);
+		for (i = 0; i < sum->typeCount && strcmp(sum->types[i].type, type); i++)
+			;
+		// there is a slot for every name of getSigType, the check only guards against it growing
+		if (i == sum->typeCount && i < SUMMARY_MAX_TYPES) {
+			sum->types[i].type = type;
+			sum->typeCount++;
+		}
+		if (i < SUMMARY_MAX_TYPES)
+			sum->types[i].count += entries;
+		sum->entryCount += entries;
+		sum->eslCount++;
+		offset += sigList->SignatureListSize;
+	}
+
+	return SUCCESS;
+}
+
+/**
+ *prints or emits the size, timestamp and ESL/entry counts of one variable without parsing any entry,
+ *so that it can be polled cheaply, TS is only checked for its size
+ *@param e, emitter for structured output, NULL for text output
+ *@param name, variable name or file name
+ *@param data, contents of variable, NULL if it could not be read
+ *@param size, length of data
+ *@param ts, last update of the variable from TS, NULL if unknown
+ *@return SUCCESS or error number if the data could not be read or its headers do not add up
+ */
+static int summarizeVariable(struct emitter *e, const char *name, const char *data, size_t size, const struct efi_time *ts)
+{
+	struct varSummary sum = { 0 };
+	char str[32];
+	int rc, isTS = !strcmp(name, "TS");
+
+	if (!data)
+		rc = INVALID_FILE;
+	else if (isTS)
+		rc = size == sizeof(struct efi_time) * (ARRAY_SIZE(variables) - 1) ? SUCCESS : INVALID_TIMESTAMP;
+	else
+		rc = countESLs(data, size, &sum);
+	if (ts)
+		formatTimestamp(str, sizeof(str), ts);
+
+	if (e) {
+		emitMapStart(e, NULL);
+		emitString(e, "name", name);
+		if (data)
+			emitInt(e, "size", size);
+		if (data && !isTS) {
+			if (ts)
+				emitString(e, "timestamp", str);
+			emitInt(e, "eslCount", sum.eslCount);
+			emitInt(e, "entryCount", sum.entryCount);
+			emitMapStart(e, "entries");
+			for (int i = 0; i < sum.typeCount; i++)
+				emitInt(e, sum.types[i].type, sum.types[i].count);
+			emitMapEnd(e);
+		}
+		emitBool(e, "valid", rc == SUCCESS);
+		emitMapEnd(e);
+		return rc;
+	}
+	if (!data) {
+		printf("%s: could not be read\n", name);
+		return rc;
+	}
+	if (isTS) {
+		printf("%s: %zu bytes%s\n", name, size, rc ? ", MALFORMED" : "");
+		return rc;
+	}
+	printf("%s: %zu bytes, %d ESL's, %d entries", name, size, sum.eslCount, sum.entryCount);
+	for (int i = 0; i < sum.typeCount; i++)
+		printf("%s%s %d", i ? ", " : " (", sum.types[i].type, sum.types[i].count);
+	printf("%s, timestamp %s%s\n", sum.typeCount ? ")" : "", ts ? str : "unknown", rc ? ", MALFORMED" : "");
+
+	return rc;
+}
+
+// every level of tree as an array of digests, the root last
+static void emitTree(struct emitter *e, const char *key, const struct merkleTree *tree)
+{
+	emitArrayStart(e, key);
+	for (int i = 0; i < tree->levelCount; i++) {
+		emitArrayStart(e, NULL);
+		for (size_t j = 0; j < tree->sizes[i]; j++)
+			emitBytes(e, NULL, tree->levels[i] + j * DIGEST_SIZE, DIGEST_SIZE);
+		emitArrayEnd(e);
+	}
+	emitArrayEnd(e);
+}
+
+// the digests of one variable, of its ESL's and every level of their trees
+static void emitDigest(struct emitter *e, const struct varDigest *digest)
+{
+	const struct eslDigest *esl;
+
+	emitMapStart(e, NULL);
+	emitString(e, "name", digest->name);
+	if (digest->present) {
+		emitInt(e, "size", digest->size);
+		emitBytes(e, "digest", digest->digest, DIGEST_SIZE);
+		emitArrayStart(e, "esls");
+		for (size_t i = 0; i < digest->eslCount; i++) {
+			esl = &digest->esls[i];
+			emitMapStart(e, NULL);
+			emitString(e, "type", esl->list ? getSigType(esl->list->SignatureType) : "MALFORMED");
+			emitBytes(e, "digest", esl->digest, DIGEST_SIZE);
+			emitInt(e, "entryCount", esl->entries.levelCount ? esl->entries.sizes[0] : 0);
+			emitTree(e, "tree", &esl->entries);
+			emitMapEnd(e);
+		}
+		emitArrayEnd(e);
+		emitTree(e, "tree", &digest->eslTree);
+	}
+	emitBool(e, "valid", digest->present && digest->valid);
+	emitMapEnd(e);
+}
+
+// one line for the variable and one per ESL
+static void printDigest(const struct varDigest *digest)
+{
+	char hex[DIGEST_SIZE * 2 + 1];
+	const struct eslDigest *esl;
+
+	if (!digest->present) {
+		printf("%s: could not be read\n", digest->name);
+		return;
+	}
+	hex[hexEncode(hex, digest->digest, DIGEST_SIZE, 0)] = '\0';
+	printf("%s: %s, %zu bytes", digest->name, hex, digest->size);
+	if (strcmp(digest->name, "TS"))
+		printf(", %zu ESL's", digest->eslCount);
+	printf("%s\n", digest->valid ? "" : ", MALFORMED");
+	for (size_t i = 0; i < digest->eslCount; i++) {
+		esl = &digest->esls[i];
+		hex[hexEncode(hex, esl->digest, DIGEST_SIZE, 0)] = '\0';
+		if (esl->list)
+			printf("\tESL %zu %s, %zu entries: %s\n", i, getSigType(esl->list->SignatureType),
+			       esl->entries.levelCount ? esl->entries.sizes[0] : 0, hex);
+		else
+			printf("\tESL %zu MALFORMED: %s\n", i, hex);
+	}
+}
+
+/**
+ *prints the root digest over the variables read and the digest of each of them, see edk2-svc-digest.c.
+ *Text output stops at the ESL digests, structured output gives every level of every tree down to the entries
+ *@param var, only this variable, NULL for all. With file it is the variable the file holds and must be given
+ *@param file, file with ESL's to use instead of the variables, NULL if not given
+ *@param path, where the variables are, default SECVARPATH
+ *@param e, emitter for structured output, NULL for text output
+ *@return SUCCESS if at least one variable could be read, else error number
+ */
+static int printDigests(const char *var, const char *file, const char *path, struct emitter *e)
+{
+	struct varDigest digests[ARRAY_SIZE(variables)];
+	unsigned char leaves[ARRAY_SIZE(variables) * DIGEST_SIZE];
+	char hex[DIGEST_SIZE * 2 + 1];
+	struct merkleTree root = { 0 };
+	struct list_head bank;
+	struct secvar *secVar;
+	char *data = NULL;
+	size_t count = 0, size = 0;
+	int rc = SUCCESS, successCount = 0;
+
+	list_head_init(&bank);
+	if (file) {
+		data = getDataFromFile(file, &size);
+		rc = digestVariable(&digests[count++], var, (unsigned char *)data, size);
+	}
+	else {
+		rc = loadSecVars(&bank, path ? path : SECVARPATH, var);
+		for (int i = 0; i < ARRAY_SIZE(variables) && !rc; i++) {
+			if (var && strcmp(var, variables[i]))
+				continue;
+			secVar = find_secvar(variables[i], strlen(variables[i]) + 1, &bank);
+			rc = digestVariable(&digests[count++], variables[i], secVar ? (unsigned char *)secVar->data : NULL,
+					    secVar ? secVar->data_size : 0);
+		}
+	}
+	for (size_t i = 0; i < count && !rc; i++) {
+		memcpy(leaves + i * DIGEST_SIZE, digests[i].digest, DIGEST_SIZE);
+		if (digests[i].present && digests[i].valid)
+			successCount++;
+	}
+	if (!rc)
+		rc = merkleBuild(&root, leaves, count);
+	if (rc)
+		goto out;
+
+	if (e) {
+		emitBytes(e, "root", merkleRoot(&root), DIGEST_SIZE);
+		emitArrayStart(e, "variables");
+		for (size_t i = 0; i < count; i++)
+			emitDigest(e, &digests[i]);
+		emitArrayEnd(e);
+	}
+	else {
+		hex[hexEncode(hex, merkleRoot(&root), DIGEST_SIZE, 0)] = '\0';
+		printf("root: %s\n", hex);
+		for (size_t i = 0; i < count; i++)
+			printDigest(&digests[i]);
+	}
+	if (!successCount) {
+		prlog(PR_ERR, "No valid files to print, returning failure\n");
+		rc = INVALID_FILE;
+	}
+out:
+	for (size_t i = 0; i < count; i++)
+		freeVarDigest(&digests[i]);
+	merkleFree(&root);
+	clear_bank_list(&bank);
+	if (data)
+		free(data);
+
+	return rc;
+}
+
 /** 
  *inspired by secvar/backend/edk2-compat-process.c by Nayna Jain
  *@param c  pointer to start of esl file
@@ -522,10 +1254,10 @@ const char* getSigType(const uuid_t type)
  */
 void printGuidSig(const void *sig) 
 {
-	const unsigned char *p = sig;
-	for (int i = 0; i < 16; i++)
-		printf("%02hhx", p[i]);
-	printf("\n");
+	char hex[32];
+
+	fwrite(hex, 1, hexEncode(hex, sig, sizeof(hex) / 2, 0), stdout);
+	putchar('\n');
 }
 
 /**
@@ -588,17 +1320,32 @@ static int getSizeFromSizeFile(size_t *returnSize, const char* path)
 	}
 
 	close(fptr);
+	rc = parseSize(returnSize, c, read_size);
+	free(c);
+
+	return rc;
+}
+
+/**
+ *parses the contents of a <var>/size file
+ *@param returnSize , the parsed size
+ *@param c , the first (up to 8) characters of the file
+ *@param len , number of characters in c, c must have room for a NUL after them
+ *@return SUCCESS or INVALID_FILE if c is not a number
+ */
+static int parseSize(size_t *returnSize, const char *c, ssize_t len)
+{
+	char digits[9] = { 0 };
+
+	memcpy(digits, c, len < 8 ? len : 8);
 	// turn string into base 10 int
-	*returnSize = strtol(c, NULL, 0); 
+	*returnSize = strtol(digits, NULL, 0); 
 	// strol likes to return zero if there is no conversion from string to int
 	// so we need to differentiate an error from a file that actually contains 0
-	if (*returnSize == 0 && c[0] != '0')
-		rc = INVALID_FILE;
-	else
-		rc = SUCCESS;
-	free(c);
+	if (*returnSize == 0 && digits[0] != '0')
+		return INVALID_FILE;
 
-	return rc;
+	return SUCCESS;
 }
 
 struct command edk2_compat_command_table[] = {
@@ -607,6 +1354,7 @@ struct command edk2_compat_command_table[] = {
 	{ .name = "validate", .func = performValidation },
 	{ .name = "verify", .func = performVerificationCommand },
 #ifndef NO_CRYPTO
-	{ .name = "generate", .func = performGenerateCommand }
+	{ .name = "generate", .func = performGenerateCommand },
+	{ .name = "check-image", .func = performCheckImageCommand }
 #endif
 };
@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include "timing.h"
+#include "memstats.h"
+#include "external/skiboot/include/endian.h"
+#include "backends/edk2-compat/include/edk2-svc.h"// include last, pragma pack(1) issue
+
+/*
+ *a packed snapshot holds all secure variables of one host in a single file:
+ *  header | index entry for every variable | payloads
+ *every payload starts on a SNAPSHOT_ALIGN boundary so the mapped file can be used in place,
+ *all integers are little endian
+ */
+#define SNAPSHOT_MAGIC "SECVSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN 64
+#define SNAPSHOT_DIGEST_SIZE 32
+
+struct snapshotHeader {
+	char magic[8];
+	leint32_t version;
+	leint32_t count;
+};
+
+struct snapshotEntry {
+	// NUL padded variable name
+	char name[8];
+	leint64_t offset;
+	leint64_t size;
+	leint32_t flags;
+	leint32_t reserved;
+	// sha256 of the payload
+	unsigned char digest[SNAPSHOT_DIGEST_SIZE];
+};
+
+static int parseSnapshot(struct list_head *bank, const unsigned char *buf, size_t len, const char *name, const char *file);
+static int hashPayload(const unsigned char *data, size_t size, unsigned char *digest);
+
+/**
+ *determines if path is a packed snapshot rather than a directory of variables
+ *@param path, file name given by the user, '-' is always taken as a snapshot on stdin
+ *@return 1 if path starts with the snapshot magic, 0 otherwise
+ */
+int isSnapshot(const char *path)
+{
+	char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+	int fd, rc = 0;
+
+	if (isStdio(path))
+		return 1;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (read(fd, magic, sizeof(magic)) == sizeof(magic) && !memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)))
+		rc = 1;
+	close(fd);
+
+	return rc;
+}
+
+/**
+ *maps a packed snapshot and adds its variables to bank
+ *@param bank list to add the secvar's to
+ *@param file snapshot file or '-' for stdin
+ *@param name only add this variable, NULL for all of them
+ *@return SUCCESS or error number if the file can not be read or is malformed
+ */
+int readSnapshot(struct list_head *bank, const char *file, const char *name)
+{
+	int fd, rc;
+	struct stat st;
+	unsigned char *buf = NULL;
+	size_t len = 0;
+	uint64_t start;
+
+	if (isStdio(file)) {
+		buf = (unsigned char *)getDataFromFile(file, &len);
+		if (!buf)
+			return INVALID_FILE;
+		rc = parseSnapshot(bank, buf, len, name, file);
+		free(buf);
+		return rc;
+	}
+	start = timingStart();
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		prlog(PR_ERR, "ERROR: Could not open snapshot %s: %s\n", file, strerror(errno));
+		timingStop(TIMING_FILE_IO, start);
+		return INVALID_FILE;
+	}
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		prlog(PR_ERR, "ERROR: %s is not a regular file\n", file);
+		close(fd);
+		timingStop(TIMING_FILE_IO, start);
+		return INVALID_FILE;
+	}
+	len = st.st_size;
+	buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	timingStop(TIMING_FILE_IO, start);
+	if (buf == MAP_FAILED) {
+		prlog(PR_ERR, "ERROR: Could not map snapshot %s: %s\n", file, strerror(errno));
+		return INVALID_FILE;
+	}
+	rc = parseSnapshot(bank, buf, len, name, file);
+	munmap(buf, len);
+
+	return rc;
+}
+
+/**
+ *checks the index of a snapshot and the digest of every payload, then copies the payloads into bank
+ *@return SUCCESS or INVALID_FILE, nothing is added to bank on failure
+ */
+static int parseSnapshot(struct list_head *bank, const unsigned char *buf, size_t len, const char *name, const char *file)
+{
+	const struct snapshotHeader *header = (const struct snapshotHeader *)buf;
+	const struct snapshotEntry *entries;
+	unsigned char digest[SNAPSHOT_DIGEST_SIZE];
+	struct list_head found;
+	struct secvar *var, *next;
+	uint64_t offset, size, indexEnd;
+	uint32_t count;
+	int rc = INVALID_FILE;
+
+	list_head_init(&found);
+	if (len < sizeof(*header) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic))) {
+		prlog(PR_ERR, "ERROR: %s is not a secvar snapshot\n", file);
+		return INVALID_FILE;
+	}
+	if (le32_to_cpu(header->version) != SNAPSHOT_VERSION) {
+		prlog(PR_ERR, "ERROR: Unsupported snapshot version %u in %s\n", le32_to_cpu(header->version), file);
+		return INVALID_FILE;
+	}
+	count = le32_to_cpu(header->count);
+	indexEnd = sizeof(*header) + (uint64_t)count * sizeof(*entries);
+	if (count > ARRAY_SIZE(variables) || indexEnd > len) {
+		prlog(PR_ERR, "ERROR: Snapshot %s holds %u variables, more than fit in %zd bytes or than exist\n", file, count, len);
+		return INVALID_FILE;
+	}
+	entries = (const struct snapshotEntry *)(buf + sizeof(*header));
+	for (uint32_t i = 0; i < count; i++) {
+		offset = le64_to_cpu(entries[i].offset);
+		size = le64_to_cpu(entries[i].size);
+		if (!memchr(entries[i].name, '\0', sizeof(entries[i].name)) || isVariable(entries[i].name)) {
+			prlog(PR_ERR, "ERROR: Snapshot %s entry #%u does not name a secure variable\n", file, i);
+			goto out;
+		}
+		if (find_secvar(entries[i].name, strlen(entries[i].name) + 1, &found)) {
+			prlog(PR_ERR, "ERROR: Snapshot %s holds %s twice\n", file, entries[i].name);
+			goto out;
+		}
+		if (offset % SNAPSHOT_ALIGN || offset < indexEnd || offset > len || size > len - offset) {
+			prlog(PR_ERR, "ERROR: Snapshot %s has %s at offset %llu with %llu bytes, outside of the file\n", file,
+				entries[i].name, (unsigned long long)offset, (unsigned long long)size);
+			goto out;
+		}
+		if (hashPayload(buf + offset, size, digest) || memcmp(digest, entries[i].digest, sizeof(digest))) {
+			prlog(PR_ERR, "ERROR: Snapshot %s has a bad digest for %s\n", file, entries[i].name);
+			goto out;
+		}
+		// entries that are filtered out are still checked, a snapshot is either good or not
+		var = new_secvar(entries[i].name, strlen(entries[i].name) + 1, (const char *)buf + offset, size, le32_to_cpu(entries[i].flags));
+		if (!var) {
+			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+			rc = ALLOC_FAIL;
+			goto out;
+		}
+		list_add_tail(&found, &var->link);
+	}
+	list_for_each_safe(&found, var, next, link) {
+		if (name && strcmp(name, var->key))
+			continue;
+		prlog(PR_NOTICE, "---read %s from snapshot %s: %zd bytes----\n", var->key, file, var->data_size);
+		list_del(&var->link);
+		list_add_tail(bank, &var->link);
+	}
+	rc = SUCCESS;
+
+out:
+	clear_bank_list(&found);
+
+	return rc;
+}
+
+/**
+ *writes every secvar of bank into file as a packed snapshot
+ *@param file snapshot file to create or '-' for stdout
+ *@param bank list of secvar's, keys must be secure variable names
+ *@return SUCCESS or error number
+ */
+int writeSnapshot(const char *file, struct list_head *bank)
+{
+	struct snapshotHeader *header;
+	struct snapshotEntry *entry;
+	struct secvar *var;
+	unsigned char *buf;
+	uint32_t count = 0;
+	size_t len, offset;
+	int rc;
+
+	list_for_each(bank, var, link)
+		count++;
+	// first pass finds the size of the file, payloads are padded out to SNAPSHOT_ALIGN
+	len = sizeof(*header) + count * sizeof(*entry);
+	list_for_each(bank, var, link)
+		len = (len + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN + var->data_size;
+	buf = memCalloc(MEM_FILE_IO, 1, len);
+	if (!buf) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	header = (struct snapshotHeader *)buf;
+	memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+	header->version = cpu_to_le32(SNAPSHOT_VERSION);
+	header->count = cpu_to_le32(count);
+	entry = (struct snapshotEntry *)(buf + sizeof(*header));
+	offset = sizeof(*header) + count * sizeof(*entry);
+	list_for_each(bank, var, link) {
+		if (strlen(var->key) >= sizeof(entry->name)) {
+			prlog(PR_ERR, "ERROR: Variable name %s is too long for a snapshot\n", var->key);
+			rc = INVALID_VAR_NAME;
+			goto out;
+		}
+		offset = (offset + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+		strcpy(entry->name, var->key);
+		entry->offset = cpu_to_le64(offset);
+		entry->size = cpu_to_le64(var->data_size);
+		entry->flags = cpu_to_le32(var->flags);
+		rc = hashPayload((unsigned char *)var->data, var->data_size, entry->digest);
+		if (rc)
+			goto out;
+		memcpy(buf + offset, var->data, var->data_size);
+		offset += var->data_size;
+		entry++;
+	}
+	rc = createFile(file, (char *)buf, len);
+
+out:
+	free(buf);
+
+	return rc;
+}
+
+// sha256 of one payload, the ctx functions are used because crypto_md_generate_hash prints the hash
+static int hashPayload(const unsigned char *data, size_t size, unsigned char *digest)
+{
+	crypto_md_ctx *ctx = NULL;
+	uint64_t start = timingStart();
+	int rc;
+
+	rc = crypto_md_ctx_init(&ctx, CRYPTO_MD_SHA256);
+	if (!rc)
+		rc = crypto_md_update(ctx, data, size);
+	if (!rc)
+		rc = crypto_md_finish(ctx, digest);
+	if (ctx)
+		crypto_md_free(ctx);
+	timingStop(TIMING_HASH, start);
+	if (rc) {
+		prlog(PR_ERR, "ERROR: failed to hash snapshot payload\n");
+		return HASH_FAIL;
+	}
+
+	return SUCCESS;
+}
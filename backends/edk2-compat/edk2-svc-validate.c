@@ -5,6 +5,7 @@
 #include <stdlib.h>// for exit
 #include <argp.h>
 #include "crypto/crypto.h"
+#include "memstats.h"
 #include "include/edk2-svc.h"// import last!!
 
 struct Arguments {
@@ -17,6 +18,7 @@ static bool validate_hash(uuid_t type, size_t size);
 static int parse_opt(int key, char *arg, struct argp_state *state);
 static int validateSingularESL(size_t* bytesRead, const unsigned char* esl, size_t eslvarsize, const char *varName);
 static int validateCertStruct(crypto_x509 *x509, const char *varName);
+static int validateESLChain(const unsigned char *eslBuf, size_t buflen, const char *key);
 
 
 enum fileTypes{
@@ -62,7 +64,8 @@ int performValidation(int argc, char* argv[])
 		options, parse_opt, "<FILE>", 
 		"The purpose of this command is to help ensure that the format of the file is correct"
 		" and is able to be parsed for data. NOTE: This command mainly performs formatting checks, invalid content/signatures can still exist"
-		" use 'secvarctl verify' to see if content and file signature (if PKCS7/auth) are valid"
+		" use 'secvarctl verify' to see if content and file signature (if PKCS7/auth) are valid."
+		" Use '-' as <FILE> to read from stdin"
 	};
 
 	rc = argp_parse( &argp, argc, argv, ARGP_NO_EXIT | ARGP_IN_ORDER | ARGP_NO_HELP, 0, &args);
@@ -329,6 +332,16 @@ out:
  *@return SUCCESS if at least one ESL validates
  */ 
 int validateESL(const unsigned char *eslBuf, size_t buflen, const char *key) 
+{
+	enum memTag tag = memTagEnter(MEM_ESL);
+	int rc = validateESLChain(eslBuf, buflen, key);
+
+	memTagExit(tag);
+
+	return rc;
+}
+
+static int validateESLChain(const unsigned char *eslBuf, size_t buflen, const char *key) 
 {
 	ssize_t eslvarsize = buflen;
 	size_t  eslsize = 0;
@@ -573,8 +586,179 @@ static int validateCertStruct(crypto_x509 *x509, const char *varName)
 	return SUCCESS;
 }
 
+// DER of the pkcs7 signedData OID, the first thing in a ContentInfo
+static const unsigned char pkcs7SignedDataOID[] = { 0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x07, 0x02 };
+#define PEM_ARMOR "-----BEGIN "
+
+/*
+ *gets the size of the DER SEQUENCE at the start of buf, only definite lengths of up to 4 bytes are taken
+ *@param buf, data to look at
+ *@param size, length of buf
+ *@param hdrLen, returned length of the tag and length bytes
+ *@return length of the whole SEQUENCE or 0 if buf does not start with one
+ */
+static size_t derSequenceSize(const unsigned char *buf, size_t size, size_t *hdrLen)
+{
+	size_t len = 0, i, count;
+
+	if (size < 2 || buf[0] != 0x30)
+		return 0;
+	if (buf[1] < 0x80) {
+		*hdrLen = 2;
+		len = buf[1];
+	} else {
+		count = buf[1] & 0x7f;
+		if (count == 0 || count > 4 || size < 2 + count)
+			return 0;
+		for (i = 0; i < count; i++)
+			len = (len << 8) | buf[2 + i];
+		*hdrLen = 2 + count;
+	}
+	if (len > size - *hdrLen)
+		return 0;
+
+	return *hdrLen + len;
+}
+
+/*
+ *looks for PEM armor, bundles may have text before the first block so the whole buffer is searched
+ */
+static bool hasPEMArmor(const unsigned char *buf, size_t size)
+{
+	size_t len = strlen(PEM_ARMOR);
+	const unsigned char *p = buf, *end = buf + size;
+
+	while (end - p >= (ssize_t)len) {
+		p = memchr(p, '-', end - p - len + 1);
+		if (!p)
+			return false;
+		if (!memcmp(p, PEM_ARMOR, len))
+			return true;
+		p++;
+	}
+
+	return false;
+}
+
+/*
+ *checks that buf starts with a PE/COFF image: MZ header pointing at a PE signature
+ */
+static bool isPEImage(const unsigned char *buf, size_t size)
+{
+	uint32_t peOffset;
+
+	if (size < 0x40 || buf[0] != 'M' || buf[1] != 'Z')
+		return false;
+	peOffset = buf[0x3c] | buf[0x3d] << 8 | buf[0x3e] << 16 | (uint32_t)buf[0x3f] << 24;
+
+	return peOffset <= size - 4 && !memcmp(buf + peOffset, "PE\0\0", 4);
+}
+
+/*
+ *checks the header of an auth: the certificate type is PKCS7 and the signature fits in the buffer
+ */
+static bool isAuthHeader(const unsigned char *buf, size_t size)
+{
+	const struct efi_variable_authentication_2 *auth = (const struct efi_variable_authentication_2 *)buf;
+	size_t certLen;
+
+	if (size < sizeof(*auth))
+		return false;
+	if (!uuid_equals(&auth->auth_info.cert_type, &EFI_CERT_TYPE_PKCS7_GUID))
+		return false;
+	certLen = auth->auth_info.hdr.dw_length;
+
+	return certLen > sizeof(auth->auth_info) && certLen <= size - sizeof(auth->timestamp);
+}
+
+/*
+ *checks the header of the first ESL: known signature type and sizes that add up inside the buffer
+ */
+static bool isESLHeader(const unsigned char *buf, size_t size)
+{
+	const EFI_SIGNATURE_LIST *list = (const EFI_SIGNATURE_LIST *)buf;
+	const char *type;
+	size_t sigs;
+
+	if (size < sizeof(*list))
+		return false;
+	// PKCS7 is a known GUID but not something an ESL holds
+	type = getSigType(list->SignatureType);
+	if (!strcmp(type, "UNKNOWN") || !strcmp(type, "PKCS7"))
+		return false;
+	if (list->SignatureSize <= sizeof(uuid_t) || list->SignatureListSize > size)
+		return false;
+	if (list->SignatureListSize < sizeof(*list) + (size_t)list->SignatureHeaderSize + list->SignatureSize)
+		return false;
+	sigs = list->SignatureListSize - sizeof(*list) - list->SignatureHeaderSize;
+
+	return sigs % list->SignatureSize == 0;
+}
+
+/**
+ *finds the format of a buffer from magic bytes and header fields only, nothing is parsed or allocated
+ *formats with a magic value or a GUID are tried before raw DER, PEM is looked for last since it is a text search
+ *@param buf, data to look at
+ *@param size, length of buf
+ *@return FORMAT_UNKNOWN if nothing matches, a hash is only reported if the size is one of hash_functions
+ */
+enum fileFormat sniffFormat(const unsigned char *buf, size_t size)
+{
+	size_t hdrLen, inner;
+
+	if (!buf || !size)
+		return FORMAT_UNKNOWN;
+	if (isPEImage(buf, size))
+		return FORMAT_PE;
+	if (derSequenceSize(buf, size, &hdrLen) == size) {
+		if (size - hdrLen >= sizeof(pkcs7SignedDataOID) && !memcmp(buf + hdrLen, pkcs7SignedDataOID, sizeof(pkcs7SignedDataOID)))
+			return FORMAT_PKCS7;
+		// a certificate is a SEQUENCE that starts with the tbsCertificate SEQUENCE
+		if (derSequenceSize(buf + hdrLen, size - hdrLen, &inner))
+			return FORMAT_X509;
+	}
+	if (isAuthHeader(buf, size))
+		return FORMAT_AUTH;
+	if (isESLHeader(buf, size))
+		return FORMAT_ESL;
+	if (hasPEMArmor(buf, size))
+		return FORMAT_PEM;
+	for (int i = 0; i < ARRAY_SIZE(hash_functions); i++) {
+		if (size == hash_functions[i].size)
+			return FORMAT_HASH;
+	}
+
+	return FORMAT_UNKNOWN;
+}
+
+/**
+ *@return a printable name of format
+ */
+const char *formatName(enum fileFormat format)
+{
+	switch (format) {
+	case FORMAT_PEM:
+		return "PEM";
+	case FORMAT_X509:
+		return "DER x509";
+	case FORMAT_PKCS7:
+		return "PKCS7";
+	case FORMAT_AUTH:
+		return "auth";
+	case FORMAT_ESL:
+		return "ESL";
+	case FORMAT_HASH:
+		return "hash";
+	case FORMAT_PE:
+		return "PE image";
+	default:
+		return "unknown";
+	}
+}
+
 /**
  *parses x509 certficate buffer (PEM or DER) into certificate struct
+ *the format is sniffed first so the buffer is only handed to one parser
  *@param x509, returned pointer to address of x509,
  *@param certBuf pointer to certificate data
  *@param buflen length of certBuf
@@ -586,28 +770,26 @@ int parseX509(crypto_x509 **x509, const unsigned char *certBuf, size_t buflen)
 {
 	unsigned char *generatedDER = NULL;
 	size_t generatedDERSize;
+	enum fileFormat format;
 	if ((ssize_t)buflen <= 0) {
 		prlog(PR_ERR, "ERROR: Certificate has invalid length %zd, cannot validate\n", buflen);
 		return CERT_FAIL;
 	}
-	// puts cert data into x509_Crt struct and returns number of failed parses
-	*x509 = crypto_x509_parse_der(certBuf, buflen);
-	if (!*x509) {
-		prlog(PR_INFO, "Failed to parse x509 as DER, trying PEM...\n");
-		// if failed, maybe input is PEM and so try converting PEM to DER, if conversion fails then we know it was DER and it failed
+	format = sniffFormat(certBuf, buflen);
+	if (format == FORMAT_PEM) {
 		if (crypto_convert_pem_to_der(certBuf, buflen, &generatedDER, &generatedDERSize)) {
-			prlog(PR_ERR, "ERROR: Failed to parse x509 in DER and file is not in PEM\n");
-			return CERT_FAIL;
-		}
-		// if success then try to parse into x509 struct again
-		*x509 = crypto_x509_parse_der(generatedDER, generatedDERSize); 
-		if (!*x509) {
-			prlog(PR_ERR, "ERROR: Failed to parse x509 (tried DER and PEM formats). \n");
+			prlog(PR_ERR, "ERROR: Failed to convert x509 from PEM to DER\n");
 			return CERT_FAIL;
 		}
+		*x509 = crypto_x509_parse_der(generatedDER, generatedDERSize);
+		free(generatedDER);
+	} else
+		*x509 = crypto_x509_parse_der(certBuf, buflen);
+	if (!*x509) {
+		prlog(PR_ERR, "ERROR: Failed to parse x509 as %s, the data was detected as %s\n",
+		      format == FORMAT_PEM ? "PEM" : "DER", formatName(format));
+		return CERT_FAIL;
 	}
-	if (generatedDER) 
-	 	free(generatedDER);
 
 	return SUCCESS;
 }
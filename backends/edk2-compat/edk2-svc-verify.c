@@ -6,30 +6,69 @@
 #include <fcntl.h> // O_RDONLY
 #include <unistd.h> // has read/open functions
 #include <argp.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "external/skiboot/include/opal-api.h"
 #include "external/skiboot/include/secvar.h"
-#include "backends/edk2-compat/include/edk2-svc.h"
+#include "output.h"
+#include "threadpool.h"
+#include "memo.h"
+#include "crypto/crypto.h"
+#include "backends/edk2-compat/include/edk2-svc.h"// include last, pragma pack(1) issue
+#include "external/skiboot/include/edk2-compat-process.h" // for struct secvar_ctx, also packs
 
 
 
 struct Arguments {
-	int helpFlag, writeFlag, currVarCount, updateVarCount;
-	const char *pathToSecVars, **updateVars;
+	int helpFlag, writeFlag, planFlag, currVarCount, updateVarCount, jobs;
+	const char *pathToSecVars, **updateVars, *fleetPath, *memoPath;
 	char **currentVars;
+	enum outputFormat outForm;
 }; 
 
+// one snapshot root of a --fleet run
+struct fleetHost {
+	char *name, *path;
+	// sha256 of the PK, KEK and TS this host starts from, the verdict only depends on them and the updates
+	unsigned char authorities[32];
+	// index of the first host with the same authorities, the only one that is actually processed
+	size_t group;
+	int rc;
+	const char *error;
+};
+
+struct fleet {
+	struct fleetHost *hosts;
+	size_t count;
+	// number of distinct authorities, which is how many hosts actually go through process()
+	size_t groups;
+	// parsed and validated once, every host processes a copy
+	struct list_head update_bank;
+	// shared by every host, NULL for none
+	struct verifyMemo *memo;
+};
+
 
 extern struct secvar_backend_driver edk2_compatible_v1;
 
-static int verify(char **currentVars, int currCount, const char **updateVars, int updateCount, const char *path, int writeFlag);
+static int verify(char **currentVars, int currCount, const char **updateVars, int updateCount, const char *path, int writeFlag, int planFlag, int jobs, struct verifyMemo *memo, struct emitter *e);
+static int processEachUpdate(struct secvar_ctx *ctx, struct list_head *variable_bank, struct list_head *update_bank, struct emitter *e);
 static int validateVarsArg(const char *vars[], int size);
-static int getCurrentVars(char **newCurr, int *size, const char *path);
 static char *opalErrToString(int rc);
 static int parse_opt(int key, char *arg, struct argp_state *state);
 static int validateBanks(struct list_head *update_bank, struct list_head *variable_bank);
+static int validateUpdateBank(struct list_head *update_bank);
+static int validateVariableBank(struct list_head *variable_bank);
 static int setupBanks(struct list_head *variable_bank, struct list_head *update_bank, char *currentVars[], int currCount, const char *updateVars[], int updateCount, const char*path);
 static void printBanks(struct list_head *variable_bank, struct list_head *update_bank);
 static int commitUpdateBank(struct list_head *update_bank, const char *path);
+static int verifyFleet(const char *fleetPath, const char *updateVars[], int updateCount, int jobs, struct verifyMemo *memo, struct emitter *e);
+static int getFleetHosts(struct fleet *f, const char *fleetPath);
+static int scanFleetHost(void *ctx, size_t index);
+static int processFleetHost(void *ctx, size_t index);
+static int hashAuthorities(struct list_head *variable_bank, unsigned char *out);
+static int compareAuthorities(const void *a, const void *b);
+static void printFleet(struct fleet *f, struct emitter *e);
 
 /**
 *performs verification command, called from main
@@ -40,9 +79,11 @@ static int commitUpdateBank(struct list_head *update_bank, const char *path);
 int performVerificationCommand(int argc, char* argv[])
 {
 	int rc;
+	struct emitter emitter, *e = NULL;
+	struct verifyMemo *memo = NULL;
 	struct Arguments args = {	
-		.helpFlag = 0, .writeFlag = 0, .currVarCount = 0, .updateVarCount = 0,
-		.pathToSecVars = NULL, .updateVars = NULL, .currentVars = 0
+		.helpFlag = 0, .writeFlag = 0, .planFlag = 0, .currVarCount = 0, .updateVarCount = 0, .jobs = 0,
+		.pathToSecVars = NULL, .updateVars = NULL, .fleetPath = NULL, .memoPath = NULL, .currentVars = 0, .outForm = OUTPUT_TEXT
 	};
     // combine command and subcommand for usage/help messages
 	argv[0] = "secvarctl verify";
@@ -50,9 +91,23 @@ int performVerificationCommand(int argc, char* argv[])
 	struct argp_option options[] = 
 	{
 		{"verbose", 'v', 0, 0, "print more verbose process information"},
-		{"path", 'p', "PATH" ,0, "manually set path to current variables, looks for .../<var>/data file in PATH, default is " SECVARPATH " . Cannot be used with `-c` "},
-		{"current", 'c', "{CURRENT VAR LIST}", 0, "manually set current vars to be contents of CURRENT VAR LIST (see below for format)"},
+		{"path", 'p', "PATH" ,0, "manually set path to current variables, looks for .../<var>/data file in PATH, default is " SECVARPATH " ."
+							" PATH may also be a packed snapshot file (see `secvarctl read --snapshot-out`). Cannot be used with `-c` "},
+		{"current", 'c', "{CURRENT VAR LIST}", 0, "manually set current vars to be contents of CURRENT VAR LIST (see below for format) or of a single packed snapshot file"},
 		{"write", 'w', 0, 0, "if successful, submit the update to be commited upon reboot. Equivalent to `secvarctl write`"},
+		{"plan", ARGP_OPT_PLAN_KEY, 0, 0, "the updates may be given in any order, find one in which every update is signed by the current or an"
+						" earlier updated PK/KEK and is newer than the last update of its variable, print it and verify in that order."
+						" If there is none, print the updates that block every order. Cannot be used with `--fleet`"},
+		{"fleet", ARGP_OPT_FLEET_KEY, "DIR", 0, "verify the updates against every snapshot in DIR, each subdirectory of DIR is laid out"
+						" like `-p` (.../<host>/<var>/data), each file in DIR is a packed snapshot and every one gets a verdict. Cannot be used with `-p`, `-c` or `-w`"},
+		{"jobs", 'j', "N", 0, "number of threads. With --fleet hosts are processed concurrently, default is the number of online cpus."
+					" Otherwise the signatures of all updates are checked concurrently, each against the PK/KEK it will see,"
+					" and the results are applied in order, default is 1"},
+		{"memo", ARGP_OPT_MEMO_KEY, "FILE", 0, "remember the verdict of every signature check in FILE and reuse it when the same update is checked"
+					" against the same PK/KEK again, FILE is created if needed. Anyone who can write FILE can make updates pass, keep it"
+					" with the same care as the variables. Ignored with `-w` or when " MEMO_OFF_ENV " is set"},
+		{"output", ARGP_OPT_OUTPUT_KEY, "FORMAT", 0, "output format, one of {'text', 'json', 'cbor'}, default is text."
+										" json and cbor carry the verdict of every update and the resulting variables and are written to stdout"},
 		{0, 'u', "{UPDATE LIST}", OPTION_HIDDEN, "set update variables (see below for format)"},
 		{"help", '?', 0, 0, "Give this help list", 1},
 		{"usage", ARGP_OPT_USAGE_KEY, 0, 0, "Give a short usage message", -1 },
@@ -69,7 +124,8 @@ int performVerificationCommand(int argc, char* argv[])
 		" ' -u <varName_1> <authFileForVar_1> <varName_2> <authFileForVar_2> ... '"
 		" Where <varName> is one of {'PK','KEK','db','dbx'}"
 		" and <authFileForVar> is a properly generated authenticated variable file that is"
-		" signed by a current variable with priviledges to approve the update\n\n"
+		" signed by a current variable with priviledges to approve the update."
+		" One file in either list may be '-' to read it from stdin\n\n"
 		"CURRENT_VAR_LIST:\nOptional, only used when -c is used. Formatted as:"
 		" ' -c <varName_1> <eslFileForVar_1> <varName_2> <eslFileForVar_2> ... '"
 		" Where <varName> is one of {'PK','KEK','db','dbx', 'TS'} and"
@@ -82,7 +138,43 @@ int performVerificationCommand(int argc, char* argv[])
 		goto out;
 	}
 
-	rc = verify(args.currentVars, args.currVarCount, args.updateVars, args.updateVarCount, args.pathToSecVars, args.writeFlag);
+	// an update is never committed on a remembered verdict
+	if (args.memoPath && (args.writeFlag || memoDisabled()))
+		prlog(PR_NOTICE, "Not using memo %s, %s\n", args.memoPath, args.writeFlag ? "-w checks every signature" : MEMO_OFF_ENV " is set");
+	else if (args.memoPath) {
+		rc = memoOpen(&memo, args.memoPath, crypto_provider_name());
+		if (rc)
+			goto out;
+	}
+
+	if (args.outForm != OUTPUT_TEXT) {
+		// structured data owns stdout, everything else goes to stderr
+		rc = reserveStdoutForData();
+		if (rc)
+			goto out;
+		e = &emitter;
+		emitterInit(e, args.outForm);
+		emitMapStart(e, NULL);
+	}
+
+	if (args.fleetPath)
+		rc = verifyFleet(args.fleetPath, args.updateVars, args.updateVarCount, args.jobs, memo, e);
+	else
+		rc = verify(args.currentVars, args.currVarCount, args.updateVars, args.updateVarCount, args.pathToSecVars, args.writeFlag, args.planFlag, args.jobs, memo, e);
+	// failing to save the memo only costs the next run time
+	memoClose(memo);
+
+	if (e) {
+		emitString(e, "result", rc ? "FAILURE" : "SUCCESS");
+		emitInt(e, "rc", rc);
+		emitMapEnd(e);
+		if (emitterFlush(e, STDIO_FILE)) {
+			prlog(PR_ERR, "ERROR: Failed to write structured output\n");
+			if (!rc)
+				rc = FILE_WRITE_FAIL;
+		}
+		emitterFree(e);
+	}
 	
 out:
 	if (args.currentVars) 
@@ -105,6 +197,7 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 {
 	struct Arguments *args = state->input;
 	int current, rc = SUCCESS;
+	char *end;
 
 	switch (key) {
 		case '?':
@@ -121,6 +214,25 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 		case 'w':
 			args->writeFlag = 1;
 			break;
+		case ARGP_OPT_PLAN_KEY:
+			args->planFlag = 1;
+			break;
+		case ARGP_OPT_MEMO_KEY:
+			args->memoPath = arg;
+			break;
+		case ARGP_OPT_FLEET_KEY:
+			args->fleetPath = arg;
+			break;
+		case 'j':
+			args->jobs = strtol(arg, &end, 10);
+			if (*end || args->jobs <= 0) {
+				prlog(PR_ERR, "ERROR: Number of jobs must be a positive integer, found %s\n", arg);
+				rc = ARG_PARSE_FAIL;
+			}
+			break;
+		case ARGP_OPT_OUTPUT_KEY:
+			rc = parseOutputFormat(arg, &args->outForm);
+			break;
 		case 'v':
 			verbose = PR_DEBUG;
 			break;
@@ -132,7 +244,7 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 				break;
 			}
 			current = state ->next - 1;
-	        while(state->next != state->argc && state->argv[state->next][0] != '-')
+	        while(state->next != state->argc && (state->argv[state->next][0] != '-' || isStdio(state->argv[state->next])))
 	            state->next++;
 	        args->updateVarCount = (state->next - current);
 	        args->updateVars = malloc(sizeof(char*) * args->updateVarCount);
@@ -151,7 +263,7 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 				break;
 			}
 			current = state ->next - 1;
-	        while(state->next != state->argc && state->argv[state->next][0] != '-')
+	        while(state->next != state->argc && (state->argv[state->next][0] != '-' || isStdio(state->argv[state->next])))
 	            state->next++;
 	        args->currVarCount = (state->next - current);
 	        args->currentVars = malloc(sizeof(char*) * args->currVarCount);
@@ -175,9 +287,15 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
 					"-u <varName_1> <authFileForVar_1> <varName_2> <authFileForVar_2> ...\n\t\t"
 					"Where <varName> is one of {'PK','KEK','db','dbx'} and <authFileForVar> is "
 					"a properly generated authenticated variable file\n");
+			else if (args->fleetPath && (args->pathToSecVars || args->currVarCount || args->writeFlag || args->planFlag))
+				prlog(PR_ERR, "ERROR: --fleet cannot be used with -p, -c, -w or --plan\n");
+			else if (args->writeFlag && args->pathToSecVars && isSnapshot(args->pathToSecVars))
+				prlog(PR_ERR, "ERROR: Cannot update a packed snapshot. remove -w\n");
 			else if (args->currVarCount) {
 				if (args->writeFlag)
 					prlog(PR_ERR, "ERROR: Cannot update files if current variable files are given. remove -w\n");
+				else if (args->currVarCount == 1 && isSnapshot(args->currentVars[0]))
+					break;
 				else if (validateVarsArg((const char **) args->currentVars, args->currVarCount)) 
 					prlog(PR_ERR,"ERROR: Current vars list not in right format: "
 						"<varName_1> <eslFileForVar_1> <varName_2> <eslFileForVar_2> ...\n\t\t"
@@ -207,12 +325,21 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
  *@param updateCount length of updateVars
  *@param path holds path if -p option or null if no -p
  *@param writeFlag 0 if -w no given, 1 if given
+ *@param planFlag 1 if --plan was given, the updates are reordered before processing
+ *@param jobs number of threads to check signatures with, 0 for 1
+ *@param memo verdicts of earlier signature checks, NULL for none
+ *@param e emitter for structured output, NULL for text output
  *@return SUCCESS or error value
  */
-static int verify(char * currentVars[], int currCount, const char *updateVars[], int updateCount, const char *path, int writeFlag)
+static int verify(char * currentVars[], int currCount, const char *updateVars[], int updateCount, const char *path, int writeFlag, int planFlag, int jobs, struct verifyMemo *memo, struct emitter *e)
 {
 	int rc;
 	struct list_head update_bank,variable_bank, update_bank_copy;
+	struct secvar_ctx ctx;
+	secvar_ctx_init(&ctx);
+	if (jobs)
+		ctx.jobs = jobs;
+	ctx.memo = memo;
 	list_head_init(&variable_bank);
 	list_head_init(&update_bank);
 	list_head_init(&update_bank_copy);
@@ -228,10 +355,12 @@ static int verify(char * currentVars[], int currCount, const char *updateVars[],
 	rc = validateBanks(&update_bank,&variable_bank);
 	if(rc){
 		prlog(PR_ERR,"ERROR:Could not validate data in banks\n");
+		if (e)
+			emitString(e, "error", "invalid input data");
 		goto out;
 	}
 	// run preprocess
-	rc = edk2_compatible_v1.pre_process(&variable_bank, &update_bank);
+	rc = edk2_compatible_v1.pre_process(&ctx, &variable_bank, &update_bank);
 	if (rc) {
 		prlog(PR_ERR,"ERROR: Failed in preprocessing OPAL ERR = %d = %s\n",rc, opalErrToString(rc));
 		goto out;
@@ -240,10 +369,20 @@ static int verify(char * currentVars[], int currCount, const char *updateVars[],
 		prlog(PR_INFO, "PRE PROCESSING BANKS:\n");
 		printBanks(&variable_bank, &update_bank);
 	}
+	if (planFlag) {
+		rc = planUpdates(&ctx, &variable_bank, &update_bank, updateVars, updateCount, e);
+		if (rc) {
+			prlog(PR_ERR, "ERROR: Could not find an order in which all updates apply\n");
+			goto out;
+		}
+	}
 	// create copy of update_bank (it changes after process) and if we write, we are going to want to have original auth's
 	if (writeFlag) copy_bank_list(&update_bank_copy, &update_bank);
 	// run process
-	rc = edk2_compatible_v1.process(&variable_bank, &update_bank);
+	if (e)
+		rc = processEachUpdate(&ctx, &variable_bank, &update_bank, e);
+	else
+		rc = edk2_compatible_v1.process(&ctx, &variable_bank, &update_bank);
 	if (rc) {
 		prlog(PR_ERR,"ERROR: Failed in processing OPAL ERR = %d = %s\n",rc, opalErrToString(rc));
 		goto out;
@@ -269,37 +408,398 @@ out:
 }
 
 
+/**
+ *verifies one set of updates against every snapshot of a fleet, updates are read and validated once,
+ *hosts that start from the same PK, KEK and TS get the same verdict so only the first of them is processed
+ *@param fleetPath directory holding one snapshot root per subdirectory
+ *@param updateVars holds content of -u argument
+ *@param updateCount length of updateVars
+ *@param jobs number of threads, 0 for one per online cpu
+ *@param memo verdicts of earlier signature checks, NULL for none
+ *@param e emitter for structured output, NULL for text output
+ *@return SUCCESS if the updates are valid for every host, else the error of the first failing host
+ */
+static int verifyFleet(const char *fleetPath, const char *updateVars[], int updateCount, int jobs, struct verifyMemo *memo, struct emitter *e)
+{
+	int rc;
+	size_t i, j, n;
+	struct fleet f = { .hosts = NULL, .count = 0, .groups = 0, .memo = memo };
+	struct fleetHost **sorted = NULL;
+	struct list_head unused;
+	struct threadpool *pool = NULL;
+
+	list_head_init(&f.update_bank);
+	list_head_init(&unused);
+	rc = setupBanks(&unused, &f.update_bank, (char *[]){ NULL }, 0, updateVars, updateCount, NULL);
+	if (!rc)
+		rc = validateUpdateBank(&f.update_bank);
+	if (rc) {
+		prlog(PR_ERR, "ERROR: Could not validate updates\n");
+		if (e)
+			emitString(e, "error", "invalid input data");
+		goto out;
+	}
+	rc = getFleetHosts(&f, fleetPath);
+	if (rc)
+		goto out;
+	pool = threadpoolCreate(jobs ? jobs : threadpoolDefaultSize());
+	if (!pool) {
+		prlog(PR_ERR, "ERROR: failed to start threads\n");
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	// a job only fails on errors that are not the host's fault, bad data is recorded in the host's rc
+	rc = threadpoolRun(pool, scanFleetHost, &f, f.count);
+	if (rc)
+		goto out;
+
+	// sort by authorities so that hosts sharing them are adjacent, the first host of each run is the one processed
+	sorted = malloc(f.count * sizeof(*sorted));
+	if (!sorted) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	for (i = 0, n = 0; i < f.count; i++) {
+		f.hosts[i].group = i;
+		if (!f.hosts[i].error)
+			sorted[n++] = &f.hosts[i];
+	}
+	qsort(sorted, n, sizeof(*sorted), compareAuthorities);
+	for (i = 0; i < n; i = j, f.groups++) {
+		for (j = i; j < n && !memcmp(sorted[i]->authorities, sorted[j]->authorities, sizeof(sorted[i]->authorities)); j++)
+			sorted[j]->group = sorted[i] - f.hosts;
+	}
+
+	rc = threadpoolRun(pool, processFleetHost, &f, f.count);
+	if (rc)
+		goto out;
+	for (i = 0; i < f.count; i++) {
+		if (!f.hosts[i].error && f.hosts[i].group != i) {
+			f.hosts[i].rc = f.hosts[f.hosts[i].group].rc;
+			f.hosts[i].error = f.hosts[f.hosts[i].group].error;
+		}
+	}
+	printFleet(&f, e);
+	for (i = 0; i < f.count && !rc; i++)
+		rc = f.hosts[i].rc;
+
+out:
+	if (pool)
+		threadpoolDestroy(pool);
+	for (i = 0; i < f.count; i++) {
+		free(f.hosts[i].name);
+		free(f.hosts[i].path);
+	}
+	free(f.hosts);
+	free(sorted);
+	clear_bank_list(&f.update_bank);
+	clear_bank_list(&unused);
+
+	return rc;
+}
+
+/**
+ *fills f->hosts with every subdirectory and packed snapshot of fleetPath, in name order
+ *@param f fleet to fill
+ *@param fleetPath directory holding one snapshot root per subdirectory
+ *@return SUCCESS or error if the directory could not be read or holds no snapshots
+ */
+static int getFleetHosts(struct fleet *f, const char *fleetPath)
+{
+	int n, rc = SUCCESS;
+	struct dirent **entries = NULL;
+	struct stat st;
+	char *path;
+
+	n = scandir(fleetPath, &entries, NULL, alphasort);
+	if (n < 0) {
+		prlog(PR_ERR, "ERROR: Could not open fleet directory %s\n", fleetPath);
+		return INVALID_FILE;
+	}
+	f->hosts = calloc(n ? n : 1, sizeof(*f->hosts));
+	if (!f->hosts) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	for (int i = 0; i < n; i++) {
+		if (entries[i]->d_name[0] == '.')
+			continue;
+		// directory vars are found by appending <var>/data to the path so it needs the trailing '/'
+		path = malloc(strlen(fleetPath) + strlen(entries[i]->d_name) + 3);
+		if (!path) {
+			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+			rc = ALLOC_FAIL;
+			goto out;
+		}
+		sprintf(path, "%s/%s", fleetPath, entries[i]->d_name);
+		if (stat(path, &st) || !(S_ISDIR(st.st_mode) || (S_ISREG(st.st_mode) && isSnapshot(path)))) {
+			free(path);
+			continue;
+		}
+		if (S_ISDIR(st.st_mode))
+			strcat(path, "/");
+		f->hosts[f->count].path = path;
+		f->hosts[f->count].name = strdup(entries[i]->d_name);
+		if (!f->hosts[f->count++].name) {
+			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+			rc = ALLOC_FAIL;
+			goto out;
+		}
+	}
+	if (!f->count) {
+		prlog(PR_ERR, "ERROR: No snapshots found in %s\n", fleetPath);
+		rc = INVALID_FILE;
+	}
+	prlog(PR_INFO, "Found %zu snapshots in %s\n", f->count, fleetPath);
+
+out:
+	for (int i = 0; i < n; i++)
+		free(entries[i]);
+	free(entries);
+
+	return rc;
+}
+
+/**
+ *threadpool job, reads and validates the current variables of one host and hashes its authorities
+ *@param ctx struct fleet
+ *@param index host to scan
+ *@return SUCCESS or error if the host could not be scanned for reasons other than its data
+ */
+static int scanFleetHost(void *ctx, size_t index)
+{
+	struct fleetHost *host = &((struct fleet *)ctx)->hosts[index];
+	struct list_head variable_bank, update_bank;
+	int rc = SUCCESS;
+
+	list_head_init(&variable_bank);
+	list_head_init(&update_bank);
+	host->rc = setupBanks(&variable_bank, &update_bank, NULL, 0, NULL, 0, host->path);
+	if (host->rc) {
+		host->error = "Unreadable Current Variables";
+		goto out;
+	}
+	host->rc = validateVariableBank(&variable_bank);
+	if (host->rc) {
+		prlog(PR_ERR, "ERROR: Could not validate current variables of %s\n", host->name);
+		host->error = "Invalid Current Variables";
+		goto out;
+	}
+	rc = hashAuthorities(&variable_bank, host->authorities);
+
+out:
+	clear_bank_list(&variable_bank);
+	clear_bank_list(&update_bank);
+
+	return rc;
+}
+
+/**
+ *threadpool job, runs pre_process and process for one host if it is the first host of its group
+ *@param ctx struct fleet
+ *@param index host to process
+ *@return SUCCESS or error if the host could not be processed for reasons other than its data
+ */
+static int processFleetHost(void *ctx, size_t index)
+{
+	struct fleet *f = ctx;
+	struct fleetHost *host = &f->hosts[index];
+	struct list_head variable_bank, update_bank;
+	struct secvar_ctx secvarCtx;
+	int rc;
+
+	if (host->error || host->group != index)
+		return SUCCESS;
+	secvar_ctx_init(&secvarCtx);
+	secvarCtx.memo = f->memo;
+	list_head_init(&variable_bank);
+	list_head_init(&update_bank);
+	rc = setupBanks(&variable_bank, &update_bank, NULL, 0, NULL, 0, host->path);
+	if (rc)
+		goto out;
+	// process() empties the update bank so every host needs its own copy
+	copy_bank_list(&update_bank, &f->update_bank);
+	host->rc = edk2_compatible_v1.pre_process(&secvarCtx, &variable_bank, &update_bank);
+	if (!host->rc)
+		host->rc = edk2_compatible_v1.process(&secvarCtx, &variable_bank, &update_bank);
+	if (host->rc)
+		host->error = opalErrToString(host->rc);
+
+out:
+	clear_bank_list(&variable_bank);
+	clear_bank_list(&update_bank);
+
+	return rc;
+}
+
+/**
+ *hashes the PK, KEK and TS of a bank, missing variables hash the same as empty ones
+ *@param variable_bank list of secvar's of current variables
+ *@param out filled with the 32 byte sha256
+ *@return SUCCESS or error
+ */
+static int hashAuthorities(struct list_head *variable_bank, unsigned char *out)
+{
+	const char *authorities[] = { "PK", "KEK", "TS" };
+	struct secvar *var;
+	crypto_md_ctx *ctx = NULL;
+	uint64_t size;
+	int rc;
+
+	rc = crypto_md_ctx_init(&ctx, CRYPTO_MD_SHA256);
+	for (int i = 0; i < ARRAY_SIZE(authorities) && !rc; i++) {
+		var = find_secvar(authorities[i], strlen(authorities[i]) + 1, variable_bank);
+		size = var ? var->data_size : 0;
+		// sizes are hashed too so bytes moved from one variable to the next change the result
+		rc = crypto_md_update(ctx, (unsigned char *)&size, sizeof(size));
+		if (!rc && size)
+			rc = crypto_md_update(ctx, (unsigned char *)var->data, size);
+	}
+	if (!rc)
+		rc = crypto_md_finish(ctx, out);
+	if (ctx)
+		crypto_md_free(ctx);
+	if (rc) {
+		prlog(PR_ERR, "ERROR: failed to hash current variables\n");
+		return HASH_FAIL;
+	}
+
+	return SUCCESS;
+}
+
+// qsort comparison of two struct fleetHost pointers, ties keep host order
+static int compareAuthorities(const void *a, const void *b)
+{
+	const struct fleetHost *x = *(const struct fleetHost **)a, *y = *(const struct fleetHost **)b;
+	int rc = memcmp(x->authorities, y->authorities, sizeof(x->authorities));
+
+	if (rc)
+		return rc;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ *prints the verdict of every host as a table, or emits it as a "hosts" array
+ *@param f fleet after processing
+ *@param e emitter for structured output, NULL for text output
+ */
+static void printFleet(struct fleet *f, struct emitter *e)
+{
+	size_t i, valid = 0;
+
+	for (i = 0; i < f->count; i++) {
+		if (!f->hosts[i].rc)
+			valid++;
+	}
+	if (e) {
+		emitArrayStart(e, "hosts");
+		for (i = 0; i < f->count; i++) {
+			emitMapStart(e, NULL);
+			emitString(e, "name", f->hosts[i].name);
+			emitString(e, "verdict", f->hosts[i].rc ? "invalid" : "valid");
+			if (f->hosts[i].rc) {
+				emitString(e, "error", f->hosts[i].error);
+				emitInt(e, "errorCode", f->hosts[i].rc);
+			}
+			emitMapEnd(e);
+		}
+		emitArrayEnd(e);
+		emitInt(e, "valid", valid);
+		emitInt(e, "invalid", f->count - valid);
+		emitInt(e, "processed", f->groups);
+		return;
+	}
+	printf("%-32s %-8s %s\n", "HOST", "VERDICT", "ERROR");
+	for (i = 0; i < f->count; i++)
+		printf("%-32s %-8s %s\n", f->hosts[i].name, f->hosts[i].rc ? "invalid" : "valid", f->hosts[i].rc ? f->hosts[i].error : "");
+	printf("%zu hosts: %zu valid, %zu invalid, %zu distinct PK/KEK/TS processed\n", f->count, valid, f->count - valid, f->groups);
+}
+
+/**
+ *does the same as edk2_compatible_v1.process but one update at a time, so that a verdict can be emitted for every update
+ *the first failure stops processing, like process(), and the remaining updates are reported as skipped
+ *@param ctx context that pre_process was run with
+ *@param variable_bank list of secvar's of current variables, only updated if all updates are valid
+ *@param update_bank list of secvar's of update variables, will be emptied
+ *@param e emitter for structured output
+ *@return SUCCESS or OPAL error of the first failing update
+ */
+static int processEachUpdate(struct secvar_ctx *ctx, struct list_head *variable_bank, struct list_head *update_bank, struct emitter *e)
+{
+	int rc = OPAL_SUCCESS;
+	bool initialSetupMode = ctx->setup_mode;
+	struct list_head single, working_bank;
+	struct secvar *var, *tmp;
+
+	list_head_init(&working_bank);
+	copy_bank_list(&working_bank, variable_bank);
+	emitArrayStart(e, "updates");
+	list_for_each(update_bank, var, link) {
+		emitMapStart(e, NULL);
+		emitString(e, "name", var->key);
+		emitInt(e, "size", var->data_size);
+		if (rc) {
+			emitString(e, "verdict", "skipped");
+			emitMapEnd(e);
+			continue;
+		}
+		list_head_init(&single);
+		tmp = new_secvar(var->key, var->key_len, var->data, var->data_size, var->flags);
+		if (!tmp) {
+			rc = OPAL_NO_MEM;
+			emitString(e, "verdict", "error");
+			emitMapEnd(e);
+			continue;
+		}
+		list_add_tail(&single, &tmp->link);
+		// process() recomputes setup mode after every call, the whole queue is judged against the initial one
+		ctx->setup_mode = initialSetupMode;
+		rc = edk2_compatible_v1.process(ctx, &working_bank, &single);
+		clear_bank_list(&single);
+		emitString(e, "verdict", rc ? "invalid" : "valid");
+		if (rc)
+			emitString(e, "error", opalErrToString(rc));
+		emitMapEnd(e);
+	}
+	emitArrayEnd(e);
+	clear_bank_list(update_bank);
+
+	if (!rc) {
+		clear_bank_list(variable_bank);
+		copy_bank_list(variable_bank, &working_bank);
+		emitArrayStart(e, "variables");
+		list_for_each(variable_bank, var, link) {
+			emitMapStart(e, NULL);
+			emitString(e, "name", var->key);
+			emitInt(e, "size", var->data_size);
+			emitMapEnd(e);
+		}
+		emitArrayEnd(e);
+	}
+	clear_bank_list(&working_bank);
+
+	return rc;
+}
+
 /**
  *parses arrays into banks with appropriate data
  *@param variable_bank will be filled with data depending on currentVars
  *@param update_bank will be filled with data dependent on updateVars
- *@param currentVars holds content of -c argument/or null if no -c
+ *@param currentVars holds content of -c argument/or null if no -c, a single item is a packed snapshot
  *@param currCount length of currentVars
  *@param updateVars holds content of -u argument
  *@param updateCount length of updateVars
- *@param path holds path to current vars
+ *@param path holds path to current vars, a directory or a packed snapshot
  *@return SUCCESS or error value
  */
 static int setupBanks(struct list_head *variable_bank, struct list_head *update_bank, char * currentVars[], int currCount, const char *updateVars[], int updateCount, const char* path)
 {
-	int defaultVarsFlag = 0;
 	size_t len;
-	struct secvar *tmp = NULL;
 	char * c;
 
-	// if current vars string is given, check it. if not, get default/path vars
-	if (!currentVars) { 
-		defaultVarsFlag = 1;
-		// max length of this array is #OfVars *2 b/c max contents= {Pk, path/pk/data, KEK, path/kek/data,etc}
-		currentVars = calloc(1, sizeof(char*) * ARRAY_SIZE(variables) * 2);
-		if (!currentVars) {
-			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
-			return ALLOC_FAIL;
-		}
-		getCurrentVars(currentVars, &currCount, path);	
-	}
-
-	// once here, strings should be ready, it is time to fill banks
 	// fill update bank with all updates
 	for (int i = 0;i < updateCount; i += 2) { 
 		c = getDataFromFile((char *)updateVars[i + 1], &len);
@@ -310,30 +810,20 @@ static int setupBanks(struct list_head *variable_bank, struct list_head *update_
 		else 
 			prlog(PR_INFO, "Failed to open %s, not adding it to list\n", updateVars[i + 1]);
 	}
+	// if current vars are not given, get default/path vars
+	if (!currentVars) 
+		return loadSecVars(variable_bank, path, NULL);
+	if (currCount == 1)
+		return loadSecVars(variable_bank, currentVars[0], NULL);
 	// fill variable bank with current vars
 	for(int i = 0; i < currCount; i += 2){
-		if (defaultVarsFlag) {
-			// if getting secvar successful add tmp to list
-			if (!getSecVar(&tmp, currentVars[i], currentVars[i + 1])) 
-				list_add_tail(variable_bank,&tmp->link);
-			
-		}
-		else {
-			c = getDataFromFile( (char *)currentVars[i + 1], &len);
-			if (c) {
-				list_add_tail(variable_bank, &new_secvar(currentVars[i], strlen(currentVars[i]) + 1, c, len, 0)->link);
-				free(c);
-			}
-			else 
-				prlog(PR_INFO, "Failed to open %s, not adding it to list\n", currentVars[i + 1]);
+		c = getDataFromFile( (char *)currentVars[i + 1], &len);
+		if (c) {
+			list_add_tail(variable_bank, &new_secvar(currentVars[i], strlen(currentVars[i]) + 1, c, len, 0)->link);
+			free(c);
 		}
-	}
-	// cleanup because of dynamically allocated memory of default paths, need to cleanup pointer to array and pointer to strings
-	if (defaultVarsFlag) {	
-		for( int i = 0; i < currCount; i++)
-			free(currentVars[i]);
-		free(currentVars);
-		currentVars = NULL;
+		else 
+			prlog(PR_INFO, "Failed to open %s, not adding it to list\n", currentVars[i + 1]);
 	}
 
 	return SUCCESS;
@@ -347,11 +837,43 @@ static int setupBanks(struct list_head *variable_bank, struct list_head *update_
  */
 static int validateBanks(struct list_head *update_bank, struct list_head *variable_bank)
 {	
-	int rc = SUCCESS;
+	int rc;
 	struct secvar *var = NULL;
 
+	rc = validateUpdateBank(update_bank);
+	if (rc)
+		return rc;
+	rc = validateVariableBank(variable_bank);
+	if (rc)
+		return rc;
+
+	// print current contents of banks
+	if (verbose >= PR_INFO) {	
+		prlog(PR_INFO, "Current Variables are : ");
+		list_for_each(variable_bank, var, link){
+			prlog(PR_INFO, "%s ", var->key);
+		}
+		prlog(PR_INFO,"\n");
+		prlog(PR_INFO,"Update Variables are : ");
+		list_for_each(update_bank, var,link){
+			prlog(PR_INFO, "%s ", var->key);
+		}
+		prlog(PR_INFO,"\n");
+	}
+
+	return rc;
+}
+
+/**
+ *runs auth validation on every update
+ *@param update_bank list of secvar's of update variables
+ *@return SUCCESS or error value if any auth fails
+ */
+static int validateUpdateBank(struct list_head *update_bank)
+{
+	int rc = SUCCESS;
+	struct secvar *var = NULL;
 
-	// validate all data in both banks using efi-validate
 	list_for_each(update_bank, var,link){
 		prlog(PR_INFO, "----VALIDATING UPDATE FOR %s----\n", var->key);
 		// return early if they try to update TS
@@ -367,35 +889,34 @@ static int validateBanks(struct list_head *update_bank, struct list_head *variab
 		}
 	}
 
+	return rc;
+}
+
+/**
+ *runs esl validation on every current variable (timestamp validation for TS)
+ *@param variable_bank list of secvar's of current variables
+ *@return SUCCESS or error value if any variable fails
+ */
+static int validateVariableBank(struct list_head *variable_bank)
+{
+	int rc = SUCCESS;
+	struct secvar *var = NULL;
+
 	// if no PK then were in setup mode so skip vallidation of current keys
-	if (find_secvar("PK", 3, variable_bank)) {
-		list_for_each(variable_bank, var, link) {
-			prlog(PR_INFO, "----VALIDATING CURRENT VAR: %s----\n", var->key);
-			if (strcmp(var->key, "TS") == 0) 
-				rc = validateTS((unsigned char *)var->data, var->data_size);
-			else
-				rc = validateESL((unsigned char *)var->data, var->data_size, var->key);
-			if (rc) {
-				prlog(PR_ERR, "ERROR: failed to validate data file for %s,returned %d\n", var->key, rc);
-				return rc;
-			}
-		}
-	}
-	else
+	if (!find_secvar("PK", 3, variable_bank)) {
 		prlog(PR_WARNING, "WARNING: No PK, entering setup mode, no validation on current keys will be done\n");
-
-	// print current contents of banks
-	if (verbose >= PR_INFO) {	
-		prlog(PR_INFO, "Current Variables are : ");
-		list_for_each(variable_bank, var, link){
-			prlog(PR_INFO, "%s ", var->key);
-		}
-		prlog(PR_INFO,"\n");
-		prlog(PR_INFO,"Update Variables are : ");
-		list_for_each(update_bank, var,link){
-			prlog(PR_INFO, "%s ", var->key);
+		return rc;
+	}
+	list_for_each(variable_bank, var, link) {
+		prlog(PR_INFO, "----VALIDATING CURRENT VAR: %s----\n", var->key);
+		if (strcmp(var->key, "TS") == 0) 
+			rc = validateTS((unsigned char *)var->data, var->data_size);
+		else
+			rc = validateESL((unsigned char *)var->data, var->data_size, var->key);
+		if (rc) {
+			prlog(PR_ERR, "ERROR: failed to validate data file for %s,returned %d\n", var->key, rc);
+			return rc;
 		}
-		prlog(PR_INFO,"\n");
 	}
 
 	return rc;
@@ -434,56 +955,6 @@ static int validateVarsArg(const char *vars[], int size)
 }
 
 
-/**
- *called if -c not used, tries to find the variables in the path/default path
- *@param newCurr , empty array of strings to be filled
- *@param size , pointer to integer to be filled with length of newCurr
- *@param path , path to the location of the subdirectories {"PK", "KEK", "db", "dbx", "TS"}
- *@return the return of the validation of newCurr, SUCCESS if everything is ordered and formated right
- */
-static int getCurrentVars(char *newCurr[], int *size, const char* path)
-{
-	int lenCtr = 0, i, offset = 0;
-	char *ext = "/data";
-	char *fullPath = NULL;
-	for (i = 0; i < ARRAY_SIZE(variables); i++) {
-		fullPath = malloc(strlen(path) + strlen(variables[i]) + strlen(ext) + 1);
-		if (!fullPath) { 
-			prlog(PR_ERR, "ERROR: failed to allocate memory\n");
-			return ALLOC_FAIL;
-		}
-		strcpy(fullPath, path);
-		offset += strlen(path);
-		strncpy(fullPath + offset, variables[i], strlen(variables[i]));
-		offset += strlen(variables[i]);
-		strncpy(fullPath + offset, ext, strlen(ext) + 1);
-		// if it is a file then add variable name and data file to newCurr
-		if (!isFile(fullPath)) {
-			newCurr[lenCtr] = malloc(strlen(variables[i]) + 1);
-			if (!newCurr[lenCtr]) {
-				prlog(PR_ERR, "ERROR: failed to allocate memory\n");
-				free(fullPath);
-				return ALLOC_FAIL;
-			}
-			strncpy(newCurr[lenCtr++], variables[i], strlen(variables[i]) + 1);
-			newCurr[lenCtr] = malloc(strlen(fullPath) + 1);
-			if (!newCurr[lenCtr]) {
-				prlog(PR_ERR, "ERROR: failed to allocate memory\n");
-				free(fullPath);
-				return ALLOC_FAIL;
-			}
-
-			strcpy(newCurr[lenCtr++],fullPath);
-		}
-		offset = 0;
-		free(fullPath);
-		fullPath = NULL;
-	}
-	*size = lenCtr;
-
-	return validateVarsArg((const char**)newCurr, *size);
-}
-
 /**
  *prints the name and size of each secvar in the banks
  *@param variable_bank list of secvar's of current variables
@@ -15,6 +15,14 @@
 // all argp options must have a single character option 
 // so we set --usage to have a single character option that is out of range
 #define ARGP_OPT_USAGE_KEY 0x100
+// long only options, also out of the single character range
+#define ARGP_OPT_OUTPUT_KEY 0x101
+#define ARGP_OPT_FLEET_KEY 0x102
+#define ARGP_OPT_SNAPSHOT_KEY 0x103
+#define ARGP_OPT_PLAN_KEY 0x104
+#define ARGP_OPT_SUMMARY_KEY 0x105
+#define ARGP_OPT_DIGEST_KEY 0x106
+#define ARGP_OPT_MEMO_KEY 0x107
 #define CERT_BUFFER_SIZE        2048
 
 #ifndef SECVARPATH
@@ -44,6 +52,7 @@ int performVerificationCommand(int argc, char *argv[]);
 int performWriteCommand(int argc, char *argv[]);
 int performValidation(int argc, char* argv[]); 
 int performGenerateCommand(int argc, char* argv[]);
+int performCheckImageCommand(int argc, char *argv[]);
 
 int printCertInfo(crypto_x509 *x509);
 void printESLInfo(EFI_SIGNATURE_LIST *sigList);
@@ -57,6 +66,13 @@ int parseX509(crypto_x509 **x509, const unsigned char *certBuf, size_t buflen);
 const char* getSigType(const uuid_t);
 
 int getSecVar(struct secvar **var, const char* name, const char *fullPath);
+int loadSecVars(struct list_head *bank, const char *path, const char *name);
+int isSnapshot(const char *path);
+int readSnapshot(struct list_head *bank, const char *file, const char *name);
+int writeSnapshot(const char *file, struct list_head *bank);
+struct emitter;
+struct secvar_ctx;
+int planUpdates(struct secvar_ctx *ctx, struct list_head *variable_bank, struct list_head *update_bank, const char *updateVars[], int updateCount, struct emitter *e);
 int updateVar(const char* path, const char* var, const unsigned char* buff, size_t size);
 int isVariable(const char *var);
 
@@ -67,5 +83,58 @@ int validatePKCS7(const unsigned char *cert_data, size_t len);
 int validateTS(const unsigned char *data, size_t size);
 int validateTime(struct efi_time *time);
 
-extern struct command edk2_compat_command_table[5];
+// what a buffer looks like from its magic bytes and headers, see sniffFormat
+enum fileFormat {
+	FORMAT_UNKNOWN = 0,
+	FORMAT_PEM,
+	FORMAT_X509,
+	FORMAT_PKCS7,
+	FORMAT_AUTH,
+	FORMAT_ESL,
+	FORMAT_HASH,
+	FORMAT_PE,
+};
+enum fileFormat sniffFormat(const unsigned char *buf, size_t size);
+const char *formatName(enum fileFormat format);
+
+// digests computed in one pass over an image, at most one per hash function
+#define PE_MAX_DIGESTS ARRAY_SIZE(hash_functions)
+struct peImage;
+int peOpen(struct peImage **img, const char *file);
+void peClose(struct peImage *img);
+int peDigests(struct peImage *img, const struct hash_funct *algs[], int count, unsigned char *hashes[]);
+int peSignatures(struct peImage *img, const unsigned char *pkcs7[], size_t sizes[], int max);
+int authenticodeHash(const char *file, const struct hash_funct *alg, unsigned char *hash);
+
+// content digests for comparing the variables of many hosts, see edk2-svc-digest.c
+#define DIGEST_SIZE 32
+// level 0 holds the leaves and the last level the root, every level is DIGEST_SIZE digests back to back in nodes,
+// sizes, levels and nodes share one allocation
+struct merkleTree {
+	int levelCount;
+	size_t *sizes;
+	unsigned char **levels;
+	unsigned char *nodes;
+};
+struct eslDigest {
+	// NULL for trailing bytes that are not an ESL
+	const EFI_SIGNATURE_LIST *list;
+	struct merkleTree entries;
+	unsigned char digest[DIGEST_SIZE];
+};
+struct varDigest {
+	const char *name;
+	size_t size, eslCount;
+	int present, valid;
+	struct eslDigest *esls;
+	struct merkleTree eslTree;
+	unsigned char digest[DIGEST_SIZE];
+};
+int merkleBuild(struct merkleTree *tree, const unsigned char *leaves, size_t count);
+const unsigned char *merkleRoot(const struct merkleTree *tree);
+void merkleFree(struct merkleTree *tree);
+int digestVariable(struct varDigest *digest, const char *name, const unsigned char *data, size_t size);
+void freeVarDigest(struct varDigest *digest);
+
+extern struct command edk2_compat_command_table[6];
 #endif
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifdef LAZY_CRYPTO
+// ^only built with LAZY_CRYPTO=1, the crypto backend is then a module (see Makefile) loaded on first use
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include "crypto.h"
+#include "include/prlog.h"
+
+/*
+ *the providers live in a module that is opened by the first crypto_ call (see crypto.c),
+ *so commands that never look at a certificate or signature (ex: read of dbx, TS) never map the crypto library
+ */
+static void *handle = NULL;
+static int openFailed = 0;
+
+static void *openModule(void)
+{
+	const char *env = getenv("SECVARCTL_CRYPTO_MODULE");
+	char path[PATH_MAX], *slash;
+	ssize_t len;
+	void *module;
+
+	if (env)
+		return dlopen(env, RTLD_NOW | RTLD_LOCAL);
+	// a module next to the executable wins, so a build tree never picks up an installed module
+	len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (len > 0) {
+		path[len] = '\0';
+		slash = strrchr(path, '/');
+		if (slash && slash - path + 1 + strlen(CRYPTO_MODULE) < sizeof(path)) {
+			strcpy(slash + 1, CRYPTO_MODULE);
+			module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+			if (module)
+				return module;
+			prlog(PR_INFO, "Could not load crypto module %s: %s\n", path, dlerror());
+		}
+	}
+
+	return dlopen(CRYPTO_MODULE_DIR "/" CRYPTO_MODULE, RTLD_NOW | RTLD_LOCAL);
+}
+
+// only called from loadProviders in crypto.c, which runs once
+const struct crypto_provider *crypto_module_provider(const char *symbol)
+{
+	const struct crypto_provider *ops;
+
+	if (openFailed)
+		return NULL;
+	if (!handle) {
+		handle = openModule();
+		if (!handle) {
+			prlog(PR_ERR, "ERROR: Could not load crypto module: %s\n", dlerror());
+			openFailed = 1;
+			return NULL;
+		}
+		prlog(PR_INFO, "Loaded crypto module\n");
+	}
+	ops = dlsym(handle, symbol);
+	if (!ops)
+		prlog(PR_ERR, "ERROR: Crypto module does not have %s\n", symbol);
+
+	return ops;
+}
+
+#endif
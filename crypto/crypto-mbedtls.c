@@ -11,22 +11,61 @@
 
 #include <mbedtls/pk_internal.h> // for validating cert pk data
 #include <mbedtls/error.h> 
+#include <mbedtls/md.h>
 #include "external/extraMbedtls/include/pkcs7.h"
 #include "external/extraMbedtls/include/generate-pkcs7.h"
 #include <mbedtls/platform.h>
 #include "generic.h"
+#include "timing.h"
+#include "memstats.h"
 
-crypto_pkcs7 *crypto_pkcs7_parse_der(const unsigned char *buf, const int buflen) 
+// what the opaque crypto.h types point to in this provider
+static mbedtls_x509_crt *crt(crypto_x509 *x509)
+{
+    return (mbedtls_x509_crt *)x509;
+}
+
+static mbedtls_md_context_t *mdCtx(crypto_md_ctx *ctx)
+{
+    return (mbedtls_md_context_t *)ctx;
+}
+
+// crypto.h message digest ids to mbedtls ones
+static mbedtls_md_type_t md_type(int md_id)
+{
+    switch (md_id) {
+        case CRYPTO_MD_SHA1:
+            return MBEDTLS_MD_SHA1;
+        case CRYPTO_MD_SHA224:
+            return MBEDTLS_MD_SHA224;
+        case CRYPTO_MD_SHA256:
+            return MBEDTLS_MD_SHA256;
+        case CRYPTO_MD_SHA384:
+            return MBEDTLS_MD_SHA384;
+        case CRYPTO_MD_SHA512:
+            return MBEDTLS_MD_SHA512;
+        default:
+            return MBEDTLS_MD_NONE;
+    }
+}
+
+static crypto_pkcs7 *mbed_pkcs7_parse_der(const unsigned char *buf, const int buflen) 
 {
     int rc;
     struct mbedtls_pkcs7 *pkcs7;
+    uint64_t start;
+    enum memTag tag;
     pkcs7 = malloc(sizeof(struct mbedtls_pkcs7));
     if (!pkcs7) {
      prlog(PR_ERR, "ERROR: failed to allocate memory\n");
      return NULL;
     }
     mbedtls_pkcs7_init(pkcs7);
+    tag = memTagEnter(MEM_PKCS7);
+    start = timingStart();
     rc = mbedtls_pkcs7_parse_der(buf, buflen, pkcs7);
+    timingStop(TIMING_PKCS7_PARSE, start);
+    memTagExit(tag);
     if (rc != MBEDTLS_PKCS7_SIGNED_DATA)  // if pkcs7 parsing fails, then try new signed data format 
             prlog(PR_ERR, "ERROR: parsing pkcs7 failed mbedtls error #%04x\n", rc); 
     else 
@@ -38,68 +77,82 @@ crypto_pkcs7 *crypto_pkcs7_parse_der(const unsigned char *buf, const int buflen)
         return NULL;
     }
     else
-        return pkcs7;
+        return (crypto_pkcs7 *)pkcs7;
 }
 
-int crypto_pkcs7_md_is_sha256(crypto_pkcs7 *pkcs7)
+static int mbed_pkcs7_md_is_sha256(crypto_pkcs7 *pkcs7)
 {
     return MBEDTLS_OID_CMP(MBEDTLS_OID_DIGEST_ALG_SHA256, &((struct mbedtls_pkcs7 *)pkcs7)->signed_data.digest_alg_identifiers);
 }
 
-void crypto_pkcs7_free(crypto_pkcs7 *pkcs7)
+static void mbed_pkcs7_free(crypto_pkcs7 *pkcs7)
 {
         mbedtls_pkcs7_free((struct mbedtls_pkcs7 *)pkcs7);
         free(pkcs7);
 }
 
-crypto_x509* crypto_pkcs7_get_signing_cert(crypto_pkcs7 *pkcs7, int cert_num)
+static crypto_x509 *mbed_pkcs7_get_signing_cert(crypto_pkcs7 *pkcs7, int cert_num)
 {
     mbedtls_x509_crt *pkcs7_cert = NULL;
 
-    pkcs7_cert = &pkcs7->signed_data.certs;
+    pkcs7_cert = &((struct mbedtls_pkcs7 *)pkcs7)->signed_data.certs;
     for (int i = 0; i < cert_num && pkcs7_cert != NULL; i++)
         pkcs7_cert = pkcs7_cert->next;
 
-    return pkcs7_cert;
+    return (crypto_x509 *)pkcs7_cert;
 
 }
 
-int crypto_pkcs7_signed_hash_verify(crypto_pkcs7 *pkcs7, crypto_x509 *x509, unsigned char *hash, int hash_len)
+static int mbed_pkcs7_signed_hash_verify(crypto_pkcs7 *pkcs7, crypto_x509 *x509, unsigned char *hash, int hash_len)
 {
-    return mbedtls_pkcs7_signed_hash_verify(pkcs7, x509, hash, hash_len);
+    uint64_t start = timingStart();
+    int rc = mbedtls_pkcs7_signed_hash_verify((struct mbedtls_pkcs7 *)pkcs7, crt(x509), hash, hash_len);
+
+    timingStop(TIMING_SIG_VERIFY, start);
+    return rc;
 }
 
-int crypto_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize, 
+static int mbed_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize, 
     const char** crtFiles, const char** keyFiles,  int keyPairs, int hashFunct)
 {
-    return to_pkcs7_generate_signature(pkcs7, pkcs7Size, newData, newDataSize, crtFiles, keyFiles, keyPairs, hashFunct);
+    enum memTag tag = memTagEnter(MEM_PKCS7);
+    uint64_t start = timingStart();
+    int rc = to_pkcs7_generate_signature(pkcs7, pkcs7Size, newData, newDataSize, crtFiles, keyFiles, keyPairs, md_type(hashFunct));
+
+    timingStop(TIMING_SIGN, start);
+    memTagExit(tag);
+    return rc;
 }
 
-int crypto_pkcs7_generate_w_already_signed_data(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize, 
+static int mbed_pkcs7_generate_w_already_signed_data(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize, 
     const char** crtFiles, const char** sigFiles,  int keyPairs, int hashFunct)
 {
-    return to_pkcs7_already_signed_data(pkcs7, pkcs7Size, newData, newDataSize, crtFiles, sigFiles, keyPairs, hashFunct);
+    enum memTag tag = memTagEnter(MEM_PKCS7);
+    int rc = to_pkcs7_already_signed_data(pkcs7, pkcs7Size, newData, newDataSize, crtFiles, sigFiles, keyPairs, md_type(hashFunct));
+
+    memTagExit(tag);
+    return rc;
 }
 
-int crypto_x509_get_der_len(crypto_x509 *x509) 
+static int mbed_x509_get_der_len(crypto_x509 *x509) 
 {
-    return x509->raw.len; 
+    return crt(x509)->raw.len; 
 }
 
-int crypto_x509_get_tbs_der_len(crypto_x509 *x509) 
+static int mbed_x509_get_tbs_der_len(crypto_x509 *x509) 
 {
-    return x509->tbs.len;
+    return crt(x509)->tbs.len;
 }
 
-int crypto_x509_get_version(crypto_x509 *x509) 
+static int mbed_x509_get_version(crypto_x509 *x509) 
 {
-    return x509->version;
+    return crt(x509)->version;
 }
 
-int crypto_x509_is_RSA(crypto_x509 *x509)
+static int mbed_x509_is_RSA(crypto_x509 *x509)
 {
     int pk_type;
-    pk_type = x509->pk.pk_info->type;
+    pk_type = crt(x509)->pk.pk_info->type;
     if (pk_type != MBEDTLS_PK_RSA)
         //zero is also a pk type (MBEDTLS_PK_NONE) so return generic failure if zero so it doesnt look like a success
        return  (pk_type == 0 ? CERT_FAIL : pk_type);
@@ -107,80 +160,108 @@ int crypto_x509_is_RSA(crypto_x509 *x509)
         return SUCCESS;
 }
 
-int crypto_x509_get_sig_len(crypto_x509 *x509)
+static int mbed_x509_get_sig_len(crypto_x509 *x509)
 {
-    return x509->sig.len;
+    return crt(x509)->sig.len;
 }
 
-int crypto_x509_md_is_sha256(crypto_x509 *x509)
+static int mbed_x509_md_is_sha256(crypto_x509 *x509)
 {
-    if (x509->sig_md == MBEDTLS_MD_SHA256) 
+    if (crt(x509)->sig_md == MBEDTLS_MD_SHA256) 
         return SUCCESS;
     else
         return CERT_FAIL;
 }
 
-int crypto_x509_oid_is_pkcs1_sha256(crypto_x509 *x509)
+static int mbed_x509_oid_is_pkcs1_sha256(crypto_x509 *x509)
 {
-    if ( MBEDTLS_OID_CMP(MBEDTLS_OID_PKCS1_SHA256, &x509->sig_oid))
+    if ( MBEDTLS_OID_CMP(MBEDTLS_OID_PKCS1_SHA256, &crt(x509)->sig_oid))
         return CERT_FAIL;
     return SUCCESS;
 }
 
-int crypto_x509_get_pk_bit_len(crypto_x509 *x509)
+static int mbed_x509_get_pk_bit_len(crypto_x509 *x509)
 {
-    return mbedtls_pk_get_bitlen( &x509->pk);
+    return mbedtls_pk_get_bitlen( &crt(x509)->pk);
 }
 
-void crypto_x509_get_short_info(crypto_x509 *x509, char *short_desc, size_t max_len)
+static void mbed_x509_get_short_info(crypto_x509 *x509, char *short_desc, size_t max_len)
 {
 
-    mbedtls_x509_sig_alg_gets(short_desc, max_len, &x509->sig_oid,
-                       x509->sig_pk, x509->sig_md, x509->sig_opts );
+    mbedtls_x509_sig_alg_gets(short_desc, max_len, &crt(x509)->sig_oid,
+                       crt(x509)->sig_pk, crt(x509)->sig_md, crt(x509)->sig_opts );
+}
+
+static int mbed_x509_get_long_desc(char *x509_info, size_t max_len, char *delim, crypto_x509 *x509)
+{
+    return mbedtls_x509_crt_info(x509_info, max_len, delim, crt(x509));
 }
 
-int crypto_x509_get_long_desc(char *x509_info, size_t max_len, char *delim, crypto_x509 *x509)
+static int mbed_x509_get_subject(crypto_x509 *x509, char *out, size_t max_len)
 {
-    return mbedtls_x509_crt_info(x509_info, max_len, delim, x509); 
+    if (mbedtls_x509_dn_gets(out, max_len, &crt(x509)->subject) < 0)
+        return CERT_FAIL;
+    return SUCCESS;
 }
 
-crypto_x509 *crypto_x509_parse_der(const unsigned char *data, size_t data_len)
+static int mbed_x509_get_issuer(crypto_x509 *x509, char *out, size_t max_len)
+{
+    if (mbedtls_x509_dn_gets(out, max_len, &crt(x509)->issuer) < 0)
+        return CERT_FAIL;
+    return SUCCESS;
+}
+
+static int mbed_x509_get_expiry(crypto_x509 *x509, char *out, size_t max_len)
+{
+    int rc;
+    rc = snprintf(out, max_len, "%04d-%02d-%02dT%02d:%02d:%02dZ", crt(x509)->valid_to.year, crt(x509)->valid_to.mon,
+                  crt(x509)->valid_to.day, crt(x509)->valid_to.hour, crt(x509)->valid_to.min, crt(x509)->valid_to.sec);
+    if (rc < 0 || rc >= max_len)
+        return CERT_FAIL;
+    return SUCCESS;
+}
+
+static crypto_x509 *mbed_x509_parse_der(const unsigned char *data, size_t data_len)
 {
     int rc;
     mbedtls_x509_crt *x509 = NULL;
+    uint64_t start;
     x509 = malloc(sizeof(*x509));
     if (!x509){
       prlog(PR_ERR, "ERROR: failed to allocate memory\n");
       return NULL;
     }
     mbedtls_x509_crt_init(x509);
+    start = timingStart();
     rc = mbedtls_x509_crt_parse(x509, data, data_len); 
+    timingStop(TIMING_X509_PARSE, start);
 
     if (rc) {
-        crypto_x509_free(x509);
+        mbedtls_x509_crt_free(x509);
+        free(x509);
         return NULL;
     }
     else
-        return x509;
+        return (crypto_x509 *)x509;
 }
 
-void crypto_x509_free(crypto_x509 *x509)
+static void mbed_x509_free(crypto_x509 *x509)
 {
-    mbedtls_x509_crt_free(x509);
+    mbedtls_x509_crt_free(crt(x509));
     free(x509);
 }
 
-int crypto_convert_pem_to_der(const unsigned char *input, size_t ilen, unsigned char **output, size_t *olen)
+static int mbed_convert_pem_to_der(const unsigned char *input, size_t ilen, unsigned char **output, size_t *olen)
 {
     return convert_pem_to_der(input, ilen, output, olen);
 }
 
-void crypto_strerror(int rc, char *out_str, size_t out_max_len) 
+static void mbed_strerror(int rc, char *out_str, size_t out_max_len) 
 {
     mbedtls_strerror(rc, out_str, out_max_len);
 }
 
-int crypto_md_ctx_init(crypto_md_ctx **ctx, int md_id) 
+static int mbed_md_ctx_init(crypto_md_ctx **ctx, int md_id) 
 {
     int rc;
     const mbedtls_md_info_t *md_info;
@@ -189,34 +270,93 @@ int crypto_md_ctx_init(crypto_md_ctx **ctx, int md_id)
         prlog(PR_ERR, "ERROR: failed to allocate memory\n");
         return ALLOC_FAIL;
     }
-    md_info = mbedtls_md_info_from_type(md_id);
-    mbedtls_md_init(*ctx);
-    rc = mbedtls_md_setup(*ctx, md_info, 0);
+    md_info = mbedtls_md_info_from_type(md_type(md_id));
+    mbedtls_md_init(mdCtx(*ctx));
+    rc = mbedtls_md_setup(mdCtx(*ctx), md_info, 0);
     if (rc)
         return HASH_FAIL;
-    return mbedtls_md_starts(*ctx);
+    return mbedtls_md_starts(mdCtx(*ctx));
 }
 
-int crypto_md_update(crypto_md_ctx *ctx, const unsigned char *data, size_t data_len)
+static int mbed_md_update(crypto_md_ctx *ctx, const unsigned char *data, size_t data_len)
 {
-    return mbedtls_md_update((mbedtls_md_context_t *)ctx, data, data_len);    
+    return mbedtls_md_update(mdCtx(ctx), data, data_len);
 }
 
-int crypto_md_finish(crypto_md_ctx *ctx, unsigned char *hash) 
+static int mbed_md_finish(crypto_md_ctx *ctx, unsigned char *hash) 
 {
-    return mbedtls_md_finish(ctx, hash);
+    return mbedtls_md_finish(mdCtx(ctx), hash);
 }
 
-void crypto_md_free(crypto_md_ctx *ctx) 
+static void mbed_md_free(crypto_md_ctx *ctx) 
 {
-    mbedtls_md_free(ctx);
+    mbedtls_md_free(mdCtx(ctx));
     if (ctx) free(ctx);
 }
 
-int crypto_md_generate_hash(const unsigned char* data, size_t size, int hashFunct, unsigned char** outHash, size_t* outHashSize)
+static int mbed_md_generate_hash(const unsigned char* data, size_t size, int hashFunct, unsigned char** outHash, size_t* outHashSize)
 {
     //calls function in generate-pkcs7 (mbedtls specific)
-    return toHash(data, size, hashFunct, outHash, outHashSize);
+    uint64_t start = timingStart();
+    int rc = toHash(data, size, md_type(hashFunct), outHash, outHashSize);
+
+    timingStop(TIMING_HASH, start);
+    return rc;
+}
+
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+// mbedtls internals are charged to crypto, unless they happen while a pkcs7 is parsed or generated
+static void *trackedCalloc(size_t count, size_t size)
+{
+    return memCalloc(memTagCurrent() == MEM_PKCS7 ? MEM_PKCS7 : MEM_CRYPTO, count, size);
+}
+
+static int mbed_enable_alloc_tracking(void)
+{
+    return mbedtls_platform_set_calloc_free(trackedCalloc, memFree) ? ALLOC_FAIL : SUCCESS;
+}
+#else
+static int mbed_enable_alloc_tracking(void)
+{
+    // mbedtls calls calloc/free directly, they are only seen in static builds where the linker wraps them
+    prlog(PR_NOTICE, "mbedtls was built without MBEDTLS_PLATFORM_MEMORY, its allocations are not tagged\n");
+    return SUCCESS;
 }
+#endif
+
+// no Authenticode members, the PKCS7 parser in external/extraMbedtls only takes signed data with pkcs7-data content
+const struct crypto_provider crypto_mbedtls_provider = {
+    .name = "mbedtls",
+    .pkcs7_md_is_sha256 = mbed_pkcs7_md_is_sha256,
+    .pkcs7_free = mbed_pkcs7_free,
+    .pkcs7_parse_der = mbed_pkcs7_parse_der,
+    .pkcs7_get_signing_cert = mbed_pkcs7_get_signing_cert,
+    .pkcs7_signed_hash_verify = mbed_pkcs7_signed_hash_verify,
+    .pkcs7_generate_w_signature = mbed_pkcs7_generate_w_signature,
+    .pkcs7_generate_w_already_signed_data = mbed_pkcs7_generate_w_already_signed_data,
+    .x509_get_der_len = mbed_x509_get_der_len,
+    .x509_get_tbs_der_len = mbed_x509_get_tbs_der_len,
+    .x509_get_version = mbed_x509_get_version,
+    .x509_get_sig_len = mbed_x509_get_sig_len,
+    .x509_md_is_sha256 = mbed_x509_md_is_sha256,
+    .x509_oid_is_pkcs1_sha256 = mbed_x509_oid_is_pkcs1_sha256,
+    .x509_get_pk_bit_len = mbed_x509_get_pk_bit_len,
+    .x509_is_RSA = mbed_x509_is_RSA,
+    .x509_get_short_info = mbed_x509_get_short_info,
+    .x509_get_long_desc = mbed_x509_get_long_desc,
+    .x509_get_subject = mbed_x509_get_subject,
+    .x509_get_issuer = mbed_x509_get_issuer,
+    .x509_get_expiry = mbed_x509_get_expiry,
+    .x509_parse_der = mbed_x509_parse_der,
+    .x509_free = mbed_x509_free,
+    .convert_pem_to_der = mbed_convert_pem_to_der,
+    .strerror = mbed_strerror,
+    .md_ctx_init = mbed_md_ctx_init,
+    .md_update = mbed_md_update,
+    .md_finish = mbed_md_finish,
+    .md_free = mbed_md_free,
+    .md_generate_hash = mbed_md_generate_hash,
+    .enable_alloc_tracking = mbed_enable_alloc_tracking,
+};
 
 #endif
\ No newline at end of file
@@ -5,13 +5,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>// for exit
+#include <time.h> // for strftime
 #include "crypto.h"
 #include "include/prlog.h"
 #include "include/err.h"
 #include "generic.h"
+#include "timing.h"
+#include "memstats.h"
 
 #include <openssl/pkcs7.h>
 #include <openssl/x509.h>
+#include <openssl/x509v3.h>
 #include <openssl/objects.h>
 #include <openssl/ossl_typ.h>
 #include <openssl/asn1.h>
@@ -19,7 +23,29 @@
 #include <openssl/evp.h>
 #include <openssl/err.h>
 
-crypto_pkcs7 *crypto_pkcs7_parse_der(const unsigned char *buf, const int buflen) 
+// crypto.h message digest ids to OpenSSL NIDs
+static int md_nid(int md_id)
+{
+    switch (md_id) {
+        case CRYPTO_MD_SHA1:
+            return NID_sha1;
+        case CRYPTO_MD_SHA224:
+            return NID_sha224;
+        case CRYPTO_MD_SHA256:
+            return NID_sha256;
+        case CRYPTO_MD_SHA384:
+            return NID_sha384;
+        case CRYPTO_MD_SHA512:
+            return NID_sha512;
+        default:
+            return NID_undef;
+    }
+}
+
+static crypto_x509 *openssl_x509_parse_der(const unsigned char *data, size_t data_len);
+static int openssl_convert_pem_to_der(const unsigned char *input, size_t ilen, unsigned char **output, size_t *olen);
+
+static PKCS7 *pkcs7_parse_der(const unsigned char *buf, const int buflen) 
 {
     int rc, i, num_signers;
     PKCS7* pkcs7;
@@ -38,7 +64,7 @@ crypto_pkcs7 *crypto_pkcs7_parse_der(const unsigned char *buf, const int buflen)
     if (!rc) {
         prlog(PR_ERR, "ERROR: PKCS7 does not contain signed data\n");
         rc = PKCS7_FAIL;
-        crypto_pkcs7_free(pkcs7);
+        PKCS7_free(pkcs7);
         goto out;
     }
     //mbedtls prints signer serial number when parsing, trying to stay as close to mbedtls output as possible
@@ -70,11 +96,22 @@ out:
     return pkcs7; 
 }
 
-int crypto_pkcs7_md_is_sha256(crypto_pkcs7 *pkcs7)
+static crypto_pkcs7 *openssl_pkcs7_parse_der(const unsigned char *buf, const int buflen) 
+{
+    enum memTag tag = memTagEnter(MEM_PKCS7);
+    uint64_t start = timingStart();
+    PKCS7 *pkcs7 = pkcs7_parse_der(buf, buflen);
+
+    timingStop(TIMING_PKCS7_PARSE, start);
+    memTagExit(tag);
+    return (crypto_pkcs7 *)pkcs7;
+}
+
+static int openssl_pkcs7_md_is_sha256(crypto_pkcs7 *pkcs7)
 {
     X509_ALGOR *alg;
     //extract signer algorithms from pkcs7
-    alg = sk_X509_ALGOR_value(pkcs7->d.sign->md_algs, 0);
+    alg = sk_X509_ALGOR_value(((PKCS7 *)pkcs7)->d.sign->md_algs, 0);
     if (!alg) {
         prlog(PR_ERR, "ERROR: Could not extract message digest identifiers from PKCS7\n");
         return PKCS7_FAIL;
@@ -86,22 +123,22 @@ int crypto_pkcs7_md_is_sha256(crypto_pkcs7 *pkcs7)
         return PKCS7_FAIL;
 }
 
-void crypto_pkcs7_free(crypto_pkcs7 *pkcs7) 
+static void openssl_pkcs7_free(crypto_pkcs7 *pkcs7) 
 {
-    PKCS7_free(pkcs7);
+    PKCS7_free((PKCS7 *)pkcs7);
 }
 
-crypto_x509 *crypto_pkcs7_get_signing_cert(crypto_pkcs7 *pkcs7, int cert_num)
+static crypto_x509 *openssl_pkcs7_get_signing_cert(crypto_pkcs7 *pkcs7, int cert_num)
 {
     X509 *pkcs7_cert = NULL;
 
-    pkcs7_cert = sk_X509_value(pkcs7->d.sign->cert, cert_num);
+    pkcs7_cert = sk_X509_value(((PKCS7 *)pkcs7)->d.sign->cert, cert_num);
 
-    return pkcs7_cert;
+    return (crypto_x509 *)pkcs7_cert;
 
 }
 
-int crypto_pkcs7_signed_hash_verify(crypto_pkcs7 *pkcs7, crypto_x509 *x509, unsigned char *hash, int hash_len)
+static int pkcs7_signed_hash_verify(PKCS7 *pkcs7, X509 *x509, unsigned char *hash, int hash_len)
 {
     //currently this function works and the mbedtls version currently perform the following steps
     //  1. the hash, md context and given x509 are used to generated a signature
@@ -194,7 +231,16 @@ out:
     return PKCS7_FAIL;
 }
 
-int crypto_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize, 
+static int openssl_pkcs7_signed_hash_verify(crypto_pkcs7 *pkcs7, crypto_x509 *x509, unsigned char *hash, int hash_len)
+{
+    uint64_t start = timingStart();
+    int rc = pkcs7_signed_hash_verify((PKCS7 *)pkcs7, (X509 *)x509, hash, hash_len);
+
+    timingStop(TIMING_SIG_VERIFY, start);
+    return rc;
+}
+
+static int pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize, 
     const char** crtFiles, const char** keyFiles,  int keyPairs, int hashFunct)
 {
     int rc;
@@ -202,7 +248,7 @@ int crypto_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size,
     BIO *bio = NULL, *out_bio = NULL;
     EVP_PKEY *evp_pkey = NULL;
     const EVP_MD *evp_md = NULL;
-    crypto_x509 *x509 = NULL;
+    X509 *x509 = NULL;
     size_t pkcs7_out_len;
     unsigned char *keyPEM = NULL, *key = NULL, *keyTmp, *crtPEM = NULL, *crt = NULL, *out_bio_der = NULL;
     size_t keySizePEM, keySize, crtSizePEM, crtSize;
@@ -212,7 +258,7 @@ int crypto_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size,
         return PKCS7_FAIL;
     }
 
-    evp_md = EVP_get_digestbynid(hashFunct);
+    evp_md = EVP_get_digestbynid(md_nid(hashFunct));
     if (!evp_md) {
         prlog(PR_ERR, "ERROR: Unknown NID (%d) for MD found in PKCS7\n", hashFunct);
         return PKCS7_FAIL;
@@ -240,7 +286,7 @@ int crypto_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size,
             rc = INVALID_FILE;
             goto out;
         }
-        rc = crypto_convert_pem_to_der(keyPEM, keySizePEM, (unsigned char **) &key, &keySize);
+        rc = openssl_convert_pem_to_der(keyPEM, keySizePEM, (unsigned char **) &key, &keySize);
         if (rc) {
             prlog(PR_ERR, "Conversion for %s from PEM to DER failed\n", keyFiles[i]);
             goto out;
@@ -252,7 +298,7 @@ int crypto_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size,
             rc = INVALID_FILE;
             goto out;
         }
-        rc = crypto_convert_pem_to_der(crtPEM, crtSizePEM, (unsigned char **) &crt, &crtSize);
+        rc = openssl_convert_pem_to_der(crtPEM, crtSizePEM, (unsigned char **) &crt, &crtSize);
         if (rc) {
             prlog(PR_ERR, "Conversion for %s from PEM to DER failed\n", crtFiles[i]);
             goto out;
@@ -266,7 +312,7 @@ int crypto_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size,
             goto out;
         }
         //get x509 from cert DER buff
-        x509 = crypto_x509_parse_der(crt, crtSize);
+        x509 = (X509 *)openssl_x509_parse_der(crt, crtSize);
         if (!x509) {
             prlog(PR_ERR, "ERROR: Failed to parse certificate into x509 openssl struct\n");
             rc = INVALID_FILE;
@@ -290,7 +336,7 @@ int crypto_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size,
         evp_pkey = NULL;
         free(crt);
         crt = NULL;
-        crypto_x509_free(x509);
+        X509_free(x509);
         x509 = NULL;
     }
     //finalize the struct, runs hashing and signatures
@@ -346,7 +392,7 @@ out:
     if (evp_pkey)
         EVP_PKEY_free(evp_pkey);
     if (x509)
-        crypto_x509_free(x509);
+        X509_free(x509);
     if (gen_pkcs7_struct)
         PKCS7_free(gen_pkcs7_struct);
     BIO_free(bio);
@@ -355,43 +401,48 @@ out:
     return rc;
 }
 
-int crypto_pkcs7_generate_w_already_signed_data(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize, 
-    const char** crtFiles, const char** sigFiles,  int keyPairs, int hashFunct)
+static int openssl_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize, 
+    const char** crtFiles, const char** keyFiles,  int keyPairs, int hashFunct)
 {
-    prlog(PR_ERR, "ERROR: Currently unable to support generation of PKCS7 with externally generated signatures when compiling with OpenSSL\n");
-    return PKCS7_FAIL;
+    enum memTag tag = memTagEnter(MEM_PKCS7);
+    uint64_t start = timingStart();
+    int rc = pkcs7_generate_w_signature(pkcs7, pkcs7Size, newData, newDataSize, crtFiles, keyFiles, keyPairs, hashFunct);
+
+    timingStop(TIMING_SIGN, start);
+    memTagExit(tag);
+    return rc;
 }
 
-int crypto_x509_get_der_len(crypto_x509 *x509) 
+static int openssl_x509_get_der_len(crypto_x509 *x509) 
 {
-    return i2d_X509(x509, NULL); 
+    return i2d_X509((X509 *)x509, NULL);
 }
 
-int crypto_x509_get_tbs_der_len(crypto_x509 *x509) 
+static int openssl_x509_get_tbs_der_len(crypto_x509 *x509) 
 {
-    return i2d_re_X509_tbs(x509, NULL); 
+    return i2d_re_X509_tbs((X509 *)x509, NULL);
 }
 
-int crypto_x509_get_version(crypto_x509 *x509) 
+static int openssl_x509_get_version(crypto_x509 *x509) 
 {
     //add one because function return one less than actual certificate version, see https://www.openssl.org/docs/man1.1.0/man3/X509_get_version.html
-    return X509_get_version( x509) + 1;
+    return X509_get_version((X509 *)x509) + 1;
 }
 
-int crypto_x509_is_RSA(crypto_x509 *x509)
+static int openssl_x509_is_RSA(crypto_x509 *x509)
 {
     int pk_type;
-    pk_type = X509_get_signature_type(x509);
+    pk_type = X509_get_signature_type((X509 *)x509);
     if (pk_type != EVP_PK_RSA)
         return pk_type;
     else 
         return SUCCESS;
 }
 
-int crypto_x509_get_sig_len(crypto_x509 *x509)
+static int openssl_x509_get_sig_len(crypto_x509 *x509)
 {
     ASN1_BIT_STRING *sig;
-    sig = X509_get0_pubkey_bitstr( x509);
+    sig = X509_get0_pubkey_bitstr((X509 *)x509);
     if (!sig) {
         prlog( PR_ERR, "ERROR: Could not extract signature length from x509\n");
         return CERT_FAIL;
@@ -400,10 +451,10 @@ int crypto_x509_get_sig_len(crypto_x509 *x509)
     return sig->length;
 }
 
-int crypto_x509_md_is_sha256(crypto_x509 *x509)
+static int openssl_x509_md_is_sha256(crypto_x509 *x509)
 {
     const X509_ALGOR *alg = NULL;
-    alg = X509_get0_tbs_sigalg(x509);
+    alg = X509_get0_tbs_sigalg((X509 *)x509);
     if (!alg) {
         prlog(PR_ERR, "ERROR: Could not extract algorithm from X509\n");
         return CERT_FAIL;
@@ -418,11 +469,11 @@ int crypto_x509_md_is_sha256(crypto_x509 *x509)
     }
 }
 
-int crypto_x509_oid_is_pkcs1_sha256(crypto_x509 *x509)
+static int openssl_x509_oid_is_pkcs1_sha256(crypto_x509 *x509)
 {
     const X509_ALGOR *alg = NULL;
 
-    alg = X509_get0_tbs_sigalg(x509);
+    alg = X509_get0_tbs_sigalg((X509 *)x509);
     if (!alg) {
         prlog(PR_ERR, "ERROR: Could not extract algorithm from X509\n");
         return CERT_FAIL;
@@ -434,13 +485,13 @@ int crypto_x509_oid_is_pkcs1_sha256(crypto_x509 *x509)
 }
 
 
-int crypto_x509_get_pk_bit_len(crypto_x509 *x509)
+static int openssl_x509_get_pk_bit_len(crypto_x509 *x509)
 {
     EVP_PKEY * pub = NULL;
     RSA *rsa = NULL;
     int length;
     
-    pub = X509_get_pubkey(x509);
+    pub = X509_get_pubkey((X509 *)x509);
     if (!pub) {
         prlog( PR_ERR, "ERROR: Failed to extract public key from x509\n");
         return CERT_FAIL;
@@ -456,10 +507,10 @@ int crypto_x509_get_pk_bit_len(crypto_x509 *x509)
     return length;
 }
 
-void crypto_x509_get_short_info(crypto_x509 *x509, char *short_desc, size_t max_len)
+static void openssl_x509_get_short_info(crypto_x509 *x509, char *short_desc, size_t max_len)
 {
     const X509_ALGOR *alg = NULL;
-    alg = X509_get0_tbs_sigalg(x509);
+    alg = X509_get0_tbs_sigalg((X509 *)x509);
     //unlikely failure
     if (!alg) {
         prlog(PR_ERR, "ERROR: Could not extract algorithm from X509\n");
@@ -470,13 +521,13 @@ void crypto_x509_get_short_info(crypto_x509 *x509, char *short_desc, size_t max_
 
 }
 
-int crypto_x509_get_long_desc(char *x509_info, size_t max_len, char *delim, crypto_x509 *x509)
+static int openssl_x509_get_long_desc(char *x509_info, size_t max_len, char *delim, crypto_x509 *x509)
 {
     int rc;
     long actual_mem_len;
     BIO *bio = BIO_new(BIO_s_mem());
     char *tmp = NULL;
-    rc = X509_print_ex(bio, x509, XN_FLAG_MULTILINE, X509_FLAG_COMPAT | X509_FLAG_NO_PUBKEY | X509_FLAG_NO_SIGDUMP);
+    rc = X509_print_ex(bio, (X509 *)x509, XN_FLAG_MULTILINE, X509_FLAG_COMPAT | X509_FLAG_NO_PUBKEY | X509_FLAG_NO_SIGDUMP);
     if (rc < 0){
         prlog(PR_ERR, "ERROR: could not get BIO data on X509, openssl err#%d\n",rc);
         return rc;
@@ -490,23 +541,73 @@ int crypto_x509_get_long_desc(char *x509_info, size_t max_len, char *delim, cryp
     return actual_mem_len;
 }
 
-crypto_x509 *crypto_x509_parse_der(const unsigned char *data, size_t data_len)
+static int x509_name_to_str(X509_NAME *name, char *out, size_t max_len)
+{
+    BIO *bio;
+    char *tmp = NULL;
+    long len;
+
+    bio = BIO_new(BIO_s_mem());
+    if (!bio) {
+        prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+        return CERT_FAIL;
+    }
+    if (!name || X509_NAME_print_ex(bio, name, 0, XN_FLAG_RFC2253) < 0 || !max_len) {
+        BIO_free(bio);
+        return CERT_FAIL;
+    }
+    len = BIO_get_mem_data(bio, &tmp);
+    len = len < max_len ? len : max_len - 1;
+    memcpy(out, tmp, len);
+    out[len] = '\0';
+    BIO_free(bio);
+
+    return SUCCESS;
+}
+
+static int openssl_x509_get_subject(crypto_x509 *x509, char *out, size_t max_len)
+{
+    return x509_name_to_str(X509_get_subject_name((X509 *)x509), out, max_len);
+}
+
+static int openssl_x509_get_issuer(crypto_x509 *x509, char *out, size_t max_len)
+{
+    return x509_name_to_str(X509_get_issuer_name((X509 *)x509), out, max_len);
+}
+
+static int openssl_x509_get_expiry(crypto_x509 *x509, char *out, size_t max_len)
+{
+    struct tm t;
+
+    if (!ASN1_TIME_to_tm(X509_get0_notAfter((X509 *)x509), &t)) {
+        prlog(PR_ERR, "ERROR: Could not extract expiry date from x509\n");
+        return CERT_FAIL;
+    }
+    if (!strftime(out, max_len, "%Y-%m-%dT%H:%M:%SZ", &t))
+        return CERT_FAIL;
+
+    return SUCCESS;
+}
+
+static crypto_x509 *openssl_x509_parse_der(const unsigned char *data, size_t data_len)
 {
     X509* x509;
+    uint64_t start = timingStart();
+
     x509 = d2i_X509(NULL, &data, data_len);
-    
+    timingStop(TIMING_X509_PARSE, start);
     if (!x509)
         return NULL;
 
-    return x509; 
+    return (crypto_x509 *)x509;
 }
 
-void crypto_x509_free(crypto_x509 *x509)
+static void openssl_x509_free(crypto_x509 *x509)
 {
-    X509_free(x509);
+    X509_free((X509 *)x509);
 }
 
-int crypto_convert_pem_to_der(const unsigned char *input, size_t ilen, unsigned char **output, size_t *olen)
+static int openssl_convert_pem_to_der(const unsigned char *input, size_t ilen, unsigned char **output, size_t *olen)
 {
     int rc;
     BIO *bio;
@@ -521,20 +622,20 @@ int crypto_convert_pem_to_der(const unsigned char *input, size_t ilen, unsigned
     return rc;
 }
 
-void crypto_strerror(int rc, char *out_str, size_t out_max_len) 
+static void openssl_strerror(int rc, char *out_str, size_t out_max_len) 
 {
     ERR_error_string_n(rc, out_str, out_max_len);
 }
 
-int crypto_md_ctx_init(crypto_md_ctx **ctx, int md_id) 
+static int openssl_md_ctx_init(crypto_md_ctx **ctx, int md_id) 
 {
     const EVP_MD *md;
-    md = EVP_get_digestbynid(md_id);
+    md = EVP_get_digestbynid(md_nid(md_id));
     if (!md) {
         prlog(PR_ERR, "ERROR: Invalid MD NID\n");
         return HASH_FAIL;
     }
-    *ctx = EVP_MD_CTX_new();
+    *ctx = (crypto_md_ctx *)EVP_MD_CTX_new();
     if (!*ctx) {
         prlog(PR_ERR, "ERROR: failed to allocate memory\n");
         return ALLOC_FAIL;
@@ -543,32 +644,32 @@ int crypto_md_ctx_init(crypto_md_ctx **ctx, int md_id)
     
 }
 
-int crypto_md_update(crypto_md_ctx *ctx, const unsigned char *data, size_t data_len)
+static int openssl_md_update(crypto_md_ctx *ctx, const unsigned char *data, size_t data_len)
 {
     //returns 1 on success and 0 for fail
-    return !EVP_DigestUpdate(ctx, data, data_len);    
+    return !EVP_DigestUpdate((EVP_MD_CTX *)ctx, data, data_len);
 }
 
-int crypto_md_finish(crypto_md_ctx *ctx, unsigned char *hash) 
+static int openssl_md_finish(crypto_md_ctx *ctx, unsigned char *hash) 
 {
-    return !EVP_DigestFinal_ex(ctx, hash, NULL);
+    return !EVP_DigestFinal_ex((EVP_MD_CTX *)ctx, hash, NULL);
 }
 
-void crypto_md_free(crypto_md_ctx *ctx) 
+static void openssl_md_free(crypto_md_ctx *ctx) 
 {
-    EVP_MD_CTX_free(ctx);
+    EVP_MD_CTX_free((EVP_MD_CTX *)ctx);
 }
 
-int crypto_md_generate_hash(const unsigned char* data, size_t size, int hashFunct, unsigned char** outHash, size_t* outHashSize)
+static int md_generate_hash(const unsigned char* data, size_t size, int hashFunct, unsigned char** outHash, size_t* outHashSize)
 {
     int rc;
     crypto_md_ctx *ctx;
     size_t hash_len;
-    rc = crypto_md_ctx_init(&ctx, hashFunct);
+    rc = openssl_md_ctx_init(&ctx, hashFunct);
     if (rc)
         return rc;
 
-    rc = crypto_md_update(ctx, data, size);
+    rc = openssl_md_update(ctx, data, size);
     if (rc)
         goto out;
     //get hashlen
@@ -600,7 +701,7 @@ int crypto_md_generate_hash(const unsigned char* data, size_t size, int hashFunc
         rc = ALLOC_FAIL;
         goto out;
     }
-    rc = crypto_md_finish(ctx, *outHash);
+    rc = openssl_md_finish(ctx, *outHash);
     if (rc) {
         free(*outHash);
         *outHash = NULL;
@@ -609,14 +710,241 @@ int crypto_md_generate_hash(const unsigned char* data, size_t size, int hashFunc
     *outHashSize = hash_len;
 
     if (verbose) { 
-        printf("Hash generation successful, %s: ", OBJ_nid2sn(hashFunct) );
+        printf("Hash generation successful, %s: ", OBJ_nid2sn(md_nid(hashFunct)) );
         printHex(*outHash, *outHashSize);
     }
 
 out:
-    crypto_md_free(ctx);
+    openssl_md_free(ctx);
+    return rc;
+
+}
+
+static int openssl_md_generate_hash(const unsigned char* data, size_t size, int hashFunct, unsigned char** outHash, size_t* outHashSize)
+{
+    uint64_t start = timingStart();
+    int rc = md_generate_hash(data, size, hashFunct, outHash, outHashSize);
+
+    timingStop(TIMING_HASH, start);
+    return rc;
+}
+
+// Authenticode signs a SpcIndirectDataContent, which holds the digest of the image
+#define SPC_INDIRECT_DATA_OID "1.3.6.1.4.1.311.2.1.4"
+
+/*
+ *finds the SpcIndirectDataContent of an Authenticode signature
+ *@param body , receives the contents of its SEQUENCE without the tag and length, that is what the signer hashed
+ *@return SUCCESS or PKCS7_FAIL if pkcs7 does not carry a SpcIndirectDataContent
+ */
+static int authenticode_content(PKCS7 *pkcs7, const unsigned char **body, long *body_len)
+{
+    PKCS7 *contents = pkcs7->d.sign->contents;
+    ASN1_OBJECT *spc;
+    int tag, xclass, rc;
+
+    spc = OBJ_txt2obj(SPC_INDIRECT_DATA_OID, 1);
+    rc = spc && contents && contents->type ? OBJ_cmp(contents->type, spc) : -1;
+    ASN1_OBJECT_free(spc);
+    if (rc || !contents->d.other || contents->d.other->type != V_ASN1_SEQUENCE) {
+        prlog(PR_ERR, "ERROR: PKCS7 is not an Authenticode signature\n");
+        return PKCS7_FAIL;
+    }
+    // an ASN1_TYPE keeps a SEQUENCE as its whole DER encoding
+    *body = contents->d.other->value.sequence->data;
+    rc = ASN1_get_object(body, body_len, &tag, &xclass, contents->d.other->value.sequence->length);
+    if (rc & 0x80 || tag != V_ASN1_SEQUENCE) {
+        prlog(PR_ERR, "ERROR: Malformed SpcIndirectDataContent in Authenticode signature\n");
+        return PKCS7_FAIL;
+    }
+
+    return SUCCESS;
+}
+
+static int openssl_pkcs7_authenticode_digest(crypto_pkcs7 *pkcs7, int *md_id, unsigned char *digest, size_t *digest_len)
+{
+    const unsigned char *p, *end;
+    const X509_ALGOR *alg;
+    const ASN1_OCTET_STRING *md;
+    X509_SIG *digest_info;
+    long len;
+    int tag, xclass, nid, rc;
+
+    rc = authenticode_content((PKCS7 *)pkcs7, &p, &len);
+    if (rc)
+        return rc;
+    end = p + len;
+    // SpcIndirectDataContent is { SpcAttributeTypeAndOptionalValue, DigestInfo }, only the DigestInfo matters
+    rc = ASN1_get_object(&p, &len, &tag, &xclass, end - p);
+    if (rc & 0x80 || tag != V_ASN1_SEQUENCE) {
+        prlog(PR_ERR, "ERROR: Malformed SpcIndirectDataContent in Authenticode signature\n");
+        return PKCS7_FAIL;
+    }
+    p += len;
+    digest_info = d2i_X509_SIG(NULL, &p, end - p);
+    if (!digest_info) {
+        prlog(PR_ERR, "ERROR: Authenticode signature has no image digest\n");
+        return PKCS7_FAIL;
+    }
+    X509_SIG_get0(digest_info, &alg, &md);
+    nid = OBJ_obj2nid(alg->algorithm);
+    *md_id = 0;
+    for (int id = CRYPTO_MD_SHA1; id <= CRYPTO_MD_SHA512; id++) {
+        if (md_nid(id) == nid)
+            *md_id = id;
+    }
+    if (!*md_id || md->length > EVP_MAX_MD_SIZE || md->length != EVP_MD_size(EVP_get_digestbynid(nid))) {
+        prlog(PR_ERR, "ERROR: Unsupported image digest %s in Authenticode signature\n", OBJ_nid2sn(nid));
+        rc = PKCS7_FAIL;
+    }
+    else {
+        memcpy(digest, md->data, md->length);
+        *digest_len = md->length;
+        rc = SUCCESS;
+    }
+    X509_SIG_free(digest_info);
+
+    return rc;
+}
+
+static int pkcs7_authenticode_verify(PKCS7 *pkcs7, X509_STORE *store)
+{
+    const unsigned char *body;
+    long body_len;
+    BIO *bio;
+    int rc;
+
+    rc = authenticode_content(pkcs7, &body, &body_len);
+    if (rc)
+        return rc;
+    bio = BIO_new_mem_buf(body, body_len);
+    if (!bio) {
+        prlog(PR_ERR, "ERROR: Failed to initialize signed data BIO structure\n");
+        return ALLOC_FAIL;
+    }
+    // intermediate certificates come with the signature, only the anchor has to be in store
+    if (PKCS7_verify(pkcs7, NULL, store, bio, NULL, PKCS7_BINARY) == 1)
+        rc = SUCCESS;
+    else {
+        prlog(PR_INFO, "Authenticode signature not verified: %s\n", ERR_reason_error_string(ERR_peek_last_error()));
+        rc = AUTH_FAIL;
+    }
+    // the queue is per thread, a failure here must not show up in the next check
+    ERR_clear_error();
+    BIO_free(bio);
+
+    return rc;
+}
+
+static int openssl_pkcs7_authenticode_verify(crypto_pkcs7 *pkcs7, crypto_x509_store *store)
+{
+    uint64_t start = timingStart();
+    int rc = pkcs7_authenticode_verify((PKCS7 *)pkcs7, (X509_STORE *)store);
+
+    timingStop(TIMING_SIG_VERIFY, start);
     return rc;
+}
+
+static crypto_x509_store *openssl_x509_store_new(void)
+{
+    X509_STORE *store = X509_STORE_new();
+
+    if (!store) {
+        prlog(PR_ERR, "ERROR: Failed to allocate x509 store\n");
+        return NULL;
+    }
+    // like firmware, any certificate of the store is an anchor and there is no trusted time to check validity against
+    X509_STORE_set_flags(store, X509_V_FLAG_PARTIAL_CHAIN | X509_V_FLAG_NO_CHECK_TIME);
+    // code signing certificates are not S/MIME certificates, which is what PKCS7_verify checks for by default
+    X509_STORE_set_purpose(store, X509_PURPOSE_ANY);
+
+    return (crypto_x509_store *)store;
+}
+
+static int openssl_x509_store_add(crypto_x509_store *store, crypto_x509 *x509)
+{
+    if (X509_STORE_add_cert((X509_STORE *)store, (X509 *)x509) != 1) {
+        prlog(PR_ERR, "ERROR: Failed to add certificate to x509 store\n");
+        ERR_clear_error();
+        return CERT_FAIL;
+    }
+
+    return SUCCESS;
+}
+
+static void openssl_x509_store_free(crypto_x509_store *store)
+{
+    X509_STORE_free((X509_STORE *)store);
+}
+
+// openssl internals are charged to crypto, unless they happen while a pkcs7 is parsed or generated
+static enum memTag cryptoTag(void)
+{
+    return memTagCurrent() == MEM_PKCS7 ? MEM_PKCS7 : MEM_CRYPTO;
+}
+
+static void *trackedMalloc(size_t size, const char *file, int line)
+{
+    return memMalloc(cryptoTag(), size);
+}
+
+static void *trackedRealloc(void *ptr, size_t size, const char *file, int line)
+{
+    return memRealloc(cryptoTag(), ptr, size);
+}
+
+static void trackedFree(void *ptr, const char *file, int line)
+{
+    memFree(ptr);
+}
+
+static int openssl_enable_alloc_tracking(void)
+{
+    if (!CRYPTO_set_mem_functions(trackedMalloc, trackedRealloc, trackedFree)) {
+        prlog(PR_WARNING, "WARNING: OpenSSL allocations can not be tracked, they are missing from the memory report\n");
+        return ALLOC_FAIL;
+    }
 
+    return SUCCESS;
 }
 
-#endif
\ No newline at end of file
+// generating a PKCS7 from external signatures is left to mbedtls
+const struct crypto_provider crypto_openssl_provider = {
+    .name = "openssl",
+    .pkcs7_md_is_sha256 = openssl_pkcs7_md_is_sha256,
+    .pkcs7_free = openssl_pkcs7_free,
+    .pkcs7_parse_der = openssl_pkcs7_parse_der,
+    .pkcs7_get_signing_cert = openssl_pkcs7_get_signing_cert,
+    .pkcs7_signed_hash_verify = openssl_pkcs7_signed_hash_verify,
+    .pkcs7_generate_w_signature = openssl_pkcs7_generate_w_signature,
+    .x509_get_der_len = openssl_x509_get_der_len,
+    .x509_get_tbs_der_len = openssl_x509_get_tbs_der_len,
+    .x509_get_version = openssl_x509_get_version,
+    .x509_get_sig_len = openssl_x509_get_sig_len,
+    .x509_md_is_sha256 = openssl_x509_md_is_sha256,
+    .x509_oid_is_pkcs1_sha256 = openssl_x509_oid_is_pkcs1_sha256,
+    .x509_get_pk_bit_len = openssl_x509_get_pk_bit_len,
+    .x509_is_RSA = openssl_x509_is_RSA,
+    .x509_get_short_info = openssl_x509_get_short_info,
+    .x509_get_long_desc = openssl_x509_get_long_desc,
+    .x509_get_subject = openssl_x509_get_subject,
+    .x509_get_issuer = openssl_x509_get_issuer,
+    .x509_get_expiry = openssl_x509_get_expiry,
+    .x509_parse_der = openssl_x509_parse_der,
+    .x509_free = openssl_x509_free,
+    .convert_pem_to_der = openssl_convert_pem_to_der,
+    .strerror = openssl_strerror,
+    .md_ctx_init = openssl_md_ctx_init,
+    .md_update = openssl_md_update,
+    .md_finish = openssl_md_finish,
+    .md_free = openssl_md_free,
+    .md_generate_hash = openssl_md_generate_hash,
+    .enable_alloc_tracking = openssl_enable_alloc_tracking,
+    .x509_store_new = openssl_x509_store_new,
+    .x509_store_add = openssl_x509_store_add,
+    .x509_store_free = openssl_x509_store_free,
+    .pkcs7_authenticode_digest = openssl_pkcs7_authenticode_digest,
+    .pkcs7_authenticode_verify = openssl_pkcs7_authenticode_verify,
+};
+
+#endif
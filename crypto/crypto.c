@@ -0,0 +1,396 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "crypto.h"
+#include "include/prlog.h"
+#include "include/err.h"
+
+/*
+ *every crypto_ function runs on the provider chosen with crypto_select,
+ *more than one provider is compiled in with OPENSSL=1 MBEDTLS=1, the first one is the default
+ */
+struct providerSlot {
+	const char *name;
+	// NULL until loaded with LAZY_CRYPTO, and if the module does not have it
+	const struct crypto_provider *ops;
+	const char *symbol;
+};
+
+#ifdef LAZY_CRYPTO
+#define PROVIDER(lib) { #lib, NULL, "crypto_" #lib "_provider" }
+#else
+#define PROVIDER(lib) { #lib, &crypto_##lib##_provider, "crypto_" #lib "_provider" }
+#endif
+
+// OpenSSL first, it verifies RSA signatures faster
+static struct providerSlot providers[] = {
+#ifdef OPENSSL
+	PROVIDER(openssl),
+#endif
+#ifdef MBEDTLS
+	PROVIDER(mbedtls),
+#endif
+};
+#define PROVIDER_COUNT (int)(sizeof(providers) / sizeof(providers[0]))
+
+static int selected = 0, trackAllocs = 0;
+static pthread_once_t loadOnce = PTHREAD_ONCE_INIT;
+// set once the providers are usable, anything that has to be freed was made after that
+static int loaded = 0;
+
+static void loadProviders(void)
+{
+	for (int i = 0; i < PROVIDER_COUNT; i++) {
+#ifdef LAZY_CRYPTO
+		providers[i].ops = crypto_module_provider(providers[i].symbol);
+#endif
+		if (providers[i].ops && trackAllocs)
+			providers[i].ops->enable_alloc_tracking();
+	}
+	if (providers[selected].ops)
+		prlog(PR_INFO, "Using crypto provider %s\n", providers[selected].name);
+	loaded = 1;
+}
+
+// @return the selected provider, NULL if it could not be loaded, the error is only printed by the first caller
+static const struct crypto_provider *cryptoProvider(void)
+{
+	pthread_once(&loadOnce, loadProviders);
+
+	return providers[selected].ops;
+}
+
+/*
+ *the selected provider if it implements member, else the first one that does.
+ *only for members that take and return plain buffers, structs never move between providers
+ */
+#define PROVIDER_WITH(member) ({ \
+	const struct crypto_provider *_ops = cryptoProvider(); \
+	for (int _i = 0; (!_ops || !_ops->member) && _i < PROVIDER_COUNT; _i++) \
+		_ops = providers[_i].ops; \
+	_ops && _ops->member ? _ops : NULL; })
+
+static void noProvider(const char *operation)
+{
+	prlog(PR_ERR, "ERROR: None of the crypto providers of this build support %s\n", operation);
+}
+
+int crypto_select(const char *name)
+{
+	if (!name)
+		name = getenv("SECVARCTL_CRYPTO");
+	if (!name || !*name)
+		return SUCCESS;
+	for (int i = 0; i < PROVIDER_COUNT; i++) {
+		if (!strcmp(name, providers[i].name)) {
+			selected = i;
+			return SUCCESS;
+		}
+	}
+	prlog(PR_ERR, "ERROR: Unknown crypto provider %s, this build has:", name);
+	for (int i = 0; i < PROVIDER_COUNT; i++)
+		prlog(PR_ERR, " %s", providers[i].name);
+	prlog(PR_ERR, "\n");
+
+	return ARG_PARSE_FAIL;
+}
+
+const char *crypto_provider_name(void)
+{
+	return providers[selected].name;
+}
+
+const char *crypto_provider_at(int index)
+{
+	return index >= 0 && index < PROVIDER_COUNT ? providers[index].name : NULL;
+}
+
+int crypto_pkcs7_md_is_sha256(crypto_pkcs7 *pkcs7)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->pkcs7_md_is_sha256(pkcs7) : PKCS7_FAIL;
+}
+
+void crypto_pkcs7_free(crypto_pkcs7 *pkcs7)
+{
+	// nothing was parsed if the provider never loaded, cleanup paths must not load it just to free NULL
+	if (loaded && providers[selected].ops)
+		providers[selected].ops->pkcs7_free(pkcs7);
+}
+
+crypto_pkcs7 *crypto_pkcs7_parse_der(const unsigned char *buf, const int buflen)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->pkcs7_parse_der(buf, buflen) : NULL;
+}
+
+crypto_x509 *crypto_pkcs7_get_signing_cert(crypto_pkcs7 *pkcs7, int cert_num)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->pkcs7_get_signing_cert(pkcs7, cert_num) : NULL;
+}
+
+int crypto_pkcs7_signed_hash_verify(crypto_pkcs7 *pkcs7, crypto_x509 *x509, unsigned char *hash, int hash_len)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->pkcs7_signed_hash_verify(pkcs7, x509, hash, hash_len) : PKCS7_FAIL;
+}
+
+int crypto_pkcs7_generate_w_signature(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize,
+    const char** crtFiles, const char** keyFiles,  int keyPairs, int hashFunct)
+{
+	const struct crypto_provider *ops = PROVIDER_WITH(pkcs7_generate_w_signature);
+
+	if (!ops) {
+		noProvider("signing a PKCS7");
+		return PKCS7_FAIL;
+	}
+
+	return ops->pkcs7_generate_w_signature(pkcs7, pkcs7Size, newData, newDataSize, crtFiles, keyFiles, keyPairs, hashFunct);
+}
+
+int crypto_pkcs7_generate_w_already_signed_data(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize,
+    const char** crtFiles, const char** sigFiles,  int keyPairs, int hashFunct)
+{
+	const struct crypto_provider *ops = PROVIDER_WITH(pkcs7_generate_w_already_signed_data);
+
+	if (!ops) {
+		noProvider("generating a PKCS7 with externally generated signatures, build with MBEDTLS=1");
+		return PKCS7_FAIL;
+	}
+
+	return ops->pkcs7_generate_w_already_signed_data(pkcs7, pkcs7Size, newData, newDataSize, crtFiles, sigFiles, keyPairs, hashFunct);
+}
+
+int crypto_x509_get_der_len(crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_get_der_len(x509) : CERT_FAIL;
+}
+
+int crypto_x509_get_tbs_der_len(crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_get_tbs_der_len(x509) : CERT_FAIL;
+}
+
+int crypto_x509_get_version(crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_get_version(x509) : CERT_FAIL;
+}
+
+int crypto_x509_get_sig_len(crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_get_sig_len(x509) : CERT_FAIL;
+}
+
+int crypto_x509_md_is_sha256(crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_md_is_sha256(x509) : CERT_FAIL;
+}
+
+int crypto_x509_oid_is_pkcs1_sha256(crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_oid_is_pkcs1_sha256(x509) : CERT_FAIL;
+}
+
+int crypto_x509_get_pk_bit_len(crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_get_pk_bit_len(x509) : CERT_FAIL;
+}
+
+int crypto_x509_is_RSA(crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_is_RSA(x509) : CERT_FAIL;
+}
+
+void crypto_x509_get_short_info(crypto_x509 *x509, char *short_desc, size_t max_len)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	if (ops)
+		ops->x509_get_short_info(x509, short_desc, max_len);
+	else if (max_len)
+		*short_desc = '\0';
+}
+
+int crypto_x509_get_long_desc(char *x509_info, size_t max_len, char *delim, crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_get_long_desc(x509_info, max_len, delim, x509) : CERT_FAIL;
+}
+
+int crypto_x509_get_subject(crypto_x509 *x509, char *out, size_t max_len)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_get_subject(x509, out, max_len) : CERT_FAIL;
+}
+
+int crypto_x509_get_issuer(crypto_x509 *x509, char *out, size_t max_len)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_get_issuer(x509, out, max_len) : CERT_FAIL;
+}
+
+int crypto_x509_get_expiry(crypto_x509 *x509, char *out, size_t max_len)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_get_expiry(x509, out, max_len) : CERT_FAIL;
+}
+
+crypto_x509 *crypto_x509_parse_der(const unsigned char *data, size_t data_len)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->x509_parse_der(data, data_len) : NULL;
+}
+
+void crypto_x509_free(crypto_x509 *x509)
+{
+	if (loaded && providers[selected].ops)
+		providers[selected].ops->x509_free(x509);
+}
+
+int crypto_convert_pem_to_der(const unsigned char *input, size_t ilen, unsigned char **output, size_t *olen)
+{
+	const struct crypto_provider *ops = PROVIDER_WITH(convert_pem_to_der);
+
+	if (!ops) {
+		noProvider("converting PEM to DER");
+		return CERT_FAIL;
+	}
+
+	return ops->convert_pem_to_der(input, ilen, output, olen);
+}
+
+void crypto_strerror(int rc, char *out_str, size_t out_max_len)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	if (ops)
+		ops->strerror(rc, out_str, out_max_len);
+	else
+		snprintf(out_str, out_max_len, "crypto provider %s is not loaded", crypto_provider_name());
+}
+
+int crypto_md_ctx_init(crypto_md_ctx **ctx, int md_id)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->md_ctx_init(ctx, md_id) : HASH_FAIL;
+}
+
+int crypto_md_update(crypto_md_ctx *ctx, const unsigned char *data, size_t data_len)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->md_update(ctx, data, data_len) : HASH_FAIL;
+}
+
+int crypto_md_finish(crypto_md_ctx *ctx, unsigned char *hash)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops ? ops->md_finish(ctx, hash) : HASH_FAIL;
+}
+
+void crypto_md_free(crypto_md_ctx *ctx)
+{
+	if (loaded && providers[selected].ops)
+		providers[selected].ops->md_free(ctx);
+}
+
+int crypto_md_generate_hash(const unsigned char* data, size_t size, int hashFunct, unsigned char** outHash, size_t* outHashSize)
+{
+	const struct crypto_provider *ops = PROVIDER_WITH(md_generate_hash);
+
+	if (!ops) {
+		noProvider("hashing");
+		return HASH_FAIL;
+	}
+
+	return ops->md_generate_hash(data, size, hashFunct, outHash, outHashSize);
+}
+
+/*
+ *the Authenticode members are optional and take structs, so they never fall back to another provider,
+ *the store is made before anything else so a provider without them is reported there
+ */
+crypto_x509_store *crypto_x509_store_new(void)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	if (!ops)
+		return NULL;
+	if (!ops->x509_store_new) {
+		prlog(PR_ERR, "ERROR: Crypto provider %s can not check Authenticode signatures", crypto_provider_name());
+		for (int i = 0; i < PROVIDER_COUNT; i++) {
+			if (providers[i].ops && providers[i].ops->x509_store_new)
+				prlog(PR_ERR, ", use --crypto=%s", providers[i].name);
+		}
+		prlog(PR_ERR, "\n");
+		return NULL;
+	}
+
+	return ops->x509_store_new();
+}
+
+int crypto_x509_store_add(crypto_x509_store *store, crypto_x509 *x509)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops && ops->x509_store_add ? ops->x509_store_add(store, x509) : CERT_FAIL;
+}
+
+void crypto_x509_store_free(crypto_x509_store *store)
+{
+	if (loaded && providers[selected].ops && providers[selected].ops->x509_store_free)
+		providers[selected].ops->x509_store_free(store);
+}
+
+int crypto_pkcs7_authenticode_digest(crypto_pkcs7 *pkcs7, int *md_id, unsigned char *digest, size_t *digest_len)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops && ops->pkcs7_authenticode_digest ? ops->pkcs7_authenticode_digest(pkcs7, md_id, digest, digest_len) : PKCS7_FAIL;
+}
+
+int crypto_pkcs7_authenticode_verify(crypto_pkcs7 *pkcs7, crypto_x509_store *store)
+{
+	const struct crypto_provider *ops = cryptoProvider();
+
+	return ops && ops->pkcs7_authenticode_verify ? ops->pkcs7_authenticode_verify(pkcs7, store) : PKCS7_FAIL;
+}
+
+// called before any command runs, it is applied to every provider when they are loaded
+int crypto_enable_alloc_tracking(void)
+{
+	trackAllocs = 1;
+
+	return SUCCESS;
+}
@@ -3,38 +3,24 @@
 #ifndef SECVARCTL_CRYPTO_H
 #define SECVARCTL_CRYPTO_H
 
-#ifdef OPENSSL
-
-#include <openssl/obj_mac.h>
-#include <openssl/pkcs7.h>
-#include <openssl/x509.h>
-#include <openssl/evp.h>
-
-#define CRYPTO_MD_SHA1 NID_sha1
-#define CRYPTO_MD_SHA224 NID_sha224
-#define CRYPTO_MD_SHA256 NID_sha256 
-#define CRYPTO_MD_SHA384 NID_sha384
-#define CRYPTO_MD_SHA512 NID_sha512
-
-typedef PKCS7 crypto_pkcs7;
-typedef X509 crypto_x509;
-typedef EVP_MD_CTX crypto_md_ctx;
+#include <stddef.h>
 
+/*
+ *the crypto library is chosen at runtime (see crypto_select), everything here is independent of it:
+ *message digests are our own ids that every provider maps to its library and the structs are opaque,
+ *only the provider that created one knows what it points to
+ */
+#define CRYPTO_MD_SHA1 1
+#define CRYPTO_MD_SHA224 2
+#define CRYPTO_MD_SHA256 3
+#define CRYPTO_MD_SHA384 4
+#define CRYPTO_MD_SHA512 5
 
-#elif defined MBEDTLS
-
-#include <mbedtls/md.h>
-#include "external/extraMbedtls/include/pkcs7.h"
-#define CRYPTO_MD_SHA1 MBEDTLS_MD_SHA1
-#define CRYPTO_MD_SHA224 MBEDTLS_MD_SHA224
-#define CRYPTO_MD_SHA256 MBEDTLS_MD_SHA256 
-#define CRYPTO_MD_SHA384 MBEDTLS_MD_SHA384
-#define CRYPTO_MD_SHA512  MBEDTLS_MD_SHA512
+typedef struct crypto_pkcs7 crypto_pkcs7;
+typedef struct crypto_x509 crypto_x509;
+typedef struct crypto_md_ctx crypto_md_ctx;
+typedef struct crypto_x509_store crypto_x509_store;
 
-typedef struct mbedtls_pkcs7  crypto_pkcs7;
-typedef mbedtls_x509_crt crypto_x509;
-typedef mbedtls_md_context_t crypto_md_ctx;
-#endif
 /**====================PKCS7 Functions ====================**/
 
 /* 
@@ -142,6 +128,33 @@ void crypto_x509_get_short_info(crypto_x509 *x509, char *short_desc, size_t max_
  */
 int crypto_x509_get_long_desc(char *x509_info, size_t max_len, char *delim, crypto_x509 *x509);
 
+/*
+ *writes the subject distinguished name of the x509 as a one line string
+ *@param x509 ,  a pointer to either an openssl or mbedtls x509 struct
+ *@param out , already alloc-d pointer to output string
+ *@param max_len , number of bytes allocated to out
+ *@return SUCCESS or CERT_FAIL if the name could not be written
+ */
+int crypto_x509_get_subject(crypto_x509 *x509, char *out, size_t max_len);
+
+/*
+ *writes the issuer distinguished name of the x509 as a one line string
+ *@param x509 ,  a pointer to either an openssl or mbedtls x509 struct
+ *@param out , already alloc-d pointer to output string
+ *@param max_len , number of bytes allocated to out
+ *@return SUCCESS or CERT_FAIL if the name could not be written
+ */
+int crypto_x509_get_issuer(crypto_x509 *x509, char *out, size_t max_len);
+
+/*
+ *writes the end of the validity period of the x509 in UTC, formatted as 'YYYY-MM-DDThh:mm:ssZ'
+ *@param x509 ,  a pointer to either an openssl or mbedtls x509 struct
+ *@param out , already alloc-d pointer to output string, should hold at least 21 bytes
+ *@param max_len , number of bytes allocated to out
+ *@return SUCCESS or CERT_FAIL if the time could not be extracted
+ */
+int crypto_x509_get_expiry(crypto_x509 *x509, char *out, size_t max_len);
+
 /*
  *parses a data buffer into an x509 struct 
  *@param x509 , output, a pointer to either an openssl or mbedtls x509 struct, should have already been allocated
@@ -228,4 +241,139 @@ void crypto_md_free(crypto_md_ctx *ctx);
  *NOTE: outHash is allocated inside this funtion and must be unallocated sometime after calling
  */
 int crypto_md_generate_hash(const unsigned char* data, size_t size, int hashFunct, unsigned char** outHash, size_t* outHashSize);
-#endif
\ No newline at end of file
+
+/*
+ *routes the allocations of the crypto library through memstats.c so they show up in --mem-stats,
+ *must be called before the library allocates anything
+ *@return SUCCESS or err if the library does not allow its allocator to be replaced
+ */
+int crypto_enable_alloc_tracking(void);
+
+/**====================Authenticode Functions ====================**/
+/*
+ *allocates an empty set of trusted certificates, filled once and then used to check any number of signatures
+ *@return a pointer to either an openssl or mbedtls store, NULL if it could not be allocated or
+ *if the selected provider can not check Authenticode signatures
+ *NOTE: if successful (returns not NULL), remember to call crypto_x509_store_free to unalloc.
+ */
+crypto_x509_store *crypto_x509_store_new(void);
+
+/*
+ *adds a certificate to a store, the store keeps its own reference so x509 may be freed afterwards
+ *@param store , from crypto_x509_store_new
+ *@param x509 , a pointer to either an openssl or mbedtls x509 struct
+ *@return SUCCESS or CERT_FAIL
+ */
+int crypto_x509_store_add(crypto_x509_store *store, crypto_x509 *x509);
+
+/*
+ *frees a store and its references to the certificates
+ *@param store , from crypto_x509_store_new
+ */
+void crypto_x509_store_free(crypto_x509_store *store);
+
+/*
+ *extracts the image digest that an Authenticode signature (the PKCS7 in the certificate table of a PE/COFF image) signs
+ *@param pkcs7 , a pointer to either an openssl or mbedtls pkcs7 struct
+ *@param md_id , receives the message digest of the image digest (CRYPTO_MD_xxx)
+ *@param digest , receives the image digest, must hold at least 64 bytes
+ *@param digest_len , receives the length of digest
+ *@return SUCCESS or PKCS7_FAIL if pkcs7 is not an Authenticode signature
+ */
+int crypto_pkcs7_authenticode_digest(crypto_pkcs7 *pkcs7, int *md_id, unsigned char *digest, size_t *digest_len);
+
+/*
+ *checks the signature of an Authenticode PKCS7 and that its signer chains to a certificate of store, the way firmware does:
+ *every certificate of store is trusted on its own, even if it is not self signed, and validity periods are ignored.
+ *the image digest is not checked here, compare crypto_pkcs7_authenticode_digest with the digest of the image
+ *@param pkcs7 , a pointer to either an openssl or mbedtls pkcs7 struct
+ *@param store , from crypto_x509_store_new
+ *@return SUCCESS, AUTH_FAIL if pkcs7 is not signed by store or PKCS7_FAIL if it is not an Authenticode signature
+ */
+int crypto_pkcs7_authenticode_verify(crypto_pkcs7 *pkcs7, crypto_x509_store *store);
+
+/**====================Providers ====================**/
+/*
+ *a crypto library implementing the functions above, the members have the same contract without the crypto_ prefix.
+ *every member that takes or returns a struct is required, the buffer in/buffer out members (pkcs7_generate_*,
+ *convert_pem_to_der, md_generate_hash) can be NULL and are then run on another provider that has them.
+ *the Authenticode members (x509_store_*, pkcs7_authenticode_*) are either all set or all NULL,
+ *in which case the provider can not check PE/COFF image signatures
+ */
+struct crypto_provider {
+	const char *name;
+	int (*pkcs7_md_is_sha256)(crypto_pkcs7 *pkcs7);
+	void (*pkcs7_free)(crypto_pkcs7 *pkcs7);
+	crypto_pkcs7 *(*pkcs7_parse_der)(const unsigned char *buf, const int buflen);
+	crypto_x509 *(*pkcs7_get_signing_cert)(crypto_pkcs7 *pkcs7, int cert_num);
+	int (*pkcs7_signed_hash_verify)(crypto_pkcs7 *pkcs7, crypto_x509 *x509, unsigned char *hash, int hash_len);
+	int (*pkcs7_generate_w_signature)(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize,
+		const char** crtFiles, const char** keyFiles,  int keyPairs, int hashFunct);
+	int (*pkcs7_generate_w_already_signed_data)(unsigned char **pkcs7, size_t *pkcs7Size, const unsigned char *newData, size_t newDataSize,
+		const char** crtFiles, const char** sigFiles,  int keyPairs, int hashFunct);
+	int (*x509_get_der_len)(crypto_x509 *x509);
+	int (*x509_get_tbs_der_len)(crypto_x509 *x509);
+	int (*x509_get_version)(crypto_x509 *x509);
+	int (*x509_get_sig_len)(crypto_x509 *x509);
+	int (*x509_md_is_sha256)(crypto_x509 *x509);
+	int (*x509_oid_is_pkcs1_sha256)(crypto_x509 *x509);
+	int (*x509_get_pk_bit_len)(crypto_x509 *x509);
+	int (*x509_is_RSA)(crypto_x509 *x509);
+	void (*x509_get_short_info)(crypto_x509 *x509, char *short_desc, size_t max_len);
+	int (*x509_get_long_desc)(char *x509_info, size_t max_len, char *delim, crypto_x509 *x509);
+	int (*x509_get_subject)(crypto_x509 *x509, char *out, size_t max_len);
+	int (*x509_get_issuer)(crypto_x509 *x509, char *out, size_t max_len);
+	int (*x509_get_expiry)(crypto_x509 *x509, char *out, size_t max_len);
+	crypto_x509 *(*x509_parse_der)(const unsigned char *data, size_t data_len);
+	void (*x509_free)(crypto_x509 *x509);
+	int (*convert_pem_to_der)(const unsigned char *input, size_t ilen, unsigned char **output, size_t *olen);
+	void (*strerror)(int rc, char *out_str, size_t out_max_len);
+	int (*md_ctx_init)(crypto_md_ctx **ctx, int md_id);
+	int (*md_update)(crypto_md_ctx *ctx, const unsigned char *data, size_t data_len);
+	int (*md_finish)(crypto_md_ctx *ctx, unsigned char *hash);
+	void (*md_free)(crypto_md_ctx *ctx);
+	int (*md_generate_hash)(const unsigned char* data, size_t size, int hashFunct, unsigned char** outHash, size_t* outHashSize);
+	int (*enable_alloc_tracking)(void);
+	crypto_x509_store *(*x509_store_new)(void);
+	int (*x509_store_add)(crypto_x509_store *store, crypto_x509 *x509);
+	void (*x509_store_free)(crypto_x509_store *store);
+	int (*pkcs7_authenticode_digest)(crypto_pkcs7 *pkcs7, int *md_id, unsigned char *digest, size_t *digest_len);
+	int (*pkcs7_authenticode_verify)(crypto_pkcs7 *pkcs7, crypto_x509_store *store);
+};
+
+#ifdef OPENSSL
+extern const struct crypto_provider crypto_openssl_provider;
+#endif
+#ifdef MBEDTLS
+extern const struct crypto_provider crypto_mbedtls_provider;
+#endif
+
+/*
+ *chooses the provider every crypto_ function runs on, nothing is loaded until the first of them is called
+ *@param name , name of a provider compiled in (ex: "openssl"), if NULL $SECVARCTL_CRYPTO is used,
+ *if that is not set either the first provider of the build is kept (OpenSSL when both are built)
+ *@return SUCCESS or ARG_PARSE_FAIL if this build has no such provider
+ */
+int crypto_select(const char *name);
+
+/*
+ *@return the name of the selected provider
+ */
+const char *crypto_provider_name(void);
+
+/*
+ *lists the providers compiled in, in the order they are tried, for tools that run on each of them
+ *@param index , starts at 0
+ *@return the name to give to crypto_select, NULL once index is past the last provider
+ */
+const char *crypto_provider_at(int index);
+
+#ifdef LAZY_CRYPTO
+/*
+ *opens the crypto module on the first call and looks a provider up in it, see crypto-lazy.c
+ *@param symbol , name of the provider struct (ex: "crypto_openssl_provider")
+ *@return the provider or NULL if the module or the provider could not be loaded
+ */
+const struct crypto_provider *crypto_module_provider(const char *symbol);
+#endif
+#endif
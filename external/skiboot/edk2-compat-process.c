@@ -23,12 +23,39 @@
 #include <stdlib.h>
 #include "prlog.h"
 #include "crypto/crypto.h"
+#include "timing.h"
+#include "threadpool.h"
+#include "memo.h"
 #include "external/skiboot/include/edk2.h"
 
 
 
 
-bool setup_mode;
+/* An update of a queue whose signature is checked ahead of processing */
+struct queued_update {
+	const struct secvar *update;
+	void *auth_buffer;
+	const char *newesl;
+	int new_data_size;
+	struct efi_time timestamp;
+	/* PK and KEK as the update sees them, if all updates before it apply */
+	struct secvar pk;
+	struct secvar kek;
+	struct list_head bank;
+	int rc;
+	const char *signer;
+};
+
+void secvar_ctx_init(struct secvar_ctx *ctx)
+{
+	ctx->setup_mode = false;
+	ctx->verbose = verbose;
+	ctx->jobs = 1;
+	ctx->memo = NULL;
+	ctx->queue = NULL;
+	ctx->queue_len = 0;
+	ctx->queue_next = 0;
+}
 
 int update_variable_in_bank(struct secvar *update_var, const char *data,
 			    const uint64_t dsize, struct list_head *bank)
@@ -376,7 +403,8 @@ static struct efi_time *get_last_timestamp(const char *key, char *last_timestamp
 		return NULL;
 }
 
-int update_timestamp(const char *key, const struct efi_time *timestamp, char *last_timestamp)
+int update_timestamp(struct secvar_ctx *ctx, const char *key,
+		     const struct efi_time *timestamp, char *last_timestamp)
 {
 	struct efi_time *prev;
 
@@ -387,7 +415,7 @@ int update_timestamp(const char *key, const struct efi_time *timestamp, char *la
 	/* Update with new timestamp */
 	memcpy(prev, timestamp, sizeof(struct efi_time));
 
-	prlog(PR_DEBUG, "updated prev year is %d month %d day %d\n",
+	ctx_prlog(ctx, PR_DEBUG, "updated prev year is %d month %d day %d\n",
 			le16_to_cpu(prev->year), prev->month, prev->day);
 
 	return OPAL_SUCCESS;
@@ -410,8 +438,8 @@ static uint64_t unpack_timestamp(const struct efi_time *timestamp)
 	return val;
 }
 
-int check_timestamp(const char *key, const struct efi_time *timestamp,
-		    char *last_timestamp)
+int check_timestamp(struct secvar_ctx *ctx, const char *key,
+		    const struct efi_time *timestamp, char *last_timestamp)
 {
 	struct efi_time *prev;
 	uint64_t new;
@@ -421,10 +449,10 @@ int check_timestamp(const char *key, const struct efi_time *timestamp,
 	if (prev == NULL)
 		return OPAL_INTERNAL_ERROR;
 
-	prlog(PR_DEBUG, "timestamp year is %d month %d day %d\n",
+	ctx_prlog(ctx, PR_DEBUG, "timestamp year is %d month %d day %d\n",
 			le16_to_cpu(timestamp->year), timestamp->month,
 			timestamp->day);
-	prlog(PR_DEBUG, "prev year is %d month %d day %d\n",
+	ctx_prlog(ctx, PR_DEBUG, "prev year is %d month %d day %d\n",
 			le16_to_cpu(prev->year), prev->month, prev->day);
 
 	new = unpack_timestamp(timestamp);
@@ -632,11 +660,12 @@ static int verify_signature(const struct efi_variable_authentication_2 *auth,
  * Create the hash of the buffer
  * name || vendor guid || attributes || timestamp || newcontent
  * which is submitted as signed by the user.
- * Returns the sha256 hash, else negative error code.
+ * Returns the sha256 hash and its length in hash_size, else NULL.
  */
 static char *get_hash_to_verify(const char *key, const char *new_data,
 				const size_t new_data_size,
-				const struct efi_time *timestamp)
+				const struct efi_time *timestamp,
+				size_t *hash_size)
 {
 	le32 attr = cpu_to_le32(SECVAR_ATTRIBUTES);
 	size_t varlen;
@@ -718,6 +747,7 @@ static char *get_hash_to_verify(const char *key, const char *new_data,
 	hash = zalloc(32);
 	if (!hash)
 		return NULL;
+	*hash_size = 32;
 	//NICK CHILD removed direct mbedtls call, use general crypt
 	//rc = mbedtls_md_finish(&ctx, hash);
 	rc = crypto_md_finish(ctx, hash);
@@ -743,19 +773,221 @@ bool is_pkcs7_sig_format(const void *data)
 	return !memcmp(&auth->auth_info.cert_type, &pkcs7_guid, 16);
 }
 
-int process_update(const struct secvar *update, char **newesl,
+/*
+ * One half of a memo key: SHA256 of a and, if given, b. The key of a
+ * signature check is the digest of the PKCS7 and the hash it signs,
+ * then the digest of the authority it is checked against. Any change
+ * to the update, its timestamp or the authority gives another key.
+ */
+static int memo_digest(const void *a, size_t a_size, const void *b,
+		       size_t b_size, unsigned char *out)
+{
+	crypto_md_ctx *ctx = NULL;
+	int rc;
+
+	rc = crypto_md_ctx_init(&ctx, CRYPTO_MD_SHA256);
+	if (!rc)
+		rc = crypto_md_update(ctx, a, a_size);
+	if (!rc && b)
+		rc = crypto_md_update(ctx, b, b_size);
+	if (!rc)
+		rc = crypto_md_finish(ctx, out);
+	if (ctx)
+		crypto_md_free(ctx);
+
+	return rc ? OPAL_INTERNAL_ERROR : OPAL_SUCCESS;
+}
+
+int verify_update(struct secvar_ctx *ctx, const struct secvar *update,
+		  const struct efi_variable_authentication_2 *auth,
+		  const char *newesl, const int new_data_size,
+		  const struct efi_time *timestamp, struct list_head *bank,
+		  const char **signer)
+{
+	const char *key_authority[3];
+	char *tbhbuffer = NULL;
+	uint64_t hash_start;
+	size_t tbhbuffersize = 0;
+	struct secvar *avar = NULL;
+	unsigned char key[MEMO_KEY_SIZE];
+	int rc = OPAL_EMPTY;
+	int verified = 0, update_keyed = 0, keyed;
+	int i;
+
+	/* Prepare the data to be verified */
+	hash_start = timingStart();
+	tbhbuffer = get_hash_to_verify(update->key, newesl, new_data_size,
+				timestamp, &tbhbuffersize);
+	timingStop(TIMING_HASH, hash_start);
+	if (!tbhbuffer)
+		return OPAL_INTERNAL_ERROR;
+
+	/* The update half of the memo key is the same for every authority */
+	if (ctx->memo)
+		update_keyed = !memo_digest(auth->auth_info.cert_data,
+					    get_pkcs7_len(auth), tbhbuffer,
+					    tbhbuffersize, key);
+
+	/* Get the authority to verify the signature */
+	get_key_authority(key_authority, update->key);
+
+	/*
+	 * Try for all the authorities that are allowed to sign.
+	 * For eg. db/dbx can be signed by both PK or KEK
+	 */
+	for (i = 0; key_authority[i] != NULL; i++) {
+		ctx_prlog(ctx, PR_DEBUG, "update key is %s\n", update->key); //changed by NICK for clarity
+		ctx_prlog(ctx, PR_DEBUG, "key authority is %s\n", key_authority[i]);
+		avar = find_secvar(key_authority[i],
+				    strlen(key_authority[i]) + 1,
+				    bank);
+		if (!avar || !avar->data_size)
+			continue;
+
+		/* A verdict from an earlier run saves the PKCS7 and RSA work */
+		keyed = update_keyed
+			&& !memo_digest(avar->data, avar->data_size, NULL, 0,
+					key + MEMO_KEY_SIZE / 2);
+		if (keyed && memoLookup(ctx->memo, key, &verified)) {
+			ctx_prlog(ctx, PR_INFO, "Remembered verdict of %s against %s: %s\n",
+				  update->key, key_authority[i],
+				  verified ? "verified" : "rejected");
+			rc = verified ? OPAL_SUCCESS : OPAL_PERMISSION;
+		} else {
+			/* Verify the signature */
+			rc = verify_signature(auth, tbhbuffer, tbhbuffersize,
+					      avar);
+			/* Only the verdicts of the signature itself are kept */
+			if (keyed && (rc == OPAL_SUCCESS || rc == OPAL_PERMISSION))
+				memoStore(ctx->memo, key, rc == OPAL_SUCCESS);
+		}
+
+		/* Break if signature verification is successful */
+		if (rc == OPAL_SUCCESS) {
+			if (signer)
+				*signer = key_authority[i];
+			break;
+		}
+	}
+
+	free(tbhbuffer);
+
+	return rc;
+}
+
+static int verify_queued_update(void *arg, size_t index)
+{
+	struct secvar_ctx *ctx = arg;
+	struct queued_update *q = &ctx->queue[index];
+
+	/* Malformed updates fail in process_update before their signature */
+	if (!q->auth_buffer)
+		return OPAL_SUCCESS;
+
+	q->rc = verify_update(ctx, q->update, q->auth_buffer, q->newesl,
+			      q->new_data_size, &q->timestamp, &q->bank,
+			      &q->signer);
+
+	return OPAL_SUCCESS;
+}
+
+int verify_queue(struct secvar_ctx *ctx, struct list_head *update_bank,
+		 struct list_head *bank)
+{
+	struct secvar *var, *pkvar, *kekvar;
+	struct secvar pk = { 0 }, kek = { 0 };
+	struct queued_update *q;
+	struct threadpool *pool = NULL;
+	int size, rc = OPAL_SUCCESS;
+	size_t i, len = 0;
+
+	clear_queue(ctx);
+	list_for_each(update_bank, var, link)
+		len++;
+	ctx->queue = calloc(len, sizeof(*ctx->queue));
+	if (!ctx->queue)
+		return OPAL_NO_MEM;
+	ctx->queue_len = len;
+
+	pkvar = find_secvar("PK", 3, bank);
+	kekvar = find_secvar("KEK", 4, bank);
+	pk = pkvar ? *pkvar : (struct secvar){ .key = "PK", .key_len = 3 };
+	kek = kekvar ? *kekvar : (struct secvar){ .key = "KEK", .key_len = 4 };
+
+	/*
+	 * Only PK and KEK updates change who may sign later updates, so the
+	 * authorities every update sees are known before anything is verified.
+	 * If an update fails, processing stops there and the results after it
+	 * are never used.
+	 */
+	i = 0;
+	list_for_each(update_bank, var, link) {
+		q = &ctx->queue[i++];
+		q->update = var;
+		q->rc = OPAL_PERMISSION;
+		q->pk = pk;
+		q->kek = kek;
+		list_head_init(&q->bank);
+		list_add_tail(&q->bank, &q->pk.link);
+		list_add_tail(&q->bank, &q->kek.link);
+
+		size = get_auth_descriptor2(var->data, var->data_size,
+					    &q->auth_buffer);
+		if (size < 0 || var->data_size < size) {
+			free(q->auth_buffer);
+			q->auth_buffer = NULL;
+			continue;
+		}
+		memcpy(&q->timestamp, q->auth_buffer, sizeof(struct efi_time));
+		q->newesl = var->data + size;
+		q->new_data_size = var->data_size - size;
+
+		if (key_equals(var->key, "PK")) {
+			pk.data = (char *)q->newesl;
+			pk.data_size = q->new_data_size;
+		} else if (key_equals(var->key, "KEK")) {
+			kek.data = (char *)q->newesl;
+			kek.data_size = q->new_data_size;
+		}
+	}
+
+	/* Nested inside of another job, e.g. verify --fleet, stay on this thread */
+	if (ctx->jobs > 1 && !threadpoolInJob())
+		pool = threadpoolCreate(ctx->jobs);
+	if (pool) {
+		rc = threadpoolRun(pool, verify_queued_update, ctx, len);
+		threadpoolDestroy(pool);
+	} else {
+		for (i = 0; i < len && !rc; i++)
+			rc = verify_queued_update(ctx, i);
+	}
+
+	return rc;
+}
+
+void clear_queue(struct secvar_ctx *ctx)
+{
+	size_t i;
+
+	for (i = 0; i < ctx->queue_len; i++)
+		free(ctx->queue[i].auth_buffer);
+	free(ctx->queue);
+	ctx->queue = NULL;
+	ctx->queue_len = 0;
+	ctx->queue_next = 0;
+}
+
+int process_update(struct secvar_ctx *ctx,
+		   const struct secvar *update, char **newesl,
 		   int *new_data_size, struct efi_time *timestamp,
 		   struct list_head *bank, char *last_timestamp)
 {
 	struct efi_variable_authentication_2 *auth = NULL;
 	void *auth_buffer = NULL;
 	int auth_buffer_size = 0;
-	const char *key_authority[3];
-	char *tbhbuffer = NULL;
-	size_t tbhbuffersize = 0;
-	struct secvar *avar = NULL;
+	const char *signer = NULL;
 	int rc = 0;
-	int i;
+	int count;
 
 	/* We need to split data into authentication descriptor and new ESL */
 	auth_buffer_size = get_auth_descriptor2(update->data,
@@ -763,7 +995,7 @@ int process_update(const struct secvar *update, char **newesl,
 						&auth_buffer);
 	if ((auth_buffer_size < 0)
 	     || (update->data_size < auth_buffer_size)) {
-		prlog(PR_ERR, "Invalid auth buffer size\n");
+		ctx_prlog(ctx, PR_ERR, "Invalid auth buffer size\n");
 		rc = auth_buffer_size;
 		goto out;
 	}
@@ -777,17 +1009,17 @@ int process_update(const struct secvar *update, char **newesl,
 
 	memcpy(timestamp, auth_buffer, sizeof(struct efi_time));
 
-	rc = check_timestamp(update->key, timestamp, last_timestamp);
+	rc = check_timestamp(ctx, update->key, timestamp, last_timestamp);
 	/* Failure implies probably an older command being resubmitted */
 	if (rc != OPAL_SUCCESS) {
-		prlog(PR_ERR, "Timestamp verification failed for key %s\n", update->key);
+		ctx_prlog(ctx, PR_ERR, "Timestamp verification failed for key %s\n", update->key);
 		goto out;
 	}
 
 	/* Calculate the size of new ESL data */
 	*new_data_size = update->data_size - auth_buffer_size;
 	if (*new_data_size < 0) {
-		prlog(PR_ERR, "Invalid new ESL (new data content) size\n");
+		ctx_prlog(ctx, PR_ERR, "Invalid new ESL (new data content) size\n");
 		rc = OPAL_PARAMETER;
 		goto out;
 	}
@@ -799,56 +1031,35 @@ int process_update(const struct secvar *update, char **newesl,
 	memcpy(*newesl, update->data + auth_buffer_size, *new_data_size);
 
 	/* Validate the new ESL is in right format */
-	rc = validate_esl_list(update->key, *newesl, *new_data_size);
-	if (rc < 0) {
-		prlog(PR_ERR, "ESL validation failed for key %s with error %04x\n",
-		      update->key, rc);
+	count = validate_esl_list(update->key, *newesl, *new_data_size);
+	if (count < 0) {
+		ctx_prlog(ctx, PR_ERR, "ESL validation failed for key %s with error %04x\n",
+		      update->key, count);
+		rc = count;
 		goto out;
 	}
 
-	if (setup_mode) {
+	if (ctx->setup_mode) {
 		rc = OPAL_SUCCESS;
 		goto out;
 	}
 
-	/* Prepare the data to be verified */
-	tbhbuffer = get_hash_to_verify(update->key, *newesl, *new_data_size,
-				timestamp);
-	if (!tbhbuffer) {
-		rc = OPAL_INTERNAL_ERROR;
-		goto out;
-	}
-
-	/* Get the authority to verify the signature */
-	get_key_authority(key_authority, update->key);
-
-	/*
-	 * Try for all the authorities that are allowed to sign.
-	 * For eg. db/dbx can be signed by both PK or KEK
-	 */
-	for (i = 0; key_authority[i] != NULL; i++) {
-		prlog(PR_DEBUG, "update key is %s\n", update->key); //changed by NICK for clarity
-		prlog(PR_DEBUG, "key authority is %s\n", key_authority[i]);
-		avar = find_secvar(key_authority[i],
-				    strlen(key_authority[i]) + 1,
-				    bank);
-		if (!avar || !avar->data_size)
-			continue;
-
-		/* Verify the signature */
-		rc = verify_signature(auth, tbhbuffer, tbhbuffersize,
-				      avar);
-
-		/* Break if signature verification is successful */
-		if (rc == OPAL_SUCCESS) {
-			printf("Update for %s is correctly signed by current %s\n", update->key, key_authority[i]); //changed by NICK for clarity
-			break;
-		}
-	}
+	/* Use the result of verify_queue if it checked this update */
+	if (ctx->queue_next < ctx->queue_len
+	    && ctx->queue[ctx->queue_next].update == update) {
+		rc = ctx->queue[ctx->queue_next].rc;
+		signer = ctx->queue[ctx->queue_next++].signer;
+	} else
+		rc = verify_update(ctx, update, auth, *newesl, *new_data_size,
+				   timestamp, bank, &signer);
+	/* With no authority to check against, the ESL count is returned */
+	if (rc == OPAL_EMPTY)
+		rc = count;
+	if (rc == OPAL_SUCCESS)
+		printf("Update for %s is correctly signed by current %s\n", update->key, signer); //changed by NICK for clarity
 
 out:
 	free(auth_buffer);
-	free(tbhbuffer);
 
 	return rc;
 }
@@ -26,15 +26,14 @@
 #include <stdlib.h>
 
 
-struct list_head staging_bank;
-
 /*
  * Initializes supported variables as empty if not loaded from
  * storage. Variables are initialized as volatile if not found.
  * Updates should clear this flag.
  * Returns OPAL Error if anything fails in initialization
  */
-static int edk2_compat_pre_process(struct list_head *variable_bank,
+static int edk2_compat_pre_process(struct secvar_ctx *ctx,
+				   struct list_head *variable_bank,
 				   struct list_head *update_bank __unused)
 {
 	struct secvar *pkvar;
@@ -53,9 +52,9 @@ static int edk2_compat_pre_process(struct list_head *variable_bank,
 		list_add_tail(variable_bank, &pkvar->link);
 	}
 	if (pkvar->data_size == 0)
-		setup_mode = true;
+		ctx->setup_mode = true;
 	else
-		setup_mode = false;
+		ctx->setup_mode = false;
 
 	kekvar = find_secvar("KEK", 4, variable_bank);
 	if (!kekvar) {
@@ -104,17 +103,20 @@ static int edk2_compat_pre_process(struct list_head *variable_bank,
 	return OPAL_SUCCESS;
 };
 
-static int edk2_compat_process(struct list_head *variable_bank,
+static int edk2_compat_process(struct secvar_ctx *ctx,
+			       struct list_head *variable_bank,
 			       struct list_head *update_bank)
 {
 	struct secvar *var = NULL;
 	struct secvar *tsvar = NULL;
 	struct efi_time timestamp;
+	/* local rather than global so several banks can be processed at once */
+	struct list_head staging_bank;
 	char *newesl = NULL;
 	int neweslsize;
 	int rc = 0;
 
-	prlog(PR_INFO, "Setup mode = %d\n", setup_mode);
+	ctx_prlog(ctx, PR_INFO, "Setup mode = %d\n", ctx->setup_mode);
 
 	/* Check HW-KEY-HASH */ //NICK REMOVED THIS BC NO HW KEYS
 	/*if (!setup_mode) {
@@ -157,20 +159,28 @@ static int edk2_compat_process(struct list_head *variable_bank,
 	if (!tsvar)
 		return OPAL_PERMISSION;
 
+	/*
+	 * Check all signatures up front, results are still used in queue
+	 * order. If that fails, updates are verified one by one below.
+	 */
+	if (ctx->jobs > 1 && !ctx->setup_mode
+	    && verify_queue(ctx, update_bank, &staging_bank))
+		clear_queue(ctx);
+
 	list_for_each(update_bank, var, link) {
 
 		/*
 		 * Submitted data is auth_2 descriptor + new ESL data
 		 * Extract the auth_2 2 descriptor
 		 */
-		prlog(PR_INFO, "Update for %s\n", var->key);
+		ctx_prlog(ctx, PR_INFO, "Update for %s\n", var->key);
 
-		rc = process_update(var, &newesl,
+		rc = process_update(ctx, var, &newesl,
 				    &neweslsize, &timestamp,
 				    &staging_bank,
 				    tsvar->data);
 		if (rc) {
-			prlog(PR_ERR, "Update processing failed with rc %04x\n", rc);
+			ctx_prlog(ctx, PR_ERR, "Update processing failed with rc %04x\n", rc);
 			break;
 		}
 
@@ -183,18 +193,18 @@ static int edk2_compat_process(struct list_head *variable_bank,
 					     neweslsize,
 					     &staging_bank);
 		if (rc) {
-			prlog(PR_ERR, "Updating the variable data failed %04x\n", rc);
+			ctx_prlog(ctx, PR_ERR, "Updating the variable data failed %04x\n", rc);
 			break;
 		}
 
 		free(newesl);
 		newesl = NULL;
 		/* Update the TS variable with the new timestamp */
-		rc = update_timestamp(var->key,
+		rc = update_timestamp(ctx, var->key,
 				      &timestamp,
 				      tsvar->data);
 		if (rc) {
-			prlog (PR_ERR, "Variable updated, but timestamp updated failed %04x\n", rc);
+			ctx_prlog(ctx, PR_ERR, "Variable updated, but timestamp updated failed %04x\n", rc);
 			break;
 		}
 
@@ -228,7 +238,7 @@ static int edk2_compat_process(struct list_head *variable_bank,
 	free(newesl);
 	clear_bank_list(&staging_bank);
 
-	/* Set the global variable setup_mode as per final contents in variable_bank */
+	/* Set setup_mode as per final contents in variable_bank */
 	var = find_secvar("PK", 3, variable_bank);
 	if (!var) {
 		/* This should not happen */
@@ -237,11 +247,12 @@ static int edk2_compat_process(struct list_head *variable_bank,
 	}
 
 	if (var->data_size == 0)
-		setup_mode = true;
+		ctx->setup_mode = true;
 	else
-		setup_mode = false;
+		ctx->setup_mode = false;
 
 cleanup:
+	clear_queue(ctx);
 	/*
 	 * For any failure in processing update queue, we clear the update bank
 	 * and return failure
@@ -251,7 +262,8 @@ cleanup:
 	return rc;
 }
 
-static int edk2_compat_post_process(struct list_head *variable_bank,
+static int edk2_compat_post_process(struct secvar_ctx *ctx __unused,
+				    struct list_head *variable_bank,
 				    struct list_head *update_bank __unused)
 {
 /*	struct secvar *hwvar; //NICK COMMENTED OUT, NO HW
@@ -49,8 +49,29 @@
 #define key_equals(a,b) (!strncmp(a, b, EDK2_MAX_KEY_LEN))
 #define uuid_equals(a,b) (!memcmp(a, b, UUID_SIZE))
 
-extern bool setup_mode;
-extern struct list_head staging_bank;
+/*
+ * State of one run of pre_process/process, everything that used to be
+ * global so that several banks can be verified at once
+ */
+struct secvar_ctx {
+	/* PK is empty, updates are not checked against it */
+	bool setup_mode;
+	/* log level of this run, see prlog.h */
+	int verbose;
+	/* threads used to check the signatures of a queue up front, 1 for none */
+	int jobs;
+	/* verdicts of earlier runs, see memo.h, NULL for none */
+	struct verifyMemo *memo;
+	/* filled by verify_queue, used by process_update in queue order */
+	struct queued_update *queue;
+	size_t queue_len, queue_next;
+};
+
+/* prlog with the log level of the context */
+#define ctx_prlog(ctx, l, ...) prlog_level((ctx)->verbose, l, ##__VA_ARGS__)
+
+/* Start a context at the global log level */
+void secvar_ctx_init(struct secvar_ctx *ctx);
 
 /* Update the variable in the variable bank with the new value. */
 int update_variable_in_bank(struct secvar *update_var, const char *data,
@@ -67,16 +88,39 @@ int get_auth_descriptor2(const void *buf, const size_t buflen,
 int validate_esl_list(const char *key, const char *esl, const size_t size);
 
 /* Update the TS variable with the new timestamp */
-int update_timestamp(const char *key, const struct efi_time *timestamp, char *last_timestamp);
+int update_timestamp(struct secvar_ctx *ctx, const char *key,
+		     const struct efi_time *timestamp, char *last_timestamp);
 
 /* Check the new timestamp against the timestamp last update was done */
-int check_timestamp(const char *key, const struct efi_time *timestamp, char *last_timestamp);
+int check_timestamp(struct secvar_ctx *ctx, const char *key,
+		    const struct efi_time *timestamp, char *last_timestamp);
 
 /* Check the GUID of the data type */
 bool is_pkcs7_sig_format(const void *data);
 
+/* Verify the signature of an update against the authorities in the bank,
+ * the signing authority is returned in signer. Returns OPAL_EMPTY if no
+ * authority in the bank holds a key.
+ */
+int verify_update(struct secvar_ctx *ctx, const struct secvar *update,
+		  const struct efi_variable_authentication_2 *auth,
+		  const char *newesl, const int new_data_size,
+		  const struct efi_time *timestamp, struct list_head *bank,
+		  const char **signer);
+
+/* Check the signatures of all updates in the queue concurrently, each one
+ * against the PK and KEK it will see once the updates before it are applied.
+ * process_update then uses these results in place of verify_update.
+ */
+int verify_queue(struct secvar_ctx *ctx, struct list_head *update_bank,
+		 struct list_head *bank);
+
+/* Drop the results of verify_queue */
+void clear_queue(struct secvar_ctx *ctx);
+
 /* Process the update */
-int process_update(const struct secvar *update, char **newesl,
+int process_update(struct secvar_ctx *ctx,
+		   const struct secvar *update, char **newesl,
 		   int *neweslsize, struct efi_time *timestamp,
 		   struct list_head *bank, char *last_timestamp);
 
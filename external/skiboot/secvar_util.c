@@ -12,7 +12,9 @@
 #include "external/skiboot/include/secvar.h"
 //ADDED BY NICK
 #include "external/skiboot/include/opal-api.h"
-#define zalloc(...) calloc(1,__VA_ARGS__)
+#include "memstats.h"
+// every secvar of a bank is allocated here, see --mem-stats
+#define zalloc(...) memCalloc(MEM_BANK, 1, __VA_ARGS__)
 
 void clear_bank_list(struct list_head *bank)
 {
@@ -10,6 +10,71 @@
 #include <sys/types.h>
 #include "err.h"
 #include "prlog.h"
+#include "generic.h"
+#include "timing.h"
+#include "memstats.h"
+
+#define READ_CHUNK_SIZE 4096
+// bytes encoded per fwrite by printHex
+#define HEX_CHUNK_SIZE 1024
+
+#define HEX_ROW(h) h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" h "8" h "9" h "a" h "b" h "c" h "d" h "e" h "f"
+// "000102...ff", the two hex characters of byte b start at hexPairs[b * 2]
+static const char hexPairs[] = HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3") HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+			       HEX_ROW("8") HEX_ROW("9") HEX_ROW("a") HEX_ROW("b") HEX_ROW("c") HEX_ROW("d") HEX_ROW("e") HEX_ROW("f");
+
+// base64 character to its value + 1, 0 for characters that are not base64
+#define B64_SPACE 0x80
+#define B64_PAD 0x81
+static const unsigned char base64Values[256] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x80, 0x00, 0x00, 0x80, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3f, 0x00, 0x00, 0x00, 0x40,
+	0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x00, 0x00, 0x00, 0x81, 0x00, 0x00,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29,
+	0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0x34, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+// stdin can only be consumed once, remember if someone already did
+static int stdinConsumed = 0;
+// where data written to STDIO_FILE goes, see reserveStdoutForData()
+static int dataOutFd = STDOUT_FILENO;
+
+/**
+ *determines if the given path is the '-' placeholder for stdin/stdout
+ *@param path, file name given by the user
+ *@return 1 if path is '-', 0 otherwise
+ */
+int isStdio(const char *path)
+{
+	return path && !strcmp(path, STDIO_FILE);
+}
+
+/**
+ *moves stdout out of the way so that data written to STDIO_FILE is the only thing
+ *that reaches the real stdout, all other text output (RESULT lines, info, etc) is sent to stderr
+ *@return SUCCESS or INVALID_FILE if the descriptors could not be duplicated
+ */
+int reserveStdoutForData(void)
+{
+	int fd;
+
+	if (dataOutFd != STDOUT_FILENO)
+		return SUCCESS;
+	fflush(stdout);
+	fd = dup(STDOUT_FILENO);
+	if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		prlog(PR_ERR, "ERROR: Could not redirect stdout: %s\n", strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return INVALID_FILE;
+	}
+	dataOutFd = fd;
+
+	return SUCCESS;
+}
 
 /**
  *determines if given file currently exists
@@ -20,6 +85,8 @@ int isFile(const char* path)
 {
 	int fptr;
 
+	if (isStdio(path))
+		return SUCCESS;
 	fptr = open(path, O_RDONLY);
 	if (fptr < 0) {
 		return INVALID_FILE;
@@ -38,11 +105,107 @@ size_t getLeadingWhitespace(unsigned char* data, size_t dataSize)
 
 	return whiteSpaceSize;
 }
+
+/**
+ *writes the lowercase hex of data to out, one table load per byte rather than a printf
+ *@param out buffer with room for 2 (3 if sep is given) characters per byte, not NUL terminated
+ *@param data bytes to encode
+ *@param len number of bytes
+ *@param sep if not 0, written before every byte
+ *@return number of characters written to out
+ */
+size_t hexEncode(char *out, const unsigned char *data, size_t len, char sep)
+{
+	char *start = out;
+
+	for (size_t i = 0; i < len; i++) {
+		if (sep)
+			*out++ = sep;
+		memcpy(out, &hexPairs[data[i] * 2], 2);
+		out += 2;
+	}
+
+	return out - start;
+}
+
+/**
+ *decodes base64 text, such as the body of a PEM block, whitespace between characters is skipped
+ *@param out where the bytes go, must have room for len / 4 * 3 bytes
+ *@param outLen the number of bytes written to out
+ *@param in the text
+ *@param len length of in
+ *@return SUCCESS or INVALID_FILE if in is not base64
+ */
+int base64Decode(unsigned char *out, size_t *outLen, const char *in, size_t len)
+{
+	const unsigned char *c = (const unsigned char *)in, *end = c + len;
+	unsigned char *start = out;
+	unsigned int a, b, d, e, quad = 0, count = 0, pad = 0;
+
+	while (c < end) {
+		// whole groups of four characters, that is every line of a PEM block but the last, take one table lookup per character and no branch
+		if (!count && end - c >= 4) {
+			a = base64Values[c[0]] - 1u;
+			b = base64Values[c[1]] - 1u;
+			d = base64Values[c[2]] - 1u;
+			e = base64Values[c[3]] - 1u;
+			if (!((a | b | d | e) & ~0x3fu)) {
+				quad = a << 18 | b << 12 | d << 6 | e;
+				out[0] = quad >> 16;
+				out[1] = quad >> 8;
+				out[2] = quad;
+				out += 3;
+				c += 4;
+				continue;
+			}
+		}
+		a = base64Values[*c++];
+		if (a == B64_SPACE)
+			continue;
+		// only padding may follow padding, and there are at most two at the end of a group
+		if (!a || (pad && a != B64_PAD) || (a == B64_PAD && (count < 2 || pad == 2)))
+			return INVALID_FILE;
+		if (a == B64_PAD) {
+			pad++;
+			a = 1;
+		}
+		quad = quad << 6 | (a - 1);
+		if (++count < 4)
+			continue;
+		out[0] = quad >> 16;
+		out[1] = quad >> 8;
+		out[2] = quad;
+		out += 3 - pad;
+		count = 0;
+		quad = 0;
+		if (pad)
+			break;
+	}
+	// anything but whitespace after the padding, or a group cut short
+	while (c < end && base64Values[*c] == B64_SPACE)
+		c++;
+	if (c != end || count)
+		return INVALID_FILE;
+	*outLen = out - start;
+
+	return SUCCESS;
+}
+
+/**
+ *prints data as /xx/xx/... followed by a new line, encoded in chunks and written with fwrite
+ *@param data bytes to print
+ *@param length number of bytes
+ */
 void printHex(unsigned char* data, size_t length)
 {
-	for (int i = 0; i < length; i++) 
-		printf("/%02x", data[i]);
-	printf("\n");
+	char buff[HEX_CHUNK_SIZE * 3];
+	size_t len;
+
+	for (size_t i = 0; i < length; i += len) {
+		len = length - i < HEX_CHUNK_SIZE ? length - i : HEX_CHUNK_SIZE;
+		fwrite(buff, 1, hexEncode(buff, data + i, len, '/'), stdout);
+	}
+	putchar('\n');
 }
 
 /**
@@ -52,26 +215,67 @@ void printHex(unsigned char* data, size_t length)
  */
 void printRaw(const char* c, size_t size) 
 {
-	for (int i = 0; i < size; i++)
-		printf("%c", *(c + i));
-	printf("\n\n");
+	fwrite(c, 1, size, stdout);
+	fputs("\n\n", stdout);
 }
 
 
 /**
- *This Function returns a pointer to allocated memory that holds the data from the file 
- *@param fullPath string of file with path
+ *reads from fd until EOF, growing the buffer as needed. used for pipes/stdin where the size is not known ahead of time
+ *@param fd, open file descriptor
+ *@param name, name used for log messages
  *@param size address of unitialized int memory that will be filled with length of returned char*
- *@return NULL if cannot open file or read file
- *@return char* to allocted data of file with one extra '\0' for good measure
- *NOTE:REMEMBER TO UNALLOCATE RETURNED DATA
- **/
-char* getDataFromFile(const char* fullPath, size_t *size) 
+ *@return NULL if cannot read from fd, else allocated data
+ */
+static char* readIncremental(int fd, const char *name, size_t *size)
+{
+	char *c = NULL;
+	size_t capacity = 0, len = 0;
+	ssize_t read_size;
+
+	do {
+		if (len == capacity) {
+			capacity = capacity ? capacity * 2 : READ_CHUNK_SIZE;
+			if (reallocArray((void **)&c, capacity, sizeof(char))) {
+				prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+				return NULL;
+			}
+		}
+		read_size = read(fd, c + len, capacity - len);
+		if (read_size < 0) {
+			if (errno == EINTR)
+				continue;
+			prlog(PR_ERR, "ERROR: failed to read from %s: %s\n", name, strerror(errno));
+			free(c);
+			return NULL;
+		}
+		len += read_size;
+	} while (read_size > 0);
+
+	if (len == 0)
+		prlog(PR_WARNING, "WARNING: file %s is empty\n", name);
+	prlog(PR_NOTICE,"----reading %s is success: read %zd bytes----\n", name, len);
+	*size = len;
+
+	return c;
+}
+
+// does the reading for getDataFromFile, which times and tags it
+static char* readFile(const char* fullPath, size_t *size) 
 {
 	int fptr;
 	char *c = NULL;
 	struct stat fileInfo;
 	ssize_t read_size;
+
+	if (isStdio(fullPath)) {
+		if (stdinConsumed) {
+			prlog(PR_ERR, "ERROR: stdin can only be used as one input\n");
+			return NULL;
+		}
+		stdinConsumed = 1;
+		return readIncremental(STDIN_FILENO, "stdin", size);
+	}
 	fptr = open(fullPath, O_RDONLY);			
 	if (fptr < 0) {
 		prlog(PR_WARNING,"----opening %s failed : %s----\n", fullPath, strerror(errno));
@@ -80,6 +284,11 @@ char* getDataFromFile(const char* fullPath, size_t *size)
 	if (fstat(fptr, &fileInfo) < 0) {
 		goto out;
 	}
+	// pipes, fifos and character devices do not report a usable size
+	if (!S_ISREG(fileInfo.st_mode)) {
+		c = readIncremental(fptr, fullPath, size);
+		goto out;
+	}
 	if(fileInfo.st_size <= 0){
 		prlog(PR_WARNING, "WARNING: file %s is empty\n", fullPath);
 	}
@@ -103,18 +312,59 @@ out:
 	return c;
 }
 
-/*
- *writes size bytes of buff to 
- *@param file string to file
- *@param authBuf pointer to auth data
- *@param size length of data
- *@return negative int, error if opening/writing to .../update file
- *@return 0 for success or error number
+/**
+ *This Function returns a pointer to allocated memory that holds the data from the file 
+ *@param fullPath string of file with path, or STDIO_FILE to read from stdin
+ *@param size address of unitialized int memory that will be filled with length of returned char*
+ *@return NULL if cannot open file or read file
+ *@return char* to allocted data of file with one extra '\0' for good measure
+ *NOTE:REMEMBER TO UNALLOCATE RETURNED DATA
+ *file io is timed and its buffers are tagged here since every subcommand reads and writes through these, see --timings and --mem-stats
+ **/
+char* getDataFromFile(const char* fullPath, size_t *size) 
+{
+	enum memTag tag = memTagEnter(MEM_FILE_IO);
+	uint64_t start = timingStart();
+	char *c = readFile(fullPath, size);
+
+	timingStop(TIMING_FILE_IO, start);
+	memTagExit(tag);
+
+	return c;
+}
+
+/**
+ *writes all of buff to fd, pipes may accept less than requested so loop until done
+ *@return SUCCESS or FILE_WRITE_FAIL
  */
-int writeData(const char * file, const char * buff, size_t size)
+static int writeAll(int fd, const char *name, const char *buff, size_t size)
+{
+	ssize_t rc;
+	size_t written = 0;
+
+	while (written < size) {
+		rc = write(fd, buff + written, size - written);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			prlog(PR_ERR,"ERROR: Writing data to %s failed: %s\n", name, strerror(errno));
+			return FILE_WRITE_FAIL;
+		}
+		written += rc;
+	}
+	prlog(PR_NOTICE,"%zd/%zd bytes successfully written from file to %s\n", written, size, name);
+
+	return SUCCESS;
+}
+
+// does the writing for writeData, which times it
+static int writeExisting(const char * file, const char * buff, size_t size)
 {
+	int rc, fptr;
 
-	int rc, fptr = open(file, O_WRONLY|O_TRUNC);
+	if (isStdio(file))
+		return writeAll(dataOutFd, "stdout", buff, size);
+	fptr = open(file, O_WRONLY|O_TRUNC);
 	if (fptr == -1) {
 		prlog(PR_ERR, "ERROR: Opening %s failed: %s\n", file, strerror(errno));
 		return INVALID_FILE;
@@ -133,19 +383,15 @@ int writeData(const char * file, const char * buff, size_t size)
 	return SUCCESS;
 }
 
-/*
- *writes size bytes of buff to new file
- *@param file string to file
- *@param authBuf pointer to auth data
- *@param size length of data
- *@return negative int, error if opening/writing to .../update file
- *@return 0 for success or error number
- */
-int createFile(const char * file, const char * buff, size_t size)
+// does the writing for createFile, which times it
+static int writeNew(const char * file, const char * buff, size_t size)
 {
-	int rc;
+	int rc, fptr;
+
+	if (isStdio(file))
+		return writeAll(dataOutFd, "stdout", buff, size);
 	// create and set permissions
-	int fptr = open(file, O_WRONLY|O_TRUNC|O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH); 
+	fptr = open(file, O_WRONLY|O_TRUNC|O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH); 
 	if (fptr == -1) {
 		prlog(PR_ERR, "ERROR: Opening %s failed: %s\n", file, strerror(errno));
 		return INVALID_FILE;
@@ -164,6 +410,42 @@ int createFile(const char * file, const char * buff, size_t size)
 	return SUCCESS;
 }
 
+/*
+ *writes size bytes of buff to 
+ *@param file string to file, or STDIO_FILE for stdout
+ *@param authBuf pointer to auth data
+ *@param size length of data
+ *@return negative int, error if opening/writing to .../update file
+ *@return 0 for success or error number
+ */
+int writeData(const char * file, const char * buff, size_t size)
+{
+	uint64_t start = timingStart();
+	int rc = writeExisting(file, buff, size);
+
+	timingStop(TIMING_FILE_IO, start);
+
+	return rc;
+}
+
+/*
+ *writes size bytes of buff to new file
+ *@param file string to file, or STDIO_FILE for stdout
+ *@param authBuf pointer to auth data
+ *@param size length of data
+ *@return negative int, error if opening/writing to .../update file
+ *@return 0 for success or error number
+ */
+int createFile(const char * file, const char * buff, size_t size)
+{
+	uint64_t start = timingStart();
+	int rc = writeNew(file, buff, size);
+
+	timingStop(TIMING_FILE_IO, start);
+
+	return rc;
+}
+
 /*
  *returns a new pointer to an array with new length
  *@param arr , a pointer to the array, will be reallocated to have new_length*size_each bytes or NULL if error
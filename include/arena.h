@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+struct arenaBlock;
+struct arenaAdopted;
+
+/*
+ *bump allocator for buffers that all live until the end of one job,
+ *nothing is freed on its own, arenaReset releases everything at once and keeps the memory for the next job
+ */
+struct arena {
+	struct arenaBlock *blocks;
+	// buffers from other allocators (ex: the crypto library) that are freed on reset
+	struct arenaAdopted *adopted;
+};
+// fails when included after the #pragma pack(1) of edk2.h, the layout would then differ from arena.c's
+_Static_assert(__alignof__(struct arena) == __alignof__(void *), "arena.h must be included before edk2.h");
+
+void arenaInit(struct arena *arena);
+void *arenaAlloc(struct arena *arena, size_t size);
+void *arenaCalloc(struct arena *arena, size_t count, size_t size);
+int arenaAdopt(struct arena *arena, void *ptr);
+void arenaReset(struct arena *arena);
+void arenaDestroy(struct arena *arena);
+struct arena *arenaForThread(void);
+#endif
@@ -3,6 +3,9 @@
 #ifndef GENERIC_H
 #define GENERIC_H
 
+// file name that means stdin when reading and stdout when writing
+#define STDIO_FILE "-"
+
 struct command {
 	char name[32];
 	int (*func)(int, char**);
@@ -15,5 +18,9 @@ void printRaw(const char* c, size_t size) ;
 int isFile(const char* path);
 size_t getLeadingWhitespace(unsigned char* data, size_t dataSize);
 void printHex(unsigned char* data, size_t length);
+size_t hexEncode(char *out, const unsigned char *data, size_t len, char sep);
+int base64Decode(unsigned char *out, size_t *outLen, const char *in, size_t len);
+int isStdio(const char *path);
+int reserveStdoutForData(void);
 int reallocArray(void **arr, size_t new_length, size_t size_each);
 #endif
\ No newline at end of file
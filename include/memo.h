@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifndef MEMO_H
+#define MEMO_H
+#include <stddef.h>
+
+// a key is two SHA256 digests: what was signed and who it was checked against
+#define MEMO_KEY_SIZE 64
+// more entries than this are not remembered, the file is never larger than ~4.5MB
+#define MEMO_MAX_ENTRIES 65536
+// set to anything but "" or "0" to never read or write a memo, whatever the command line says
+#define MEMO_OFF_ENV "SECVARCTL_NO_MEMO"
+
+struct verifyMemo;
+
+int memoDisabled(void);
+int memoOpen(struct verifyMemo **memo, const char *path, const char *tag);
+int memoLookup(struct verifyMemo *memo, const unsigned char *key, int *verified);
+void memoStore(struct verifyMemo *memo, const unsigned char *key, int verified);
+int memoClose(struct verifyMemo *memo);
+#endif
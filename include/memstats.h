@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+#include <stddef.h>
+#include <stdint.h>
+
+// subsystems allocations are charged to with --mem-stats, keep memTagNames in memstats.c in the same order
+enum memTag {
+	MEM_OTHER = 0,
+	MEM_FILE_IO,
+	MEM_ESL,
+	MEM_PKCS7,
+	MEM_CRYPTO,
+	MEM_BANK,
+	MEM_TAG_COUNT
+};
+
+// 0 unless --mem-stats was given, the malloc wrappers pass straight through when off
+extern int memStatsEnabled;
+
+int memStatsEnable(void);
+uint64_t memStatsAllocs(void);
+enum memTag memTagEnter(enum memTag tag);
+void memTagExit(enum memTag previous);
+enum memTag memTagCurrent(void);
+void *memMalloc(enum memTag tag, size_t size);
+void *memCalloc(enum memTag tag, size_t count, size_t size);
+void *memRealloc(enum memTag tag, void *ptr, size_t size);
+void memFree(void *ptr);
+int memStatsReport(void);
+#endif
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifndef OUTPUT_H
+#define OUTPUT_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define EMITTER_MAX_DEPTH 32
+
+enum outputFormat {
+	OUTPUT_TEXT = 0,
+	OUTPUT_JSON,
+	OUTPUT_CBOR
+};
+
+/*
+ *structured output is accumulated in buf and written out in one go by emitterFlush,
+ *every emit function takes a key which must be non-NULL inside of a map and NULL inside of an array/at the root
+ */
+struct emitter {
+	enum outputFormat format;
+	unsigned char *buf;
+	size_t len, cap;
+	int depth;
+	// json only, 1 if the next item at depth needs a leading ','
+	int needComma[EMITTER_MAX_DEPTH];
+	// set if any emit fails, checked at flush time so callers do not have to check every call
+	int err;
+};
+// fails when included after the #pragma pack(1) of edk2.h, the layout would then differ from output.c's
+_Static_assert(__alignof__(struct emitter) == __alignof__(void *), "output.h must be included before edk2.h");
+
+int parseOutputFormat(const char *str, enum outputFormat *format);
+void emitterInit(struct emitter *e, enum outputFormat format);
+void emitterFree(struct emitter *e);
+int emitterFlush(struct emitter *e, const char *file);
+
+void emitMapStart(struct emitter *e, const char *key);
+void emitMapEnd(struct emitter *e);
+void emitArrayStart(struct emitter *e, const char *key);
+void emitArrayEnd(struct emitter *e);
+void emitString(struct emitter *e, const char *key, const char *value);
+void emitInt(struct emitter *e, const char *key, int64_t value);
+void emitBool(struct emitter *e, const char *key, int value);
+void emitBytes(struct emitter *e, const char *key, const unsigned char *data, size_t len);
+#endif
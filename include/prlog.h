@@ -14,5 +14,7 @@ extern int verbose;
 #define PR_PRINTF	PR_NOTICE
 #define PR_INFO		6
 #define PR_DEBUG	7
- #define prlog(l,...) do { if(l<=MAXLEVEL)fprintf((l <= PR_ERR) ? stderr : stdout, ##__VA_ARGS__); } while(0)
+// stdout is fully buffered (see main), flush it before warnings so messages still show up in order
+#define prlog_level(max,l,...) do { if(l<=(max)) { if (l <= PR_WARNING) fflush(stdout); fprintf((l <= PR_WARNING) ? stderr : stdout, ##__VA_ARGS__); } } while(0)
+#define prlog(l,...) prlog_level(MAXLEVEL, l, ##__VA_ARGS__)
 #endif
\ No newline at end of file
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <stddef.h>
+
+/*
+ *a job is called once for every index in [0, numJobs), from any thread of the pool,
+ *jobs of the same run must not depend on each other
+ *@return SUCCESS or an error number
+ */
+typedef int (*threadpoolJob)(void *ctx, size_t index);
+
+struct threadpool;
+
+int threadpoolDefaultSize(void);
+int threadpoolInJob(void);
+struct threadpool *threadpoolCreate(int numThreads);
+int threadpoolRun(struct threadpool *pool, threadpoolJob job, void *ctx, size_t numJobs);
+void threadpoolDestroy(struct threadpool *pool);
+#endif
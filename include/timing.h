@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifndef TIMING_H
+#define TIMING_H
+#include <stdint.h>
+
+// hot phases measured with --timings, keep timingPhaseNames in timing.c in the same order
+enum timingPhase {
+	TIMING_FILE_IO = 0,
+	TIMING_PKCS7_PARSE,
+	TIMING_X509_PARSE,
+	TIMING_HASH,
+	TIMING_SIG_VERIFY,
+	TIMING_SIGN,
+	TIMING_PHASE_COUNT
+};
+
+// 0 unless --timings was given, checked first so instrumentation costs nothing when off
+extern int timingEnabled;
+
+int timingEnable(const char *traceFile);
+uint64_t timingStart(void);
+void timingStop(enum timingPhase phase, uint64_t start);
+int timingReport(void);
+#endif
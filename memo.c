@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "err.h"
+#include "prlog.h"
+#include "generic.h"
+#include "memo.h"
+
+/*
+ *persistent verdicts of signature checks, so that the same update checked against the same authority
+ *is only verified once across runs. The keys are made by the caller (see verify_update), this file
+ *only keeps them sorted in memory and in a file of the form:
+ *  magic | tag | count | count * (key | verdict) | checksum
+ *with count and checksum little endian. The checksum (FNV-1a) only catches damaged files, whoever can
+ *write the memo can make any update pass, so it must be as well protected as the variables themselves.
+ *A file that is damaged or was made under another tag is dropped as a whole and rewritten
+ */
+#define MEMO_MAGIC "SVCMEMO1"
+#define MEMO_MAGIC_SIZE 8
+#define MEMO_TAG_SIZE 16
+#define MEMO_HEADER_SIZE (MEMO_MAGIC_SIZE + MEMO_TAG_SIZE + 4)
+#define MEMO_ENTRY_SIZE (MEMO_KEY_SIZE + 1)
+#define MEMO_CHECKSUM_SIZE 8
+// entries room is made for when the memo is empty, it then doubles up to MEMO_MAX_ENTRIES
+#define MEMO_MIN_CAPACITY 64
+
+struct verifyMemo {
+	char *path;
+	char tag[MEMO_TAG_SIZE];
+	// lookups and stores come from the threads of verify_queue
+	pthread_mutex_t lock;
+	// count entries of MEMO_ENTRY_SIZE sorted by key, with room for capacity
+	unsigned char *entries;
+	size_t count, capacity, hits, misses;
+	int dirty;
+};
+
+/**
+ *@return 1 if MEMO_OFF_ENV turns memos off
+ */
+int memoDisabled(void)
+{
+	const char *env = getenv(MEMO_OFF_ENV);
+
+	return env && *env && strcmp(env, "0");
+}
+
+static uint64_t checksum(const unsigned char *data, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ data[i]) * 0x100000001b3ULL;
+
+	return h;
+}
+
+static void putLE(unsigned char *out, uint64_t v, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		out[i] = v >> (8 * i);
+}
+
+static uint64_t getLE(const unsigned char *in, int bytes)
+{
+	uint64_t v = 0;
+
+	for (int i = bytes - 1; i >= 0; i--)
+		v = v << 8 | in[i];
+
+	return v;
+}
+
+/*
+ *makes room for at least capacity entries, never more than MEMO_MAX_ENTRIES
+ *@return SUCCESS or ALLOC_FAIL, the entries are then unchanged
+ */
+static int growEntries(struct verifyMemo *memo, size_t capacity)
+{
+	unsigned char *entries;
+
+	if (capacity < MEMO_MIN_CAPACITY)
+		capacity = MEMO_MIN_CAPACITY;
+	if (capacity > MEMO_MAX_ENTRIES)
+		capacity = MEMO_MAX_ENTRIES;
+	if (capacity <= memo->capacity)
+		return SUCCESS;
+	entries = realloc(memo->entries, capacity * MEMO_ENTRY_SIZE);
+	if (!entries) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	memo->entries = entries;
+	memo->capacity = capacity;
+
+	return SUCCESS;
+}
+
+/*
+ *checks a memo file and takes its entries, anything unexpected drops the whole file
+ *@return SUCCESS, INVALID_FILE or ALLOC_FAIL
+ */
+static int loadEntries(struct verifyMemo *memo, const unsigned char *data, size_t size)
+{
+	size_t count;
+	const unsigned char *entry;
+
+	if (size < MEMO_HEADER_SIZE + MEMO_CHECKSUM_SIZE || memcmp(data, MEMO_MAGIC, MEMO_MAGIC_SIZE)
+	    || memcmp(data + MEMO_MAGIC_SIZE, memo->tag, MEMO_TAG_SIZE))
+		return INVALID_FILE;
+	count = getLE(data + MEMO_MAGIC_SIZE + MEMO_TAG_SIZE, 4);
+	if (count > MEMO_MAX_ENTRIES || size != MEMO_HEADER_SIZE + count * MEMO_ENTRY_SIZE + MEMO_CHECKSUM_SIZE
+	    || getLE(data + size - MEMO_CHECKSUM_SIZE, MEMO_CHECKSUM_SIZE) != checksum(data, size - MEMO_CHECKSUM_SIZE))
+		return INVALID_FILE;
+	entry = data + MEMO_HEADER_SIZE;
+	for (size_t i = 0; i < count; i++, entry += MEMO_ENTRY_SIZE) {
+		if (entry[MEMO_KEY_SIZE] > 1 || (i && memcmp(entry - MEMO_ENTRY_SIZE, entry, MEMO_KEY_SIZE) >= 0))
+			return INVALID_FILE;
+	}
+	if (growEntries(memo, count))
+		return ALLOC_FAIL;
+	memcpy(memo->entries, data + MEMO_HEADER_SIZE, count * MEMO_ENTRY_SIZE);
+	memo->count = count;
+
+	return SUCCESS;
+}
+
+/**
+ *opens the memo kept in path, a missing, damaged or differently tagged file gives an empty memo
+ *@param memo, returned memo, close with memoClose
+ *@param path, file the memo is read from and written back to
+ *@param tag, entries are only used under the same tag (ex: the crypto provider), at most MEMO_TAG_SIZE characters count
+ *@return SUCCESS or ALLOC_FAIL
+ */
+int memoOpen(struct verifyMemo **memo, const char *path, const char *tag)
+{
+	struct verifyMemo *m;
+	unsigned char *data = NULL;
+	size_t size = 0;
+	int rc = SUCCESS;
+
+	m = calloc(1, sizeof(*m));
+	if (!m || !(m->path = strdup(path))) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		free(m);
+		return ALLOC_FAIL;
+	}
+	// zero padded so that the tag compares and saves as a fixed size field
+	memcpy(m->tag, tag, strnlen(tag, MEMO_TAG_SIZE));
+	pthread_mutex_init(&m->lock, NULL);
+	if (!access(path, F_OK))
+		data = (unsigned char *)getDataFromFile(path, &size);
+	if (data)
+		rc = loadEntries(m, data, size);
+	if (rc == INVALID_FILE || (!data && !access(path, F_OK))) {
+		prlog(PR_NOTICE, "Memo %s is damaged or was made with another crypto provider, it is started again\n", path);
+		m->dirty = 1;
+		rc = SUCCESS;
+	}
+	if (!rc)
+		rc = growEntries(m, 0);
+	free(data);
+	if (rc) {
+		free(m->entries);
+		free(m->path);
+		free(m);
+		return rc;
+	}
+	prlog(PR_INFO, "Memo %s has %zu verdicts\n", path, m->count);
+	*memo = m;
+
+	return SUCCESS;
+}
+
+// index of key or of where it would go, found is set if it is there
+static size_t findEntry(struct verifyMemo *memo, const unsigned char *key, int *found)
+{
+	size_t lo = 0, hi = memo->count, mid;
+	int cmp;
+
+	*found = 0;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = memcmp(memo->entries + mid * MEMO_ENTRY_SIZE, key, MEMO_KEY_SIZE);
+		if (!cmp) {
+			*found = 1;
+			return mid;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ *@param memo, open memo
+ *@param key, MEMO_KEY_SIZE bytes
+ *@param verified, returned verdict, 1 if the signature was good
+ *@return 1 if key is in the memo, else 0
+ */
+int memoLookup(struct verifyMemo *memo, const unsigned char *key, int *verified)
+{
+	size_t i;
+	int found;
+
+	pthread_mutex_lock(&memo->lock);
+	i = findEntry(memo, key, &found);
+	if (found) {
+		*verified = memo->entries[i * MEMO_ENTRY_SIZE + MEMO_KEY_SIZE];
+		memo->hits++;
+	}
+	else
+		memo->misses++;
+	pthread_mutex_unlock(&memo->lock);
+
+	return found;
+}
+
+/**
+ *remembers the verdict of key, nothing is stored once the memo has MEMO_MAX_ENTRIES or if it can not grow,
+ *the memo only has to be written back if a verdict is new or changed
+ *@param memo, open memo
+ *@param key, MEMO_KEY_SIZE bytes
+ *@param verified, 1 if the signature was good, 0 if it was not
+ */
+void memoStore(struct verifyMemo *memo, const unsigned char *key, int verified)
+{
+	unsigned char *entry;
+	size_t i;
+	int found;
+
+	pthread_mutex_lock(&memo->lock);
+	i = findEntry(memo, key, &found);
+	if (found) {
+		entry = memo->entries + i * MEMO_ENTRY_SIZE;
+		if (entry[MEMO_KEY_SIZE] != !!verified) {
+			entry[MEMO_KEY_SIZE] = !!verified;
+			memo->dirty = 1;
+		}
+	}
+	else if (memo->count < memo->capacity || (memo->count < MEMO_MAX_ENTRIES && !growEntries(memo, memo->capacity * 2))) {
+		entry = memo->entries + i * MEMO_ENTRY_SIZE;
+		memmove(entry + MEMO_ENTRY_SIZE, entry, (memo->count - i) * MEMO_ENTRY_SIZE);
+		memcpy(entry, key, MEMO_KEY_SIZE);
+		entry[MEMO_KEY_SIZE] = !!verified;
+		memo->count++;
+		memo->dirty = 1;
+	}
+	pthread_mutex_unlock(&memo->lock);
+}
+
+/*
+ *writes the memo to a temporary file that is renamed over path, so a reader never sees half a memo
+ *@return SUCCESS or FILE_WRITE_FAIL
+ */
+static int saveMemo(struct verifyMemo *memo)
+{
+	unsigned char header[MEMO_HEADER_SIZE], trailer[MEMO_CHECKSUM_SIZE];
+	size_t bodySize = memo->count * MEMO_ENTRY_SIZE;
+	char *tmp;
+	size_t tmpLen = strlen(memo->path) + 32;
+	uint64_t h;
+	FILE *f = NULL;
+	int fd, rc = FILE_WRITE_FAIL;
+
+	tmp = malloc(tmpLen);
+	if (!tmp) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	snprintf(tmp, tmpLen, "%s.%ld.tmp", memo->path, (long)getpid());
+	memcpy(header, MEMO_MAGIC, MEMO_MAGIC_SIZE);
+	memcpy(header + MEMO_MAGIC_SIZE, memo->tag, MEMO_TAG_SIZE);
+	putLE(header + MEMO_MAGIC_SIZE + MEMO_TAG_SIZE, memo->count, 4);
+	// checksum of header and entries as if they were one buffer
+	h = checksum(header, sizeof(header));
+	for (size_t i = 0; i < bodySize; i++)
+		h = (h ^ memo->entries[i]) * 0x100000001b3ULL;
+	putLE(trailer, h, MEMO_CHECKSUM_SIZE);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd >= 0) {
+		f = fdopen(fd, "w");
+		if (!f)
+			close(fd);
+	}
+	if (f) {
+		if (fwrite(header, 1, sizeof(header), f) == sizeof(header) && fwrite(memo->entries, 1, bodySize, f) == bodySize
+		    && fwrite(trailer, 1, sizeof(trailer), f) == sizeof(trailer))
+			rc = SUCCESS;
+		if (fclose(f))
+			rc = FILE_WRITE_FAIL;
+		if (!rc && rename(tmp, memo->path))
+			rc = FILE_WRITE_FAIL;
+	}
+	if (rc) {
+		prlog(PR_WARNING, "WARNING: Could not write memo %s\n", memo->path);
+		unlink(tmp);
+	}
+	free(tmp);
+
+	return rc;
+}
+
+/**
+ *writes the memo back if it changed and frees it
+ *@param memo, open memo, NULL does nothing
+ *@return SUCCESS or error if it could not be written, the verdicts of the run are not affected
+ */
+int memoClose(struct verifyMemo *memo)
+{
+	int rc = SUCCESS;
+
+	if (!memo)
+		return SUCCESS;
+	prlog(PR_INFO, "Memo %s: %zu verdicts reused, %zu signatures checked\n", memo->path, memo->hits, memo->misses);
+	if (memo->dirty)
+		rc = saveMemo(memo);
+	pthread_mutex_destroy(&memo->lock);
+	free(memo->entries);
+	free(memo->path);
+	free(memo);
+
+	return rc;
+}
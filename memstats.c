@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "err.h"
+#include "prlog.h"
+#include "memstats.h"
+
+/*
+ *every malloc/calloc/realloc/free made by secvarctl is routed here by the linker (-Wl,--wrap=malloc...),
+ *see the Makefile. the crypto libraries are hooked through crypto_enable_alloc_tracking instead.
+ *the real allocator is only reached through the __real_ functions below, so nothing in this file
+ *is ever counted itself
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static const char *memTagNames[MEM_TAG_COUNT] = {
+	"other", "file_io", "esl", "pkcs7", "crypto", "bank"
+};
+
+struct tagStats {
+	uint64_t allocs, frees, bytes, live, peak;
+};
+
+// one live allocation, ptr is NULL for an empty slot
+struct allocEntry {
+	void *ptr;
+	size_t size;
+	enum memTag tag;
+};
+
+int memStatsEnabled = 0;
+
+static pthread_mutex_t memLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread enum memTag currentTag = MEM_OTHER;
+static struct tagStats stats[MEM_TAG_COUNT];
+static uint64_t totalLive = 0, totalPeak = 0;
+// open addressing with linear probing, size is a power of two and kept at most half full
+static struct allocEntry *table = NULL;
+static size_t tableSize = 0, tableUsed = 0;
+
+static size_t slotOf(const void *ptr)
+{
+	uint64_t h = (uintptr_t)ptr;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	return h & (tableSize - 1);
+}
+
+static struct allocEntry *findEntry(const void *ptr)
+{
+	size_t i;
+
+	if (!tableSize)
+		return NULL;
+	for (i = slotOf(ptr); table[i].ptr; i = (i + 1) & (tableSize - 1)) {
+		if (table[i].ptr == ptr)
+			return &table[i];
+	}
+
+	return NULL;
+}
+
+// charges a free of entry to its tag and takes it out of the table, later entries are shifted back into the gap
+static void removeEntry(struct allocEntry *entry)
+{
+	size_t i = entry - table, j = i, home;
+	struct tagStats *s = &stats[entry->tag];
+
+	s->frees++;
+	s->live -= entry->size;
+	totalLive -= entry->size;
+	tableUsed--;
+	for (;;) {
+		j = (j + 1) & (tableSize - 1);
+		if (!table[j].ptr)
+			break;
+		home = slotOf(table[j].ptr);
+		// the entry at j can fill the gap at i only if its home slot is not cyclically within (i, j]
+		if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+			table[i] = table[j];
+			i = j;
+		}
+	}
+	table[i].ptr = NULL;
+}
+
+static int growTable(void)
+{
+	struct allocEntry *old = table;
+	size_t oldSize = tableSize, i, j;
+
+	tableSize = oldSize ? oldSize * 2 : 4096;
+	table = __real_calloc(tableSize, sizeof(*table));
+	if (!table) {
+		table = old;
+		tableSize = oldSize;
+		return ALLOC_FAIL;
+	}
+	for (i = 0; i < oldSize; i++) {
+		if (!old[i].ptr)
+			continue;
+		for (j = slotOf(old[i].ptr); table[j].ptr; j = (j + 1) & (tableSize - 1))
+			;
+		table[j] = old[i];
+	}
+	__real_free(old);
+
+	return SUCCESS;
+}
+
+// records a new allocation, must be called with memLock held
+static void addEntry(void *ptr, size_t size, enum memTag tag)
+{
+	struct allocEntry *entry;
+	struct tagStats *s = &stats[tag];
+	size_t i;
+
+	// a pointer we still know about was freed by a library without going through us
+	entry = findEntry(ptr);
+	if (entry)
+		removeEntry(entry);
+	s->allocs++;
+	s->bytes += size;
+	s->live += size;
+	if (s->live > s->peak)
+		s->peak = s->live;
+	totalLive += size;
+	if (totalLive > totalPeak)
+		totalPeak = totalLive;
+	// if the table can not grow the allocation is still counted, its free just is not
+	if ((tableUsed + 1) * 2 > tableSize && growTable())
+		return;
+	for (i = slotOf(ptr); table[i].ptr; i = (i + 1) & (tableSize - 1))
+		;
+	table[i] = (struct allocEntry){ ptr, size, tag };
+	tableUsed++;
+}
+
+/**
+ *turns on counting of allocations, should be called before anything is allocated
+ *@return SUCCESS
+ */
+int memStatsEnable(void)
+{
+	memStatsEnabled = 1;
+
+	return SUCCESS;
+}
+
+/**
+ *for measuring a piece of code, the difference taken around it is what it allocated
+ *@return the number of allocations counted so far over every tag
+ */
+uint64_t memStatsAllocs(void)
+{
+	uint64_t allocs = 0;
+
+	pthread_mutex_lock(&memLock);
+	for (int i = 0; i < MEM_TAG_COUNT; i++)
+		allocs += stats[i].allocs;
+	pthread_mutex_unlock(&memLock);
+
+	return allocs;
+}
+
+/**
+ *charges allocations made by this thread to tag until memTagExit is called
+ *@return the tag that was current, to be given to memTagExit
+ */
+enum memTag memTagEnter(enum memTag tag)
+{
+	enum memTag previous = currentTag;
+
+	currentTag = tag;
+
+	return previous;
+}
+
+void memTagExit(enum memTag previous)
+{
+	currentTag = previous;
+}
+
+enum memTag memTagCurrent(void)
+{
+	return currentTag;
+}
+
+void *memMalloc(enum memTag tag, size_t size)
+{
+	void *ptr = __real_malloc(size);
+
+	if (ptr && memStatsEnabled) {
+		pthread_mutex_lock(&memLock);
+		addEntry(ptr, size, tag);
+		pthread_mutex_unlock(&memLock);
+	}
+
+	return ptr;
+}
+
+void *memCalloc(enum memTag tag, size_t count, size_t size)
+{
+	void *ptr = __real_calloc(count, size);
+
+	if (ptr && memStatsEnabled) {
+		pthread_mutex_lock(&memLock);
+		addEntry(ptr, count * size, tag);
+		pthread_mutex_unlock(&memLock);
+	}
+
+	return ptr;
+}
+
+/**
+ *a resized buffer stays charged to the tag it was first allocated under,
+ *tag is only used for buffers that were not known before
+ */
+void *memRealloc(enum memTag tag, void *ptr, size_t size)
+{
+	struct allocEntry *entry, old = { NULL, 0, tag };
+	void *ret;
+
+	if (!memStatsEnabled)
+		return __real_realloc(ptr, size);
+	// the entry has to be gone before ptr is released, another thread may be handed the same address
+	pthread_mutex_lock(&memLock);
+	entry = ptr ? findEntry(ptr) : NULL;
+	if (entry) {
+		old = *entry;
+		removeEntry(entry);
+	}
+	pthread_mutex_unlock(&memLock);
+	ret = __real_realloc(ptr, size);
+	pthread_mutex_lock(&memLock);
+	if (ret)
+		addEntry(ret, size, old.tag);
+	else if (old.ptr && size)
+		// realloc failed, the old buffer is still there
+		addEntry(old.ptr, old.size, old.tag);
+	pthread_mutex_unlock(&memLock);
+
+	return ret;
+}
+
+void memFree(void *ptr)
+{
+	struct allocEntry *entry;
+
+	if (ptr && memStatsEnabled) {
+		pthread_mutex_lock(&memLock);
+		entry = findEntry(ptr);
+		if (entry)
+			removeEntry(entry);
+		pthread_mutex_unlock(&memLock);
+	}
+	__real_free(ptr);
+}
+
+void *__wrap_malloc(size_t size)
+{
+	return memMalloc(currentTag, size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	return memCalloc(currentTag, count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	return memRealloc(currentTag, ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+	memFree(ptr);
+}
+
+/**
+ *prints allocations, bytes and high water marks of every tag to stderr,
+ *the total peak is the most memory live at once, not the sum of the peaks of the tags
+ *@return SUCCESS
+ */
+int memStatsReport(void)
+{
+	struct tagStats copy[MEM_TAG_COUNT], total = { 0 };
+
+	if (!memStatsEnabled)
+		return SUCCESS;
+	pthread_mutex_lock(&memLock);
+	// stdio allocates on its own, take a copy and stop counting before printing anything
+	memStatsEnabled = 0;
+	memcpy(copy, stats, sizeof(copy));
+	total.live = totalLive;
+	total.peak = totalPeak;
+	__real_free(table);
+	table = NULL;
+	tableSize = tableUsed = 0;
+	pthread_mutex_unlock(&memLock);
+
+	fprintf(stderr, "%-10s %10s %10s %14s %12s %12s\n", "tag", "allocs", "frees", "bytes", "live bytes", "peak bytes");
+	for (int i = 0; i < MEM_TAG_COUNT; i++) {
+		if (!copy[i].allocs)
+			continue;
+		fprintf(stderr, "%-10s %10llu %10llu %14llu %12llu %12llu\n", memTagNames[i], (unsigned long long)copy[i].allocs,
+			(unsigned long long)copy[i].frees, (unsigned long long)copy[i].bytes, (unsigned long long)copy[i].live,
+			(unsigned long long)copy[i].peak);
+		total.allocs += copy[i].allocs;
+		total.frees += copy[i].frees;
+		total.bytes += copy[i].bytes;
+	}
+	fprintf(stderr, "%-10s %10llu %10llu %14llu %12llu %12llu\n", "total", (unsigned long long)total.allocs,
+		(unsigned long long)total.frees, (unsigned long long)total.bytes, (unsigned long long)total.live,
+		(unsigned long long)total.peak);
+
+	return SUCCESS;
+}
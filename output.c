@@ -0,0 +1,369 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "err.h"
+#include "prlog.h"
+#include "generic.h"
+#include "output.h"
+
+#define EMITTER_INITIAL_SIZE 4096
+
+// CBOR major types, RFC 8949
+#define CBOR_UINT 0x00
+#define CBOR_NEGINT 0x20
+#define CBOR_BYTES 0x40
+#define CBOR_TEXT 0x60
+#define CBOR_ARRAY_INDEF 0x9f
+#define CBOR_MAP_INDEF 0xbf
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_BREAK 0xff
+
+static const char hexDigits[] = "0123456789abcdef";
+
+/**
+ *converts the argument of --output into an outputFormat
+ *@param str, one of {"text", "json", "cbor"}
+ *@param format, filled with the matching format
+ *@return SUCCESS or ARG_PARSE_FAIL if str is unknown
+ */
+int parseOutputFormat(const char *str, enum outputFormat *format)
+{
+	if (!strcmp(str, "text"))
+		*format = OUTPUT_TEXT;
+	else if (!strcmp(str, "json"))
+		*format = OUTPUT_JSON;
+	else if (!strcmp(str, "cbor"))
+		*format = OUTPUT_CBOR;
+	else {
+		prlog(PR_ERR, "ERROR: Unknown output format %s, expected one of {'text', 'json', 'cbor'}\n", str);
+		return ARG_PARSE_FAIL;
+	}
+
+	return SUCCESS;
+}
+
+void emitterInit(struct emitter *e, enum outputFormat format)
+{
+	memset(e, 0, sizeof(*e));
+	e->format = format;
+}
+
+void emitterFree(struct emitter *e)
+{
+	if (e->buf)
+		free(e->buf);
+	e->buf = NULL;
+	e->len = e->cap = 0;
+}
+
+/**
+ *makes sure at least extra more bytes fit in the buffer
+ *@return SUCCESS or ALLOC_FAIL, on failure the emitter is marked as errored
+ */
+static int reserve(struct emitter *e, size_t extra)
+{
+	size_t newCap;
+
+	if (e->err)
+		return e->err;
+	if (e->len + extra <= e->cap)
+		return SUCCESS;
+	newCap = e->cap ? e->cap : EMITTER_INITIAL_SIZE;
+	while (newCap < e->len + extra)
+		newCap *= 2;
+	if (reallocArray((void **)&e->buf, newCap, sizeof(unsigned char))) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		e->buf = NULL;
+		e->len = e->cap = 0;
+		e->err = ALLOC_FAIL;
+		return e->err;
+	}
+	e->cap = newCap;
+
+	return SUCCESS;
+}
+
+static void put(struct emitter *e, const void *data, size_t len)
+{
+	if (reserve(e, len))
+		return;
+	memcpy(e->buf + e->len, data, len);
+	e->len += len;
+}
+
+static void putByte(struct emitter *e, unsigned char c)
+{
+	put(e, &c, 1);
+}
+
+// writes a CBOR head, the major type and the smallest encoding of val
+static void cborHead(struct emitter *e, unsigned char major, uint64_t val)
+{
+	unsigned char head[9];
+	int n, i;
+
+	if (val < 24) {
+		putByte(e, major | val);
+		return;
+	}
+	if (val <= UINT8_MAX) {
+		head[0] = major | 24;
+		n = 1;
+	}
+	else if (val <= UINT16_MAX) {
+		head[0] = major | 25;
+		n = 2;
+	}
+	else if (val <= UINT32_MAX) {
+		head[0] = major | 26;
+		n = 4;
+	}
+	else {
+		head[0] = major | 27;
+		n = 8;
+	}
+	// CBOR is big endian
+	for (i = n; i > 0; i--, val >>= 8)
+		head[i] = val & 0xff;
+	put(e, head, n + 1);
+}
+
+/*
+ *length of the UTF-8 sequence at s, 0 if it is not valid UTF-8 (overlong, surrogate, above U+10FFFF or cut short)
+ */
+static int utf8Length(const unsigned char *s)
+{
+	int n, i;
+	unsigned int c;
+
+	if (*s < 0x80)
+		return 1;
+	if (*s >= 0xc2 && *s <= 0xdf) {
+		n = 2;
+		c = *s & 0x1f;
+	}
+	else if ((*s & 0xf0) == 0xe0) {
+		n = 3;
+		c = *s & 0x0f;
+	}
+	else if (*s >= 0xf0 && *s <= 0xf4) {
+		n = 4;
+		c = *s & 0x07;
+	}
+	else
+		return 0;
+	for (i = 1; i < n; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		c = c << 6 | (s[i] & 0x3f);
+	}
+	if ((n == 3 && (c < 0x800 || (c >= 0xd800 && c <= 0xdfff))) || (n == 4 && (c < 0x10000 || c > 0x10ffff)))
+		return 0;
+
+	return n;
+}
+
+// UTF-8 of U+FFFD, written in place of every byte that does not start a valid sequence
+static const char replacementChar[] = "\xef\xbf\xbd";
+
+/*
+ *text strings must be UTF-8 in both formats, but names of files and certificate subjects need not be
+ *@return length of str once invalid bytes are replaced
+ */
+static size_t utf8CleanLength(const unsigned char *s)
+{
+	size_t len = 0;
+	int n;
+
+	for (; *s; s += n ? n : 1)
+		len += (n = utf8Length(s)) ? n : sizeof(replacementChar) - 1;
+
+	return len;
+}
+
+static void putUtf8Clean(struct emitter *e, const unsigned char *s)
+{
+	int n;
+
+	for (; *s; s += n ? n : 1) {
+		n = utf8Length(s);
+		if (n)
+			put(e, s, n);
+		else
+			put(e, replacementChar, sizeof(replacementChar) - 1);
+	}
+}
+
+static void jsonString(struct emitter *e, const char *str)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	char esc[6] = { '\\', 'u', '0', '0' };
+	int n;
+
+	putByte(e, '"');
+	for (; *s; s += n ? n : 1) {
+		n = 1;
+		if (*s == '"' || *s == '\\') {
+			putByte(e, '\\');
+			putByte(e, *s);
+		}
+		else if (*s < 0x20) {
+			esc[4] = hexDigits[*s >> 4];
+			esc[5] = hexDigits[*s & 0xf];
+			put(e, esc, sizeof(esc));
+		}
+		else if ((n = utf8Length(s)))
+			put(e, s, n);
+		else
+			put(e, replacementChar, sizeof(replacementChar) - 1);
+	}
+	putByte(e, '"');
+}
+
+// writes the separator and key that precede every value
+static void prefix(struct emitter *e, const char *key)
+{
+	if (e->format == OUTPUT_CBOR) {
+		if (key) {
+			cborHead(e, CBOR_TEXT, strlen(key));
+			put(e, key, strlen(key));
+		}
+		return;
+	}
+	if (e->needComma[e->depth])
+		putByte(e, ',');
+	e->needComma[e->depth] = 1;
+	if (key) {
+		jsonString(e, key);
+		putByte(e, ':');
+	}
+}
+
+static void openNested(struct emitter *e, const char *key, unsigned char cbor, char json)
+{
+	prefix(e, key);
+	if (e->depth + 1 >= EMITTER_MAX_DEPTH) {
+		prlog(PR_ERR, "ERROR: Structured output is nested too deep\n");
+		e->err = ALLOC_FAIL;
+		return;
+	}
+	e->depth++;
+	e->needComma[e->depth] = 0;
+	if (e->format == OUTPUT_CBOR)
+		putByte(e, cbor);
+	else
+		putByte(e, json);
+}
+
+static void closeNested(struct emitter *e, char json)
+{
+	if (e->depth > 0)
+		e->depth--;
+	if (e->format == OUTPUT_CBOR)
+		putByte(e, CBOR_BREAK);
+	else
+		putByte(e, json);
+}
+
+void emitMapStart(struct emitter *e, const char *key)
+{
+	openNested(e, key, CBOR_MAP_INDEF, '{');
+}
+
+void emitMapEnd(struct emitter *e)
+{
+	closeNested(e, '}');
+}
+
+void emitArrayStart(struct emitter *e, const char *key)
+{
+	openNested(e, key, CBOR_ARRAY_INDEF, '[');
+}
+
+void emitArrayEnd(struct emitter *e)
+{
+	closeNested(e, ']');
+}
+
+void emitString(struct emitter *e, const char *key, const char *value)
+{
+	prefix(e, key);
+	if (e->format == OUTPUT_CBOR) {
+		cborHead(e, CBOR_TEXT, utf8CleanLength((const unsigned char *)value));
+		putUtf8Clean(e, (const unsigned char *)value);
+	}
+	else
+		jsonString(e, value);
+}
+
+void emitInt(struct emitter *e, const char *key, int64_t value)
+{
+	char num[24];
+
+	prefix(e, key);
+	if (e->format == OUTPUT_CBOR) {
+		if (value < 0)
+			cborHead(e, CBOR_NEGINT, (uint64_t)(-1 - value));
+		else
+			cborHead(e, CBOR_UINT, (uint64_t)value);
+	}
+	else
+		put(e, num, snprintf(num, sizeof(num), "%lld", (long long)value));
+}
+
+void emitBool(struct emitter *e, const char *key, int value)
+{
+	prefix(e, key);
+	if (e->format == OUTPUT_CBOR)
+		putByte(e, value ? CBOR_TRUE : CBOR_FALSE);
+	else if (value)
+		put(e, "true", 4);
+	else
+		put(e, "false", 5);
+}
+
+/**
+ *emits binary data, CBOR has a native byte string, JSON gets a lowercase hex string
+ */
+void emitBytes(struct emitter *e, const char *key, const unsigned char *data, size_t len)
+{
+	unsigned char *out;
+
+	prefix(e, key);
+	if (e->format == OUTPUT_CBOR) {
+		cborHead(e, CBOR_BYTES, len);
+		put(e, data, len);
+		return;
+	}
+	if (reserve(e, len * 2 + 2))
+		return;
+	out = e->buf + e->len;
+	*out++ = '"';
+	out += hexEncode((char *)out, data, len, 0);
+	*out++ = '"';
+	e->len += len * 2 + 2;
+}
+
+/**
+ *writes everything emitted so far to file and empties the buffer
+ *@param e, the emitter
+ *@param file, output file or STDIO_FILE for stdout
+ *@return SUCCESS or error if an emit failed or the data could not be written
+ */
+int emitterFlush(struct emitter *e, const char *file)
+{
+	int rc;
+
+	// JSON is meant to be read by line based tools as well, end with a newline
+	if (e->format == OUTPUT_JSON && e->depth == 0)
+		putByte(e, '\n');
+	if (e->err)
+		return e->err;
+	rc = createFile(file, (const char *)e->buf, e->len);
+	e->len = 0;
+
+	return rc;
+}
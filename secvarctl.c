@@ -4,8 +4,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include "prlog.h"
+#include "timing.h"
+#include "memstats.h"
+#include "crypto/crypto.h"
 #include "secvarctl.h"
 
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
 int verbose = PR_WARNING;
 static struct backend *getBackend();
 
@@ -18,6 +23,12 @@ void usage()
 	printf("USAGE: \n\t$ secvarctl [COMMAND]\n"
 		"COMMANDs:\n"
 		"\t--help/--usage\n\t"
+		"--timings[=FILE]\tprint time spent in file io, parsing, hashing and signatures to stderr,\n\t\t\t"
+		"if FILE is given also write a chrome trace event file there\n\t"
+		"--mem-stats\tprint allocations, bytes and peak memory of file io, ESL parsing, PKCS7,\n\t\t\t"
+		"crypto and variable banks to stderr\n\t"
+		"--crypto=NAME\tcrypto library to use when more than one is built (openssl, mbedtls),\n\t\t\t"
+		"defaults to $SECVARCTL_CRYPTO, then to openssl\n\t"
 		"read\t\tprints info on secure variables,\n\t\t\t"
 		"use 'secvarctl read --usage/help' for more information\n\t"
 		"write\t\tupdates secure variable with new auth,\n\t\t\t"
@@ -29,6 +40,8 @@ void usage()
 #ifndef NO_CRYPTO
 		"\tgenerate\tcreates relevant files for secure variable management,\n\t\t\t"
 		"use 'secvarctl generate --usage/help' for more information\n"
+		"\tcheck-image\ttells whether firmware would run EFI binaries with the current db/dbx,\n\t\t\t"
+		"use 'secvarctl check-image --usage/help' for more information\n"
 #endif
 		);
 }
@@ -43,6 +56,7 @@ void help()
        "verify - checks that the given files are correctly signed by the current variables\n"
 #ifndef NO_CRYPTO
        "\t\tgenerate - create files that are relevant to the secure variable management process\n"
+       "\t\tcheck-image - checks PE/COFF images against the current db and dbx\n"
 #endif
        );
 	usage();
@@ -53,9 +67,11 @@ void help()
 int main(int argc, char *argv[])
 {
 	int rc, i;
-	char *subcommand = NULL;
+	char *subcommand = NULL, *cryptoName = NULL;
 	struct backend *backend = NULL;
 	
+	// output is gathered and written in large blocks, big variables print thousands of lines
+	setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
 	if (argc < 2) {
 		usage();
 		return ARG_PARSE_FAIL;
@@ -74,7 +90,20 @@ int main(int argc, char *argv[])
 		if (!strcmp(*argv, "-v")) {
 			verbose = PR_DEBUG;
 		}
+		else if (!strcmp(*argv, "--timings"))
+			timingEnable(NULL);
+		else if (!strncmp(*argv, "--timings=", strlen("--timings=")))
+			timingEnable(*argv + strlen("--timings="));
+		else if (!strcmp(*argv, "--mem-stats")) {
+			memStatsEnable();
+			crypto_enable_alloc_tracking();
+		}
+		else if (!strncmp(*argv, "--crypto=", strlen("--crypto=")))
+			cryptoName = *argv + strlen("--crypto=");
 	}
+	// only checks the name, the library is loaded by the first command that needs it
+	if (crypto_select(cryptoName))
+		return ARG_PARSE_FAIL;
 	if (argc <= 0) {
 		prlog(PR_ERR,"ERROR: No command found\n");
 		return ARG_PARSE_FAIL;
@@ -101,6 +130,9 @@ int main(int argc, char *argv[])
 		prlog(PR_ERR, "ERROR:Unknown command %s\n", subcommand);
 		usage();
 	}
+	if (timingReport() && !rc)
+		rc = FILE_WRITE_FAIL;
+	memStatsReport();
 	
 	return rc;
 }
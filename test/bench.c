@@ -0,0 +1,765 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <argp.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "external/skiboot/include/secvar.h"
+#include "test/synthetic.h"
+#include "memstats.h"
+#include "backends/edk2-compat/include/edk2-svc.h"// include last, pragma pack(1) issue
+#include "external/skiboot/include/edk2-compat-process.h" // for struct secvar_ctx, also packs
+
+/*
+ *Benchmark harness for secvarctl, links against everything but secvarctl.c and runs
+ *the read, validate, verify and generate code paths in-process over synthetic inputs,
+ *with --crypto-ops it runs every crypto.h operation on each crypto provider of the build instead
+ */
+
+int verbose = PR_ERR;
+
+// timestamp used for every generated update, after the timestamps in goldenKeys/TS
+#define BENCH_TIMESTAMP "2030-01-01T00:00:00"
+
+struct Arguments {
+	int helpFlag, iterations, dbxHashes, dbCerts, cryptoOps;
+	const char *dataDir, *filter;
+};
+
+// everything the benchmarks run on, built once by setupWorkspace
+struct benchData {
+	char workDir[64], varsDir[128], dbxESLFile[128], dbESLFile[128], certESLFile[128], hashInFile[128], bundleFile[128], keyDir[4096];
+	unsigned char *dbxESL, *dbESL, *dbxAuth;
+	size_t dbxESLSize, dbESLSize, dbxAuthSize, certESLSize, bundleSize;
+	struct list_head variable_bank, update_bank;
+	// inputs of the crypto benchmarks, see setupCryptoInputs
+	char kekCrt[4200], kekKey[4200], sigFile[128];
+	unsigned char *kekPEM, *kekDER, *signedPKCS7, *signedHash;
+	size_t kekPEMSize, kekDERSize, signedPKCS7Size, signedHashSize, dbxPKCS7Size;
+	const unsigned char *dbxPKCS7;
+	// parsed by the selected provider, freed before the next one is selected
+	crypto_pkcs7 *pkcs7;
+	crypto_x509 *x509;
+};
+
+struct bench {
+	const char *name;
+	int (*run)(struct benchData *data);
+	int needsCrypto;
+	// bytes one run goes through, reported as MB/s, NULL if that does not mean much
+	size_t *inputSize;
+};
+
+static struct benchData data;
+static FILE *report;
+
+static int benchReadDbx(struct benchData *d)
+{
+	return synthRunCommand(performReadCommand, (const char *[]){ "read", "-p", d->varsDir, "dbx", NULL });
+}
+
+static int benchReadDb(struct benchData *d)
+{
+	return synthRunCommand(performReadCommand, (const char *[]){ "read", "-p", d->varsDir, "db", NULL });
+}
+
+static int benchReadSummary(struct benchData *d)
+{
+	return synthRunCommand(performReadCommand, (const char *[]){ "read", "-p", d->varsDir, "--summary", NULL });
+}
+
+static int benchReadDigest(struct benchData *d)
+{
+	return synthRunCommand(performReadCommand, (const char *[]){ "read", "-p", d->varsDir, "--digest", NULL });
+}
+
+static int benchValidateDbx(struct benchData *d)
+{
+	return validateESL(d->dbxESL, d->dbxESLSize, "dbx");
+}
+
+static int benchValidateDb(struct benchData *d)
+{
+	return validateESL(d->dbESL, d->dbESLSize, "db");
+}
+
+static int benchValidateAuth(struct benchData *d)
+{
+	return validateAuth(d->dbxAuth, d->dbxAuthSize, "dbx");
+}
+
+// the same pipeline as `secvarctl verify`, on copies of the banks since process consumes them
+static int benchVerify(struct benchData *d)
+{
+	int rc;
+	struct list_head variable_bank, update_bank;
+	struct secvar_ctx ctx;
+
+	list_head_init(&variable_bank);
+	list_head_init(&update_bank);
+	copy_bank_list(&variable_bank, &d->variable_bank);
+	copy_bank_list(&update_bank, &d->update_bank);
+	secvar_ctx_init(&ctx);
+	rc = edk2_compatible_v1.pre_process(&ctx, &variable_bank, &update_bank);
+	if (!rc)
+		rc = edk2_compatible_v1.process(&ctx, &variable_bank, &update_bank);
+	clear_bank_list(&variable_bank);
+	clear_bank_list(&update_bank);
+
+	return rc;
+}
+
+#ifndef NO_CRYPTO
+static int benchGenerateHashESL(struct benchData *d)
+{
+	return synthRunCommand(performGenerateCommand, (const char *[]){ "generate", "f:e", "-i", d->hashInFile, "-o", "/dev/null", NULL });
+}
+
+static int benchGenerateCertESL(struct benchData *d)
+{
+	char crt[4200];
+
+	snprintf(crt, sizeof(crt), "%s/db/db.crt", d->keyDir);
+	return synthRunCommand(performGenerateCommand, (const char *[]){ "generate", "c:e", "-i", crt, "-o", "/dev/null", NULL });
+}
+
+// a PEM bundle of as many certificates as the synthetic db
+static int benchGenerateBundleESL(struct benchData *d)
+{
+	return synthRunCommand(performGenerateCommand, (const char *[]){ "generate", "c:e", "-i", d->bundleFile, "-o", "/dev/null", NULL });
+}
+
+static int benchGenerateSigned(struct benchData *d, const char *format, const char *var, const char *signer, const char *in)
+{
+	char key[4200], crt[4200];
+
+	snprintf(key, sizeof(key), "%s/%s/%s.key", d->keyDir, signer, signer);
+	snprintf(crt, sizeof(crt), "%s/%s/%s.crt", d->keyDir, signer, signer);
+	return synthRunCommand(performGenerateCommand, (const char *[]){ "generate", format, "-n", var, "-k", key, "-c", crt,
+		"-t", BENCH_TIMESTAMP, "-i", in, "-o", "/dev/null", NULL });
+}
+
+static int benchGeneratePKCS7(struct benchData *d)
+{
+	return benchGenerateSigned(d, "e:p", "db", "PK", d->certESLFile);
+}
+
+static int benchGenerateAuthDb(struct benchData *d)
+{
+	return benchGenerateSigned(d, "e:a", "db", "PK", d->certESLFile);
+}
+
+static int benchGenerateAuthDbx(struct benchData *d)
+{
+	return benchGenerateSigned(d, "e:a", "dbx", "KEK", d->dbxESLFile);
+}
+#endif
+
+// the crypto benchmarks, objects are not freed here since they have to go back to the provider that made them
+static int benchPKCS7Parse(struct benchData *d)
+{
+	crypto_pkcs7 *pkcs7 = crypto_pkcs7_parse_der(d->dbxPKCS7, d->dbxPKCS7Size);
+
+	if (!pkcs7)
+		return PKCS7_FAIL;
+	crypto_pkcs7_free(pkcs7);
+
+	return SUCCESS;
+}
+
+static int benchPKCS7Verify(struct benchData *d)
+{
+	crypto_x509 *signer = crypto_pkcs7_get_signing_cert(d->pkcs7, 0);
+
+	if (!signer)
+		return PKCS7_FAIL;
+
+	return crypto_pkcs7_signed_hash_verify(d->pkcs7, signer, d->signedHash, d->signedHashSize);
+}
+
+static int benchX509Parse(struct benchData *d)
+{
+	crypto_x509 *x509 = crypto_x509_parse_der(d->kekDER, d->kekDERSize);
+
+	if (!x509)
+		return CERT_FAIL;
+	crypto_x509_free(x509);
+
+	return SUCCESS;
+}
+
+// every accessor validate and read use on a certificate
+static int benchX509Info(struct benchData *d)
+{
+	char buf[4096];
+
+	if (crypto_x509_get_der_len(d->x509) <= 0 || crypto_x509_get_tbs_der_len(d->x509) <= 0 ||
+	    crypto_x509_get_sig_len(d->x509) <= 0 || crypto_x509_get_pk_bit_len(d->x509) <= 0)
+		return CERT_FAIL;
+	crypto_x509_get_version(d->x509);
+	crypto_x509_md_is_sha256(d->x509);
+	crypto_x509_oid_is_pkcs1_sha256(d->x509);
+	crypto_x509_is_RSA(d->x509);
+	crypto_x509_get_short_info(d->x509, buf, sizeof(buf));
+	crypto_x509_get_subject(d->x509, buf, sizeof(buf));
+	crypto_x509_get_issuer(d->x509, buf, sizeof(buf));
+	crypto_x509_get_expiry(d->x509, buf, sizeof(buf));
+	if (crypto_x509_get_long_desc(buf, sizeof(buf), "\t\t", d->x509) < 0)
+		return CERT_FAIL;
+
+	return SUCCESS;
+}
+
+static int benchMD(struct benchData *d, int md_id)
+{
+	crypto_md_ctx *ctx = NULL;
+	unsigned char hash[64];
+	int rc;
+
+	rc = crypto_md_ctx_init(&ctx, md_id);
+	if (!rc)
+		rc = crypto_md_update(ctx, d->dbxESL, d->dbxESLSize);
+	if (!rc)
+		rc = crypto_md_finish(ctx, hash);
+	crypto_md_free(ctx);
+
+	return rc;
+}
+
+static int benchSHA1(struct benchData *d)
+{
+	return benchMD(d, hash_functions[0].crypto_md_funct);
+}
+
+static int benchSHA224(struct benchData *d)
+{
+	return benchMD(d, hash_functions[1].crypto_md_funct);
+}
+
+static int benchSHA256(struct benchData *d)
+{
+	return benchMD(d, hash_functions[2].crypto_md_funct);
+}
+
+static int benchSHA384(struct benchData *d)
+{
+	return benchMD(d, hash_functions[3].crypto_md_funct);
+}
+
+static int benchSHA512(struct benchData *d)
+{
+	return benchMD(d, hash_functions[4].crypto_md_funct);
+}
+
+static int benchMDGenerateHash(struct benchData *d)
+{
+	unsigned char *hash = NULL;
+	size_t hashSize;
+	int rc;
+
+	rc = crypto_md_generate_hash(d->dbxESL, d->dbxESLSize, CRYPTO_MD_SHA256, &hash, &hashSize);
+	free(hash);
+
+	return rc;
+}
+
+static int benchPEMToDER(struct benchData *d)
+{
+	unsigned char *der = NULL;
+	size_t derSize;
+	int rc;
+
+	rc = crypto_convert_pem_to_der(d->kekPEM, d->kekPEMSize, &der, &derSize);
+	free(der);
+
+	return rc;
+}
+
+static int benchPKCS7Sign(struct benchData *d)
+{
+	unsigned char *pkcs7 = NULL;
+	size_t pkcs7Size;
+	const char *crt = d->kekCrt, *key = d->kekKey;
+	int rc;
+
+	rc = crypto_pkcs7_generate_w_signature(&pkcs7, &pkcs7Size, d->dbESL, d->certESLSize, &crt, &key, 1, CRYPTO_MD_SHA256);
+	free(pkcs7);
+
+	return rc;
+}
+
+#ifdef MBEDTLS
+static int benchPKCS7Presigned(struct benchData *d)
+{
+	unsigned char *pkcs7 = NULL;
+	size_t pkcs7Size;
+	const char *crt = d->kekCrt, *sig = d->sigFile;
+	int rc;
+
+	rc = crypto_pkcs7_generate_w_already_signed_data(&pkcs7, &pkcs7Size, d->dbESL, d->certESLSize, &crt, &sig, 1, CRYPTO_MD_SHA256);
+	free(pkcs7);
+
+	return rc;
+}
+#endif
+
+static struct bench benches[] = {
+	{ .name = "read_dbx", .run = benchReadDbx },
+	{ .name = "read_db", .run = benchReadDb },
+	{ .name = "read_summary", .run = benchReadSummary },
+	{ .name = "read_digest", .run = benchReadDigest, .needsCrypto = 1 },
+	{ .name = "validate_esl_dbx", .run = benchValidateDbx, .inputSize = &data.dbxESLSize },
+	{ .name = "validate_esl_db", .run = benchValidateDb, .inputSize = &data.dbESLSize },
+	{ .name = "validate_auth_dbx", .run = benchValidateAuth, .needsCrypto = 1, .inputSize = &data.dbxAuthSize },
+	{ .name = "verify_db_dbx", .run = benchVerify, .needsCrypto = 1 },
+#ifndef NO_CRYPTO
+	{ .name = "generate_esl_hash", .run = benchGenerateHashESL },
+	{ .name = "generate_esl_cert", .run = benchGenerateCertESL },
+	{ .name = "generate_esl_bundle", .run = benchGenerateBundleESL, .inputSize = &data.bundleSize },
+	{ .name = "generate_pkcs7_db", .run = benchGeneratePKCS7 },
+	{ .name = "generate_auth_db", .run = benchGenerateAuthDb },
+	{ .name = "generate_auth_dbx", .run = benchGenerateAuthDbx },
+#endif
+};
+
+// operations a provider does not have run on one that does, as they would in secvarctl
+static struct bench cryptoBenches[] = {
+	{ .name = "pkcs7_parse_der", .run = benchPKCS7Parse, .inputSize = &data.dbxPKCS7Size },
+	{ .name = "pkcs7_verify", .run = benchPKCS7Verify },
+	{ .name = "x509_parse_der", .run = benchX509Parse, .inputSize = &data.kekDERSize },
+	{ .name = "x509_info", .run = benchX509Info },
+	{ .name = "md_sha1", .run = benchSHA1, .inputSize = &data.dbxESLSize },
+	{ .name = "md_sha224", .run = benchSHA224, .inputSize = &data.dbxESLSize },
+	{ .name = "md_sha256", .run = benchSHA256, .inputSize = &data.dbxESLSize },
+	{ .name = "md_sha384", .run = benchSHA384, .inputSize = &data.dbxESLSize },
+	{ .name = "md_sha512", .run = benchSHA512, .inputSize = &data.dbxESLSize },
+	{ .name = "md_generate_hash", .run = benchMDGenerateHash, .inputSize = &data.dbxESLSize },
+	{ .name = "pem_to_der", .run = benchPEMToDER, .inputSize = &data.kekPEMSize },
+	{ .name = "pkcs7_sign", .run = benchPKCS7Sign, .inputSize = &data.certESLSize },
+#ifdef MBEDTLS
+	// only the mbedtls provider can do this
+	{ .name = "pkcs7_presigned", .run = benchPKCS7Presigned, .inputSize = &data.certESLSize },
+#endif
+};
+
+static int copyVar(const char *name)
+{
+	char path[4200], *buf;
+	size_t size;
+	int rc;
+
+	snprintf(path, sizeof(path), "%s/%s/data", data.keyDir, name);
+	buf = getDataFromFile(path, &size);
+	if (!buf)
+		return INVALID_FILE;
+	rc = synthWriteVar(data.varsDir, name, (unsigned char *)buf, size);
+	free(buf);
+
+	return rc;
+}
+
+/*
+ *builds the synthetic dbx/db, writes them as variables with PK, KEK and TS from goldenKeys,
+ *generates a signed dbx update and loads the banks for verification
+ */
+static int setupWorkspace(struct Arguments *args)
+{
+	int rc;
+	struct synthCert *certs = NULL;
+	size_t numCerts = 0, size;
+	struct secvar *var;
+	char path[4200], *buf = NULL;
+#ifndef NO_CRYPTO
+	char key[4200], crt[4200];
+#endif
+
+	snprintf(data.keyDir, sizeof(data.keyDir), "%s/goldenKeys", args->dataDir);
+	strcpy(data.workDir, "/tmp/secvarctl-bench-XXXXXX");
+	if (!mkdtemp(data.workDir)) {
+		prlog(PR_ERR, "ERROR: Could not create workspace\n");
+		return INVALID_FILE;
+	}
+	snprintf(data.varsDir, sizeof(data.varsDir), "%s/vars/", data.workDir);
+	mkdir(data.varsDir, 0700);
+	snprintf(data.dbxESLFile, sizeof(data.dbxESLFile), "%s/dbx.esl", data.workDir);
+	snprintf(data.dbESLFile, sizeof(data.dbESLFile), "%s/db.esl", data.workDir);
+	snprintf(data.certESLFile, sizeof(data.certESLFile), "%s/cert.esl", data.workDir);
+	snprintf(data.hashInFile, sizeof(data.hashInFile), "%s/hash.in", data.workDir);
+	snprintf(data.bundleFile, sizeof(data.bundleFile), "%s/bundle.pem", data.workDir);
+
+	rc = synthHashESLs(args->dbxHashes, &hash_functions[2], 1, &data.dbxESL, &data.dbxESLSize);
+	if (rc)
+		goto out;
+	rc = synthLoadCerts(args->dataDir, &certs, &numCerts);
+	if (rc)
+		goto out;
+	rc = synthCertESLs(certs, numCerts, args->dbCerts, &data.dbESL, &data.dbESLSize);
+	if (rc)
+		goto out;
+	rc = synthPEMBundle(certs, numCerts, args->dbCerts, (unsigned char **)&buf, &data.bundleSize);
+	if (rc)
+		goto out;
+	rc = createFile(data.bundleFile, buf, data.bundleSize);
+	free(buf);
+	buf = NULL;
+	rc |= createFile(data.dbxESLFile, (char *)data.dbxESL, data.dbxESLSize);
+	rc |= createFile(data.dbESLFile, (char *)data.dbESL, data.dbESLSize);
+	// one certificate ESL, input for signing benchmarks
+	data.certESLSize = ((EFI_SIGNATURE_LIST *)data.dbESL)->SignatureListSize;
+	rc |= createFile(data.certESLFile, (char *)data.dbESL, data.certESLSize);
+	rc |= createFile(data.hashInFile, (char *)data.dbxESL, data.dbxESLSize < 4096 ? data.dbxESLSize : 4096);
+	rc |= synthWriteVar(data.varsDir, "dbx", data.dbxESL, data.dbxESLSize);
+	rc |= synthWriteVar(data.varsDir, "db", data.dbESL, data.dbESLSize);
+	rc |= copyVar("PK");
+	rc |= copyVar("KEK");
+	rc |= copyVar("TS");
+	if (rc) {
+		rc = INVALID_FILE;
+		goto out;
+	}
+
+	list_head_init(&data.variable_bank);
+	list_head_init(&data.update_bank);
+	for (int i = 0; i < ARRAY_SIZE(variables); i++) {
+		snprintf(path, sizeof(path), "%s%s/data", data.varsDir, variables[i]);
+		if (!getSecVar(&var, variables[i], path))
+			list_add_tail(&data.variable_bank, &var->link);
+	}
+#ifndef NO_CRYPTO
+	// the signed dbx update is generated with the same code as `secvarctl generate`
+	snprintf(path, sizeof(path), "%s/dbx.auth", data.workDir);
+	snprintf(key, sizeof(key), "%s/KEK/KEK.key", data.keyDir);
+	snprintf(crt, sizeof(crt), "%s/KEK/KEK.crt", data.keyDir);
+	rc = synthRunCommand(performGenerateCommand, (const char *[]){ "generate", "e:a", "-n", "dbx", "-k", key, "-c", crt,
+		"-t", BENCH_TIMESTAMP, "-i", data.dbxESLFile, "-o", path, NULL });
+	if (rc) {
+		prlog(PR_ERR, "ERROR: Could not generate dbx update\n");
+		goto out;
+	}
+	buf = getDataFromFile(path, &size);
+	if (!buf) {
+		rc = INVALID_FILE;
+		goto out;
+	}
+	data.dbxAuth = (unsigned char *)buf;
+	data.dbxAuthSize = size;
+	list_add_tail(&data.update_bank, &new_secvar("dbx", 4, buf, size, 0)->link);
+#endif
+out:
+	synthFreeCerts(certs, numCerts);
+
+	return rc;
+}
+
+#ifndef NO_CRYPTO
+/*
+ *the crypto benchmarks run on the PKCS7 of the dbx update, the KEK certificate and a PKCS7 signed
+ *by the KEK over one certificate ESL, like the db updates of `secvarctl generate`
+ */
+static int setupCryptoInputs(void)
+{
+	const struct efi_variable_authentication_2 *auth = (struct efi_variable_authentication_2 *)data.dbxAuth;
+	const char *crt = data.kekCrt, *key = data.kekKey;
+	char path[4200];
+	crypto_x509 *x509;
+	size_t sigSize;
+	int rc;
+
+	data.dbxPKCS7 = auth->auth_info.cert_data;
+	data.dbxPKCS7Size = get_pkcs7_len(auth);
+	snprintf(data.kekCrt, sizeof(data.kekCrt), "%s/KEK/KEK.crt", data.keyDir);
+	snprintf(data.kekKey, sizeof(data.kekKey), "%s/KEK/KEK.key", data.keyDir);
+	snprintf(path, sizeof(path), "%s/KEK/KEK.der", data.keyDir);
+	data.kekPEM = (unsigned char *)getDataFromFile(data.kekCrt, &data.kekPEMSize);
+	data.kekDER = (unsigned char *)getDataFromFile(path, &data.kekDERSize);
+	if (!data.kekPEM || !data.kekDER)
+		return INVALID_FILE;
+	rc = crypto_pkcs7_generate_w_signature(&data.signedPKCS7, &data.signedPKCS7Size, data.dbESL, data.certESLSize,
+		&crt, &key, 1, CRYPTO_MD_SHA256);
+	if (!rc)
+		rc = crypto_md_generate_hash(data.dbESL, data.certESLSize, CRYPTO_MD_SHA256, &data.signedHash, &data.signedHashSize);
+	if (rc)
+		return rc;
+	// the signature is signed without attributes and ends the DER, it is the input of the presigned path
+	x509 = crypto_x509_parse_der(data.kekDER, data.kekDERSize);
+	if (!x509)
+		return CERT_FAIL;
+	sigSize = crypto_x509_get_pk_bit_len(x509) / 8;
+	crypto_x509_free(x509);
+	if (!sigSize || sigSize > data.signedPKCS7Size)
+		return PKCS7_FAIL;
+	snprintf(data.sigFile, sizeof(data.sigFile), "%s/KEK.sig", data.workDir);
+
+	return createFile(data.sigFile, (char *)data.signedPKCS7 + data.signedPKCS7Size - sigSize, sigSize);
+}
+
+// parses what pkcs7_verify and x509_info work on with the selected provider
+static int parseCryptoInputs(void)
+{
+	data.pkcs7 = crypto_pkcs7_parse_der(data.signedPKCS7, data.signedPKCS7Size);
+	data.x509 = crypto_x509_parse_der(data.kekDER, data.kekDERSize);
+
+	return data.pkcs7 && data.x509 ? SUCCESS : PKCS7_FAIL;
+}
+
+static void freeCryptoInputs(void)
+{
+	crypto_pkcs7_free(data.pkcs7);
+	crypto_x509_free(data.x509);
+	data.pkcs7 = NULL;
+	data.x509 = NULL;
+}
+#endif
+
+static void cleanupWorkspace(void)
+{
+	char cmd[128];
+
+	clear_bank_list(&data.variable_bank);
+	clear_bank_list(&data.update_bank);
+	free(data.dbxESL);
+	free(data.dbESL);
+	free(data.dbxAuth);
+	free(data.kekPEM);
+	free(data.kekDER);
+	free(data.signedPKCS7);
+	free(data.signedHash);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", data.workDir);
+	if (system(cmd))
+		prlog(PR_WARNING, "WARNING: Could not remove %s\n", data.workDir);
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p)
+{
+	int i = (int)(p * (count - 1) + 0.5);
+
+	return sorted[i];
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ *runs one benchmark, one untimed warmup then iterations timed runs, latencies are reported in ms.
+ *allocations are counted in the warmup only, counting takes a lock on every allocation
+ */
+static int runBench(struct bench *b, int iterations)
+{
+	double *samples, start, total = 0;
+	struct rusage usage;
+	uint64_t allocs;
+	char throughput[16] = "-";
+	int rc;
+
+	samples = calloc(iterations, sizeof(*samples));
+	if (!samples)
+		return ALLOC_FAIL;
+	memStatsEnabled = 1;
+	allocs = memStatsAllocs();
+	rc = b->run(&data);
+	allocs = memStatsAllocs() - allocs;
+	memStatsEnabled = 0;
+	for (int i = 0; !rc && i < iterations; i++) {
+		start = now();
+		rc = b->run(&data);
+		samples[i] = (now() - start) * 1000;
+		total += samples[i];
+	}
+	fflush(stdout);
+	if (rc) {
+		fprintf(report, "%-20s FAILED rc = %d\n", b->name, rc);
+		free(samples);
+		return rc;
+	}
+	qsort(samples, iterations, sizeof(*samples), compareDouble);
+	getrusage(RUSAGE_SELF, &usage);
+	if (b->inputSize)
+		snprintf(throughput, sizeof(throughput), "%.1f", *b->inputSize * iterations / (total / 1000) / 1e6);
+	fprintf(report, "%-20s %12.1f %10s %10.3f %10.3f %10.3f %10.3f %10llu %12ld\n", b->name, iterations / (total / 1000),
+		throughput, percentile(samples, iterations, 0.5), percentile(samples, iterations, 0.9),
+		percentile(samples, iterations, 0.99), samples[iterations - 1], (unsigned long long)allocs, usage.ru_maxrss);
+	fflush(report);
+	free(samples);
+
+	return SUCCESS;
+}
+
+// @return the number of benchmarks that failed
+static int runBenches(struct bench *list, int count, struct Arguments *args)
+{
+	int failures = 0;
+
+	fprintf(report, "%-20s %12s %10s %10s %10s %10s %10s %10s %12s\n", "benchmark", "ops/sec", "MB/s", "p50", "p90", "p99",
+		"max", "allocs", "peakRSS");
+	for (int i = 0; i < count; i++) {
+		if (args->filter && !strstr(list[i].name, args->filter))
+			continue;
+#ifdef NO_CRYPTO
+		if (list[i].needsCrypto)
+			continue;
+#endif
+		if (runBench(&list[i], args->iterations))
+			failures++;
+	}
+
+	return failures;
+}
+
+#ifndef NO_CRYPTO
+// every crypto benchmark on each provider of the build in turn
+static int runCryptoBenches(struct Arguments *args)
+{
+	const char *name;
+	int failures = 0;
+
+	for (int i = 0; (name = crypto_provider_at(i)); i++) {
+		crypto_select(name);
+		fprintf(report, "\n%s\n", name);
+		if (parseCryptoInputs()) {
+			fprintf(report, "FAILED to parse the inputs\n");
+			failures++;
+		} else {
+			failures += runBenches(cryptoBenches, ARRAY_SIZE(cryptoBenches), args);
+		}
+		freeCryptoInputs();
+	}
+
+	return failures;
+}
+#endif
+
+static int parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct Arguments *args = state->input;
+
+	switch (key) {
+		case '?':
+			args->helpFlag = 1;
+			argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
+			break;
+		case 'n':
+			args->iterations = atoi(arg);
+			break;
+		case 'x':
+			args->dbxHashes = atoi(arg);
+			break;
+		case 'c':
+			args->dbCerts = atoi(arg);
+			break;
+		case 'd':
+			args->dataDir = arg;
+			break;
+		case 'v':
+			verbose = PR_DEBUG;
+			break;
+		case 'C':
+#ifdef NO_CRYPTO
+			prlog(PR_ERR, "ERROR: --crypto-ops needs a build with crypto\n");
+			return ARG_PARSE_FAIL;
+#endif
+			args->cryptoOps = 1;
+			break;
+		case ARGP_KEY_ARG:
+			args->filter = arg;
+			break;
+		case ARGP_KEY_SUCCESS:
+			if (args->iterations > 0 && args->dbxHashes > 0 && args->dbCerts > 0)
+				break;
+			prlog(PR_ERR, "ERROR: iterations, dbx hashes and db certificates must be positive\n");
+			argp_usage(state);
+			return ARG_PARSE_FAIL;
+	}
+
+	return SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc, failures = 0, devNull;
+	struct Arguments args = {
+		.helpFlag = 0, .iterations = 20, .dbxHashes = 10000, .dbCerts = 500,
+		.dataDir = "test/testdata", .filter = NULL, .cryptoOps = 0
+	};
+	struct argp_option options[] = {
+		{"iterations", 'n', "N", 0, "timed runs per benchmark, default 20"},
+		{"dbx", 'x', "N", 0, "number of SHA256 hashes in the synthetic dbx, default 10000"},
+		{"db", 'c', "N", 0, "number of certificates in the synthetic db, default 500"},
+		{"data", 'd', "DIR", 0, "directory with *.der certificates and goldenKeys/, default test/testdata"},
+		{"crypto-ops", 'C', 0, 0, "benchmark every crypto operation on each crypto library of the build instead"},
+		{"verbose", 'v', 0, 0, "print more verbose process information"},
+		{"help", '?', 0, 0, "Give this help list", 1},
+		{0}
+	};
+	struct argp argp = {
+		options, parse_opt, "[FILTER]",
+		"Runs secvarctl's read, validate, verify and generate code in-process and reports ops/sec,"
+		" throughput, latency percentiles (ms), allocations per run and peak RSS (KB) for each."
+		" Only benchmarks containing FILTER are run."
+	};
+
+	rc = argp_parse(&argp, argc, argv, ARGP_NO_EXIT | ARGP_IN_ORDER | ARGP_NO_HELP, 0, &args);
+	if (rc || args.helpFlag)
+		return rc;
+	// the crypto library comes from $SECVARCTL_CRYPTO, like for secvarctl
+	rc = crypto_select(NULL);
+	if (rc)
+		return rc;
+	// before the first crypto call, it is applied when the providers are loaded
+	crypto_enable_alloc_tracking();
+
+	rc = setupWorkspace(&args);
+#ifndef NO_CRYPTO
+	if (!rc && args.cryptoOps)
+		rc = setupCryptoInputs();
+#endif
+	if (rc) {
+		prlog(PR_ERR, "ERROR: Failed to set up benchmark inputs\n");
+		cleanupWorkspace();
+		return rc;
+	}
+	// commands print their results, keep those out of the report
+	report = fdopen(dup(STDOUT_FILENO), "w");
+	devNull = open("/dev/null", O_WRONLY);
+	if (!report || devNull < 0 || dup2(devNull, STDOUT_FILENO) < 0) {
+		prlog(PR_ERR, "ERROR: Could not redirect stdout\n");
+		cleanupWorkspace();
+		return INVALID_FILE;
+	}
+	close(devNull);
+
+#ifndef NO_CRYPTO
+	if (args.cryptoOps) {
+		fprintf(report, "secvarctl crypto benchmark, %d iterations, hashing the dbx = %d hashes (%zd bytes), dbx PKCS7 = %zd bytes\n",
+			args.iterations, args.dbxHashes, data.dbxESLSize, data.dbxPKCS7Size);
+		failures = runCryptoBenches(&args);
+		cleanupWorkspace();
+		fclose(report);
+		return failures ? INVALID_FILE : SUCCESS;
+	}
+#endif
+	fprintf(report, "secvarctl benchmark, %s crypto, %d iterations, dbx = %d hashes (%zd bytes), db = %d certs (%zd bytes)\n",
+		crypto_provider_name(),
+		args.iterations, args.dbxHashes, data.dbxESLSize, args.dbCerts, data.dbESLSize);
+	failures = runBenches(benches, ARRAY_SIZE(benches), &args);
+	cleanupWorkspace();
+	fclose(report);
+
+	return failures ? INVALID_FILE : SUCCESS;
+}
@@ -0,0 +1,489 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <argp.h>
+#include <sys/stat.h>
+#include "test/synthetic.h"
+#include "threadpool.h"
+#include "backends/edk2-compat/include/edk2-svc.h"
+
+/*
+ *Generates large, deterministic datasets for benchmarks and soak tests. Every signed file is made by
+ *the generate command itself, run on a thread pool, so the output is what `secvarctl generate` would give.
+ *
+ *Layout of the output directory:
+ *	vars/<var>/{data,size}	initial variables, PK/TS from goldenKeys, KEK/db with --signers certs, dbx with --dbx hashes
+ *	updates/<n>-<var>.auth	--updates updates with increasing timestamps, valid if applied in order on top of vars/
+ *	updates/sequence	"<var> <file>" per line, in the order the updates are meant to be applied
+ *	broken/<n>-<kind>.auth	--broken dbx updates that must be rejected
+ *	manifest		"<file> <var> <valid|invalid> <kind>" for every update
+ */
+
+int verbose = PR_ERR;
+
+// updates are timestamped from here on, one minute apart, later than everything in goldenKeys/TS
+#define DATAGEN_EPOCH 1893456000
+#define DATAGEN_STALE_TIMESTAMP "2000-01-01T00:00:00"
+#define DATAGEN_BROKEN_HASHES 16
+
+enum brokenKind {
+	BROKEN_TRUNCATED = 0,
+	BROKEN_SIGNATURE,
+	BROKEN_ESL_SIZE,
+	BROKEN_SIGNER,
+	BROKEN_TIMESTAMP,
+	BROKEN_KINDS
+};
+
+static const char *brokenNames[BROKEN_KINDS] = { "truncated", "bad-signature", "bad-esl-size", "wrong-signer", "stale-timestamp" };
+
+struct Arguments {
+	int helpFlag, threads;
+	size_t signers, dbxHashes, updates, broken;
+	uint64_t seed;
+	const char *outDir, *keyDir;
+};
+
+struct datagen {
+	struct Arguments *args;
+	// signer pool, every <name>.der in keyDir with a matching <name>.key and <name>.crt
+	struct synthCert *certs;
+	size_t numCerts;
+	// certs[0, numSigners) are in KEK, so their keys can sign db and dbx
+	size_t numSigners;
+};
+
+// the variable the n'th update writes to, dbx updates are the most common, KEK the least
+static const char *sequenceVar(struct datagen *g, size_t n)
+{
+	uint64_t state = g->args->seed ^ (n + 1) * 0x9E3779B97F4A7C15ULL, r;
+
+	r = synthRandom(&state) % 10;
+	if (r < 6)
+		return "dbx";
+	if (r < 9)
+		return "db";
+	return "KEK";
+}
+
+static void timestampString(char *out, size_t outSize, size_t n)
+{
+	time_t t = DATAGEN_EPOCH + n * 60;
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	strftime(out, outSize, "%FT%T", &tm);
+}
+
+/*
+ *dbx with count hashes of every SHA variant, mostly SHA256 as on real systems
+ *@return SUCCESS or ALLOC_FAIL
+ */
+static int makeDbx(size_t count, uint64_t seed, unsigned char **out, size_t *outSize)
+{
+	unsigned char *part, *tmp;
+	size_t partSize, perAlg, offset = 0;
+	int rc;
+
+	*out = NULL;
+	*outSize = 0;
+	for (int i = 0; i < ARRAY_SIZE(hash_functions); i++) {
+		perAlg = count / 16;
+		if (hash_functions[i].size == 32)
+			perAlg = count - (ARRAY_SIZE(hash_functions) - 1) * (count / 16);
+		if (!perAlg)
+			continue;
+		rc = synthHashESLs(perAlg, &hash_functions[i], seed + i, &part, &partSize);
+		if (rc)
+			goto fail;
+		tmp = realloc(*out, offset + partSize);
+		if (!tmp) {
+			free(part);
+			rc = ALLOC_FAIL;
+			goto fail;
+		}
+		*out = tmp;
+		memcpy(*out + offset, part, partSize);
+		offset += partSize;
+		free(part);
+	}
+	*outSize = offset;
+
+	return SUCCESS;
+fail:
+	free(*out);
+	*out = NULL;
+	return rc;
+}
+
+/*
+ *writes the ESL to a temporary file and signs it with generate
+ *@param signer, path of the signing key/certificate relative to keyDir without extension, NULL for goldenKeys PK
+ */
+static int signESL(struct datagen *g, const unsigned char *esl, size_t eslSize, const char *var, const char *signer,
+		   const char *timestamp, const char *outFile)
+{
+	char in[4096], key[4096], crt[4096];
+	int rc;
+
+	snprintf(in, sizeof(in), "%s.esl", outFile);
+	if (signer) {
+		snprintf(key, sizeof(key), "%s/%s.key", g->args->keyDir, signer);
+		snprintf(crt, sizeof(crt), "%s/%s.crt", g->args->keyDir, signer);
+	}
+	else {
+		snprintf(key, sizeof(key), "%s/goldenKeys/PK/PK.key", g->args->keyDir);
+		snprintf(crt, sizeof(crt), "%s/goldenKeys/PK/PK.crt", g->args->keyDir);
+	}
+	rc = createFile(in, (const char *)esl, eslSize);
+	if (rc)
+		return rc;
+	rc = synthRunCommand(performGenerateCommand, (const char *[]){ "generate", "e:a", "-n", var, "-k", key, "-c", crt,
+		"-t", timestamp, "-i", in, "-o", outFile, NULL });
+	unlink(in);
+	if (rc)
+		prlog(PR_ERR, "ERROR: Failed to generate %s\n", outFile);
+
+	return rc;
+}
+
+static int copyGoldenVar(struct datagen *g, const char *varsDir, const char *name)
+{
+	char path[4096], *buf;
+	size_t size;
+	int rc;
+
+	snprintf(path, sizeof(path), "%s/goldenKeys/%s/data", g->args->keyDir, name);
+	buf = getDataFromFile(path, &size);
+	if (!buf)
+		return INVALID_FILE;
+	rc = synthWriteVar(varsDir, name, (unsigned char *)buf, size);
+	free(buf);
+
+	return rc;
+}
+
+static int makeVars(struct datagen *g)
+{
+	char varsDir[4096];
+	unsigned char *esl;
+	size_t eslSize;
+	int rc;
+
+	snprintf(varsDir, sizeof(varsDir), "%s/vars/", g->args->outDir);
+	rc = copyGoldenVar(g, varsDir, "PK");
+	rc |= copyGoldenVar(g, varsDir, "TS");
+	if (rc)
+		return INVALID_FILE;
+	rc = synthCertESLs(g->certs, g->numCerts, g->args->signers, &esl, &eslSize);
+	if (rc)
+		return rc;
+	rc = synthWriteVar(varsDir, "KEK", esl, eslSize);
+	rc |= synthWriteVar(varsDir, "db", esl, eslSize);
+	free(esl);
+	if (rc)
+		return rc;
+	rc = makeDbx(g->args->dbxHashes, g->args->seed, &esl, &eslSize);
+	if (rc)
+		return rc;
+	rc = synthWriteVar(varsDir, "dbx", esl, eslSize);
+	free(esl);
+
+	return rc;
+}
+
+/*
+ *dbx updates replace dbx with a new set of --dbx hashes, db updates rotate the db certificates
+ *and KEK updates rewrite the same KEK so that later signers stay valid
+ */
+static int makeUpdate(struct datagen *g, size_t n)
+{
+	const char *var = sequenceVar(g, n), *signer = NULL;
+	char out[4096], timestamp[32];
+	unsigned char *esl;
+	size_t eslSize;
+	uint64_t state = g->args->seed + n + 1;
+	int rc;
+
+	snprintf(out, sizeof(out), "%s/updates/%05zu-%s.auth", g->args->outDir, n, var);
+	timestampString(timestamp, sizeof(timestamp), n);
+	if (!strcmp(var, "dbx")) {
+		rc = makeDbx(g->args->dbxHashes, g->args->seed + (n + 1) * ARRAY_SIZE(hash_functions), &esl, &eslSize);
+		signer = g->certs[synthRandom(&state) % g->numSigners].name;
+	}
+	else if (!strcmp(var, "db")) {
+		// start the round robin at a different cert every time so each db differs
+		struct synthCert *rotated = malloc(g->numCerts * sizeof(*rotated));
+
+		if (!rotated)
+			return ALLOC_FAIL;
+		for (size_t i = 0; i < g->numCerts; i++)
+			rotated[i] = g->certs[(i + n) % g->numCerts];
+		rc = synthCertESLs(rotated, g->numCerts, g->args->signers, &esl, &eslSize);
+		free(rotated);
+		signer = g->certs[synthRandom(&state) % g->numSigners].name;
+	}
+	else
+		rc = synthCertESLs(g->certs, g->numCerts, g->args->signers, &esl, &eslSize);
+	if (rc)
+		return rc;
+	rc = signESL(g, esl, eslSize, var, signer, timestamp, out);
+	free(esl);
+
+	return rc;
+}
+
+// a valid dbx update, broken afterwards in the way its kind says
+static int makeBroken(struct datagen *g, size_t n)
+{
+	enum brokenKind kind = n % BROKEN_KINDS;
+	const char *signer;
+	char out[4096], timestamp[32];
+	unsigned char *esl, *buf;
+	size_t eslSize, size, authSize;
+	uint64_t state = ~g->args->seed + n;
+	struct efi_variable_authentication_2 *auth;
+	int rc;
+
+	snprintf(out, sizeof(out), "%s/broken/%05zu-%s.auth", g->args->outDir, n, brokenNames[kind]);
+	timestampString(timestamp, sizeof(timestamp), g->args->updates + n);
+	rc = synthHashESLs(DATAGEN_BROKEN_HASHES, &hash_functions[2], state, &esl, &eslSize);
+	if (rc)
+		return rc;
+	signer = g->certs[synthRandom(&state) % g->numSigners].name;
+	// goldenKeys/db is not in the signer pool, so it is not in KEK either
+	if (kind == BROKEN_SIGNER)
+		signer = "goldenKeys/db/db";
+	rc = signESL(g, esl, eslSize, "dbx", signer, kind == BROKEN_TIMESTAMP ? DATAGEN_STALE_TIMESTAMP : timestamp, out);
+	free(esl);
+	if (rc || kind == BROKEN_SIGNER || kind == BROKEN_TIMESTAMP)
+		return rc;
+
+	buf = (unsigned char *)getDataFromFile(out, &size);
+	if (!buf)
+		return INVALID_FILE;
+	auth = (struct efi_variable_authentication_2 *)buf;
+	authSize = sizeof(auth->timestamp) + auth->auth_info.hdr.dw_length;
+	switch (kind) {
+		case BROKEN_TRUNCATED:
+			size = synthRandom(&state) % size;
+			break;
+		case BROKEN_SIGNATURE:
+			// the RSA signature is at the end of the PKCS7
+			buf[authSize - 1 - synthRandom(&state) % 32] ^= 0x01;
+			break;
+		case BROKEN_ESL_SIZE:
+			((EFI_SIGNATURE_LIST *)(buf + authSize))->SignatureListSize += 1 + synthRandom(&state) % 1024;
+			break;
+		default:
+			break;
+	}
+	rc = createFile(out, (const char *)buf, size);
+	free(buf);
+
+	return rc;
+}
+
+static int datagenJob(void *ctx, size_t index)
+{
+	struct datagen *g = ctx;
+
+	if (index == 0)
+		return makeVars(g);
+	index--;
+	if (index < g->args->updates)
+		return makeUpdate(g, index);
+
+	return makeBroken(g, index - g->args->updates);
+}
+
+// sequence and manifest, written after the pool is done since they are small and must be in order
+static int writeIndexes(struct datagen *g)
+{
+	char path[4096];
+	FILE *seq, *manifest;
+	const char *var;
+
+	snprintf(path, sizeof(path), "%s/updates/sequence", g->args->outDir);
+	seq = fopen(path, "w");
+	snprintf(path, sizeof(path), "%s/manifest", g->args->outDir);
+	manifest = fopen(path, "w");
+	if (!seq || !manifest) {
+		prlog(PR_ERR, "ERROR: Could not write indexes in %s\n", g->args->outDir);
+		if (seq)
+			fclose(seq);
+		if (manifest)
+			fclose(manifest);
+		return FILE_WRITE_FAIL;
+	}
+	for (size_t n = 0; n < g->args->updates; n++) {
+		var = sequenceVar(g, n);
+		fprintf(seq, "%s updates/%05zu-%s.auth\n", var, n, var);
+		fprintf(manifest, "updates/%05zu-%s.auth %s valid update\n", n, var, var);
+	}
+	for (size_t n = 0; n < g->args->broken; n++)
+		fprintf(manifest, "broken/%05zu-%s.auth dbx invalid %s\n", n, brokenNames[n % BROKEN_KINDS], brokenNames[n % BROKEN_KINDS]);
+	fclose(seq);
+	fclose(manifest);
+
+	return SUCCESS;
+}
+
+// drops certificates without a matching key and certificate file, they cannot sign
+static int loadSigners(struct datagen *g)
+{
+	char path[4096];
+	size_t kept = 0;
+	int rc;
+
+	rc = synthLoadCerts(g->args->keyDir, &g->certs, &g->numCerts);
+	if (rc)
+		return rc;
+	for (size_t i = 0; i < g->numCerts; i++) {
+		snprintf(path, sizeof(path), "%s/%s.key", g->args->keyDir, g->certs[i].name);
+		if (!access(path, R_OK)) {
+			snprintf(path, sizeof(path), "%s/%s.crt", g->args->keyDir, g->certs[i].name);
+			if (!access(path, R_OK)) {
+				g->certs[kept++] = g->certs[i];
+				continue;
+			}
+		}
+		free(g->certs[i].name);
+		free(g->certs[i].der);
+	}
+	g->numCerts = kept;
+	if (!kept) {
+		prlog(PR_ERR, "ERROR: No signing keys found in %s\n", g->args->keyDir);
+		return INVALID_FILE;
+	}
+	g->numSigners = g->args->signers < kept ? g->args->signers : kept;
+
+	return SUCCESS;
+}
+
+static int parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct Arguments *args = state->input;
+
+	switch (key) {
+		case '?':
+			args->helpFlag = 1;
+			argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
+			break;
+		case 'o':
+			args->outDir = arg;
+			break;
+		case 'k':
+			args->keyDir = arg;
+			break;
+		case 's':
+			args->seed = strtoull(arg, NULL, 0);
+			break;
+		case 'j':
+			args->threads = atoi(arg);
+			break;
+		case 'c':
+			args->signers = strtoull(arg, NULL, 0);
+			break;
+		case 'x':
+			args->dbxHashes = strtoull(arg, NULL, 0);
+			break;
+		case 'u':
+			args->updates = strtoull(arg, NULL, 0);
+			break;
+		case 'b':
+			args->broken = strtoull(arg, NULL, 0);
+			break;
+		case 'v':
+			verbose = PR_DEBUG;
+			break;
+		case ARGP_KEY_SUCCESS:
+			if (args->helpFlag)
+				break;
+			if (!args->outDir)
+				prlog(PR_ERR, "ERROR: No output directory given, see usage below...\n");
+			else if (!args->signers || !args->dbxHashes)
+				prlog(PR_ERR, "ERROR: --signers and --dbx must be positive\n");
+			else
+				break;
+			argp_usage(state);
+			return ARG_PARSE_FAIL;
+	}
+
+	return SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	char path[4096];
+	struct threadpool *pool;
+	struct datagen g = { 0 };
+	struct Arguments args = {
+		.helpFlag = 0, .threads = 0, .signers = 200, .dbxHashes = 20000, .updates = 100, .broken = 20,
+		.seed = 1, .outDir = NULL, .keyDir = "test/testdata"
+	};
+	struct argp_option options[] = {
+		{"out", 'o', "DIR", 0, "output directory, created if missing"},
+		{"keys", 'k', "DIR", 0, "directory with <name>.{der,key,crt} signers and goldenKeys/, default test/testdata"},
+		{"seed", 's', "N", 0, "seed for all generated data, same seed gives the same files, default 1"},
+		{"jobs", 'j', "N", 0, "number of threads, default is one per cpu"},
+		{"signers", 'c', "N", 0, "number of certificates in KEK and db, default 200"},
+		{"dbx", 'x', "N", 0, "number of hashes in dbx and in every dbx update, default 20000"},
+		{"updates", 'u', "N", 0, "length of the update sequence, default 100"},
+		{"broken", 'b', "N", 0, "number of broken updates, default 20"},
+		{"verbose", 'v', 0, 0, "print more verbose process information"},
+		{"help", '?', 0, 0, "Give this help list", 1},
+		{0}
+	};
+	struct argp argp = {
+		options, parse_opt, NULL,
+		"Deterministically generates large secure variable datasets (variables, timestamped update sequences"
+		" and broken updates) with the generate command, in parallel."
+	};
+
+	rc = argp_parse(&argp, argc, argv, ARGP_NO_EXIT | ARGP_IN_ORDER | ARGP_NO_HELP, 0, &args);
+	if (rc || args.helpFlag)
+		return rc;
+	// the crypto library comes from $SECVARCTL_CRYPTO, like for secvarctl
+	rc = crypto_select(NULL);
+	if (rc)
+		return rc;
+	g.args = &args;
+	// generate reports every file on stdout, only wanted when debugging
+	if (verbose < PR_DEBUG && !freopen("/dev/null", "w", stdout))
+		prlog(PR_WARNING, "WARNING: Could not silence generate output\n");
+	rc = loadSigners(&g);
+	if (rc)
+		goto out;
+
+	mkdir(args.outDir, 0755);
+	snprintf(path, sizeof(path), "%s/vars", args.outDir);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/updates", args.outDir);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/broken", args.outDir);
+	mkdir(path, 0755);
+
+	pool = threadpoolCreate(args.threads);
+	if (!pool) {
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	rc = threadpoolRun(pool, datagenJob, &g, 1 + args.updates + args.broken);
+	threadpoolDestroy(pool);
+	if (!rc)
+		rc = writeIndexes(&g);
+	if (rc)
+		prlog(PR_ERR, "RESULT: FAILURE\n");
+	else
+		prlog(PR_INFO, "RESULT: SUCCESS\n");
+out:
+	synthFreeCerts(g.certs, g.numCerts);
+
+	return rc;
+}
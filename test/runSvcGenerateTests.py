@@ -8,6 +8,9 @@ import sys
 import time
 import unittest
 import filecmp
+import hashlib
+import struct
+import json
 
 MEM_ERR = 101
 SECTOOLS="../secvarctl-cov"
@@ -32,7 +35,8 @@ secvarctlGenCommands = [
 ]
 badESLcommands =[
 [["t:e", "-i", "./testdata/db_by_PK.crt", "-o", OUTDIR+"foo.esl"], False], #input type dne
-[["c:e", "-i", "./testdata/db_by_PK.der", "-o",OUTDIR+"foo.esl"], False], #not PEM format
+[["c:e", "-i", "./testdata/db_by_PK.der", "-o",OUTDIR+"foo.esl"], True], #DER format is taken too
+[["c:e", "-i", "./testdata/db_by_PK.esl", "-o",OUTDIR+"foo.esl"], False], #neither PEM nor DER certificate
 [["c:e", "-i", "./testdata/brokenFiles/rsa4096.crt", "-o", OUTDIR+"foo.esl"], False], #cert will not pass prevalidation, rsa 4096
 [["c:e", "-i", "./testdata/brokenFiles/SHA384.crt", "-o", OUTDIR+"foo.esl"], False], #cert will not pass prevalidation, sha384
 [["f:e", "-i", SECTOOLS, "-o", OUTDIR+"foo.esl", "-h"], False], #no hash function
@@ -115,6 +119,113 @@ def compareFiles(a,b):
 		if filecmp.cmp(a,b):
 			return True
 		return False
+
+def authenticodeDigest(path, alg):
+	#reference Authenticode digest of a PE/COFF image, headers without checksum and certificate table entry, sections in file order, then the rest without the certificate table
+	data = open(path, "rb").read()
+	pe = struct.unpack_from("<I", data, 0x3c)[0]
+	numSections, optSize = struct.unpack_from("<HxxxxxxxxxxxxH", data, pe + 6)
+	opt = pe + 24
+	dirs = opt + (96 if struct.unpack_from("<H", data, opt)[0] == 0x10b else 112)
+	headersSize = struct.unpack_from("<I", data, opt + 60)[0]
+	checksum, certEntry = opt + 64, dirs + 4 * 8
+	certSize = struct.unpack_from("<I", data, certEntry + 4)[0]
+	h = hashlib.new(alg)
+	h.update(data[:checksum] + data[checksum + 4:certEntry] + data[certEntry + 8:headersSize])
+	hashed = headersSize
+	sections = [struct.unpack_from("<II", data, opt + optSize + i * 40 + 16) for i in range(numSections)]
+	for size, offset in sorted(sections, key=lambda s: s[1]):
+		h.update(data[offset:offset + size])
+		hashed += size
+	if len(data) > hashed + certSize:
+		h.update(data[hashed:len(data) - certSize])
+	return h.digest()
+
+def signImage(path, out):
+	#fakes what signing does to an image: fills in the checksum and appends a certificate table, none of which is in the digest
+	data = bytearray(open(path, "rb").read())
+	pe = struct.unpack_from("<I", data, 0x3c)[0]
+	opt = pe + 24
+	certEntry = opt + (96 if struct.unpack_from("<H", data, opt)[0] == 0x10b else 112) + 4 * 8
+	struct.pack_into("<I", data, opt + 64, 0x1234)
+	struct.pack_into("<II", data, certEntry, len(data), 512)
+	with open(out, "wb") as f:
+		f.write(data + os.urandom(512))
+def der(tag, body):
+	#DER tag, length and body
+	if len(body) < 0x80:
+		return bytes([tag, len(body)]) + body
+	length = len(body).to_bytes((len(body).bit_length() + 7) // 8, "big")
+	return bytes([tag, 0x80 | len(length)]) + length + body
+
+def derOid(oid):
+	parts = [int(p) for p in oid.split(".")]
+	body = bytes([40 * parts[0] + parts[1]])
+	for p in parts[2:]:
+		enc = [p & 0x7f]
+		p >>= 7
+		while p:
+			enc.insert(0, 0x80 | (p & 0x7f))
+			p >>= 7
+		body += bytes(enc)
+	return der(0x06, body)
+
+def derItems(data):
+	#splits the body of a DER SEQUENCE into its encoded items
+	items, off = [], 0
+	while off < len(data):
+		n, hdr = data[off + 1], 2
+		if n & 0x80:
+			hdr += n & 0x7f
+			n = int.from_bytes(data[off + 2:off + hdr], "big")
+		items.append(data[off:off + hdr + n])
+		off += hdr + n
+	return items
+
+def derBody(item):
+	return item[2 + (item[1] & 0x7f if item[1] & 0x80 else 0):]
+
+SPC_INDIRECT_DATA = "1.3.6.1.4.1.311.2.1.4"
+def authenticodeSign(path, out, crt, key, chain=[], digest=None):
+	#appends an Authenticode signature by crt/key to an image, chain is a list of DER certificates that go with it
+	data = bytearray(open(path, "rb").read())
+	data += bytes(-len(data) % 8)
+	digest = digest or authenticodeDigest(path, "sha256")
+	sha256 = der(0x30, derOid("2.16.840.1.101.3.4.2.1") + b"\x05\x00")
+	spc = der(0x30, der(0x30, derOid("1.3.6.1.4.1.311.2.1.15")) + der(0x30, sha256 + der(0x04, digest)))
+	attrs = der(0x30, derOid("1.2.840.113549.1.9.3") + der(0x31, derOid(SPC_INDIRECT_DATA))) + \
+		der(0x30, derOid("1.2.840.113549.1.9.4") + der(0x31, der(0x04, hashlib.sha256(derBody(spc)).digest())))
+	with open(OUTDIR + "attrs.der", "wb") as f:
+		f.write(der(0x31, attrs))
+	sig = subprocess.run(["openssl", "dgst", "-sha256", "-sign", key, OUTDIR + "attrs.der"], capture_output=True, check=True).stdout
+	cert = open(crt, "rb").read()
+	tbs = derItems(derBody(derItems(derBody(cert))[0]))
+	if tbs[0][0] == 0xa0:
+		tbs = tbs[1:]
+	signer = der(0x30, der(0x02, b"\x01") + der(0x30, tbs[2] + tbs[0]) + sha256 + der(0xa0, attrs) +
+		der(0x30, derOid("1.2.840.113549.1.1.1") + b"\x05\x00") + der(0x04, sig))
+	signedData = der(0x30, der(0x02, b"\x01") + der(0x31, sha256) + der(0x30, derOid(SPC_INDIRECT_DATA) + der(0xa0, spc)) +
+		der(0xa0, cert + b"".join(chain)) + der(0x31, signer))
+	pkcs7 = der(0x30, derOid("1.2.840.113549.1.7.2") + der(0xa0, signedData))
+	table = struct.pack("<IHH", 8 + len(pkcs7), 0x0200, 0x0002) + pkcs7
+	table += bytes(-len(table) % 8)
+	pe = struct.unpack_from("<I", data, 0x3c)[0]
+	opt = pe + 24
+	certEntry = opt + (96 if struct.unpack_from("<H", data, opt)[0] == 0x10b else 112) + 4 * 8
+	struct.pack_into("<II", data, certEntry, len(data), len(table))
+	with open(out, "wb") as f:
+		f.write(data + table)
+
+def makeVars(path, db, dbx):
+	#variable directory for -p with the given db and dbx ESL files, None for an empty variable
+	for var, esl in (("db", db), ("dbx", dbx)):
+		os.makedirs(path + var, exist_ok=True)
+		data = open(esl, "rb").read() if esl else b""
+		with open(path + var + "/data", "wb") as f:
+			f.write(data)
+		with open(path + var + "/size", "w") as f:
+			f.write(str(len(data)))
+
 # def generateESL(path="./generatedTestData/",inp="default.crt",out="default.esl"):
 # 	return command(GEN+["c:e", "-i", path+inp, "-o", path+out])
 # def createSizeFile(path):
@@ -356,6 +467,236 @@ class Test(unittest.TestCase):
 		#two files should be eqaul
 		self.assertEqual(compareFiles(expectedOutput, actualOutput), True)
 		
+	def test_genPE(self):
+		out = "genPELog.txt"
+		images = ["./testdata/images/image64.efi", "./testdata/images/image32.efi"]
+		signer = ["-k", "./testdata/goldenKeys/KEK/KEK.key", "-c", "./testdata/goldenKeys/KEK/KEK.crt"]
+		hashFile = OUTDIR + "image.hash"
+		for alg in ["SHA256", "SHA384", "SHA512"]:
+			for image in images:
+				self.assertEqual( getCmdResult(GEN + ["pe:h", "-h", alg, "-i", image, "-o", hashFile], out, self), True)
+				with open(hashFile, "rb") as f:
+					self.assertEqual( f.read(), authenticodeDigest(image, alg.lower()))
+		#the checksum and certificate table of a signed image are not part of its digest
+		signedImage = OUTDIR + "signed.efi"
+		signImage(images[0], signedImage)
+		self.assertEqual( getCmdResult(GEN + ["pe:h", "-i", signedImage, "-o", hashFile], out, self), True)
+		with open(hashFile, "rb") as f:
+			self.assertEqual( f.read(), authenticodeDigest(images[0], "sha256"))
+		#several images make one ESL, hashes in the order of -i
+		esl = OUTDIR + "images.esl"
+		self.assertEqual( getCmdResult(GEN + ["pe:e", "-j", "2", "-i", images[0], "-i", images[1], "-o", esl], out, self), True)
+		self.assertEqual( getCmdResult([SECTOOLS, "validate", "-e", "-x", esl], out, self), True)
+		with open(esl, "rb") as f:
+			data = f.read()
+		self.assertEqual( len(data), 28 + 2 * (16 + 32))
+		self.assertEqual( data[28 + 16:28 + 48], authenticodeDigest(images[0], "sha256"))
+		self.assertEqual( data[28 + 64:], authenticodeDigest(images[1], "sha256"))
+		#signed dbx update revoking both
+		auth = OUTDIR + "images_dbx_by_KEK.auth"
+		self.assertEqual( getCmdResult(GEN + ["pe:a", "-n", "dbx", "-i", images[0], "-i", images[1], "-o", auth] + signer, out, self), True)
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "-p", "./testdata/goldenKeys/", "-u", "dbx", auth], out, self), True)
+		#bad inputs
+		self.assertEqual( getCmdResult(GEN + ["pe:h", "-h", "SHA1", "-i", images[0], "-o", hashFile], out, self), False) #not an Authenticode hash
+		self.assertEqual( getCmdResult(GEN + ["pe:h", "-i", "./testdata/db_by_PK.crt", "-o", hashFile], out, self), False) #not an image
+		self.assertEqual( getCmdResult(GEN + ["pe:h", "-i", "-", "-o", hashFile], out, self), False) #stdin is not a file
+		self.assertEqual( getCmdResult(GEN + ["f:h", "-i", images[0], "-i", images[1], "-o", hashFile], out, self), False) #only pe takes several inputs
+		truncated = OUTDIR + "truncated.efi"
+		with open(images[0], "rb") as f, open(truncated, "wb") as t:
+			t.write(f.read()[:1024])
+		self.assertEqual( getCmdResult(GEN + ["pe:h", "-i", truncated, "-o", hashFile], out, self), False) #sections past the end
+		#headers cut short must be rejected, not crash (a signal gives a negative return code)
+		tiny = OUTDIR + "tiny.efi"
+		for data in [b"MZ" + bytes(58) + struct.pack("<I", 0x10000000), #PE header far past the end
+			     b"MZ\0\0PE\0\0" + bytes(20) + struct.pack("<H", 0x10b) + bytes(30) + struct.pack("<I", 4) + bytes(16), #SizeOfHeaders past the end
+			     b"MZ\0\0PE\0\0" + bytes(20) + struct.pack("<H", 0x20b) + bytes(30) + struct.pack("<I", 4) + bytes(40)]: #data directories past the end
+			with open(tiny, "wb") as f:
+				f.write(data)
+			self.assertGreater(command(GEN + ["pe:h", "-i", tiny, "-o", hashFile], out), 0)
+	def test_genBundle(self):
+		out = "genBundleLog.txt"
+		keys = "./testdata/goldenKeys/"
+		crts = [keys + "PK/PK.crt", keys + "KEK/KEK.crt", keys + "db/db.crt"]
+		bundle = OUTDIR + "bundle.pem"
+		#text between the blocks is skipped, like the names in distribution bundles
+		with open(bundle, "w") as f:
+			for crt in crts:
+				f.write("# " + crt + "\n" + open(crt).read() + "\n")
+		expected = b""
+		for crt in crts:
+			esl = OUTDIR + "single.esl"
+			self.assertEqual( getCmdResult(GEN + ["c:e", "-i", crt, "-o", esl], out, self), True)
+			expected += open(esl, "rb").read()
+		#one ESL per certificate, in the order of the bundle
+		for jobs in ["1", "3"]:
+			esl = OUTDIR + "bundle.esl"
+			self.assertEqual( getCmdResult(GEN + ["c:e", "-j", jobs, "-i", bundle, "-o", esl], out, self), True)
+			self.assertEqual( open(esl, "rb").read(), expected)
+		self.assertEqual( getCmdResult([SECTOOLS, "validate", "-e", esl], out, self), True)
+		#a db update with the whole bundle
+		auth = OUTDIR + "bundle_db_by_KEK.auth"
+		self.assertEqual( getCmdResult(GEN + ["c:a", "-n", "db", "-k", keys + "KEK/KEK.key", "-c", keys + "KEK/KEK.crt", "-i", bundle, "-o", auth], out, self), True)
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "-p", keys, "-u", "db", auth], out, self), True)
+		#bad bundles
+		pem = open(bundle).read()
+		broken = OUTDIR + "brokenBundle.pem"
+		def brokenResult(text, args=[]):
+			with open(broken, "w") as f:
+				f.write(text)
+			return getCmdResult(GEN + ["c:e", "-i", broken, "-o", esl] + args, out, self)
+		self.assertEqual( brokenResult(pem + open(keys + "db/db.key").read()), False) #a private key is not a certificate
+		self.assertEqual( brokenResult(pem[:pem.rindex("-----END")]), False) #last block is not closed
+		self.assertEqual( brokenResult(pem.replace("-----END CERTIFICATE-----", "-----END CERT-----", 1)), False) #END does not match BEGIN
+		lines = pem.split("\n")
+		lines[3] = "*" + lines[3][1:]
+		self.assertEqual( brokenResult("\n".join(lines)), False) #not base64
+		lines = pem.split("\n")
+		lines[3] = lines[3][::-1]
+		self.assertEqual( brokenResult("\n".join(lines)), False) #base64 of something else than a certificate
+		self.assertEqual( brokenResult("\n".join(lines), ["-f"]), True) #unless validation is skipped
+	def test_genCertSet(self):
+		out = "genCertSetLog.txt"
+		keys = "./testdata/goldenKeys/"
+		setDir = OUTDIR + "certSet/"
+		for d in ["vendorA", "vendorB"]:
+			os.makedirs(setDir + d, exist_ok=True)
+		#PEM and DER files, the PK twice
+		command(["cp", keys + "PK/PK.crt", setDir + "vendorA/1.pem"], out)
+		command(["cp", keys + "KEK/KEK.der", setDir + "vendorA/2.der"], out)
+		command(["cp", keys + "PK/PK.der", setDir + "vendorB/1.der"], out)
+		listFile = OUTDIR + "certSet.list"
+		with open(listFile, "w") as f:
+			f.write("# db certificates\n\n" + keys + "db/db.crt\n" + keys + "KEK/KEK.crt\n")
+		expected = b""
+		for crt in ["PK/PK.crt", "KEK/KEK.crt", "db/db.crt"]:
+			esl = OUTDIR + "single.esl"
+			self.assertEqual( getCmdResult(GEN + ["c:e", "-i", keys + crt, "-o", esl], out, self), True)
+			expected += open(esl, "rb").read()
+		#directories in name order then the list, repeated certificates left out, the same whatever the number of threads
+		esl = OUTDIR + "certSet.esl"
+		for jobs in ["1", "4"]:
+			self.assertEqual( getCmdResult(GEN + ["c:e", "-j", jobs, "-i", setDir + "vendorA", "-i", setDir + "vendorB", "-i", "@" + listFile, "-o", esl], out, self), True)
+			self.assertEqual( open(esl, "rb").read(), expected)
+		#several -i files and a single DER file
+		self.assertEqual( getCmdResult(GEN + ["c:e", "-i", keys + "PK/PK.der", "-i", keys + "KEK/KEK.crt", "-i", keys + "db/db.der", "-o", esl], out, self), True)
+		self.assertEqual( open(esl, "rb").read(), expected)
+		self.assertEqual( getCmdResult(GEN + ["c:e", "-i", keys + "db/db.der", "-o", esl], out, self), True)
+		self.assertEqual( open(esl, "rb").read(), expected[-len(open(esl, "rb").read()):])
+		#a signed db update of the whole set
+		auth = OUTDIR + "certSet_db_by_KEK.auth"
+		self.assertEqual( getCmdResult(GEN + ["c:a", "-n", "db", "-k", keys + "KEK/KEK.key", "-c", keys + "KEK/KEK.crt", "-i", setDir + "vendorA", "-i", "@" + listFile, "-o", auth], out, self), True)
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "-p", keys, "-u", "db", auth], out, self), True)
+		#bad sets
+		self.assertEqual( getCmdResult(GEN + ["c:e", "-i", setDir + "vendorA", "-i", keys + "db/db.key", "-o", esl], out, self), False) #a key is not a certificate
+		self.assertEqual( getCmdResult(GEN + ["c:e", "-i", setDir + "vendorA", "-i", keys + "db/data", "-o", esl], out, self), False) #an ESL is not a certificate
+		self.assertEqual( getCmdResult(GEN + ["c:e", "-i", "@" + OUTDIR + "noSuchList", "-o", esl], out, self), False) #missing list
+		with open(listFile, "a") as f:
+			f.write(OUTDIR + "noSuchCert.pem\n")
+		self.assertEqual( getCmdResult(GEN + ["c:e", "-i", "@" + listFile, "-o", esl], out, self), False) #missing file in the list
+		self.assertEqual( getCmdResult(GEN + ["c:h", "-i", setDir + "vendorA", "-o", esl], out, self), False) #a set can not be hashed
+		self.assertEqual( getCmdResult(GEN + ["e:e", "-i", esl, "-i", esl, "-o", esl], out, self), False) #only pe and c take several inputs
+	def test_genAuto(self):
+		out = "genAutoLog.txt"
+		keys = "./testdata/goldenKeys/"
+		p7 = OUTDIR + "auto.p7"
+		self.assertEqual( getCmdResult(GEN + ["c:p", "-n", "db", "-k", keys + "KEK/KEK.key", "-c", keys + "KEK/KEK.crt", "-i", keys + "db/db.crt", "-o", p7], out, self), True)
+		hashFile = OUTDIR + "auto.hash"
+		with open(hashFile, "wb") as f:
+			f.write(bytes(range(48)))
+		#every format gives the same output as when it is given explicitly
+		inputs = [
+			["c", "e", keys + "db/db.crt", []],
+			["c", "e", keys + "db/db.der", []],
+			["e", "h", "./testdata/db_by_PK.esl", []],
+			["a", "e", "./testdata/db_by_PK.auth", []],
+			["p", "h", p7, []],
+			["pe", "e", "./testdata/images/image64.efi", []],
+			["h", "e", hashFile, ["-h", "SHA384"]],
+		]
+		for inForm, outForm, inFile, extra in inputs:
+			explicit, auto = OUTDIR + "explicit.out", OUTDIR + "auto.out"
+			self.assertEqual( getCmdResult(GEN + [inForm + ":" + outForm, "-i", inFile, "-o", explicit] + extra, out, self), True)
+			#a raw hash is told apart by its length, which picks the hash function
+			self.assertEqual( getCmdResult(GEN + ["auto:" + outForm, "-i", inFile, "-o", auto], out, self), True)
+			self.assertEqual( open(auto, "rb").read(), open(explicit, "rb").read())
+		#several images, a directory of certificates
+		self.assertEqual( getCmdResult(GEN + ["pe:e", "-i", "./testdata/images/image64.efi", "-i", "./testdata/images/image32.efi", "-o", explicit], out, self), True)
+		self.assertEqual( getCmdResult(GEN + ["auto:e", "-i", "./testdata/images/image64.efi", "-i", "./testdata/images/image32.efi", "-o", auto], out, self), True)
+		self.assertEqual( open(auto, "rb").read(), open(explicit, "rb").read())
+		setDir = OUTDIR + "autoSet/"
+		os.makedirs(setDir, exist_ok=True)
+		command(["cp", keys + "db/db.der", keys + "KEK/KEK.crt", setDir], out)
+		self.assertEqual( getCmdResult(GEN + ["c:e", "-i", setDir, "-o", explicit], out, self), True)
+		self.assertEqual( getCmdResult(GEN + ["auto:e", "-i", setDir, "-o", auto], out, self), True)
+		self.assertEqual( open(auto, "rb").read(), open(explicit, "rb").read())
+		#unknown data, a hash of the wrong length for '-h' and mixed inputs are refused
+		self.assertEqual( getCmdResult(GEN + ["auto:e", "-i", keys + "db/db.key", "-o", auto], out, self), False)
+		self.assertEqual( getCmdResult(GEN + ["auto:e", "-h", "SHA256", "-i", hashFile, "-o", auto], out, self), False)
+		self.assertEqual( getCmdResult(GEN + ["auto:e", "-i", "./testdata/db_by_PK.esl", "-i", keys + "db/db.crt", "-o", auto], out, self), False)
+	def test_checkImage(self):
+		out = "checkImageLog.txt"
+		keys = "./testdata/goldenKeys/"
+		image = "./testdata/images/image64.efi"
+		varDir = OUTDIR + "imageVars/"
+		check = [SECTOOLS, "check-image", "-p", varDir]
+		def verdict(img):
+			res = subprocess.run(check + [img], capture_output=True, text=True)
+			return [l for l in res.stdout.splitlines() if l.startswith(img + ": ")][0].split(": ")[1]
+		makeVars(varDir, keys + "db/data", None)
+		signedByDb = OUTDIR + "image_by_db.efi"
+		authenticodeSign(image, signedByDb, keys + "db/db.der", keys + "db/db.key")
+		self.assertEqual( getCmdResult(check + [signedByDb], out, self), True)
+		self.assertEqual( verdict(signedByDb), "ACCEPTED, it is signed by a certificate in db")
+		self.assertEqual( verdict(image), "REJECTED, it is not signed and its digest is not in db")
+		signedByKEK = OUTDIR + "image_by_KEK.efi"
+		authenticodeSign(image, signedByKEK, keys + "KEK/KEK.der", keys + "KEK/KEK.key")
+		self.assertEqual( getCmdResult(check + [signedByKEK], out, self), False)
+		self.assertEqual( verdict(signedByKEK), "REJECTED, it is not signed by a certificate in db")
+		#a leaf issued by the db certificate chains up to it
+		leafKey, leafCsr, leafCrt = OUTDIR + "leaf.key", OUTDIR + "leaf.csr", OUTDIR + "leaf.der"
+		self.assertEqual( command(["openssl", "req", "-new", "-newkey", "rsa:2048", "-nodes", "-subj", "/CN=image signer", "-keyout", leafKey, "-out", leafCsr], out), 0)
+		self.assertEqual( command(["openssl", "x509", "-req", "-in", leafCsr, "-CA", keys + "db/db.crt", "-CAkey", keys + "db/db.key", "-set_serial", "7", "-days", "1", "-outform", "DER", "-out", leafCrt], out), 0)
+		signedByLeaf = OUTDIR + "image_by_leaf.efi"
+		authenticodeSign(image, signedByLeaf, leafCrt, leafKey)
+		self.assertEqual( verdict(signedByLeaf), "ACCEPTED, it is signed by a certificate in db")
+		#changing the image after signing it
+		tampered = OUTDIR + "image_tampered.efi"
+		with open(signedByDb, "rb") as f:
+			data = bytearray(f.read())
+		data[0x400] ^= 0xff
+		with open(tampered, "wb") as f:
+			f.write(data)
+		self.assertEqual( verdict(tampered), "REJECTED, its signatures are not of this image")
+		#digest in db
+		imageEsl = OUTDIR + "image64.esl"
+		self.assertEqual( getCmdResult(GEN + ["pe:e", "-i", image, "-o", imageEsl], out, self), True)
+		makeVars(varDir, imageEsl, None)
+		self.assertEqual( getCmdResult(check + [image], out, self), True)
+		self.assertEqual( verdict(image), "ACCEPTED, its digest is in db")
+		#dbx wins over db, by digest and by certificate
+		dbCertEsl = OUTDIR + "db_cert.esl"
+		self.assertEqual( getCmdResult(GEN + ["c:e", "-i", keys + "db/db.crt", "-o", dbCertEsl], out, self), True)
+		makeVars(varDir, keys + "db/data", imageEsl)
+		self.assertEqual( verdict(signedByDb), "REJECTED, its digest is in dbx")
+		makeVars(varDir, keys + "db/data", dbCertEsl)
+		self.assertEqual( verdict(signedByLeaf), "REJECTED, it is signed by a certificate in dbx")
+		#several images at once, machine readable
+		makeVars(varDir, keys + "db/data", None)
+		images = [signedByDb, signedByKEK, image, "./testdata/db_by_PK.crt"]
+		res = subprocess.run(check + ["-j", "2", "--output", "json"] + images, capture_output=True, text=True)
+		self.assertNotEqual( res.returncode, 0)
+		result = json.loads(res.stdout)
+		self.assertEqual( [i["file"] for i in result["images"]], images)
+		self.assertEqual( [i["verdict"] for i in result["images"]], ["ACCEPTED", "REJECTED", "REJECTED", "ERROR"])
+		self.assertEqual( [i["signatures"] for i in result["images"]], [1, 1, 0, 0])
+		#snapshot of the variables
+		snapshot = OUTDIR + "imageVars.snap"
+		self.assertEqual( getCmdResult([SECTOOLS, "read", "-p", varDir, "--snapshot-out", snapshot], out, self), True)
+		self.assertEqual( getCmdResult([SECTOOLS, "check-image", "-p", snapshot, signedByDb, signedByLeaf], out, self), True)
+		#bad inputs
+		self.assertEqual( getCmdResult(check + ["./testdata/db_by_PK.crt"], out, self), False) #not an image
+		self.assertEqual( getCmdResult(check + ["-"], out, self), False) #stdin is not a file
+		self.assertEqual( getCmdResult(check, out, self), False) #no image
 	def test_genHash(self):
 		out = "genHashLog.txt"
 		inpDir = "./testdata/"
@@ -4,7 +4,10 @@ import unittest
 import subprocess
 import os
 import filecmp
+import json
 import sys
+import hashlib
+import struct
 MEM_ERR = 101
 SECTOOLS="../secvarctl-cov"
 SECVARPATH="/sys/firmware/secvar/vars/"
@@ -40,6 +43,9 @@ readCommands=[
 	[["--usage"], True],[["--help"], True], #usage and help
 	[["-f", "./testenv/db/data", "-r"], True],#print raw data from file
 	[["-p", "./testenv/", "-r"], True], #print raw data from current vars
+	[["-p", "./testenv/", "--output", "json"], True], #structured output
+	[["-f", "./testenv/db/data", "--output", "cbor"], True],
+	[["-p", "./testenv/", "--output", "xml"], False], #unknown output format
 
 	[["-p", "."], False],#bad path
 	[["-f", "./testdata/db_by_PK.auth"], False],#given authfile instead of esl
@@ -53,9 +59,13 @@ readCommands=[
 verifyCommands=[
 [["--usage"], True],[["--help"], True],
 [["-c", "PK","./testenv/PK/data", "-u", "db","./testdata/db_by_PK.auth"], True],#update with current vars set and update set
+[["-p","./testenv/","--output", "json", "-u", "db","./testdata/db_by_PK.auth", "KEK", "./testdata/KEK_by_PK.auth"], True], #structured output
+[["-p","./testenv/","--output", "cbor", "-u", "db","./testdata/db_by_PK.auth","KEK", "./testdata/KEK_by_PK.auth", "PK", "./testdata/bad_PK_by_db.auth" ], False], #structured output with bad update
 [["-c", "PK","./testenv/PK/data","KEK","./testenv/KEK/data","db","./testenv/db/data","-u", "db","./testdata/db_by_PK.auth", "KEK", "./testdata/KEK_by_PK.auth", "PK", "./testdata/PK_by_PK.auth" ], True], #update chain with given current vars set
 [["-p","./testenv/","-u", "db","./testdata/db_by_PK.auth", "KEK", "./testdata/KEK_by_PK.auth", "PK", "./testdata/PK_by_PK.auth" ], True], #update chain with path set
 [["-p", "./testenv/", "-u", "db", "./testdata/db_by_PK.auth", "db", "./testdata/db_by_KEK.auth"], True], #submit newer update after older
+[["-j", "4", "-p", "./testenv/", "-u", "db", "./testdata/db_by_PK.auth", "db", "./testdata/db_by_KEK.auth", "dbx", "./testdata/dbx_by_KEK.auth", "KEK", "./testdata/KEK_by_PK.auth", "PK", "./testdata/PK_by_PK.auth"], True], #signatures checked concurrently
+[["-j", "4", "-p", "./testenv/", "-u", "db", "./testdata/db_by_PK.auth", "PK", "./testdata/bad_PK_by_db.auth", "db", "./testdata/db_by_KEK.auth"], False], #concurrently checked chain with one improperly signed auth file should fail
 [["-c", "PK","./testenv/PK/data", "KEK", "./testenv/KEK/foo", "-u", "db","./testdata/db_by_PK.auth"], True],#KEK bad path, should continue
 [["-p","./testenv/", "-u", "db", "./testdata/brokenFiles/1db_by_PK.auth","KEK", "./testdata/KEK_by_PK.auth", "PK", "./testdata/PK_by_PK.auth" ], False], #update chain with one broken auth file should fail
 [["-p","./testenv/", "-u", "db", "./testdata/db_by_PK.auth","KEK", "./testdata/KEK_by_PK.auth", "PK", "./testdata/bad_PK_by_db.auth" ], False], #update chain with one improperly signed auth file should fail
@@ -146,6 +156,13 @@ def getCmdResult(args, out, self):
 		return False
 
 
+def getStdioResult(args, inFile, out, outFile=None):#runs command with inFile as stdin and optionally stores stdout into outFile
+	with open(inFile, "rb") as i, open(out, "w") as f, open(outFile if outFile else os.devnull, "wb") as o:
+		f.write("\n\n**********COMMAND RAN: $"+ ' '.join(args) +" < "+ inFile +"\n")
+		f.flush()
+		result = subprocess.call(args, stdin=i, stdout=o, stderr=f)
+	return result == 0
+
 def setupTestEnv():
 	out="log.txt"
 	command(["cp", "-a", "./testdata/goldenKeys/.", "testenv/"], out)
@@ -304,6 +321,289 @@ class Test(unittest.TestCase):
 			postUpdate="testGenerated.esl" 
 			self.assertEqual( getCmdResult(cmd+["-i", i, "-o", postUpdate],out, self), False) #all broken auths should fail to have correct esl
 			self.assertEqual( getCmdResult(["rm",postUpdate],out, self), False) #removal of output file should fail since it was never made
+	def test_stdio(self):
+		out="stdiolog.txt"
+		self.assertEqual( getStdioResult([SECTOOLS, "read", "-f", "-"], "./testenv/PK/data", out), True)#read esl from stdin
+		self.assertEqual( getStdioResult([SECTOOLS, "validate", "-"], "./testdata/db_by_PK.auth", out), True)#validate auth from stdin
+		self.assertEqual( getStdioResult([SECTOOLS, "validate", "-e", "-"], "./testdata/db_by_PK.auth", out), False)#auth from stdin is not an esl
+		self.assertEqual( getStdioResult([SECTOOLS, "verify", "-p", "./testenv/", "-u", "db", "-"], "./testdata/db_by_PK.auth", out), True)#update from stdin
+		self.assertEqual( getStdioResult([SECTOOLS, "verify", "-c", "PK", "-", "-u", "db", "./testdata/db_by_PK.auth"], "./testenv/PK/data", out), True)#current var from stdin
+		self.assertEqual( getStdioResult([SECTOOLS, "verify", "-c", "PK", "-", "-u", "db", "-"], "./testenv/PK/data", out), False)#stdin can only be read once
+		self.assertEqual( getStdioResult([SECTOOLS, "generate", "a:e", "-i", "-", "-o", "-"], "./testdata/db_by_PK.auth", out, "testGenerated.esl"), True)#stdin to stdout
+		self.assertEqual(compareFiles("./testdata/db_by_PK.esl", "testGenerated.esl"), True)#stdout only contains data
+		command(["rm", "testGenerated.esl"])
+	def test_structuredOutput(self):
+		out="structuredOutputlog.txt"
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "read", "-p", "./testenv/", "--output", "json"], stdout=subprocess.PIPE, stderr=f)
+		self.assertEqual(result.returncode, 0)
+		data = json.loads(result.stdout)#stdout only contains json
+		self.assertEqual([v["name"] for v in data["variables"]], ["PK", "KEK", "db", "dbx", "TS"])
+		self.assertEqual(len(data["variables"][0]["esls"][0]["entries"][0]["certificate"]["sha256"]), 64)
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "verify", "-p", "./testenv/", "--output", "json", "-u", "db", "./testdata/db_by_PK.auth", "PK", "./testdata/bad_PK_by_db.auth", "KEK", "./testdata/KEK_by_PK.auth"], stdout=subprocess.PIPE, stderr=f)
+		self.assertNotEqual(result.returncode, 0)
+		data = json.loads(result.stdout)
+		self.assertEqual([u["verdict"] for u in data["updates"]], ["valid", "invalid", "skipped"])
+		#file names need not be UTF-8, the json must still be
+		badName = b"./testdata/db_\xff\xc3(\xed\xa0\x80.auth"
+		command(["cp", "./testdata/db_by_KEK.auth", badName])
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "verify", "--plan", "-p", "./testenv/", "--output", "json", "-u", "db", badName], stdout=subprocess.PIPE, stderr=f)
+		command(["rm", badName])
+		self.assertEqual(result.returncode, 0)
+		data = json.loads(result.stdout.decode("utf-8"))#strict decode
+		self.assertEqual(data["plan"][0]["file"], "./testdata/db_\ufffd\ufffd(\ufffd\ufffd\ufffd.auth")
+	def test_readSummary(self):
+		out="readSummarylog.txt"
+		with open(out, "w") as f:
+			full = json.loads(subprocess.run([SECTOOLS, "read", "-p", "./testenv/", "--output", "json"], stdout=subprocess.PIPE, stderr=f).stdout)
+			result = subprocess.run([SECTOOLS, "read", "-p", "./testenv/", "--summary", "--output", "json"], stdout=subprocess.PIPE, stderr=f)
+		self.assertEqual(result.returncode, 0)
+		summary = json.loads(result.stdout)
+		#the counts from the headers match the fully parsed output
+		for var, sumVar in zip(full["variables"], summary["variables"]):
+			self.assertEqual(sumVar["name"], var["name"])
+			self.assertEqual(sumVar["size"], var["size"])
+			if var["name"] != "TS":
+				self.assertEqual(sumVar["eslCount"], len(var["esls"]))
+				self.assertEqual(sumVar["entryCount"], sum(len(esl["entries"]) for esl in var["esls"]))
+				self.assertEqual(sumVar["timestamp"], [t["time"] for t in full["variables"][-1]["timestamps"] if t["variable"] == var["name"]][0])
+		self.assertEqual(summary["variables"][3]["entries"], {"SHA256": 1})
+		#one variable still gets its timestamp, text output is one line per variable
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "read", "-p", "./testenv/", "--summary", "db"], stdout=subprocess.PIPE, stderr=f, text=True)
+		self.assertEqual(result.stdout.splitlines()[0], "db: 857 bytes, 1 ESL's, 1 entries (X509 1), timestamp " + summary["variables"][2]["timestamp"])
+		#several ESL's in one file, a truncated ESL
+		with open("summary.esl", "wb") as f:
+			f.write(open("./testdata/db_by_PK.esl", "rb").read() + open("./testenv/dbx/data", "rb").read())
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "read", "--summary", "--output", "json", "-f", "summary.esl"], stdout=subprocess.PIPE, stderr=f)
+		self.assertEqual(json.loads(result.stdout)["variables"][0]["entries"], {"X509": 1, "SHA256": 1})
+		with open("summary.esl", "wb") as f:
+			f.write(open("./testdata/db_by_PK.esl", "rb").read()[:-10])
+		self.assertEqual( getCmdResult([SECTOOLS, "read", "--summary", "-f", "summary.esl"], out, self), False)
+		self.assertEqual( getCmdResult([SECTOOLS, "read", "--summary", "-r", "-p", "./testenv/"], out, self), False)
+		#every type getSigType can name, one ESL of one 48 byte entry each
+		guids = {"SHA1": "12a56c8210cfc94ab187be01496631bd", "SHA224": "33526e0b5ca6c9449407d9ab83bfc8bd",
+			"SHA256": "2616c4c14c509240aca941f936934328", "SHA384": "07533effd09fc94885f18ad56c701e01",
+			"SHA512": "ae0f3e09c4a6504f9f1bd41e2b89c19a", "X509": "a159c0a5e494a74a87b5ab155c2bf072",
+			"RSA2048": "e866573c9c26344eaa14ed776e85b3b6", "PKCS7": "9dd2af4adf68ee498aa9347d375665a7",
+			"UNKNOWN": "00" * 16}
+		with open("summary.esl", "wb") as f:
+			for guid in guids.values():
+				f.write(bytes.fromhex(guid) + struct.pack("<III", 28 + 48, 0, 48) + bytes(48))
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "read", "--summary", "--output", "json", "-f", "summary.esl"], stdout=subprocess.PIPE, stderr=f)
+		self.assertEqual(result.returncode, 0)
+		self.assertEqual(json.loads(result.stdout)["variables"][0]["entries"], {name: 1 for name in guids})
+		command(["rm", "summary.esl"])
+	def test_readDigest(self):
+		out="readDigestlog.txt"
+		h = lambda t, *parts: hashlib.sha256(bytes([t]) + b"".join(parts)).digest()
+		def tree(leaves):#every level, an odd last node moves up as is
+			levels = [leaves]
+			while len(levels[-1]) > 1:
+				l = levels[-1]
+				levels.append([h(1, l[i], l[i + 1]) for i in range(0, len(l) - 1, 2)] + ([l[-1]] if len(l) % 2 else []))
+			return levels if leaves else []
+		root = lambda levels: levels[-1][0] if levels else bytes(32)
+		def varDigest(name, data):
+			if name == "TS":
+				return h(3, name.encode() + b"\0", h(0, data), b"\1")
+			esls, off = [], 0
+			while off < len(data):
+				listSize, hdrSize, sigSize = struct.unpack("<III", data[off + 16:off + 28])
+				entries = [h(0, data[o:o + sigSize]) for o in range(off + 28 + hdrSize, off + listSize, sigSize)]
+				esls.append(h(2, data[off:off + 28 + hdrSize], root(tree(entries))))
+				off += listSize
+			return h(3, name.encode() + b"\0", root(tree(esls)), b"\1")#ends with the valid flag
+		def digest(args):
+			with open(out, "w") as f:
+				result = subprocess.run([SECTOOLS, "read", "--digest", "--output", "json"] + args, stdout=subprocess.PIPE, stderr=f)
+			return result.returncode, json.loads(result.stdout)
+		#the root is the tree over the variable digests, computed here from the data
+		rc, data = digest(["-p", "./testenv/"])
+		self.assertEqual(rc, 0)
+		names = ["PK", "KEK", "db", "dbx", "TS"]
+		digests = [varDigest(n, open("./testenv/" + n + "/data", "rb").read()) for n in names]
+		self.assertEqual([v["digest"] for v in data["variables"]], [d.hex() for d in digests])
+		self.assertEqual(data["root"], root(tree(digests)).hex())
+		#a snapshot of the same variables has the same root
+		self.assertEqual( getCmdResult([SECTOOLS, "read", "-p", "./testenv/", "--snapshot-out", "digestSnapshot.svs"], out, self), True)
+		self.assertEqual(digest(["-p", "digestSnapshot.svs"])[1]["root"], data["root"])
+		#one changed hash out of five only changes the nodes above it
+		esl = bytearray(open("./testenv/dbx/data", "rb").read())
+		hdr, entry = esl[:28], esl[28:]
+		hashes = [bytes(entry[:16]) + bytes([i]) * 32 for i in range(5)]
+		struct.pack_into("<I", hdr, 16, 28 + 48 * 5)
+		with open("digest.esl", "wb") as f:
+			f.write(hdr + b"".join(hashes))
+		before = digest(["-f", "digest.esl", "dbx"])[1]["variables"][0]["esls"][0]
+		hashes[3] = hashes[3][:16] + bytes(32)
+		with open("digest.esl", "wb") as f:
+			f.write(hdr + b"".join(hashes))
+		after = digest(["-f", "digest.esl", "dbx"])[1]["variables"][0]["esls"][0]
+		self.assertEqual(after["tree"], [[x.hex() for x in l] for l in tree([h(0, e) for e in hashes])])
+		self.assertEqual([[i for i in range(len(l)) if l[i] != after["tree"][n][i]] for n, l in enumerate(before["tree"])], [[3], [1], [0], [0]])
+		#a truncated ESL still gets a digest but is not valid
+		with open("digest.esl", "wb") as f:
+			f.write(bytes(esl[:-10]))
+		rc, data = digest(["-f", "digest.esl", "dbx"])
+		self.assertNotEqual(rc, 0)
+		self.assertEqual(data["variables"][0]["valid"], False)
+		self.assertEqual(data["variables"][0]["esls"][0]["type"], "MALFORMED")
+		#an ESL that is not a whole number of entries, the bytes after the last one are in the digest
+		eslSize = struct.unpack("<I", esl[16:20])[0]
+		with open("digest.esl", "wb") as f:
+			f.write(esl[:16] + struct.pack("<I", eslSize + 5) + esl[20:eslSize] + b"extra")
+		rc, data = digest(["-f", "digest.esl", "dbx"])
+		self.assertNotEqual(rc, 0)
+		self.assertEqual(data["variables"][0]["esls"][0]["type"], "MALFORMED")
+		self.assertEqual(data["variables"][0]["esls"][0]["digest"], h(4, open("digest.esl", "rb").read()).hex())
+		#a file is named after the variable it holds, not its path, and needs that name
+		self.assertEqual(digest(["-f", "./testenv/dbx/data", "dbx"])[1]["variables"][0]["digest"], digests[3].hex())
+		self.assertEqual( getCmdResult([SECTOOLS, "read", "--digest", "-f", "./testenv/dbx/data"], out, self), False)
+		#bytes forged from an ESL header and its entry root are not taken for that ESL
+		golden = digest(["-p", "./testenv/"])[1]
+		dbx = next(v for v in golden["variables"] if v["name"] == "dbx")
+		command(["rm", "-rf", "digestForged"])
+		command(["cp", "-r", "./testenv", "digestForged"])
+		with open("digestForged/dbx/data", "wb") as f:
+			f.write(esl[:28] + bytes.fromhex(dbx["esls"][0]["tree"][-1][0]))
+		with open("digestForged/dbx/size", "w") as f:
+			f.write("60")
+		forged = digest(["-p", "digestForged"])[1]
+		forgedDbx = next(v for v in forged["variables"] if v["name"] == "dbx")
+		self.assertEqual(forgedDbx["esls"][0]["digest"], h(4, open("digestForged/dbx/data", "rb").read()).hex())
+		self.assertNotEqual(forged["root"], golden["root"])
+		self.assertEqual( getCmdResult([SECTOOLS, "read", "--digest", "--summary", "-p", "./testenv/"], out, self), False)
+		command(["rm", "-r", "digest.esl", "digestSnapshot.svs", "digestForged"])
+	def test_timings(self):
+		out="timingslog.txt"
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "--timings=testTrace.json", "verify", "-p", "./testenv/", "-u", "db", "./testdata/db_by_PK.auth"], stdout=f, stderr=subprocess.PIPE)
+		self.assertEqual(result.returncode, 0)
+		phases = [line.split()[0] for line in result.stderr.decode().splitlines() if line]
+		for phase in ["file_io", "pkcs7_parse", "x509_parse", "hash", "sig_verify"]:
+			self.assertIn(phase, phases)
+		with open("testTrace.json") as f:
+			events = json.load(f)["traceEvents"]
+		self.assertTrue(all(e["ph"] == "X" and e["dur"] >= 0 for e in events))
+		self.assertIn("sig_verify", [e["name"] for e in events])
+		command(["rm", "testTrace.json"])
+		self.assertEqual( getCmdResult([SECTOOLS, "--timings=./fakeDir/trace.json", "read", "-p", "./testenv/"], out, self), False)#trace file cannot be written
+	def test_memStats(self):
+		out="memstatslog.txt"
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "--mem-stats", "verify", "-p", "./testenv/", "-u", "db", "./testdata/db_by_PK.auth"], stdout=f, stderr=subprocess.PIPE)
+		self.assertEqual(result.returncode, 0)
+		rows = {line.split()[0]: line.split()[1:] for line in result.stderr.decode().splitlines() if line}
+		for tag in ["file_io", "esl", "pkcs7", "bank", "total"]:
+			self.assertIn(tag, rows)
+		self.assertEqual(rows["bank"][0], rows["bank"][1])#every secvar is freed
+		self.assertGreater(int(rows["total"][4]), 0)
+	def test_cryptoSelect(self):
+		out="cryptoselectlog.txt"
+		verifyCmd=["verify", "-p", "./testenv/", "-u", "db", "./testdata/db_by_PK.auth"]
+		result = subprocess.run([SECTOOLS, "-v"]+verifyCmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+		self.assertEqual(result.returncode, 0)
+		used = [line.split()[-1] for line in result.stdout.decode().splitlines() if line.startswith("Using crypto provider")]
+		self.assertEqual(len(used), 1)
+		self.assertEqual( getCmdResult([SECTOOLS, "--crypto="+used[0]]+verifyCmd, out, self), True)
+		self.assertEqual( getCmdResult([SECTOOLS, "--crypto=nosuchlib"]+verifyCmd, out, self), False)
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS]+verifyCmd, stdout=f, stderr=f, env=dict(os.environ, SECVARCTL_CRYPTO="nosuchlib"))
+		self.assertNotEqual(result.returncode, 0)
+	def test_fleet(self):
+		out="fleetlog.txt"
+		command(["rm", "-rf", "testFleet"])
+		command(["mkdir", "testFleet"])
+		for host in ["host0", "host1", "host2", "host3"]:
+			command(["cp", "-r", "./testenv", "testFleet/"+host])
+		command(["rm", "-r", "testFleet/host2/KEK"])#db update is no longer signed by a current key
+		command(["cp", "./testdata/brokenFiles/empty.esl", "testFleet/host3/db/data"])
+		command(["dd", "if=./testdata/goldenKeys/KEK/data", "of=testFleet/host3/KEK/data", "count=100", "bs=1"])#invalid current KEK
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "--fleet", "testFleet", "-j", "2", "-u", "db", "./testdata/db_by_KEK.auth"], out, self), False)
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "verify", "--fleet", "testFleet", "--output", "json", "-u", "db", "./testdata/db_by_KEK.auth"], stdout=subprocess.PIPE, stderr=f)
+		data = json.loads(result.stdout)
+		self.assertEqual([(h["name"], h["verdict"]) for h in data["hosts"]], [("host0", "valid"), ("host1", "valid"), ("host2", "invalid"), ("host3", "invalid")])
+		self.assertEqual(data["processed"], 2)#host0 and host1 share PK, KEK and TS
+		command(["rm", "-r", "testFleet/host2", "testFleet/host3"])
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "--fleet", "testFleet", "-u", "db", "./testdata/db_by_KEK.auth"], out, self), True)
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "--fleet", "testFleet", "-w", "-u", "db", "./testdata/db_by_KEK.auth"], out, self), False)#cannot write to a fleet
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "--fleet", "testFleet", "-j", "0", "-u", "db", "./testdata/db_by_KEK.auth"], out, self), False)
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "--fleet", "./fakeDir", "-u", "db", "./testdata/db_by_KEK.auth"], out, self), False)
+		command(["rm", "-r", "testFleet"])
+	def test_snapshot(self):
+		out="snapshotlog.txt"
+		self.assertEqual( getCmdResult([SECTOOLS, "read", "-p", "./testenv/", "--snapshot-out", "testSnapshot.svs"], out, self), True)
+		for var in ["PK", "KEK", "db", "dbx", "TS"]:
+			with open(out, "w") as f:
+				fromDir = subprocess.run([SECTOOLS, "read", "-r", "-p", "./testenv/", var], stdout=subprocess.PIPE, stderr=f).stdout
+				fromSnapshot = subprocess.run([SECTOOLS, "read", "-r", "-p", "testSnapshot.svs", var], stdout=subprocess.PIPE, stderr=f).stdout
+			self.assertEqual(fromDir, fromSnapshot)
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "-p", "testSnapshot.svs", "-u", "db", "./testdata/db_by_KEK.auth"], out, self), True)
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "-c", "testSnapshot.svs", "-u", "db", "./testdata/db_by_KEK.auth"], out, self), True)
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "-c", "testSnapshot.svs", "-u", "PK", "./testdata/bad_PK_by_db.auth"], out, self), False)
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "-w", "-p", "testSnapshot.svs", "-u", "db", "./testdata/db_by_KEK.auth"], out, self), False)#snapshots are read only
+		self.assertEqual( getCmdResult([SECTOOLS, "read", "-p", "./testenv/", "-f", "./testdata/db_by_PK.esl", "--snapshot-out", "testSnapshot.svs"], out, self), False)
+		with open("testSnapshot.svs", "r+b") as f:
+			f.seek(-1, 2)
+			last = f.read(1)
+			f.seek(-1, 2)
+			f.write(bytes([last[0] ^ 1]))
+		self.assertEqual( getCmdResult([SECTOOLS, "read", "-p", "testSnapshot.svs"], out, self), False)#payload no longer matches its digest
+		command(["rm", "testSnapshot.svs"])
+	def test_plan(self):
+		out="planlog.txt"
+		chain=["KEK", "./testdata/KEK_by_PK.auth", "PK", "./testdata/PK_by_PK.auth", "db", "./testdata/db_by_PK.auth"]
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "-p", "./testenv/", "-u"]+chain, out, self), False)#update chain with bad order
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "--plan", "-p", "./testenv/", "-u"]+chain, out, self), True)
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "verify", "--plan", "-p", "./testenv/", "--output", "json", "-u", "db", "./testdata/db_by_KEK.auth"]+chain, stdout=subprocess.PIPE, stderr=f)
+		data = json.loads(result.stdout)
+		self.assertEqual(data["result"], "SUCCESS")
+		self.assertEqual([u["file"] for u in data["plan"]].index("./testdata/PK_by_PK.auth"), 3)#the new PK must come after everything signed by the old one
+		self.assertEqual([u["name"] for u in data["updates"]], [u["name"] for u in data["plan"]])
+		with open(out, "w") as f:
+			result = subprocess.run([SECTOOLS, "verify", "--plan", "-p", "./testenv/", "--output", "json", "-u", "db", "./testdata/db_by_PK.auth", "PK", "./testdata/bad_PK_by_db.auth", "db", "./testdata/db_by_PK.auth"], stdout=subprocess.PIPE, stderr=f)
+		data = json.loads(result.stdout)
+		self.assertEqual(data["result"], "FAILURE")
+		self.assertEqual(sorted([u["file"] for u in data["conflicts"]]), ["./testdata/bad_PK_by_db.auth", "./testdata/db_by_PK.auth"])#improperly signed PK and the same db twice
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "--plan", "--fleet", "./testenv", "-u"]+chain, out, self), False)
+	def test_verifyMemo(self):
+		out="memolog.txt"
+		memo="testMemo.bin"
+		good=[SECTOOLS, "verify", "-v", "--memo", memo, "-p", "./testenv/", "-u", "db", "./testdata/db_by_KEK.auth"]
+		bad=[SECTOOLS, "verify", "-v", "--memo", memo, "-p", "./testenv/", "-u", "PK", "./testdata/bad_PK_by_db.auth"]
+		command(["rm", "-f", memo])
+		for run in range(2):
+			written = os.stat(memo).st_ino if run else None
+			with open(out, "w") as f:
+				goodRun = subprocess.run(good, stdout=subprocess.PIPE, stderr=f)
+				badRun = subprocess.run(bad, stdout=subprocess.PIPE, stderr=f)
+			self.assertEqual(goodRun.returncode, 0)
+			self.assertNotEqual(badRun.returncode, 0)#a rejected signature stays rejected
+			self.assertEqual(b"Remembered verdict" in goodRun.stdout + badRun.stdout, run == 1)#second run reuses both verdicts
+		self.assertEqual(os.stat(memo).st_ino, written)#and has nothing new to write, a write renames a new file over it
+		with open(memo, "r+b") as f:
+			f.seek(-1, 2)
+			last = f.read(1)
+			f.seek(-1, 2)
+			f.write(bytes([last[0] ^ 1]))
+		self.assertEqual( getCmdResult(good, out, self), True)#damaged memo is dropped and rewritten
+		with open(out, "w") as f:
+			result = subprocess.run(good, stdout=subprocess.PIPE, stderr=f)
+		self.assertIn(b"Remembered verdict", result.stdout)
+		command(["rm", memo])
+		with open(out, "w") as f:
+			result = subprocess.run(good, stdout=f, stderr=f, env=dict(os.environ, SECVARCTL_NO_MEMO="1"))
+		self.assertEqual(result.returncode, 0)
+		self.assertFalse(os.path.exists(memo))
+		self.assertEqual( getCmdResult([SECTOOLS, "verify", "-w", "--memo", memo, "-p", "./testenv/", "-u", "db", "./testdata/db_by_KEK.auth"], out, self), True)
+		self.assertFalse(os.path.exists(memo))#-w checks every signature
 	def test_badenv(self):
 		out="badEnvLog.txt"
 		for i in badEnvCommands:
@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "test/synthetic.h"
+
+#define SYNTH_MAX_ARGS 32
+
+/**
+ *xorshift64*, deterministic for a given seed so that generated data is reproducible
+ *@param state, the generator state, must not be zero
+ *@return next pseudo random number
+ */
+uint64_t synthRandom(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ *writes one ESL with a single entry at out
+ *@return number of bytes written
+ */
+static size_t writeESL(unsigned char *out, const uuid_t *type, const unsigned char *data, size_t size)
+{
+	EFI_SIGNATURE_LIST esl;
+
+	esl.SignatureType = *type;
+	esl.SignatureListSize = sizeof(esl) + sizeof(uuid_t) + size;
+	esl.SignatureHeaderSize = 0;
+	esl.SignatureSize = sizeof(uuid_t) + size;
+	memcpy(out, &esl, sizeof(esl));
+	// owner guid is left blank, same as `secvarctl generate`
+	memset(out + sizeof(esl), 0, sizeof(uuid_t));
+	memcpy(out + sizeof(esl) + sizeof(uuid_t), data, size);
+
+	return esl.SignatureListSize;
+}
+
+/**
+ *creates count ESL's, each holding one pseudo random hash of type alg, the way dbx is usually built
+ *@param count, number of hashes
+ *@param alg, hash function info, sets the hash length and ESL guid
+ *@param seed, seed for the hash data, same seed gives same output
+ *@param out, the resulting ESL's, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+ *@param outSize, length of out
+ *@return SUCCESS or ALLOC_FAIL
+ */
+int synthHashESLs(size_t count, const struct hash_funct *alg, uint64_t seed, unsigned char **out, size_t *outSize)
+{
+	unsigned char hash[64];
+	uint64_t state = seed ? seed : 1, r;
+	size_t eslSize = sizeof(EFI_SIGNATURE_LIST) + sizeof(uuid_t) + alg->size, offset = 0;
+
+	*out = malloc(eslSize * count);
+	if (!*out) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	for (size_t i = 0; i < count; i++) {
+		for (size_t j = 0; j < alg->size; j += sizeof(r)) {
+			r = synthRandom(&state);
+			memcpy(hash + j, &r, alg->size - j < sizeof(r) ? alg->size - j : sizeof(r));
+		}
+		offset += writeESL(*out + offset, alg->guid, hash, alg->size);
+	}
+	*outSize = offset;
+
+	return SUCCESS;
+}
+
+/**
+ *creates count ESL's, each holding one x509, certs are used in a round robin
+ *@param certs, DER certificates to choose from
+ *@param numCerts, length of certs
+ *@param count, number of ESL's to create
+ *@param out, the resulting ESL's, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+ *@param outSize, length of out
+ *@return SUCCESS or ALLOC_FAIL
+ */
+int synthCertESLs(const struct synthCert *certs, size_t numCerts, size_t count, unsigned char **out, size_t *outSize)
+{
+	size_t total = 0, offset = 0;
+
+	for (size_t i = 0; i < count; i++)
+		total += sizeof(EFI_SIGNATURE_LIST) + sizeof(uuid_t) + certs[i % numCerts].size;
+	*out = malloc(total);
+	if (!*out) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	for (size_t i = 0; i < count; i++)
+		offset += writeESL(*out + offset, &EFI_CERT_X509_GUID, certs[i % numCerts].der, certs[i % numCerts].size);
+	*outSize = offset;
+
+	return SUCCESS;
+}
+
+/**
+ *writes certificates as a PEM bundle, every certificate in a "-----BEGIN CERTIFICATE-----" block with lines of 64 characters
+ *@param certs, certificates to choose from, used round robin
+ *@param numCerts, number of certs
+ *@param count, number of certificates in the bundle
+ *@param out, the resulting bundle, NOTE: REMEMBER TO UNALLOC THIS MEMORY
+ *@param outSize, length of out
+ *@return SUCCESS or ALLOC_FAIL
+ */
+int synthPEMBundle(const struct synthCert *certs, size_t numCerts, size_t count, unsigned char **out, size_t *outSize)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	static const char begin[] = "-----BEGIN CERTIFICATE-----\n", end[] = "-----END CERTIFICATE-----\n";
+	size_t total = 0, chars, offset = 0;
+	const unsigned char *der;
+	unsigned int group;
+
+	for (size_t i = 0; i < count; i++) {
+		chars = (certs[i % numCerts].size + 2) / 3 * 4;
+		total += strlen(begin) + chars + (chars + 63) / 64 + strlen(end);
+	}
+	*out = malloc(total);
+	if (!*out) {
+		prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+		return ALLOC_FAIL;
+	}
+	for (size_t i = 0; i < count; i++) {
+		der = certs[i % numCerts].der;
+		memcpy(*out + offset, begin, strlen(begin));
+		offset += strlen(begin);
+		for (size_t j = 0; j < certs[i % numCerts].size; j += 3) {
+			group = der[j] << 16;
+			if (j + 1 < certs[i % numCerts].size)
+				group |= der[j + 1] << 8;
+			if (j + 2 < certs[i % numCerts].size)
+				group |= der[j + 2];
+			(*out)[offset++] = alphabet[group >> 18];
+			(*out)[offset++] = alphabet[(group >> 12) & 0x3f];
+			(*out)[offset++] = j + 1 < certs[i % numCerts].size ? alphabet[(group >> 6) & 0x3f] : '=';
+			(*out)[offset++] = j + 2 < certs[i % numCerts].size ? alphabet[group & 0x3f] : '=';
+			if (j % 48 == 45 || j + 3 >= certs[i % numCerts].size)
+				(*out)[offset++] = '\n';
+		}
+		memcpy(*out + offset, end, strlen(end));
+		offset += strlen(end);
+	}
+	*outSize = offset;
+
+	return SUCCESS;
+}
+
+static int compareNames(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ *loads every *.der file in dir, sorted by name so the order does not depend on the file system
+ *@param dir, directory to look in
+ *@param certs, the loaded certificates, free with synthFreeCerts
+ *@param numCerts, number of loaded certificates
+ *@return SUCCESS or error if no certificate was found
+ */
+int synthLoadCerts(const char *dir, struct synthCert **certs, size_t *numCerts)
+{
+	DIR *d;
+	struct dirent *ent;
+	char **names = NULL, path[4096];
+	size_t count = 0, len;
+	int rc = SUCCESS;
+
+	*certs = NULL;
+	*numCerts = 0;
+	d = opendir(dir);
+	if (!d) {
+		prlog(PR_ERR, "ERROR: Could not open directory %s\n", dir);
+		return INVALID_FILE;
+	}
+	while ((ent = readdir(d))) {
+		len = strlen(ent->d_name);
+		if (len < 5 || strcmp(ent->d_name + len - 4, ".der"))
+			continue;
+		if (reallocArray((void **)&names, count + 1, sizeof(*names))) {
+			closedir(d);
+			return ALLOC_FAIL;
+		}
+		names[count++] = strdup(ent->d_name);
+	}
+	closedir(d);
+	if (!count) {
+		prlog(PR_ERR, "ERROR: No .der certificates found in %s\n", dir);
+		return INVALID_FILE;
+	}
+	qsort(names, count, sizeof(*names), compareNames);
+
+	*certs = calloc(count, sizeof(**certs));
+	if (!*certs) {
+		rc = ALLOC_FAIL;
+		goto out;
+	}
+	for (size_t i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+		(*certs)[i].der = (unsigned char *)getDataFromFile(path, &(*certs)[i].size);
+		if (!(*certs)[i].der) {
+			rc = INVALID_FILE;
+			break;
+		}
+		// the name moves into the cert
+		names[i][strlen(names[i]) - 4] = '\0';
+		(*certs)[i].name = names[i];
+		names[i] = NULL;
+		(*numCerts)++;
+	}
+out:
+	for (size_t i = 0; i < count; i++)
+		free(names[i]);
+	free(names);
+	if (rc) {
+		synthFreeCerts(*certs, *numCerts);
+		*certs = NULL;
+		*numCerts = 0;
+	}
+
+	return rc;
+}
+
+void synthFreeCerts(struct synthCert *certs, size_t numCerts)
+{
+	for (size_t i = 0; i < numCerts; i++) {
+		free(certs[i].name);
+		free(certs[i].der);
+	}
+	free(certs);
+}
+
+/**
+ *writes a variable in the same layout as SECVARPATH, <varsDir><name>/data and <varsDir><name>/size
+ *@param varsDir, directory holding the variables, ending with '/'
+ *@param name, variable name
+ *@param buf, variable data
+ *@param size, length of buf
+ *@return SUCCESS or error number
+ */
+int synthWriteVar(const char *varsDir, const char *name, const unsigned char *buf, size_t size)
+{
+	char path[4096], sizeStr[32];
+	int rc;
+
+	snprintf(path, sizeof(path), "%s%s", varsDir, name);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s%s/data", varsDir, name);
+	rc = createFile(path, (const char *)buf, size);
+	if (rc)
+		return rc;
+	snprintf(path, sizeof(path), "%s%s/size", varsDir, name);
+	snprintf(sizeStr, sizeof(sizeStr), "%zd", size);
+
+	return createFile(path, sizeStr, strlen(sizeStr));
+}
+
+/**
+ *runs a subcommand the same way main() would, args are copied since commands modify their arguments
+ *@param func, the command, ex: performGenerateCommand
+ *@param args, NULL terminated argument list starting with the command name
+ *@return return code of the command
+ */
+int synthRunCommand(int (*func)(int, char **), const char **args)
+{
+	char *argv[SYNTH_MAX_ARGS], *copies[SYNTH_MAX_ARGS];
+	int argc, rc;
+
+	for (argc = 0; args[argc] && argc < SYNTH_MAX_ARGS - 1; argc++)
+		copies[argc] = argv[argc] = strdup(args[argc]);
+	argv[argc] = NULL;
+	rc = func(argc, argv);
+	for (int i = 0; i < argc; i++)
+		free(copies[i]);
+
+	return rc;
+}
@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+#include <stddef.h>
+#include <stdint.h>
+#include "backends/edk2-compat/include/edk2-svc.h"
+
+// a DER certificate loaded from disk, used as ESL entries, name is the file name without ".der"
+struct synthCert {
+	char *name;
+	unsigned char *der;
+	size_t size;
+};
+
+uint64_t synthRandom(uint64_t *state);
+int synthHashESLs(size_t count, const struct hash_funct *alg, uint64_t seed, unsigned char **out, size_t *outSize);
+int synthCertESLs(const struct synthCert *certs, size_t numCerts, size_t count, unsigned char **out, size_t *outSize);
+int synthPEMBundle(const struct synthCert *certs, size_t numCerts, size_t count, unsigned char **out, size_t *outSize);
+int synthLoadCerts(const char *dir, struct synthCert **certs, size_t *numCerts);
+void synthFreeCerts(struct synthCert *certs, size_t numCerts);
+int synthWriteVar(const char *varsDir, const char *name, const unsigned char *buf, size_t size);
+int synthRunCommand(int (*func)(int, char **), const char **args);
+#endif
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "err.h"
+#include "prlog.h"
+#include "threadpool.h"
+
+/*
+ *fixed size pool of worker threads running one batch of jobs at a time, workers take the next
+ *unclaimed index from a shared counter so uneven job sizes still balance out
+ */
+struct threadpool {
+	pthread_t *threads;
+	int numThreads;
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	// current batch, only read under lock, generation is bumped for every run so workers can tell a new batch from a spurious wakeup
+	threadpoolJob job;
+	void *ctx;
+	size_t numJobs, next, finished;
+	unsigned long generation;
+	// workers currently inside a batch, a run only returns once they are all back to waiting
+	int active;
+	int shutdown;
+	// error of the failing job with the lowest index, so the result does not depend on scheduling
+	int rc;
+	size_t rcIndex;
+};
+
+// set while this thread runs a job, see threadpoolInJob
+static __thread int insideJob = 0;
+
+/**
+ *@return number of online cpus, at least 1
+ */
+int threadpoolDefaultSize(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int)n : 1;
+}
+
+/**
+ *lets code that can run on its own pool find out that it is already being run by one,
+ *in which case it should do its work inline rather than start more threads
+ *@return 1 if the calling thread is running a job of any pool, 0 otherwise
+ */
+int threadpoolInJob(void)
+{
+	return insideJob;
+}
+
+/*
+ *claims and runs jobs of the current batch until there are none left
+ *@param job, ctx, numJobs, the batch as read under the lock when it was started or joined,
+ *only next is shared with the other threads outside of it
+ */
+static void runJobs(struct threadpool *pool, threadpoolJob job, void *ctx, size_t numJobs)
+{
+	size_t i;
+	int rc;
+
+	for (;;) {
+		i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		if (i >= numJobs)
+			return;
+		insideJob = 1;
+		rc = job(ctx, i);
+		insideJob = 0;
+		pthread_mutex_lock(&pool->lock);
+		if (rc && i < pool->rcIndex) {
+			pool->rc = rc;
+			pool->rcIndex = i;
+		}
+		if (++pool->finished == numJobs)
+			pthread_cond_broadcast(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct threadpool *pool = arg;
+	unsigned long seen = 0;
+	threadpoolJob job;
+	void *ctx;
+	size_t numJobs;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->shutdown && pool->generation == seen)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->shutdown)
+			break;
+		seen = pool->generation;
+		job = pool->job;
+		ctx = pool->ctx;
+		numJobs = pool->numJobs;
+		pool->active++;
+		pthread_mutex_unlock(&pool->lock);
+		runJobs(pool, job, ctx, numJobs);
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->active == 0)
+			pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/**
+ *starts numThreads - 1 workers, the thread calling threadpoolRun is the last one
+ *@param numThreads, total number of threads to run jobs on, <= 0 for threadpoolDefaultSize()
+ *@return the pool or NULL on failure, destroy with threadpoolDestroy
+ */
+struct threadpool *threadpoolCreate(int numThreads)
+{
+	struct threadpool *pool;
+
+	if (numThreads <= 0)
+		numThreads = threadpoolDefaultSize();
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		goto fail;
+	pool->threads = calloc(numThreads, sizeof(*pool->threads));
+	if (!pool->threads) {
+		free(pool);
+		goto fail;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (pool->numThreads = 0; pool->numThreads < numThreads - 1; pool->numThreads++) {
+		if (pthread_create(&pool->threads[pool->numThreads], NULL, worker, pool)) {
+			prlog(PR_WARNING, "WARNING: Could only start %d threads\n", pool->numThreads + 1);
+			break;
+		}
+	}
+
+	return pool;
+fail:
+	prlog(PR_ERR, "ERROR: failed to allocate memory\n");
+	return NULL;
+}
+
+/**
+ *runs job for every index in [0, numJobs) and waits for all of them to finish
+ *@param pool, the pool, only one run may be active at a time
+ *@param job, function to call
+ *@param ctx, passed to every call of job
+ *@param numJobs, number of calls
+ *@return SUCCESS or the error of the failing job with the lowest index, all jobs are run regardless
+ */
+int threadpoolRun(struct threadpool *pool, threadpoolJob job, void *ctx, size_t numJobs)
+{
+	int rc;
+
+	if (!numJobs)
+		return SUCCESS;
+	pthread_mutex_lock(&pool->lock);
+	pool->job = job;
+	pool->ctx = ctx;
+	pool->numJobs = numJobs;
+	__atomic_store_n(&pool->next, 0, __ATOMIC_RELAXED);
+	pool->finished = 0;
+	pool->rc = SUCCESS;
+	pool->rcIndex = numJobs;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	runJobs(pool, job, ctx, numJobs);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->finished < numJobs || pool->active)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	rc = pool->rc;
+	pthread_mutex_unlock(&pool->lock);
+
+	return rc;
+}
+
+void threadpoolDestroy(struct threadpool *pool)
+{
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->numThreads; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool);
+}
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: Apache-2.0
+/* Copyright 2021 IBM Corp.*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "err.h"
+#include "prlog.h"
+#include "generic.h"
+#include "output.h"
+#include "timing.h"
+
+static const char *timingPhaseNames[TIMING_PHASE_COUNT] = {
+	"file_io", "pkcs7_parse", "x509_parse", "hash", "sig_verify", "sign"
+};
+
+struct phaseStats {
+	uint64_t count, total, min, max;
+};
+
+// one complete ("ph":"X") event of the chrome trace
+struct traceEvent {
+	enum timingPhase phase;
+	uint64_t start, duration;
+	long tid;
+};
+
+int timingEnabled = 0;
+
+static pthread_mutex_t timingLock = PTHREAD_MUTEX_INITIALIZER;
+static struct phaseStats stats[TIMING_PHASE_COUNT];
+static const char *traceOut = NULL;
+static struct traceEvent *events = NULL;
+static size_t numEvents = 0, maxEvents = 0;
+static uint64_t epoch;
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *turns on timing of the phases in enum timingPhase
+ *@param traceFile, if not NULL, every measured call is also written there as a chrome trace event file
+ *@return SUCCESS
+ */
+int timingEnable(const char *traceFile)
+{
+	timingEnabled = 1;
+	traceOut = traceFile;
+	epoch = now();
+	for (int i = 0; i < TIMING_PHASE_COUNT; i++)
+		stats[i].min = UINT64_MAX;
+
+	return SUCCESS;
+}
+
+/**
+ *@return start time to be given to timingStop, 0 if timing is off
+ */
+uint64_t timingStart(void)
+{
+	if (!timingEnabled)
+		return 0;
+
+	return now();
+}
+
+/**
+ *records one call of phase that began at start, safe to call from several threads
+ */
+void timingStop(enum timingPhase phase, uint64_t start)
+{
+	uint64_t duration;
+	struct phaseStats *s = &stats[phase];
+
+	if (!timingEnabled)
+		return;
+	duration = now() - start;
+	pthread_mutex_lock(&timingLock);
+	s->count++;
+	s->total += duration;
+	if (duration < s->min)
+		s->min = duration;
+	if (duration > s->max)
+		s->max = duration;
+	if (traceOut) {
+		if (numEvents == maxEvents) {
+			maxEvents = maxEvents ? maxEvents * 2 : 1024;
+			// on failure the trace is cut short but the summary is still right
+			if (reallocArray((void **)&events, maxEvents, sizeof(*events))) {
+				events = NULL;
+				numEvents = maxEvents = 0;
+				traceOut = NULL;
+			}
+		}
+		if (traceOut)
+			events[numEvents++] = (struct traceEvent){ phase, start - epoch, duration, syscall(SYS_gettid) };
+	}
+	pthread_mutex_unlock(&timingLock);
+}
+
+static int writeTrace(void)
+{
+	struct emitter e;
+	int rc;
+	long pid = getpid();
+
+	emitterInit(&e, OUTPUT_JSON);
+	emitMapStart(&e, NULL);
+	emitArrayStart(&e, "traceEvents");
+	for (size_t i = 0; i < numEvents; i++) {
+		emitMapStart(&e, NULL);
+		emitString(&e, "name", timingPhaseNames[events[i].phase]);
+		emitString(&e, "cat", "secvarctl");
+		emitString(&e, "ph", "X");
+		// trace event times are in microseconds
+		emitInt(&e, "ts", events[i].start / 1000);
+		emitInt(&e, "dur", events[i].duration / 1000);
+		emitInt(&e, "pid", pid);
+		emitInt(&e, "tid", events[i].tid);
+		emitMapEnd(&e);
+	}
+	emitArrayEnd(&e);
+	emitString(&e, "displayTimeUnit", "ms");
+	emitMapEnd(&e);
+	rc = emitterFlush(&e, traceOut);
+	emitterFree(&e);
+
+	return rc;
+}
+
+/**
+ *prints the per phase summary to stderr and writes the trace file, if one was asked for,
+ *phases can nest (ex: hash inside of sign) so totals do not add up to the run time
+ *@return SUCCESS or error if the trace file could not be written
+ */
+int timingReport(void)
+{
+	int rc = SUCCESS;
+
+	if (!timingEnabled)
+		return SUCCESS;
+	pthread_mutex_lock(&timingLock);
+	// writing the trace does file io itself, which must not be recorded with the lock held
+	timingEnabled = 0;
+	fprintf(stderr, "%-12s %10s %12s %10s %10s\n", "phase", "count", "total ms", "min ms", "max ms");
+	for (int i = 0; i < TIMING_PHASE_COUNT; i++) {
+		if (!stats[i].count)
+			continue;
+		fprintf(stderr, "%-12s %10llu %12.3f %10.3f %10.3f\n", timingPhaseNames[i], (unsigned long long)stats[i].count,
+			stats[i].total / 1e6, stats[i].min / 1e6, stats[i].max / 1e6);
+	}
+	fprintf(stderr, "%-12s %10s %12.3f\n", "wall", "", (now() - epoch) / 1e6);
+	if (traceOut) {
+		rc = writeTrace();
+		if (rc)
+			prlog(PR_ERR, "ERROR: Could not write trace to %s\n", traceOut);
+	}
+	free(events);
+	events = NULL;
+	numEvents = maxEvents = 0;
+	pthread_mutex_unlock(&timingLock);
+
+	return rc;
+}